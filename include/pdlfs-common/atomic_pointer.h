@@ -145,6 +145,16 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+
+  // Atomically set to v iff currently equal to expected. Return true on
+  // success. Implies a full memory barrier.
+  inline bool CompareAndSwap(void* expected, void* v) {
+#if defined(PDLFS_OS_WIN) && defined(COMPILER_MSVC)
+    return InterlockedCompareExchangePointer(&rep_, v, expected) == expected;
+#else
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+#endif
+  }
 };
 
 // AtomicPointer based on <cstdatomic>
@@ -172,6 +182,10 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return rep_.compare_exchange_strong(expected, v);
+  }
 };
 
 // Atomic pointer based on sparc memory barriers
@@ -208,6 +222,10 @@ class AtomicPointer {
   inline void* NoBarrier_Load() const { return rep_; }
 
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // Atomic pointer based on ia64 acq/rel
@@ -240,6 +258,10 @@ class AtomicPointer {
   inline void* NoBarrier_Load() const { return rep_; }
 
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // We have neither MemoryBarrier(), nor <atomic>
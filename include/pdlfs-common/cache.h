@@ -41,6 +41,13 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity. This implementation uses the
+// CLOCK eviction policy, an approximation of LRU. Lookups and releases are
+// lock-free, so it scales better than the LRU cache when many threads
+// concurrently read from it. Insertions and erasures lock the shard they
+// modify. The cache is partitioned into 2^num_shard_bits shards.
+extern Cache* NewClockCache(size_t capacity, int num_shard_bits = 4);
+
 class Cache {
  public:
   Cache() {}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/leveldb/options.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace pdlfs {
+
+class DB;
+class Env;
+class ThreadPool;
+
+// Options that control directory splits.
+struct DirSplitOptions {
+  // If true, the suffix of each directory entry key is the 8-byte GIGA+ hash
+  // of the entry's name. Entries are then sorted by hash and the entries of a
+  // child partition are contiguous in key space. Otherwise, key suffixes are
+  // names that are hashed during the split and each split scans the entire
+  // directory.
+  // Default: false
+  bool suffix_is_hash;
+
+  // Directory for storing tables that are being moved. Each split uses a
+  // private sub-directory that is removed once the split is done. The
+  // directory must not be shared with other splitters.
+  // There is no default value.
+  std::string tmp_dir;
+
+  // Used to access "tmp_dir".
+  // Default: Env::Default()
+  Env* env;
+
+  // Maximum number of key sub-ranges a split may dump concurrently
+  // (see DumpOptions::max_parallelism).
+  // Default: 1
+  int max_dump_parallelism;
+
+  // If non-zero, start a new table once the current one reaches
+  // approximately this many bytes (see DumpOptions::table_file_size).
+  // Default: 0
+  size_t table_file_size;
+
+  // Number of moved entries removed from the source db per write batch.
+  // Default: 4096
+  size_t delete_batch_size;
+
+  // How tables are handed over to the target db.
+  // Default: kRename
+  InsertMethod insert_method;
+
+  // Thread pool for running concurrent splits and dumps. If NULL, all
+  // work is done by the calling thread.
+  // Default: NULL
+  ThreadPool* thread_pool;
+
+  DirSplitOptions();
+};
+
+// A request to move the entries of a new child partition of a directory out
+// of the db storing its parent partition.
+struct DirSplit {
+  DirSplit();
+
+  // Key prefix shared by all entries of the directory.
+  std::string prefix;
+  // Index of the new child partition (see DirIndex::NewIndexForSplitting()).
+  int child;
+  // Db storing the parent partition.
+  DB* source;
+  // Db for storing the child partition. Splits between partitions sharing
+  // a db move no data.
+  DB* target;
+
+  // Results of the split.
+  uint64_t num_moved;    // Number of entries moved
+  uint64_t bytes_moved;  // Total key and value bytes moved
+  Status status;
+};
+
+// Executes directory splits. Each split scans the parent partition once,
+// streams the entries selected by the child's hash bits into raw tables via
+// DB::Dump(), hands the tables to the target db via DB::AddL0Tables(), and
+// finally removes the moved entries from the source db. Splits of different
+// children of the same parent cover disjoint sets of entries so they can run
+// concurrently.
+class DirSplitter {
+ public:
+  explicit DirSplitter(const DirSplitOptions& options);
+  ~DirSplitter();
+
+  // Execute a single split. The result is also stored in split->status.
+  // REQUIRES: no concurrent updates to the parent partition.
+  Status Split(DirSplit* split);
+
+  // Execute "n" splits concurrently using options.thread_pool. The result of
+  // each split is stored in its status. Return the first non-OK status, or
+  // OK if all splits succeed.
+  // REQUIRES: no concurrent updates to the parent partitions.
+  Status SplitAll(DirSplit* splits, size_t n);
+
+ private:
+  struct Job;
+  static void BGWork(void* arg);
+  Status DoSplit(DirSplit* split);
+  std::string NewSplitDir();
+
+  const DirSplitOptions options_;
+  port::Mutex mutex_;
+  uint64_t next_split_;  // Protected by mutex_
+
+  // No copying allowed
+  void operator=(const DirSplitter&);
+  DirSplitter(const DirSplitter&);
+};
+
+}  // namespace pdlfs
@@ -12,6 +12,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
 
 #include "pdlfs-common/slice.h"
 
@@ -21,12 +22,27 @@ class ECT {
  public:
   static ECT* Default(size_t key_len, size_t n, const Slice* keys);
 
+  // Recreate an index from an encoding previously produced by EncodeTo().
+  // Return NULL if the encoding is corrupted.
+  static ECT* Decode(const Slice& encoding);
+
   // Return the internal memory usage in bits.
   virtual size_t MemUsage() const = 0;
 
-  // Return the rank of a given key.
+  // Return the length of the keys indexed.
+  virtual size_t KeyLength() const = 0;
+
+  // Return the number of keys indexed.
+  virtual size_t NumKeys() const = 0;
+
+  // Return the rank of a given key. For a key that is not in the index, the
+  // result is either the rank of the largest indexed key smaller than it or
+  // that rank plus one.
   virtual size_t Find(const Slice& key) const = 0;
 
+  // Append a serialization of the index to *dst.
+  virtual void EncodeTo(std::string* dst) const = 0;
+
   virtual ~ECT();
   ECT() {}
 
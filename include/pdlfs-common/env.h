@@ -67,6 +67,11 @@ class Env {
   // Result of this call belongs to the caller and should be deleted after use.
   static Env* NewMmapIoEnvWrapper(Env* base);
 
+  // Same as above, except that the total size of the files mapped at any
+  // time is capped at "max_mmap_bytes". Files that would exceed the cap are
+  // read using regular positional reads.
+  static Env* NewMmapIoEnvWrapper(Env* base, uint64_t max_mmap_bytes);
+
   // Return an Env implementation that performs sequential io using standard os
   // io calls such as open(), read(), write(), lseek(), fsync(), and
   // close(), and random reads using pread(). Result of this call belongs to the
@@ -228,6 +233,21 @@ class SequentialFile {
   void operator=(const SequentialFile&);
 };
 
+// A single read in a batch of reads issued through
+// RandomAccessFile::MultiRead().
+struct ReadRequest {
+  ReadRequest() : offset(0), n(0), scratch(NULL) {}
+
+  // Input: read up to "n" bytes from "offset" into "scratch[0..n-1]".
+  uint64_t offset;
+  size_t n;
+  char* scratch;
+
+  // Output: set as if by RandomAccessFile::Read().
+  Slice result;
+  Status status;
+};
+
 // A file abstraction for randomly reading the contents of a file.
 class RandomAccessFile {
  public:
@@ -246,6 +266,14 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // Perform "n" independent reads. Set reqs[i].result and reqs[i].status
+  // as if by Read(reqs[i].offset, reqs[i].n, ...). Implementations may
+  // issue all reads at once to overlap their latencies. The default
+  // implementation calls Read() for each request in order.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void MultiRead(ReadRequest* reqs, size_t n) const;
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -289,6 +317,27 @@ class WritableFileWrapper : public WritableFile {
   }
 };
 
+// Options controlling an asynchronous logger.
+struct AsyncLoggerOptions {
+  AsyncLoggerOptions();
+
+  // Bytes of messages each logging thread may buffer before they are written
+  // out by the background thread.
+  // Default: 64KB
+  size_t buffer_size;
+
+  // If true, a thread whose buffer is full waits for the background thread to
+  // make room. Otherwise, the message is dropped. The number of dropped
+  // messages is periodically written to the log.
+  // Default: false
+  bool block_when_full;
+
+  // Maximum time the background thread waits before writing out buffered
+  // messages.
+  // Default: 10000 (10ms)
+  uint64_t flush_interval_micros;
+};
+
 // An interface for writing log messages.
 class Logger {
  public:
@@ -299,6 +348,14 @@ class Logger {
   // Default() belongs to the system and shall not be deleted.
   static Logger* Default();
 
+  // Create a logger that appends to the named file asynchronously. Logging
+  // threads only format messages and copy them into per-thread buffers. A
+  // background thread adds the time prefix to each message and writes them
+  // out in batches. Messages still buffered are written out when the logger
+  // is deleted. The result should be deleted when it is no longer needed.
+  static Status NewAsync(const AsyncLoggerOptions& options, const char* fname,
+                         Logger** result);
+
   // Write an entry to the log file with the specified format.
   virtual void Logv(const char* file, int line, int severity, int verbose,
                     const char* format, va_list ap) = 0;
@@ -387,6 +444,12 @@ extern Status FetchHostIPAddrs(std::vector<std::string>* ips);
 // NOTE: only useful for computing deltas of time.
 extern uint64_t CurrentMicros();
 
+// Returns the number of micro-seconds of CPU time consumed by the calling
+// thread. Falls back to CurrentMicros() where per-thread CPU clocks are not
+// available.
+// NOTE: only useful for computing deltas of time within the same thread.
+extern uint64_t CurrentThreadCpuMicros();
+
 // Sleep/delay the thread for the prescribed number of micro-seconds.
 extern void SleepForMicroseconds(int micros);
 
@@ -412,6 +475,16 @@ class ThreadPool {
   // serialized.
   virtual void Schedule(void (*function)(void*), void* arg) = 0;
 
+  // Priority classes for background work items. Queued high priority items
+  // are dequeued before queued low priority items. Items submitted via
+  // Schedule() are of high priority.
+  enum Priority { kHigh = 0, kLow = 1, kNumPriorities = 2 };
+
+  // Same as Schedule(), but with an explicit priority class. The default
+  // implementation ignores "pri" and calls Schedule().
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri);
+
   // Return a description of the pool implementation.
   virtual std::string ToDebugString() = 0;
 
@@ -355,6 +355,16 @@ class MonitoredRandomAccessFile : public RandomAccessFile {
     return status;
   }
 
+  // Implementation is safe for concurrent use by multiple threads.
+  virtual void MultiRead(ReadRequest* reqs, size_t n) const {
+    base_->MultiRead(reqs, n);
+    for (size_t i = 0; i < n; i++) {
+      if (reqs[i].status.ok()) {
+        stats_->AcceptRead(reqs[i].result.size());
+      }
+    }
+  }
+
  private:
   // Reset the counters and the base target.
   void Reset(RandomAccessFile* base) {
@@ -12,7 +12,12 @@
 
 #include "pdlfs-common/fsdbbase.h"
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/options.h"
 
+#include <algorithm>
+#include <assert.h>
+#include <utility>
 #include <vector>
 
 namespace pdlfs {
@@ -33,6 +38,63 @@ enum MXDBFormat {
 
 class DB;
 
+// The type of values read by MXDB point lookups. By default, values are
+// copied out into a std::string. Values are decoded in place so DB types able
+// to reference values inside the DB instead of copying them out specialize
+// this to use a PinnedSlice.
+template <typename DX>
+struct MXDBValue {
+  typedef std::string type;
+};
+
+template <>
+struct MXDBValue<DB> {
+  typedef PinnedSlice type;
+};
+
+// Confine a directory scan to the keys of that directory. The default does
+// nothing. DB types whose read options can bound iterators to a key prefix
+// specialize this. The prefix must remain live while the iterator is in use.
+template <typename OPT>
+struct MXDBScanBound {
+  static void Set(OPT* opt, const Slice& prefix) {}
+};
+
+template <>
+struct MXDBScanBound<ReadOptions> {
+  static void Set(ReadOptions* opt, const Slice& prefix) {
+    opt->prefix = prefix;
+  }
+};
+
+// Order the indices of a batch by their encoded keys.
+struct MXDBKeyOrder {
+  explicit MXDBKeyOrder(const std::vector<Slice>* encs) : encs(encs) {}
+  bool operator()(size_t a, size_t b) const {
+    return (*encs)[a].compare((*encs)[b]) < 0;
+  }
+  const std::vector<Slice>* encs;
+};
+
+// Look up n keys sorted in bytewise key order. By default, a single iterator
+// is shared by all keys and only re-seeked when it cannot simply be stepped to
+// the next key. DB types offering a MultiGet() specialize this to use it.
+template <typename DX, typename xslice, typename xstatus>
+struct MXDBMultiGet {
+  template <typename Iter, typename OPT>
+  static void Get(DX* dx, OPT* opt, size_t n, const xslice* keys,
+                  std::string* values, Status* statuses);
+};
+
+template <>
+struct MXDBMultiGet<DB, Slice, Status> {
+  template <typename Iter, typename OPT>
+  static void Get(DB* dx, OPT* opt, size_t n, const Slice* keys,
+                  std::string* values, Status* statuses) {
+    dx->MultiGet(*opt, n, keys, values, statuses);
+  }
+};
+
 // This is a set of templates for access filesystem metadata as KV pairs in a
 // KV-store. Providing this as templates allows for different key types and DB
 // implementations. The default DB implementation is a custom LevelDB
@@ -75,12 +137,20 @@ class MXDB {
   struct Dir {
     size_t n;  // Number dir entries scanned
     std::string key_prefix;
+    std::string names;  // Names returned by the last READDIRPLUS
     Iter* iter;
   };
   template <typename Iter, typename KX, typename TX, typename OPT>
   Dir<Iter>* OPENDIR(const DirId& id, OPT* opt, TX* tx);
   template <typename Iter>
   Status READDIR(Dir<Iter>* dir, Stat* stat, std::string* name);
+  // Read up to n entries at once. Set stats[i] and names[i] for each entry
+  // read and *num_entries to the number of entries read. Names remain valid
+  // until the next READDIRPLUS or CLOSEDIR of the same dir. Return NotFound
+  // if the end of the directory has been reached and no entries are read.
+  template <typename Iter>
+  Status READDIRPLUS(Dir<Iter>* dir, Stat* stats, Slice* names, size_t n,
+                     size_t* num_entries);
   template <typename Iter>
   void CLOSEDIR(Dir<Iter>* dir);
 
@@ -92,6 +162,26 @@ class MXDB {
   template <typename KX, typename TX, typename OPT>
   Status EXISTS(const DirId& id, const Slice& suf, OPT* opt, TX* tx);
 
+  // Batched operations. Each entry of a batch is named by its parent
+  // directory and its key suffix. Keys are encoded into a single buffer and
+  // are applied in key order. Results are returned in the original order of
+  // the batch.
+  typedef std::pair<DirId, Slice> EntryKey;
+  typedef std::vector<EntryKey> EntryKeyList;
+  typedef std::vector<Status> StatusList;
+  // Return the number of entries found. Set (*statuses)[i], (*stats)[i], and
+  // (*names)[i] (if names is not NULL) for each keys[i] as if by GET.
+  template <typename Iter, typename KX, typename TX, typename OPT,
+            typename PERF>
+  size_t BATCHGET(const EntryKeyList& keys, StatList* stats, NameList* names,
+                  StatusList* statuses, OPT* opt, TX* tx, PERF* perf);
+  // Insert all entries atomically. names is ignored under kNameInKey.
+  template <typename KX, typename TX, typename OPT, typename PERF>
+  Status BATCHPUT(const EntryKeyList& keys, const StatList& stats,
+                  const NameList& names, OPT* opt, TX* tx, PERF* perf);
+  template <typename KX, typename TX, typename OPT>
+  Status BATCHDELETE(const EntryKeyList& keys, OPT* opt, TX* tx);
+
   template <typename TX, typename OPT>
   Status COMMIT(OPT* opt, TX* tx) {
     if (tx != NULL) {
@@ -112,6 +202,11 @@ class MXDB {
   }
 
   DX* const dx_;
+
+ private:
+  template <typename KX>
+  void EncodeBatch(const EntryKeyList& keys, std::string* buf,
+                   std::vector<Slice>* encs, std::vector<size_t>* order);
 };
 
 #define MXDBTEMDECL(a, b, c, d) \
@@ -194,13 +289,13 @@ Status MXDB<DX, xslice, xstatus, fmt>::GET(  ////
   KX key(KEY_INITIALIZER(id, kDirEntType));
   key.SetSuffix(suf);
   xslice keyenc = xslice(key.data(), key.size());
-  std::string tmp;
+  typename MXDBValue<DX>::type value;
   if (tx != NULL) {
     opt->snapshot = tx->snap;
   }
-  xstatus st = dx_->Get(*opt, keyenc, &tmp);
+  xstatus st = dx_->Get(*opt, keyenc, &value);
   if (st.ok()) {
-    Slice input(tmp);
+    Slice input(value.data(), value.size());
     Slice filename;
     if (!stat->DecodeFrom(&input)) {
       s = Status::Corruption(Slice());
@@ -220,7 +315,7 @@ Status MXDB<DX, xslice, xstatus, fmt>::GET(  ////
   // Collect performance stats
   if (perf != NULL) {
     perf->getkeybytes += keyenc.size();
-    perf->getbytes += tmp.size();
+    perf->getbytes += value.size();
     perf->gets++;
   }
 
@@ -255,16 +350,20 @@ MXDB<DX, xslice, xstatus, fmt>::OPENDIR(  ////
   if (tx != NULL) {
     opt->snapshot = tx->snap;
   }
-  xslice prefix = xslice(key_prefix.data(), key_prefix.size());
-  Iter* const iter = dx_->NewIterator(*opt);
+  Dir<Iter>* dir = new Dir<Iter>;
+  dir->key_prefix.assign(key_prefix.data(), key_prefix.size());
+  // Stop the iterator at the end of the directory
+  OPT scan_opt = *opt;
+  MXDBScanBound<OPT>::Set(&scan_opt, dir->key_prefix);
+  Iter* const iter = dx_->NewIterator(scan_opt);
   if (iter == NULL) {
+    delete dir;
     return NULL;
   }
 
   // Seek to position.
+  xslice prefix = xslice(dir->key_prefix.data(), dir->key_prefix.size());
   iter->Seek(prefix);  // Deferring status checks until ReadDir.
-  Dir<Iter>* dir = new Dir<Iter>;
-  dir->key_prefix = prefix.ToString();
   dir->iter = iter;
   dir->n = 0;
   return dir;
@@ -313,6 +412,66 @@ Status MXDB<DX, xslice, xstatus, fmt>::READDIR(  ////
   return Status::OK();
 }
 
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename Iter>
+Status MXDB<DX, xslice, xstatus, fmt>::READDIRPLUS(  ////
+    Dir<Iter>* dir, Stat* stats, Slice* names, size_t n,
+    size_t* num_entries) {
+  *num_entries = 0;
+  if (dir == NULL) return Status::NotFound(Slice());
+  Iter* const iter = dir->iter;
+  Status s;
+  // Names are first collected as offsets since the buffer may move
+  std::vector<size_t> offsets;
+  offsets.reserve(n + 1);
+  dir->names.clear();
+  size_t i = 0;
+  for (; i < n && iter->Valid(); iter->Next()) {
+    xslice xinput = iter->value();
+    xslice xkey = iter->key();
+
+    Slice input = Slice(xinput.data(), xinput.size());
+    Slice key = Slice(xkey.data(), xkey.size());
+    if (!key.starts_with(dir->key_prefix))  // Hitting the end of directory
+      break;
+    if (!stats[i].DecodeFrom(&input)) {
+      s = Status::Corruption("Cannot parse Stat");
+      break;
+    }
+
+    Slice filename;
+
+    if (fmt == kNameInKey) {
+      key.remove_prefix(dir->key_prefix.length());
+      filename = key;
+    } else if (!GetLengthPrefixedSlice(&input, &filename)) {
+      s = Status::Corruption("Cannot parse filename");
+      break;
+    }
+
+    offsets.push_back(dir->names.size());
+    dir->names.append(filename.data(), filename.size());
+    i++;
+  }
+  offsets.push_back(dir->names.size());
+  for (size_t j = 0; j < i; j++) {
+    names[j] = Slice(dir->names.data() + offsets[j],
+                     offsets[j + 1] - offsets[j]);
+  }
+  *num_entries = i;
+  dir->n += i;  // +i entries scanned
+
+  if (s.ok() && i == 0) {
+    xstatus st = iter->status();
+    if (st.ok()) {
+      s = Status::NotFound(Slice());
+    } else {
+      s = XSTATUS(st);
+    }
+  }
+  return s;
+}
+
 MXDBTEMDECL(DX, xslice, xstatus, fmt)
 template <typename Iter>
 void MXDB<DX, xslice, xstatus, fmt>::CLOSEDIR(  ////
@@ -333,7 +492,9 @@ size_t MXDB<DX, xslice, xstatus, fmt>::LIST(  ////
     opt->snapshot = tx->snap;
   }
   Slice prefix = prefix_key.prefix();
-  Iter* const iter = dx_->NewIterator(*opt);
+  OPT scan_opt = *opt;
+  MXDBScanBound<OPT>::Set(&scan_opt, prefix);
+  Iter* const iter = dx_->NewIterator(scan_opt);
   iter->Seek(prefix);
   Slice name;
   Stat stat;
@@ -381,7 +542,7 @@ Status MXDB<DX, xslice, xstatus, fmt>::EXISTS(  ////
   if (tx != NULL) {
     opt->snapshot = tx->snap;
   }
-  std::string ignored;
+  typename MXDBValue<DX>::type ignored;
   xstatus st = dx_->Get(*opt, keyenc, &ignored);
   if (!st.ok()) {
     s = XSTATUS(st);
@@ -389,6 +550,221 @@ Status MXDB<DX, xslice, xstatus, fmt>::EXISTS(  ////
   return s;
 }
 
+template <typename DX, typename xslice, typename xstatus>
+template <typename Iter, typename OPT>
+void MXDBMultiGet<DX, xslice, xstatus>::Get(  ////
+    DX* dx, OPT* opt, size_t n, const xslice* keys, std::string* values,
+    Status* statuses) {
+  Iter* const iter = dx->NewIterator(*opt);
+  for (size_t i = 0; i < n; i++) {
+    Slice target(keys[i].data(), keys[i].size());
+    // The iterator already rests at the first key >= the previous target.
+    // Try its successor before paying for another seek.
+    if (iter->Valid()) {
+      xslice xkey = iter->key();
+      if (Slice(xkey.data(), xkey.size()).compare(target) < 0) {
+        iter->Next();
+        if (iter->Valid()) {
+          xkey = iter->key();
+          if (Slice(xkey.data(), xkey.size()).compare(target) < 0) {
+            iter->Seek(keys[i]);
+          }
+        }
+      }
+    } else if (i == 0) {
+      iter->Seek(keys[i]);
+    }  // Otherwise no key is >= the previous target, or there is an error
+    if (iter->Valid()) {
+      xslice xkey = iter->key();
+      if (Slice(xkey.data(), xkey.size()) == target) {
+        xslice xvalue = iter->value();
+        values[i].assign(xvalue.data(), xvalue.size());
+        statuses[i] = Status::OK();
+      } else {
+        statuses[i] = Status::NotFound(Slice());
+      }
+    } else {
+      xstatus st = iter->status();
+      if (st.ok()) {
+        statuses[i] = Status::NotFound(Slice());
+      } else {
+        statuses[i] = XSTATUS(st);
+      }
+    }
+  }
+  delete iter;
+}
+
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename KX>
+void MXDB<DX, xslice, xstatus, fmt>::EncodeBatch(  ////
+    const EntryKeyList& keys, std::string* buf, std::vector<Slice>* encs,
+    std::vector<size_t>* order) {
+  const size_t n = keys.size();
+  std::vector<size_t> offsets;
+  offsets.reserve(n + 1);
+  buf->clear();
+  for (size_t i = 0; i < n; i++) {
+    KX key(KEY_INITIALIZER(keys[i].first, kDirEntType));
+    key.SetSuffix(keys[i].second);
+    offsets.push_back(buf->size());
+    buf->append(key.data(), key.size());
+  }
+  offsets.push_back(buf->size());
+  encs->clear();
+  encs->reserve(n);
+  order->clear();
+  order->reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    encs->push_back(
+        Slice(buf->data() + offsets[i], offsets[i + 1] - offsets[i]));
+    order->push_back(i);
+  }
+  // Stable so that updates to the same key are applied in batch order
+  std::stable_sort(order->begin(), order->end(), MXDBKeyOrder(encs));
+}
+
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename Iter, typename KX, typename TX, typename OPT, typename PERF>
+size_t MXDB<DX, xslice, xstatus, fmt>::BATCHGET(  ////
+    const EntryKeyList& keys, StatList* stats, NameList* names,
+    StatusList* statuses, OPT* opt, TX* tx, PERF* perf) {
+  const size_t n = keys.size();
+  stats->resize(n);
+  statuses->resize(n);
+  if (names != NULL) names->resize(n);
+  if (n == 0) {
+    return 0;
+  }
+  std::string buf;
+  std::vector<Slice> encs;
+  std::vector<size_t> order;
+  EncodeBatch<KX>(keys, &buf, &encs, &order);
+  std::vector<xslice> sorted;
+  sorted.reserve(n);
+  for (size_t j = 0; j < n; j++) {
+    const Slice& enc = encs[order[j]];
+    sorted.push_back(xslice(enc.data(), enc.size()));
+  }
+  if (tx != NULL) {
+    opt->snapshot = tx->snap;
+  }
+  std::vector<std::string> values(n);
+  StatusList results(n);
+  MXDBMultiGet<DX, xslice, xstatus>::template Get<Iter>(
+      dx_, opt, n, &sorted[0], &values[0], &results[0]);
+
+  size_t num_found = 0;
+  size_t value_bytes = 0;
+  for (size_t j = 0; j < n; j++) {
+    const size_t i = order[j];
+    Status& s = (*statuses)[i];
+    s = results[j];
+    if (!s.ok()) {
+      continue;
+    }
+    value_bytes += values[j].size();
+    Slice input(values[j]);
+    Slice filename;
+    if (!(*stats)[i].DecodeFrom(&input)) {
+      s = Status::Corruption(Slice());
+    } else if (names != NULL) {  // Filenames requested
+      if (fmt == kNameInKey) {
+        (*names)[i] = keys[i].second.ToString();
+      } else if (!GetLengthPrefixedSlice(&input, &filename)) {
+        s = Status::Corruption(Slice());
+      } else {
+        (*names)[i] = filename.ToString();
+      }
+    }
+    if (s.ok()) {
+      num_found++;
+    }
+  }
+
+  // Collect performance stats
+  if (perf != NULL) {
+    perf->getkeybytes += buf.size();
+    perf->getbytes += value_bytes;
+    perf->gets += n;
+  }
+
+  return num_found;
+}
+
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename KX, typename TX, typename OPT, typename PERF>
+Status MXDB<DX, xslice, xstatus, fmt>::BATCHPUT(  ////
+    const EntryKeyList& keys, const StatList& stats, const NameList& names,
+    OPT* opt, TX* tx, PERF* perf) {
+  Status s;
+  const size_t n = keys.size();
+  assert(stats.size() == n);
+  assert(fmt == kNameInKey || names.size() == n);
+  std::string buf;
+  std::vector<Slice> encs;
+  std::vector<size_t> order;
+  EncodeBatch<KX>(keys, &buf, &encs, &order);
+  // Without a TX, updates are collected in a temporary one and applied to
+  // the DB all at once.
+  TX tmp;
+  TX* const t = tx != NULL ? tx : &tmp;
+  std::string value;  // Reused by all entries
+  char tmpstat[200];
+  for (size_t j = 0; j < n; j++) {
+    const size_t i = order[j];
+    Slice stat_encoding = stats[i].EncodeTo(tmpstat);
+    value.assign(stat_encoding.data(), stat_encoding.size());
+    if (fmt != kNameInKey) {
+      PutLengthPrefixedSlice(&value, names[i]);
+    }
+    t->bat.Put(xslice(encs[i].data(), encs[i].size()), xslice(value));
+    // Collect performance stats
+    if (perf != NULL) {
+      perf->putbytes += value.size();
+    }
+  }
+  if (tx == NULL && n != 0) {
+    xstatus st = dx_->Write(*opt, &tmp.bat);
+    if (!st.ok()) {
+      s = XSTATUS(st);
+    }
+  }
+
+  // Collect performance stats
+  if (perf != NULL) {
+    perf->putkeybytes += buf.size();
+    perf->puts += n;
+  }
+
+  return s;
+}
+
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename KX, typename TX, typename OPT>
+Status MXDB<DX, xslice, xstatus, fmt>::BATCHDELETE(  ////
+    const EntryKeyList& keys, OPT* opt, TX* tx) {
+  Status s;
+  const size_t n = keys.size();
+  std::string buf;
+  std::vector<Slice> encs;
+  std::vector<size_t> order;
+  EncodeBatch<KX>(keys, &buf, &encs, &order);
+  TX tmp;
+  TX* const t = tx != NULL ? tx : &tmp;
+  for (size_t j = 0; j < n; j++) {
+    const Slice& enc = encs[order[j]];
+    t->bat.Delete(xslice(enc.data(), enc.size()));
+  }
+  if (tx == NULL && n != 0) {
+    xstatus st = dx_->Write(*opt, &tmp.bat);
+    if (!st.ok()) {
+      s = XSTATUS(st);
+    }
+  }
+  return s;
+}
+
 #undef KEY_INITIALIZER
 #undef XSTATUS
 #undef MXDBTEM
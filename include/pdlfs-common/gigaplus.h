@@ -13,6 +13,7 @@
 #include "pdlfs-common/slice.h"
 
 #include <stdint.h>
+#include <string>
 #include <utility>
 
 // We currently do not support dynamic changes of the total number of metadata
@@ -66,6 +67,26 @@ class DirIndex {
   // Update the index by merging another index of the same directory.
   void Update(const DirIndex& other);
 
+  // Return the version of the index. The low 32 bits grow by one each time a
+  // partition is newly set. The high 32 bits hold an epoch that changes each
+  // time a partition is unset or the index is reset, which invalidates all
+  // earlier versions. Versions are specific to each DirIndex instance and
+  // are not comparable across instances.
+  uint64_t Version() const;
+
+  // Append to *dst a compact delta listing the partitions newly set since
+  // the given version of this index, along with the current version. All
+  // partitions are encoded if the given version is 0 or is not a version of
+  // the current epoch. Deltas are typically much smaller than the full
+  // encoding and can be piggybacked on every reply.
+  void EncodeDelta(uint64_t since, std::string* dst) const;
+
+  // Update the index by merging a delta of another index of the same
+  // directory. If "version" is not NULL, store the version of the other
+  // index into *version so that the next delta can start from it.
+  // Return false if the delta is malformed or belongs to another directory.
+  bool UpdateDelta(const Slice& delta, uint64_t* version = NULL);
+
   // Return the server responsible for the given partition.
   int GetServerForIndex(int index) const;
 
@@ -81,6 +102,15 @@ class DirIndex {
   // Return the server responsible for the given file name hash.
   int HashToServer(const Slice& hash) const;
 
+  // Return the servers responsible for "n" file names. The server for
+  // names[i] is stored in servers[i]. Faster than calling SelectServer()
+  // once per name.
+  void SelectServers(const Slice* names, int n, int* servers) const;
+
+  // Return the servers responsible for "n" file name hashes. The server for
+  // hashes[i] is stored in servers[i].
+  void HashesToServers(const Slice* hashes, int n, int* servers) const;
+
   // Return true iff the bit of a partition is set.
   bool IsSet(int index) const;
 
@@ -114,6 +144,12 @@ class DirIndex {
   // Return true if the given hash will belong to the given child partition.
   static bool ToBeMigrated(int index, const char* hash);
 
+  // Append the smallest hash belonging to the given child partition to
+  // *start, and the smallest hash past the partition to *limit. Nothing is
+  // appended to *limit if the partition extends to the end of the hash space.
+  // Hashes compare as byte strings.
+  static void PutHashRange(int index, std::string* start, std::string* limit);
+
   // Put the corresponding hash value into *dst.
   static void PutHash(std::string* dst, const Slice& name);
 
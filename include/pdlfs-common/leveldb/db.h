@@ -16,14 +16,17 @@
  */
 #pragma once
 
+#include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
 
 namespace pdlfs {
 
+class PinnedSlice;
 class Snapshot;
 class WriteBatch;
 
@@ -110,6 +113,35 @@ class DB {
   virtual Status Get(const ReadOptions& options, const Slice& key, Slice* value,
                      char* scratch, size_t scratch_size) = 0;
 
+  // If the database contains an entry for "key", make *value refer to the
+  // corresponding value and return OK.
+  //
+  // Where possible, the value is not copied. *value instead references
+  // the memory holding it inside the database, such as a cached table
+  // block or a memtable, and keeps that memory from being released until
+  // value->Reset() is called or *value is destroyed. Release pinned values
+  // promptly as they prevent cache entries from being evicted, and always
+  // before the db is deleted.
+  //
+  // If there is no entry for "key" leave *value empty and return
+  // a status for which Status::IsNotFound() returns true.
+  //
+  // May return some other Status on an error.
+  //
+  // The default implementation copies the value into *value.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     PinnedSlice* value);
+
+  // Lookup keys[0,n-1] at once. For each i, set statuses[i] and values[i]
+  // as if by Get(options, keys[i], &values[i]). All keys are read from the
+  // same consistent view of the database. Implementations may group keys
+  // that fall into the same table so that their blocks are fetched
+  // with fewer, batched storage reads.
+  //
+  // The default implementation simply calls Get() for each key.
+  virtual void MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                        std::string* values, Status* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -206,7 +238,10 @@ class DB {
   // Extract a logic range of keys into raw Table files that will be stored
   // under the specified dump directory.  If there is no key within the
   // specified range, no files will be generated.  If "min_seq" or "max_seq"
-  // is not NULL, they are piggy-backed to the caller.
+  // is not NULL, they are piggy-backed to the caller.  The range may be
+  // split into multiple tables that are generated concurrently (see
+  // DumpOptions).  Tables never overlap each other and are listed in a
+  // manifest stored along with them (see ReadDumpManifest()).
   // Return OK on success, or a non-OK status on errors.
   virtual Status Dump(const DumpOptions& options, const Range& range,
                       const std::string& dir, SequenceNumber* min_seq,
@@ -218,6 +253,58 @@ class DB {
   DB(const DB&);
 };
 
+// A value returned by DB::Get() that may reference memory owned by the db
+// instead of holding a copy of the value. The memory is pinned until the
+// object is reset or destroyed.
+class PinnedSlice : public Buffer {
+ public:
+  PinnedSlice() : pin_(NULL) {}
+  virtual ~PinnedSlice();
+
+  const char* data() const { return data_.data(); }
+  size_t size() const { return data_.size(); }
+  bool empty() const { return data_.empty(); }
+  std::string ToString() const { return data_.ToString(); }
+
+  // Return true iff the value references db memory.
+  bool pinned() const { return pin_ != NULL; }
+
+  // Release any pinned memory and make the value empty.
+  void Reset();
+
+  // Used by db implementations.
+  virtual void Fill(const char* data, size_t size);
+  virtual bool Pinnable() const { return true; }
+  virtual void Pin(Iterator* pin);
+
+ private:
+  friend class DB;
+  Slice data_;
+  Iterator* pin_;
+  std::string buf_;  // Holds values that are not pinned
+
+  // No copying allowed
+  void operator=(const PinnedSlice&);
+  PinnedSlice(const PinnedSlice&);
+};
+
+// Information on a Table file generated by DB::Dump().
+struct DumpedTable {
+  uint64_t number;  // Stored as TableFileName(dir, number)
+  uint64_t file_size;
+  SequenceNumber min_seq;
+  SequenceNumber max_seq;
+  InternalKey smallest;  // Smallest internal key in the table
+  InternalKey largest;   // Largest internal key in the table
+};
+
+// Retrieve the list of tables generated by a DB::Dump() into the
+// specified directory.  Tables are returned in key order and do not
+// overlap each other.  Return a NotFound status if the directory does not
+// contain a manifest.
+extern Status ReadDumpManifest(Env* env, const std::string& dir,
+                               std::vector<DumpedTable>* tables);
+
 // Destroy the contents of the specified database. Be very careful using this
 // method. If options.env is NULL, Env::Default() will be used.
 Status DestroyDB(const std::string& dbname, const DBOptions& options);
@@ -81,6 +81,10 @@ extern std::string InfoLogFileName(const std::string& dbname);
 // Return the name of the old info log file for "dbname".
 extern std::string OldInfoLogFileName(const std::string& dbname);
 
+// Return the name of the manifest file listing the tables generated by a
+// DB::Dump() into "dir".
+extern std::string DumpManifestFileName(const std::string& dir);
+
 // If filename is a db-owned file, store the type of the file in *type.
 // The number encoded in the filename is stored in *number.  If the
 // filename was successfully parsed, returns true.  Else return false.
@@ -39,6 +39,20 @@ class FilterPolicy;
 // trailing spaces in keys.
 extern const FilterPolicy* NewBloomFilterPolicy(int bits_per_key);
 
+// Return a new filter policy that uses a cache-line blocked bloom filter
+// with approximately the specified number of bits per key. All probes for a
+// key land in the same 64-byte block of the filter, so a negative lookup
+// costs one cache miss instead of several, at the price of a slightly
+// higher false positive rate (~1% at 10 bits per key). If "use_simd" is
+// true and the cpu supports AVX2, probes are tested in parallel using SIMD
+// instructions. Otherwise, a portable implementation is used. Both
+// produce and accept the same filters. The filters are not compatible with
+// those of NewBloomFilterPolicy() and use a different policy name, so
+// tables built with one policy simply see no filter when read with the
+// other. The same restrictions on custom comparators apply.
+extern const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key,
+                                                       bool use_simd = true);
+
 // A database can be configured with a custom FilterPolicy object.
 // This object is responsible for creating a small filter from a set
 // of keys.  These filters are stored in leveldb and are consulted
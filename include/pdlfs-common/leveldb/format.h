@@ -23,6 +23,9 @@
 #include <string>
 
 namespace pdlfs {
+namespace port {
+struct ZstdUncompressionDict;
+}
 
 class Block;
 class RandomAccessFile;
@@ -58,13 +61,23 @@ class BlockHandle {
 // end of every table file.
 class Footer {
  public:
-  Footer() {}
+  Footer() : index_type_(kFlatIndex) {}
+
+  // The layout of the index of the table. A flat index is a single block
+  // mapping keys to data blocks. A two-level index is a top-level block
+  // mapping keys to index partitions, each of which is a block mapping keys
+  // to data blocks. The index type is encoded in the magic number so that
+  // readers unaware of two-level indexes reject such tables.
+  enum IndexType { kFlatIndex = 0, kTwoLevelIndex = 1 };
+  IndexType index_type() const { return index_type_; }
+  void set_index_type(IndexType t) { index_type_ = t; }
 
   // The block handle for the metaindex block of the table
   const BlockHandle& metaindex_handle() const { return metaindex_handle_; }
   void set_metaindex_handle(const BlockHandle& h) { metaindex_handle_ = h; }
 
-  // The block handle for the index block of the table
+  // The block handle for the index block of the table. For tables with a
+  // two-level index, this is the top-level index block.
   const BlockHandle& index_handle() const { return index_handle_; }
   void set_index_handle(const BlockHandle& h) { index_handle_ = h; }
 
@@ -79,6 +92,7 @@ class Footer {
  private:
   BlockHandle metaindex_handle_;
   BlockHandle index_handle_;
+  IndexType index_type_;
 };
 
 // kTableMagicNumber was picked by running
@@ -86,6 +100,10 @@ class Footer {
 // and taking the leading 64 bits.
 static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 
+// Magic number of tables with a two-level index. Same as kTableMagicNumber
+// except for the lowest byte.
+static const uint64_t kTwoLevelIndexTableMagicNumber = 0xdb4775248b80fb58ull;
+
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
@@ -96,9 +114,19 @@ struct BlockContents {
 };
 
 // Read the block identified by "handle" from "file".  On failure
-// return non-OK.  On success fill *result and return OK.
+// return non-OK.  On success fill *result and return OK.  "dict" is the
+// digested compression dictionary of the table the block belongs to, if any.
 extern Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                        const BlockHandle& handle, BlockContents* result);
+                        const BlockHandle& handle, BlockContents* result,
+                        const port::ZstdUncompressionDict* dict = NULL);
+
+// Read the blocks identified by handles[0,num_blocks-1] from "file" using a
+// single RandomAccessFile::MultiRead() call. Set statuses[i] and results[i]
+// as if by ReadBlock(file, options, handles[i], &results[i], dict).
+extern void ReadBlocks(RandomAccessFile* file, const ReadOptions& options,
+                       const BlockHandle* handles, size_t num_blocks,
+                       BlockContents* results, Status* statuses,
+                       const port::ZstdUncompressionDict* dict = NULL);
 
 // Implementation details follow.  Clients should ignore,
 inline BlockHandle::BlockHandle()
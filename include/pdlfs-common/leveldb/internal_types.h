@@ -79,6 +79,18 @@ extern void AppendInternalKey(std::string* result,
 // REQUIRES: the result must be able to hold the entire contents.
 extern Slice AppendInternalKeyPtr(char* result, const ParsedInternalKey& key);
 
+// Set *result to the smallest key past all keys starting with "prefix" in
+// bytewise order. Set *result to empty if there is no such key (i.e.,
+// "prefix" is empty or consists of 0xff bytes).
+extern void PrefixSuccessor(const Slice& prefix, std::string* result);
+
+// Set *result to the smallest internal key whose user key is past all user
+// keys starting with "prefix". Such a key is only known for the bytewise
+// comparator, so *result is set to empty (no bound) if "ucmp" is not
+// BytewiseComparator(), or if PrefixSuccessor() finds no key.
+extern void InternalPrefixUpperBound(const Comparator* ucmp,
+                                     const Slice& prefix, std::string* result);
+
 // Attempt to parse an internal key from "internal_key".  On success,
 // stores the parsed data in "*result", and returns true.
 //
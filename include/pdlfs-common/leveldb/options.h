@@ -20,6 +20,7 @@
 #include "pdlfs-common/leveldb/types.h"
 
 #include <stddef.h>
+#include <vector>
 
 namespace pdlfs {
 
@@ -136,6 +137,32 @@ struct DBOptions {
   // Default: 1
   int index_block_restart_interval;
 
+  // If non-zero, split the index of a table into partitions of approximately
+  // this many bytes (before compression) once the index grows beyond that
+  // size. Partitions are stored as separate blocks and are read through the
+  // block cache like data blocks, while a small top-level index pointing to
+  // them stays in memory as long as the table is open. This bounds the
+  // amount of index data that must be read when a large table is opened.
+  // Tables whose index fits in a single partition use a regular index.
+  // Tables written with either index format can always be read.
+  //
+  // Default: 0 (index partitioning disabled)
+  size_t index_partition_size;
+
+  // If true, tables whose user keys all have the same length get an extra
+  // index built with an ECT (entropy-coded trie) that maps each user key to
+  // its data block using only a few bits per key. Point lookups against
+  // such tables use the ECT and leave the regular index on disk, which is
+  // then only read (through the block cache) by iterators. Since the ECT
+  // costs a fixed number of bits per key while the regular index costs a
+  // key and a handle per block, the ECT is smaller only when data blocks
+  // are small relative to keys (e.g. a few hundred bytes). Only has effect
+  // when pdlfs-common is built with PDLFS_SILT_ECT. Requires a comparator
+  // that orders user keys bytewise.
+  //
+  // Default: false
+  bool ect_index;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -152,6 +179,43 @@ struct DBOptions {
   // efficiently detect that and will switch to uncompressed mode.
   CompressionType compression;
 
+  // If non-empty, tables written to level i are compressed using
+  // compression_per_level[i] instead of "compression", and levels past the
+  // end use the last entry. Memtable dumps use the entry of level 0 since
+  // the level of a new table is only decided once it has been written. This
+  // allows the upper levels, which are rewritten often, to use a fast codec
+  // such as kLZ4Compression while the last level uses kZstdCompression.
+  // Default: empty
+  std::vector<CompressionType> compression_per_level;
+
+  // If non-zero, a dictionary of up to this many bytes is trained on the
+  // first data blocks of each table compressed with kZstdCompression and is
+  // stored in the table. All zstd-compressed blocks of the table are then
+  // compressed using the dictionary, which greatly improves the compression
+  // of small blocks holding similar records. Blocks are held uncompressed
+  // in memory until enough of them have been sampled.
+  // Default: 0
+  size_t compression_dict_size;
+
+  // Total size of the data blocks sampled for training a dictionary.
+  // Ignored if "compression_dict_size" is zero.
+  // Default: 1MB
+  size_t compression_dict_sample_size;
+
+  // If non-NULL, data blocks of new tables are compressed and checksummed by
+  // this pool while the thread building a table moves on to the next block.
+  // Blocks are still written out in order by the thread building the table,
+  // which also compresses blocks itself when the pool falls behind, so the
+  // resulting tables are identical to those built without a pool and the
+  // pool may be shared with other work (e.g. "compaction_pool").
+  // Default: NULL
+  ThreadPool* compression_pool;
+
+  // Maximum number of data blocks of a table that may be waiting to be
+  // compressed or written at any time. Ignored if "compression_pool" is NULL.
+  // Default: 8
+  int max_inflight_blocks;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -159,6 +223,24 @@ struct DBOptions {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If true, build a single filter for all keys of a table instead of one
+  // filter for every 2KB of data. A full filter is checked once per table
+  // lookup regardless of which data block may hold the key and is stored
+  // under a different metaindex entry, so tables written with either
+  // layout remain readable. Has no effect if "filter_policy" is NULL.
+  //
+  // Default: false
+  bool full_filter;
+
+  // If true, a group of concurrent writers is committed in a pipelined manner:
+  // the group leader appends the group's write-ahead log record while every
+  // writer in the group inserts its own batch into the memtable in parallel.
+  // Sequence numbers are assigned to each batch before any insertion begins.
+  // This increases write throughput when many threads write at the same time.
+  // Ignored when "no_memtable" is true.
+  // Default: false
+  bool allow_concurrent_memtable_write;
+
   // -------------------
   // Dangerous zone - parameters for experts
 
@@ -221,6 +303,14 @@ struct DBOptions {
   // Default: 256KB
   size_t table_bulk_read_size;
 
+  // If non-zero, table files are memory-mapped, up to this many bytes in
+  // total, and uncompressed blocks are served directly from the mappings
+  // without being copied into the block cache. Tables that do not fit are
+  // read using regular positional reads. Only used by ReadonlyDB on POSIX
+  // platforms.
+  // Default: 0
+  uint64_t mmap_table_bytes;
+
   // Target table file size before data compression is applied.
   // Default: 2MB
   size_t table_file_size;
@@ -253,6 +343,15 @@ struct DBOptions {
   // Default: 12
   int l0_hard_limit;
 
+  // Maximum number of key ranges a single compaction may be split into.
+  // Ranges are cut at the boundaries of the compaction's input files and
+  // are processed concurrently: one range by the background thread running
+  // the compaction and the rest by "compaction_pool". Outputs of all ranges
+  // are installed together in a single version edit.
+  // Ignored if "compaction_pool" is NULL.
+  // Default: 1
+  int max_subcompactions;
+
   DBOptions();
 };
 
@@ -284,6 +383,25 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-empty, iterators only return keys starting with "prefix".
+  // Seek() and SeekToFirst() position iterators at or after the prefix and
+  // iterators become invalid at the first key past it. With the default
+  // bytewise comparator, tables and table blocks that can only hold keys
+  // past the prefix are never read.
+  // Bounded iterators only move forward: Prev() and SeekToLast() are not
+  // supported. Keys sharing a prefix must be adjacent in the order of the
+  // comparator (as with the default bytewise comparator). The prefix must
+  // remain live while iterators created with it are in use.
+  // Default: empty
+  Slice prefix;
+
+  // If non-zero, iterators moving forward through a table read up to
+  // "readahead" bytes of upcoming data blocks at once, using a single
+  // batched read, and insert them into the block cache. No effect if the
+  // table has no block cache or "fill_cache" is false.
+  // Default: 0
+  size_t readahead;
+
   ReadOptions();
 };
 
@@ -366,10 +484,34 @@ struct InsertOptions {
   // Default: kRename
   InsertMethod method;
 
+  // If true, insert each table into the deepest level at which its key range
+  // overlaps no existing table, either at that level or any level above it.
+  // Tables that overlap other tables of the same insertion always go to
+  // level 0.  This avoids rewriting already sorted data through a series of
+  // compactions.  Otherwise, all tables are inserted into level 0.
+  // Default: false
+  bool place_in_deepest_level;
+
   InsertOptions(InsertMethod method);
   InsertOptions();
 };
 
+// Selects the keys written out by a DB::Dump().  Sub-ranges of a dump may be
+// processed concurrently so implementations must be thread-safe.
+class DumpFilter {
+ public:
+  DumpFilter() {}
+  virtual ~DumpFilter();
+
+  // Return true iff the given key-value pair should be dumped.
+  virtual bool Select(const Slice& key, const Slice& value) const = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const DumpFilter&);
+  DumpFilter(const DumpFilter&);
+};
+
 // Options that control dump operations
 struct DumpOptions {
   // If true, all data read from underlying storage will be
@@ -384,6 +526,31 @@ struct DumpOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-zero, start a new table file once the current one reaches
+  // approximately this many bytes.  Otherwise, each key sub-range is dumped
+  // into a single table.
+  // Default: 0
+  size_t table_file_size;
+
+  // Maximum number of key sub-ranges a dump may be split into.  Split
+  // points are picked among the boundaries of the db's table files such
+  // that sub-ranges hold roughly equal amounts of data.  Sub-ranges are
+  // dumped concurrently: one by the calling thread and the rest by
+  // "thread_pool".
+  // Default: 1
+  int max_parallelism;
+
+  // Thread pool for dumping sub-ranges.  If NULL, the db's compaction_pool
+  // is used.  If that is also NULL, all sub-ranges are dumped by the
+  // calling thread.
+  // Default: NULL
+  ThreadPool* thread_pool;
+
+  // If non-NULL, only keys selected by "filter" are dumped.  The key range
+  // of the dump is still scanned in its entirety.
+  // Default: NULL
+  const DumpFilter* filter;
+
   DumpOptions();
 };
 
@@ -18,6 +18,7 @@
 
 #include "pdlfs-common/status.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace pdlfs {
@@ -62,6 +63,12 @@ class Table {
   // call one of the Seek methods on the iterator before using it).
   Iterator* NewIterator(const ReadOptions&) const;
 
+  // Same as above, but the returned iterator is bounded by "upper_bound":
+  // data blocks whose keys can only be at or past the bound are never read.
+  // Forward scans also read data blocks ahead as configured by
+  // ReadOptions::readahead.
+  Iterator* NewIterator(const ReadOptions&, const Slice& upper_bound) const;
+
   // Given a key, return an approximate byte offset in the file where
   // the data for that key begins (or would begin if the key were
   // present in the file).  The returned value is in terms of file
@@ -74,6 +81,11 @@ class Table {
   // if no valid properties can be found.
   const TableProperties* GetProperties() const;
 
+  // Return the approximate number of bytes of index data held in memory
+  // for as long as the table is open. Index data read through the block
+  // cache is not included.
+  size_t ApproximateIndexMemoryUsage() const;
+
  private:
   struct Rep;
   Rep* rep_;
@@ -81,18 +93,36 @@ class Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void* table, const ReadOptions& options,
                                const Slice& block_handle);
+  Iterator* NewIndexIterator(const ReadOptions& options) const;
+  static size_t PrefetchBlocks(void* table, const ReadOptions& options,
+                               const Slice& index_key,
+                               const Slice& upper_bound);
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
-  // that key is not present.
+  // that key is not present.  If "pin" is not NULL and such a call is made,
+  // *pin is set to an iterator owning the memory of the entry.  The entry
+  // then remains valid until the caller deletes *pin.
   friend class TableCache;
   Status InternalGet(const ReadOptions& options, const Slice& key, void* arg,
                      void (*handle_result)(void* arg, const Slice& k,
-                                           const Slice& v));
+                                           const Slice& v),
+                     Iterator** pin = NULL);
+  void InternalMultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                        void* const* args,
+                        void (*handle_result)(void* arg, const Slice& k,
+                                              const Slice& v),
+                        Status* statuses);
+  Status ECTGet(const ReadOptions& options, const Slice& key, void* arg,
+                void (*handle_result)(void* arg, const Slice& k,
+                                      const Slice& v),
+                Iterator** pin);
 
   void ReadMeta(const Footer& footer);
   void ReadProperties(const Slice& props_handle_value);
-  void ReadFilter(const Slice& filter_handle_value);
+  void ReadCompressionDict(const Slice& dict_handle_value);
+  void ReadFilter(const Slice& filter_handle_value, bool full);
+  void ReadECTIndex(const Slice& ect_handle_value);
 
   // No copying allowed
   void operator=(const Table&);
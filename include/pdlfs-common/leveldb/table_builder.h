@@ -19,7 +19,9 @@
 #include "pdlfs-common/compression_type.h"
 #include "pdlfs-common/status.h"
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string>
 
 // TableBuilder provides the interface used to build a Table
 // (an immutable and sorted map from keys to values).
@@ -91,17 +93,36 @@ class TableBuilder {
   uint64_t NumBlocks() const;
 
   // Size of the file generated so far.  If invoked after a successful
-  // Finish() call, returns the size of the final generated file.
+  // Finish() call, returns the size of the final generated file.  Data
+  // blocks waiting to be compressed (see options.compression_pool and
+  // options.compression_dict_size) are counted at their uncompressed size.
   uint64_t FileSize() const;
 
+  // Total CPU time spent compressing blocks so far, in microseconds. Time
+  // spent by different threads compressing blocks in parallel adds up.
+  uint64_t CompressionMicros() const;
+
  private:
+  struct PendingBlock;
+  struct Pipeline;
+  static void BGWork(void* arg);
+  void SubmitBlock();
+  void TrainDictionary();
+  void DrainBlocks(size_t n, bool write);
+  void EmitBlock(PendingBlock* block);
+
   void WriteBlock(const Slice& block_contents, BlockHandle* handle);
   void WriteRawBlock(const Slice& raw_block_contents, CompressionType,
                      BlockHandle* handle);
+  void AppendBlock(const Slice& contents, const char* trailer,
+                   BlockHandle* handle);
 
   bool ok() const { return status().ok(); }
 
   void AddBlock(BlockBuilder* builder, BlockHandle* handle);
+  void AddIndexEntry(std::string* last_key, const Slice* next_key,
+                     const BlockHandle& handle);
+  void CutIndexPartition(const std::string& last_index_key);
 
   struct Rep;
   Rep* rep_;
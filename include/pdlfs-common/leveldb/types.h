@@ -17,10 +17,21 @@
 namespace pdlfs {
 typedef uint64_t SequenceNumber;
 
+class Iterator;
+
 class Buffer {
  public:
   virtual void Fill(const char* data, size_t size) = 0;
 
+  // Return true if the buffer references the data passed to Fill() instead
+  // of copying it. A source filling such a buffer must then keep the data
+  // alive by handing an object owning it to Pin() right after Fill().
+  virtual bool Pinnable() const { return false; }
+
+  // Take over "pin". Deleting "pin" releases the data most recently
+  // passed to Fill(). Only called when Pinnable() returns true.
+  virtual void Pin(Iterator* pin) {}
+
  protected:
   virtual ~Buffer() {}
 };
@@ -26,6 +26,7 @@ class WritableFile;
 class Logger;
 class Osd;
 class Env;
+class ThreadPool;
 
 struct MountOptions {
   MountOptions();
@@ -97,6 +98,29 @@ struct OfsOptions {
   // Logger for ofs internal/error information.
   // Default: NULL
   Logger* info_log;
+  // Checkpoint the log of a mounted file set once this many bytes have been
+  // appended to it since its last snapshot. A checkpoint writes a compacted
+  // snapshot of the set to the set's other log and switches to that log,
+  // bounding the amount of log replayed by the next mount. Use 0 to disable
+  // online checkpoints, in which case logs are only compacted at mount time.
+  // Ignored unless checkpoint_pool is set.
+  // Default: 0
+  uint64_t max_log_size;
+  // Thread pool for taking checkpoints in the background. Checkpoints are
+  // never taken by threads updating the file set. If NULL, no online
+  // checkpoints are taken.
+  // Default: NULL
+  ThreadPool* checkpoint_pool;
+};
+
+// Statistics of a mounted file set.
+struct FileSetStats {
+  FileSetStats();
+  uint64_t mount_micros;      // Time spent recovering and opening the set
+  uint64_t replayed_records;  // Number of log records replayed by the mount
+  uint64_t replayed_ops;      // Number of operations in those records
+  uint64_t num_checkpoints;   // Checkpoints taken since the set was mounted
+  uint64_t log_size;          // Bytes in the current log
 };
 
 // We use Ofs to bridge the Osd world to the traditional file system world. This
@@ -154,6 +178,10 @@ class Ofs {
   // Return OK on success, and a non-OK status on errors.
   Status SynFileSet(const char* dirname);
 
+  // Retrieve statistics of the file set mounted at the given path.
+  // Return OK on success, and a non-OK status on errors.
+  Status GetFileSetStats(const char* dirname, FileSetStats* stats);
+
   // Create a brand new sequentially-readable file with the specified name.
   Status NewSequentialFile(const char* fname, SequentialFile** result);
 
@@ -61,6 +61,13 @@
 #ifdef PDLFS_SNAPPY
 #include <snappy.h>
 #endif
+#ifdef PDLFS_LZ4
+#include <lz4.h>
+#endif
+#ifdef PDLFS_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
 #include "pdlfs-common/atomic_pointer.h"  // Platform-specific atomic pointer
 
 #include <limits.h>
@@ -185,6 +192,210 @@ inline bool Snappy_Uncompress(const char* input, size_t length, char* output) {
 #endif
 }
 
+// LZ4 blocks do not record their uncompressed size so we prepend it as a
+// 4-byte little-endian integer.
+inline bool LZ4_Compress(const char* input, size_t length,
+                         ::std::string* output) {
+#ifdef PDLFS_LZ4
+  if (length > LZ4_MAX_INPUT_SIZE) {
+    return false;
+  }
+  const int bound = LZ4_compressBound(static_cast<int>(length));
+  output->resize(4 + bound);
+  char* const buf = &(*output)[0];
+  for (int i = 0; i < 4; i++) {
+    buf[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+  }
+  const int outlen = LZ4_compress_default(
+      input, buf + 4, static_cast<int>(length), bound);
+  if (outlen <= 0) {
+    return false;
+  }
+  output->resize(4 + outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool LZ4_GetUncompressedLength(const char* input, size_t length,
+                                      size_t* result) {
+#ifdef PDLFS_LZ4
+  if (length < 4) {
+    return false;
+  }
+  *result = 0;
+  for (int i = 0; i < 4; i++) {
+    *result |= static_cast<size_t>(static_cast<unsigned char>(input[i]))
+               << (8 * i);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool LZ4_Uncompress(const char* input, size_t length, char* output) {
+#ifdef PDLFS_LZ4
+  size_t ulength;
+  if (!LZ4_GetUncompressedLength(input, length, &ulength)) {
+    return false;
+  }
+  const int outlen =
+      LZ4_decompress_safe(input + 4, output, static_cast<int>(length - 4),
+                          static_cast<int>(ulength));
+  return outlen >= 0 && static_cast<size_t>(outlen) == ulength;
+#else
+  return false;
+#endif
+}
+
+#ifdef PDLFS_ZSTD
+// Compression and decompression contexts are expensive to set up so each
+// thread keeps its own.
+struct ZstdContexts {
+  ZstdContexts() : cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()) {}
+  ~ZstdContexts() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+  ZSTD_CCtx* const cctx;
+  ZSTD_DCtx* const dctx;
+};
+
+inline ZstdContexts* Zstd_ThreadContexts() {
+  static thread_local ZstdContexts contexts;
+  return &contexts;
+}
+#endif
+
+// A zstd dictionary digested for compression or decompression. Digesting a
+// dictionary is far more costly than compressing a small block with it, so
+// callers that reuse a dictionary across blocks should digest it only once.
+// A digested dictionary is read-only and may be shared by multiple threads.
+struct ZstdCompressionDict;
+struct ZstdUncompressionDict;
+
+// Return NULL if zstd is not available or "dict" cannot be digested.
+inline ZstdCompressionDict* Zstd_NewCompressionDict(const char* dict,
+                                                    size_t dict_len) {
+#ifdef PDLFS_ZSTD
+  return reinterpret_cast<ZstdCompressionDict*>(
+      ZSTD_createCDict(dict, dict_len, ZSTD_CLEVEL_DEFAULT));
+#else
+  return NULL;
+#endif
+}
+
+inline void Zstd_DeleteCompressionDict(ZstdCompressionDict* dict) {
+#ifdef PDLFS_ZSTD
+  ZSTD_freeCDict(reinterpret_cast<ZSTD_CDict*>(dict));
+#endif
+}
+
+// Return NULL if zstd is not available or "dict" cannot be digested.
+// The returned object keeps its own copy of "dict".
+inline ZstdUncompressionDict* Zstd_NewUncompressionDict(const char* dict,
+                                                        size_t dict_len) {
+#ifdef PDLFS_ZSTD
+  return reinterpret_cast<ZstdUncompressionDict*>(
+      ZSTD_createDDict(dict, dict_len));
+#else
+  return NULL;
+#endif
+}
+
+inline void Zstd_DeleteUncompressionDict(ZstdUncompressionDict* dict) {
+#ifdef PDLFS_ZSTD
+  ZSTD_freeDDict(reinterpret_cast<ZSTD_DDict*>(dict));
+#endif
+}
+
+// Compress using zstd. If "dict" is not NULL, it is used as the compression
+// dictionary and the same dictionary must also be supplied to
+// Zstd_Uncompress().
+inline bool Zstd_Compress(const char* input, size_t length,
+                          const ZstdCompressionDict* dict,
+                          ::std::string* output) {
+#ifdef PDLFS_ZSTD
+  ZSTD_CCtx* const cctx = Zstd_ThreadContexts()->cctx;
+  if (cctx == NULL) {
+    return false;
+  }
+  output->resize(ZSTD_compressBound(length));
+  const size_t outlen =
+      dict != NULL
+          ? ZSTD_compress_usingCDict(
+                cctx, &(*output)[0], output->size(), input, length,
+                reinterpret_cast<const ZSTD_CDict*>(dict))
+          : ZSTD_compressCCtx(cctx, &(*output)[0], output->size(), input,
+                              length, ZSTD_CLEVEL_DEFAULT);
+  if (ZSTD_isError(outlen)) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result) {
+#ifdef PDLFS_ZSTD
+  const unsigned long long n = ZSTD_getFrameContentSize(input, length);
+  if (n == ZSTD_CONTENTSIZE_UNKNOWN || n == ZSTD_CONTENTSIZE_ERROR) {
+    return false;
+  }
+  *result = static_cast<size_t>(n);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_Uncompress(const char* input, size_t length,
+                            const ZstdUncompressionDict* dict, char* output) {
+#ifdef PDLFS_ZSTD
+  size_t ulength;
+  ZSTD_DCtx* const dctx = Zstd_ThreadContexts()->dctx;
+  if (dctx == NULL || !Zstd_GetUncompressedLength(input, length, &ulength)) {
+    return false;
+  }
+  const size_t outlen =
+      dict != NULL
+          ? ZSTD_decompress_usingDDict(
+                dctx, output, ulength, input, length,
+                reinterpret_cast<const ZSTD_DDict*>(dict))
+          : ZSTD_decompressDCtx(dctx, output, ulength, input, length);
+  return !ZSTD_isError(outlen) && outlen == ulength;
+#else
+  return false;
+#endif
+}
+
+// Train a zstd dictionary of at most "max_dict_len" bytes from "n" samples
+// stored back to back in "samples". Return false if a dictionary cannot be
+// trained, such as when there are too few samples.
+inline bool Zstd_TrainDictionary(const char* samples,
+                                 const size_t* sample_sizes, size_t n,
+                                 size_t max_dict_len, ::std::string* dict) {
+#ifdef PDLFS_ZSTD
+  dict->resize(max_dict_len);
+  const size_t dict_len =
+      ZDICT_trainFromBuffer(&(*dict)[0], max_dict_len, samples, sample_sizes,
+                            static_cast<unsigned>(n));
+  if (ZDICT_isError(dict_len)) {
+    dict->clear();
+    return false;
+  }
+  dict->resize(dict_len);
+  return true;
+#else
+  return false;
+#endif
+}
+
 inline bool GetHeapProfile(void (*)(void*, const char*, int), void*) {
   return false;
 }
@@ -79,7 +79,9 @@ struct RPCOptions {
 
   // Options specific to the Mercury rpc engine
 
-  // Max number of server addrs that may be cached locally
+  // Max number of server addrs that may be cached locally. The socket rpc
+  // engine also uses this to bound the number of idle persistent TCP
+  // connections kept by a client (see tcp_persistent_conns).
   size_t addr_cache_size;  //  Default: 128
 
   // Options specific to the socket rpc engine
@@ -100,6 +102,26 @@ struct RPCOptions {
   // Per-socket UDP server-side sender buffer size.
   // Default: -1
   int udp_srv_sndbuf;
+
+  // Max number of datagrams a UDP server thread receives with a single
+  // recvmmsg() call. When larger than 1 and no extra workers are configured,
+  // replies to a batch are also sent back together using sendmmsg(). Setting
+  // to 1 disables batching. Only effective on Linux.
+  // Default: 1
+  int udp_batch_size;
+
+  // If true, each UDP server thread opens its own socket bound to the same
+  // address with SO_REUSEPORT and the kernel distributes incoming datagrams
+  // among them. Otherwise all threads share a single socket.
+  // Default: false
+  bool udp_reuseport;
+
+  // If true, TCP connections are kept open and reused across calls. Each
+  // connection carries a stream of length-prefixed request frames and
+  // multiple calls may be in-flight on the same connection. Both client and
+  // server must be configured the same way. Currently requires epoll.
+  // Default: false
+  bool tcp_persistent_conns;
 };
 
 // Each RPC* is a reference to an RPC instance. This instance either acts as a
@@ -18,6 +18,12 @@
 #include "pdlfs-common/lru.h"
 #include "pdlfs-common/mutexlock.h"
 
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
+
 // This LRU cache implementation is primarily designed for the leveldb
 // sub-component of the codebase. For a more general LRU cache implementation,
 // consider using the LRUCache in "pdlfs-common/lru.h" directly.
@@ -141,4 +147,426 @@ Cache* NewLRUCache(size_t capacity) {
   return new ShardedLRUCache(capacity);  // Statically partitioned
 }
 
+// The following implements a CLOCK cache, an approximation of LRU that does
+// not reorder entries on hits. Each shard keeps its entries in a circular list
+// (the "clock") and a hash table. Lookups are lock-free: they walk the hash
+// table using atomic loads, and then bump the entry's small usage counter and
+// increment its reference count, both of which are atomic. Releases decrement
+// the reference count, also without locking. Insertions, erasures, and
+// evictions are serialized by the shard's mutex. To evict, the clock hand
+// sweeps the circular list decrementing usage counters, and evicts the first
+// entry found with a zero counter and no external references. Using a counter
+// rather than a single reference bit prevents entries that are hit only once
+// from pushing out frequently used ones. Same as ShardedLRUCache, entries that
+// are currently referenced by clients are never evicted.
+//
+// Since lookups take no lock, an entry unlinked from the hash table (and a
+// bucket array replaced by a resize) may still be visited by lookups that
+// started earlier. Such memory is therefore only reclaimed after a grace
+// period. Each lookup registers itself in one of two sets of striped reader
+// counters selected by the shard's epoch. A grace period flips the epoch and
+// waits for the counters of the previous epoch to drain, twice, so that every
+// lookup that may have seen the old state has finished. The cache drops its
+// reference to unlinked entries only after that. Grace periods are run by the
+// writer after it has released the shard's mutex and are skipped by
+// operations that unlink nothing.
+#if __cplusplus >= 201103L
+namespace {
+
+enum { kMaxUsage = 3 };
+
+struct ClockEntry {
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  std::atomic<ClockEntry*> next_hash;
+  // Circular list; protected by the shard's mutex
+  ClockEntry* next;
+  ClockEntry* prev;
+  size_t charge;
+  uint32_t hash;
+  bool in_cache;  // True iff entry has a reference from the cache
+  std::atomic<uint32_t> refs;
+  std::atomic<uint8_t> usage;  // Saturates at kMaxUsage
+  std::string key_data;
+
+  Slice key() const { return key_data; }
+};
+
+// Entries are deleted as soon as they lose their last reference. No lock is
+// needed as lookups can no longer find an entry once the cache has dropped its
+// reference to it.
+void Unref(ClockEntry* e) {
+  if (e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    assert(!e->in_cache);
+    (*e->deleter)(e->key(), e->value);
+    delete e;
+  }
+}
+
+// A hash table bucket array. Buckets and chains are only modified by writers
+// holding the shard's mutex and are published with release stores so that
+// lookups may walk them without locking.
+struct ClockTable {
+  explicit ClockTable(uint32_t length)
+      : length(length), list(new std::atomic<ClockEntry*>[length]) {
+    for (uint32_t i = 0; i < length; i++) {
+      list[i].store(NULL, std::memory_order_relaxed);
+    }
+  }
+
+  ~ClockTable() { delete[] list; }
+
+  const uint32_t length;  // Always a power of 2
+  std::atomic<ClockEntry*>* const list;
+};
+
+enum { kReaderStripes = 16 };
+
+// A lookup counter padded to its own cache line.
+struct ReaderCount {
+  ReaderCount() : n(0) {}
+  std::atomic<int> n;
+  char padding[64 - sizeof(std::atomic<int>)];
+};
+
+// Return the stripe of reader counters used by the calling thread.
+unsigned ReaderStripe() {
+  static std::atomic<unsigned> next_id(0);
+  thread_local unsigned id = next_id.fetch_add(1, std::memory_order_relaxed);
+  return id % kReaderStripes;
+}
+
+class ClockCacheShard {
+ public:
+  ClockCacheShard()
+      : capacity_(0),
+        usage_(0),
+        num_entries_(0),
+        hand_(NULL),
+        table_(new ClockTable(16)),
+        epoch_(0) {}
+
+  ~ClockCacheShard() {
+    std::vector<ClockEntry*> unlinked;
+    while (hand_ != NULL) {
+      ClockEntry* const e = hand_;
+      assert(e->refs.load() == 1);  // Entries should all have been released
+      TableRemove(e);
+      Remove(e, &unlinked);
+    }
+    // No lookups can be in progress so no grace period is needed
+    for (size_t i = 0; i < unlinked.size(); i++) {
+      Unref(unlinked[i]);
+    }
+    delete table_.load();
+  }
+
+  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+
+  ClockEntry* Insert(const Slice& key, uint32_t hash, void* value,
+                     size_t charge,
+                     void (*deleter)(const Slice& key, void* value)) {
+    ClockEntry* const e = new ClockEntry;
+    e->value = value;
+    e->deleter = deleter;
+    e->charge = charge;
+    e->hash = hash;
+    e->in_cache = false;
+    e->refs.store(1);  // This is for the handle to be returned to the client
+    e->usage.store(0);
+    e->key_data = key.ToString();
+    // Fast path for a special case in which
+    // caching is effectively turned off via !capacity_.
+    if (!capacity_) {
+      return e;
+    }
+    std::vector<ClockEntry*> unlinked;
+    ClockTable* old_table = NULL;
+    mu_.Lock();
+    e->refs.store(2);  // One more for the cache itself
+    e->in_cache = true;
+    usage_ += charge;
+    ClockEntry* const old = TableInsert(e, &old_table);
+    if (old != NULL) {
+      Remove(old, &unlinked);
+    }
+    Append(e);
+    EvictIdleEntries(&unlinked);
+    // Don't cache the incoming entry if we turn out to have run out of room.
+    if (usage_ > capacity_) {
+      TableRemove(e);
+      Remove(e, &unlinked);
+    }
+    mu_.Unlock();
+    Reclaim(&unlinked, old_table);
+    return e;
+  }
+
+  ClockEntry* Lookup(const Slice& key, uint32_t hash) {
+    std::atomic<int>* const readers = &readers_
+        [epoch_.load(std::memory_order_seq_cst) & 1][ReaderStripe()].n;
+    readers->fetch_add(1, std::memory_order_seq_cst);
+    ClockTable* const t = table_.load(std::memory_order_acquire);
+    ClockEntry* e = t->list[hash & (t->length - 1)].load(
+        std::memory_order_acquire);
+    while (e != NULL && (e->hash != hash || key != e->key())) {
+      e = e->next_hash.load(std::memory_order_acquire);
+    }
+    if (e != NULL) {
+      e->refs.fetch_add(1, std::memory_order_relaxed);
+      // Concurrent updates may get lost, which is okay. Hot entries are
+      // saturated and are not written to again.
+      const uint8_t u = e->usage.load(std::memory_order_relaxed);
+      if (u < kMaxUsage) {
+        e->usage.store(u + 1, std::memory_order_relaxed);
+      }
+    }
+    readers->fetch_sub(1, std::memory_order_release);
+    return e;
+  }
+
+  void Erase(const Slice& key, uint32_t hash) {
+    std::vector<ClockEntry*> unlinked;
+    mu_.Lock();
+    ClockEntry* const e = TableRemove(key, hash);
+    if (e != NULL) {
+      Remove(e, &unlinked);
+    }
+    mu_.Unlock();
+    Reclaim(&unlinked, NULL);
+  }
+
+ private:
+  // Return the slot pointing to the entry matching the key and hash, or the
+  // trailing slot of the corresponding chain if there is no such entry.
+  // REQUIRES: mu_ has been locked.
+  std::atomic<ClockEntry*>* FindSlot(const Slice& key, uint32_t hash) {
+    ClockTable* const t = table_.load(std::memory_order_relaxed);
+    std::atomic<ClockEntry*>* ptr = &t->list[hash & (t->length - 1)];
+    ClockEntry* e;
+    while ((e = ptr->load(std::memory_order_relaxed)) != NULL &&
+           (e->hash != hash || key != e->key())) {
+      ptr = &e->next_hash;
+    }
+    return ptr;
+  }
+
+  // Add an entry to the hash table, returning the entry it replaces if any.
+  // The table may be resized, in which case the old bucket array is stored in
+  // *old_table for the caller to reclaim. An unlinked entry keeps its
+  // next_hash so that lookups currently visiting it can move on.
+  // REQUIRES: mu_ has been locked.
+  ClockEntry* TableInsert(ClockEntry* e, ClockTable** old_table) {
+    std::atomic<ClockEntry*>* const ptr = FindSlot(e->key(), e->hash);
+    ClockEntry* const old = ptr->load(std::memory_order_relaxed);
+    e->next_hash.store(
+        old == NULL ? NULL : old->next_hash.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+    ptr->store(e, std::memory_order_release);
+    if (old == NULL && num_entries_ + 1 > table_.load()->length) {
+      // num_entries_ is updated by Append() after us
+      *old_table = Resize();
+    }
+    return old;
+  }
+
+  // REQUIRES: mu_ has been locked.
+  ClockEntry* TableRemove(const Slice& key, uint32_t hash) {
+    std::atomic<ClockEntry*>* const ptr = FindSlot(key, hash);
+    ClockEntry* const e = ptr->load(std::memory_order_relaxed);
+    if (e != NULL) {
+      ptr->store(e->next_hash.load(std::memory_order_relaxed),
+                 std::memory_order_release);
+    }
+    return e;
+  }
+
+  // REQUIRES: mu_ has been locked and e is in the table.
+  void TableRemove(ClockEntry* e) {
+    ClockEntry* const r = TableRemove(e->key(), e->hash);
+    assert(r == e);
+    (void)r;
+  }
+
+  // Double the number of buckets. Entries are relinked into a new bucket array
+  // which is then published. Lookups concurrently walking the old array may
+  // miss entries that are being moved, which is harmless for a cache. Return
+  // the old array.
+  // REQUIRES: mu_ has been locked.
+  ClockTable* Resize() {
+    ClockTable* const old_table = table_.load(std::memory_order_relaxed);
+    ClockTable* const t = new ClockTable(old_table->length * 2);
+    for (uint32_t i = 0; i < old_table->length; i++) {
+      ClockEntry* e = old_table->list[i].load(std::memory_order_relaxed);
+      while (e != NULL) {
+        ClockEntry* const next = e->next_hash.load(std::memory_order_relaxed);
+        std::atomic<ClockEntry*>* const head =
+            &t->list[e->hash & (t->length - 1)];
+        e->next_hash.store(head->load(std::memory_order_relaxed),
+                           std::memory_order_release);
+        head->store(e, std::memory_order_relaxed);
+        e = next;
+      }
+    }
+    table_.store(t, std::memory_order_release);
+    return old_table;
+  }
+
+  // Evict entries until usage_ drops below capacity_. Each entry is visited at
+  // most kMaxUsage + 1 times before it is either evicted or found pinned.
+  // REQUIRES: mu_ has been locked.
+  void EvictIdleEntries(std::vector<ClockEntry*>* unlinked) {
+    size_t budget = (kMaxUsage + 1) * num_entries_;
+    while (usage_ > capacity_ && hand_ != NULL && budget-- != 0) {
+      ClockEntry* const e = hand_;
+      hand_ = e->next;
+      if (e->refs.load(std::memory_order_acquire) != 1) {
+        continue;  // Currently in use by clients
+      }
+      const uint8_t u = e->usage.load(std::memory_order_relaxed);
+      if (u != 0) {
+        e->usage.store(u - 1, std::memory_order_relaxed);
+        continue;  // Give it another chance
+      }
+      TableRemove(e);
+      Remove(e, unlinked);
+    }
+  }
+
+  // Add an entry right behind the clock hand so that it will be the last
+  // entry to be considered for eviction.
+  void Append(ClockEntry* e) {
+    if (hand_ == NULL) {
+      e->next = e->prev = e;
+      hand_ = e;
+    } else {
+      e->next = hand_;
+      e->prev = hand_->prev;
+      e->prev->next = e;
+      hand_->prev = e;
+    }
+    num_entries_++;
+  }
+
+  // Remove an entry from the clock. The entry must have already been removed
+  // from the hash table. The cache's reference to it is dropped by Reclaim().
+  void Remove(ClockEntry* e, std::vector<ClockEntry*>* unlinked) {
+    assert(e->in_cache);
+    if (e->next == e) {
+      hand_ = NULL;
+    } else {
+      if (hand_ == e) hand_ = e->next;
+      e->prev->next = e->next;
+      e->next->prev = e->prev;
+    }
+    num_entries_--;
+    e->in_cache = false;
+    usage_ -= e->charge;
+    unlinked->push_back(e);
+  }
+
+  // Wait for a grace period and then drop the cache's references to entries
+  // unlinked from the hash table and free a replaced bucket array.
+  // REQUIRES: mu_ has NOT been locked.
+  void Reclaim(std::vector<ClockEntry*>* unlinked, ClockTable* old_table) {
+    if (unlinked->empty() && old_table == NULL) {
+      return;
+    }
+    gp_mu_.Lock();
+    for (int i = 0; i < 2; i++) {
+      const uint32_t prev = epoch_.fetch_add(1, std::memory_order_seq_cst) & 1;
+      for (int j = 0; j < kReaderStripes; j++) {
+        while (readers_[prev][j].n.load(std::memory_order_seq_cst) != 0) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    gp_mu_.Unlock();
+    for (size_t i = 0; i < unlinked->size(); i++) {
+      Unref((*unlinked)[i]);
+    }
+    delete old_table;
+  }
+
+  port::Mutex mu_;
+  size_t capacity_;
+  // State below is protected by mu_
+  size_t usage_;
+  size_t num_entries_;
+  ClockEntry* hand_;  // Next entry to examine; NULL when the clock is empty
+  std::atomic<ClockTable*> table_;  // Only modified while holding mu_
+  port::Mutex gp_mu_;  // Serializes grace periods
+  std::atomic<uint32_t> epoch_;
+  ReaderCount readers_[2][kReaderStripes];
+};
+
+class ShardedClockCache : public Cache {
+ private:
+  std::atomic<uint64_t> id_;  // The last allocated id number
+  const int num_shard_bits_;
+  ClockCacheShard* sh_;
+
+  static inline uint32_t hashval(const Slice& in) {
+    return Hash(in.data(), in.size(), 0);
+  }
+
+  uint32_t sha(uint32_t hash) const {
+    return num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0;
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, int num_shard_bits)
+      : id_(0), num_shard_bits_(num_shard_bits) {
+    const int num_shards = 1 << num_shard_bits_;
+    sh_ = new ClockCacheShard[num_shards];
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    for (int s = 0; s < num_shards; s++) {
+      sh_[s].SetCapacity(per_shard);
+    }
+  }
+
+  virtual ~ShardedClockCache() { delete[] sh_; }
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = hashval(key);
+    ClockEntry* e = sh_[sha(hash)].Insert(key, hash, value, charge, deleter);
+    return reinterpret_cast<Handle*>(e);
+  }
+
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = hashval(key);
+    ClockEntry* e = sh_[sha(hash)].Lookup(key, hash);
+    return reinterpret_cast<Handle*>(e);
+  }
+
+  virtual void Release(Handle* handle) {
+    Unref(reinterpret_cast<ClockEntry*>(handle));
+  }
+
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = hashval(key);
+    sh_[sha(hash)].Erase(key, hash);
+  }
+
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockEntry*>(handle)->value;
+  }
+
+  virtual uint64_t NewId() { return ++id_; }
+};
+
+}  // namespace
+
+Cache* NewClockCache(size_t capacity, int num_shard_bits) {
+  if (num_shard_bits < 0) num_shard_bits = 0;
+  if (num_shard_bits > 16) num_shard_bits = 16;
+  return new ShardedClockCache(capacity, num_shard_bits);
+}
+#else
+Cache* NewClockCache(size_t capacity, int num_shard_bits) {
+  return NewLRUCache(capacity);  // Requires c++11 atomics
+}
+#endif
+
 }  // namespace pdlfs
@@ -16,8 +16,15 @@
  */
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
 #include <vector>
 
 namespace pdlfs {
@@ -49,7 +56,9 @@ class CacheTest {
   std::vector<int> deleted_values_;
   Cache* cache_;
 
-  CacheTest() : cache_(NewLRUCache(kCacheSize)) { current_ = this; }
+  explicit CacheTest(Cache* cache = NewLRUCache(kCacheSize)) : cache_(cache) {
+    current_ = this;
+  }
 
   ~CacheTest() { delete cache_; }
 
@@ -185,8 +194,286 @@ TEST(CacheTest, NewId) {
   ASSERT_NE(a, b);
 }
 
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() : CacheTest(NewClockCache(kCacheSize)) {}
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(200);
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(200, deleted_keys_[1]);
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  // Pinned entries must survive eviction
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  ASSERT_GT(deleted_keys_.size(), 0);
+  for (size_t i = 0; i < deleted_keys_.size(); i++) {
+    ASSERT_NE(100, deleted_keys_[i]);
+  }
+  ASSERT_EQ(101, Lookup(100));
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  const size_t n = deleted_keys_.size();
+  cache_->Release(h1);
+  ASSERT_EQ(n + 1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[n]);
+  ASSERT_EQ(101, deleted_values_[n]);
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000 + i, 2000 + i);
+    ASSERT_EQ(2000 + i, Lookup(1000 + i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+TEST(ClockCacheTest, ClockHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2 * kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000 + index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000 + i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
+}
+
+namespace {
+struct ReaderState {
+  explicit ReaderState(Cache* c)
+      : cache(c), cv(&mu), num_running(0), num_errors(0) {}
+  Cache* const cache;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+  int num_errors;
+};
+
+void HotReader(void* arg) {
+  ReaderState* const state = reinterpret_cast<ReaderState*>(arg);
+  int errors = 0;
+  for (int i = 0; i < 100000; i++) {
+    const int k = i % 100;
+    Cache::Handle* h = state->cache->Lookup(EncodeKey(k));
+    if (h == NULL || DecodeValue(state->cache->Value(h)) != k + 1000) {
+      errors++;
+    }
+    if (h != NULL) {
+      state->cache->Release(h);
+    }
+  }
+  MutexLock ml(&state->mu);
+  state->num_errors += errors;
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+TEST(ClockCacheTest, ClockConcurrentReaders) {
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 1000 + i);
+  }
+  ReaderState state(cache_);
+  state.num_running = 4;
+  for (int i = 0; i < 4; i++) {
+    Env::Default()->StartThread(HotReader, &state);
+  }
+  MutexLock ml(&state.mu);
+  while (state.num_running != 0) {
+    state.cv.Wait();
+  }
+  ASSERT_EQ(0, state.num_errors);
+  ASSERT_EQ(0, deleted_keys_.size());
+}
+
+namespace {
+void NoopDeleter(const Slice& key, void* value) {}
+
+struct ChurnState {
+  explicit ChurnState(Cache* c)
+      : cache(c), cv(&mu), done(false), num_running(0), num_errors(0) {}
+  Cache* const cache;
+  port::Mutex mu;
+  port::CondVar cv;
+  std::atomic<bool> done;
+  int num_running;
+  int num_errors;
+};
+
+void ChurnReader(void* arg) {
+  ChurnState* const state = reinterpret_cast<ChurnState*>(arg);
+  Random rnd(301);
+  int errors = 0;
+  while (!state->done.load()) {
+    const int k = rnd.Uniform(1000);
+    Cache::Handle* h = state->cache->Lookup(EncodeKey(k));
+    if (h != NULL) {
+      if (DecodeValue(state->cache->Value(h)) != k + 1000) {
+        errors++;
+      }
+      state->cache->Release(h);
+    }
+  }
+  MutexLock ml(&state->mu);
+  state->num_errors += errors;
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+// Lookups run concurrently with inserts, erasures, evictions, and table
+// resizes that unlink entries the lookups may be visiting.
+TEST(ClockCacheTest, ClockConcurrentReadersAndWriters) {
+  Cache* const cache = NewClockCache(100, 0);
+  ChurnState state(cache);
+  state.num_running = 4;
+  for (int i = 0; i < 4; i++) {
+    Env::Default()->StartThread(ChurnReader, &state);
+  }
+  for (int round = 0; round < 20; round++) {
+    for (int k = 0; k < 1000; k++) {
+      cache->Release(
+          cache->Insert(EncodeKey(k), EncodeValue(k + 1000), 1, NoopDeleter));
+      if (k % 7 == 0) {
+        cache->Erase(EncodeKey(k / 2));
+      }
+    }
+  }
+  state.done.store(true);
+  MutexLock ml(&state.mu);
+  while (state.num_running != 0) {
+    state.cv.Wait();
+  }
+  ASSERT_EQ(0, state.num_errors);
+  delete cache;
+}
+
+TEST(ClockCacheTest, ClockNewId) {
+  uint64_t a = cache_->NewId();
+  uint64_t b = cache_->NewId();
+  ASSERT_NE(a, b);
+}
+
+namespace {
+struct BenchState {
+  BenchState(Cache* c, int n)
+      : cache(c), n(n), cv(&mu), next_seed(301), num_running(0) {}
+  Cache* const cache;
+  const int n;  // Lookups per thread
+  port::Mutex mu;
+  port::CondVar cv;
+  int next_seed;
+  int num_running;
+};
+
+const int kBenchKeys = 10000;
+
+void BenchReader(void* arg) {
+  BenchState* const state = reinterpret_cast<BenchState*>(arg);
+  state->mu.Lock();
+  Random rnd(state->next_seed++);
+  state->mu.Unlock();
+  std::vector<std::string> keys(kBenchKeys);
+  for (int i = 0; i < kBenchKeys; i++) {
+    keys[i] = EncodeKey(i);
+  }
+  for (int i = 0; i < state->n; i++) {
+    Cache::Handle* h = state->cache->Lookup(keys[rnd.Uniform(kBenchKeys)]);
+    if (h != NULL) {
+      state->cache->Release(h);
+    }
+  }
+  MutexLock ml(&state->mu);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+// Measure the rate of cache hits when "num_threads" threads concurrently
+// look up random keys all of which are in the cache.
+static void BM_Lookups(const char* name, Cache* cache, int num_threads,
+                       int n) {
+  for (int i = 0; i < kBenchKeys; i++) {
+    cache->Release(cache->Insert(EncodeKey(i), EncodeValue(i), 1, NoopDeleter));
+  }
+  BenchState state(cache, n);
+  state.num_running = num_threads;
+  const uint64_t start = CurrentMicros();
+  for (int i = 0; i < num_threads; i++) {
+    Env::Default()->StartThread(BenchReader, &state);
+  }
+  state.mu.Lock();
+  while (state.num_running != 0) {
+    state.cv.Wait();
+  }
+  state.mu.Unlock();
+  const uint64_t micros = CurrentMicros() - start;
+  const double total = static_cast<double>(num_threads) * n;
+  fprintf(stderr, "%-5s %d threads: %12.0f lookups/s\n", name, num_threads,
+          micros != 0 ? total * 1e6 / micros : 0.0);
+  delete cache;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+    const int n = argc > 2 ? atoi(argv[2]) : 2000000;
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+      ::pdlfs::BM_Lookups("lru", ::pdlfs::NewLRUCache(1 << 20), num_threads, n);
+      ::pdlfs::BM_Lookups("clock", ::pdlfs::NewClockCache(1 << 20), num_threads,
+                          n);
+    }
+    return 0;
+  }
+
   return ::pdlfs::test::RunAllTests(&argc, &argv);
 }
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/dirsplit.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/gigaplus.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/internal_types.h"
+#include "pdlfs-common/leveldb/iterator.h"
+#include "pdlfs-common/leveldb/write_batch.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/strutil.h"
+
+#include <assert.h>
+#include <vector>
+
+namespace pdlfs {
+
+DirSplitOptions::DirSplitOptions()
+    : suffix_is_hash(false),
+      env(Env::Default()),
+      max_dump_parallelism(1),
+      table_file_size(0),
+      delete_batch_size(4096),
+      insert_method(kRename),
+      thread_pool(NULL) {}
+
+DirSplit::DirSplit()
+    : child(0), source(NULL), target(NULL), num_moved(0), bytes_moved(0) {}
+
+namespace {
+// Selects the entries of a directory that belong to a given child partition.
+class ChildFilter : public DumpFilter {
+ public:
+  ChildFilter(const Slice& prefix, int child, bool suffix_is_hash)
+      : prefix_(prefix), child_(child), suffix_is_hash_(suffix_is_hash) {}
+
+  virtual bool Select(const Slice& key, const Slice& value) const {
+    if (!key.starts_with(prefix_)) {
+      return false;
+    }
+    Slice suffix = key;
+    suffix.remove_prefix(prefix_.size());
+    if (suffix_is_hash_) {
+      return suffix.size() >= 8 &&
+             DirIndex::ToBeMigrated(child_, suffix.data());
+    } else {
+      char tmp[8];
+      DirIndex::Hash(suffix, tmp);
+      return DirIndex::ToBeMigrated(child_, tmp);
+    }
+  }
+
+ private:
+  Slice prefix_;
+  int child_;
+  bool suffix_is_hash_;
+};
+
+// Remove all files under a split dir along with the dir itself.
+void CleanupSplitDir(Env* env, const std::string& dir) {
+  std::vector<std::string> names;
+  env->GetChildren(dir.c_str(), &names);
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] != "." && names[i] != "..") {
+      env->DeleteFile((dir + "/" + names[i]).c_str());
+    }
+  }
+  env->DeleteDir(dir.c_str());
+}
+}  // namespace
+
+DirSplitter::DirSplitter(const DirSplitOptions& options)
+    : options_(options), next_split_(0) {}
+
+DirSplitter::~DirSplitter() {}
+
+std::string DirSplitter::NewSplitDir() {
+  MutexLock l(&mutex_);
+  return options_.tmp_dir + "/split-" + NumberToString(next_split_++);
+}
+
+Status DirSplitter::Split(DirSplit* split) {
+  split->status = DoSplit(split);
+  return split->status;
+}
+
+Status DirSplitter::DoSplit(DirSplit* split) {
+  split->num_moved = 0;
+  split->bytes_moved = 0;
+  if (split->source == split->target) {
+    return Status::OK();
+  }
+
+  // Entries of the child are confined to [start, limit) in key space. An
+  // empty limit means the range extends to the end of the key space.
+  std::string start = split->prefix;
+  std::string limit;
+  if (options_.suffix_is_hash) {
+    std::string hash_limit;
+    DirIndex::PutHashRange(split->child, &start, &hash_limit);
+    if (!hash_limit.empty()) {
+      limit = split->prefix + hash_limit;
+    }
+  }
+  if (limit.empty()) {
+    PrefixSuccessor(split->prefix, &limit);
+  }
+
+  const ChildFilter filter(split->prefix, split->child,
+                           options_.suffix_is_hash);
+  DB* const source = split->source;
+  const Snapshot* const snapshot = source->GetSnapshot();
+  const std::string dir = NewSplitDir();
+  DumpOptions dump_options;
+  dump_options.snapshot = snapshot;
+  dump_options.table_file_size = options_.table_file_size;
+  dump_options.max_parallelism = options_.max_dump_parallelism;
+  dump_options.thread_pool = options_.thread_pool;
+  // Hash ranges are exact so filtering is only needed when keys are names
+  if (!options_.suffix_is_hash) {
+    dump_options.filter = &filter;
+  }
+  Status s = source->Dump(dump_options, Range(start, limit), dir, NULL, NULL);
+  std::vector<DumpedTable> tables;
+  if (s.ok()) {
+    s = ReadDumpManifest(options_.env, dir, &tables);
+    if (s.IsNotFound()) {  // Nothing to move
+      s = Status::OK();
+      tables.clear();
+    }
+  }
+  if (s.ok() && !tables.empty()) {
+    InsertOptions insert_options(options_.insert_method);
+    insert_options.place_in_deepest_level = true;
+    s = split->target->AddL0Tables(insert_options, dir);
+  }
+
+  // Remove moved entries from the source. The db does not support range
+  // deletions so entries are deleted one by one by walking the moved key
+  // range once more at the snapshot used by the dump.
+  if (s.ok() && !tables.empty()) {
+    ReadOptions read_options;
+    read_options.snapshot = snapshot;
+    read_options.fill_cache = false;
+    read_options.prefix = split->prefix;
+    Iterator* const iter = source->NewIterator(read_options);
+    WriteBatch batch;
+    size_t batch_size = 0;
+    iter->Seek(start);
+    for (; iter->Valid(); iter->Next()) {
+      const Slice key = iter->key();
+      if (!limit.empty() && key.compare(limit) >= 0) {
+        break;
+      }
+      const Slice value = iter->value();
+      if (filter.Select(key, value)) {
+        batch.Delete(key);
+        split->bytes_moved += key.size() + value.size();
+        split->num_moved++;
+        if (++batch_size >= options_.delete_batch_size) {
+          s = source->Write(WriteOptions(), &batch);
+          if (!s.ok()) {
+            break;
+          }
+          batch.Clear();
+          batch_size = 0;
+        }
+      }
+    }
+    if (s.ok()) {
+      s = iter->status();
+    }
+    if (s.ok() && batch_size != 0) {
+      s = source->Write(WriteOptions(), &batch);
+    }
+    delete iter;
+  }
+
+  source->ReleaseSnapshot(snapshot);
+  CleanupSplitDir(options_.env, dir);
+  return s;
+}
+
+struct DirSplitter::Job {
+  Job(DirSplitter* splitter, DirSplit* splits, size_t n)
+      : splitter(splitter),
+        splits(splits),
+        n(n),
+        cv(&mu),
+        next(0),
+        done(0),
+        refs(1) {}
+
+  DirSplitter* const splitter;
+  DirSplit* const splits;
+  const size_t n;
+  port::Mutex mu;
+  port::CondVar cv;
+  size_t next;  // Next split to claim
+  size_t done;  // Number of splits finished
+  int refs;
+};
+
+void DirSplitter::BGWork(void* arg) {
+  Job* const job = reinterpret_cast<Job*>(arg);
+  job->mu.Lock();
+  while (job->next < job->n) {
+    const size_t i = job->next++;
+    job->mu.Unlock();
+    job->splitter->Split(&job->splits[i]);
+    job->mu.Lock();
+    job->done++;
+    job->cv.SignalAll();
+  }
+  const bool last_ref = (--job->refs == 0);
+  job->mu.Unlock();
+  if (last_ref) {
+    delete job;
+  }
+}
+
+Status DirSplitter::SplitAll(DirSplit* splits, size_t n) {
+  Job* const job = new Job(this, splits, n);
+  if (options_.thread_pool != NULL && n > 1) {
+    job->refs += n - 1;
+    for (size_t i = 1; i < n; i++) {
+      options_.thread_pool->Schedule(&DirSplitter::BGWork, job);
+    }
+  }
+
+  // Work on unclaimed splits ourselves
+  job->mu.Lock();
+  while (job->next < n) {
+    const size_t i = job->next++;
+    job->mu.Unlock();
+    Split(&splits[i]);
+    job->mu.Lock();
+    job->done++;
+  }
+  while (job->done < n) {
+    job->cv.Wait();
+  }
+  const bool last_ref = (--job->refs == 0);
+  job->mu.Unlock();
+  if (last_ref) {
+    delete job;
+  }
+
+  Status s;
+  for (size_t i = 0; i < n && s.ok(); i++) {
+    s = splits[i].status;
+  }
+  return s;
+}
+
+}  // namespace pdlfs
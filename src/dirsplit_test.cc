@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/dirsplit.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/fsdbbase.h"
+#include "pdlfs-common/gigaplus.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/iterator.h"
+#include "pdlfs-common/leveldb/write_batch.h"
+#include "pdlfs-common/strutil.h"
+#include "pdlfs-common/testharness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace pdlfs {
+
+class DirSplitTest {
+ public:
+  enum { kNumTargets = 3 };
+
+  DirSplitTest() {
+    pool_ = ThreadPool::NewFixed(2);
+    dbname_ = test::TmpDir() + "/dirsplit_test";
+    DBOptions options;
+    options.create_if_missing = true;
+    options.write_buffer_size = 64 << 10;
+    for (int i = 0; i <= kNumTargets; i++) {
+      const std::string name = DbName(i);
+      DestroyDB(name, DBOptions());
+      ASSERT_OK(DB::Open(options, name, &dbs_[i]));
+    }
+    split_options_.tmp_dir = test::PrepareTmpDir("dirsplit_test_tmp");
+    split_options_.thread_pool = pool_;
+    split_options_.delete_batch_size = 100;
+    split_options_.table_file_size = 16 << 10;
+    prefix_ = Key(7, kDirEntType).prefix().ToString();
+    other_prefix_ = Key(8, kDirEntType).prefix().ToString();
+  }
+
+  ~DirSplitTest() {
+    for (int i = 0; i <= kNumTargets; i++) {
+      delete dbs_[i];
+      DestroyDB(DbName(i), DBOptions());
+    }
+    delete pool_;
+  }
+
+  std::string DbName(int i) const { return dbname_ + NumberToString(i); }
+
+  static std::string Name(int i) {
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), "file%08d", i);
+    return tmp;
+  }
+
+  std::string EntryKey(const std::string& prefix, const std::string& name) {
+    std::string key = prefix;
+    if (split_options_.suffix_is_hash) {
+      DirIndex::PutHash(&key, name);
+    } else {
+      key += name;
+    }
+    return key;
+  }
+
+  // Insert "n" entries into both the split directory and another directory
+  // stored in the source db. The name of each entry is used as its value.
+  void Populate(int n) {
+    WriteBatch batch;
+    for (int i = 0; i < n; i++) {
+      batch.Put(EntryKey(prefix_, Name(i)), Name(i));
+      batch.Put(EntryKey(other_prefix_, Name(i)), Name(i));
+    }
+    ASSERT_OK(dbs_[0]->Write(WriteOptions(), &batch));
+  }
+
+  // Return the names of all entries of a directory stored in a db.
+  std::vector<std::string> List(DB* db, const std::string& prefix) {
+    std::vector<std::string> names;
+    Iterator* iter = db->NewIterator(ReadOptions());
+    for (iter->Seek(prefix); iter->Valid(); iter->Next()) {
+      if (!iter->key().starts_with(prefix)) break;
+      ASSERT_EQ(EntryKey(prefix, iter->value().ToString()),
+                iter->key().ToString());
+      names.push_back(iter->value().ToString());
+    }
+    ASSERT_OK(iter->status());
+    delete iter;
+    return names;
+  }
+
+  static bool InPartition(int index, const std::string& name) {
+    char tmp[8];
+    DirIndex::Hash(name, tmp);
+    return DirIndex::ToBeMigrated(index, tmp);
+  }
+
+  // Split children 1, 2, and 4 out of partition 0 concurrently. Each child
+  // goes to its own target db. Partition 0 keeps the rest of the entries.
+  void CheckConcurrentSplits() {
+    const int n = 3000;
+    Populate(n);
+    dbs_[0]->CompactRange(NULL, NULL);
+    const int children[kNumTargets] = {1, 2, 4};
+    DirSplit splits[kNumTargets];
+    for (int i = 0; i < kNumTargets; i++) {
+      splits[i].prefix = prefix_;
+      splits[i].child = children[i];
+      splits[i].source = dbs_[0];
+      splits[i].target = dbs_[i + 1];
+    }
+    DirSplitter splitter(split_options_);
+    ASSERT_OK(splitter.SplitAll(splits, kNumTargets));
+
+    int total = 0;
+    for (int i = 0; i < kNumTargets; i++) {
+      std::vector<std::string> names = List(dbs_[i + 1], prefix_);
+      ASSERT_EQ(names.size(), splits[i].num_moved);
+      ASSERT_TRUE(splits[i].num_moved > 0);
+      ASSERT_TRUE(splits[i].bytes_moved > 0);
+      for (size_t j = 0; j < names.size(); j++) {
+        ASSERT_TRUE(InPartition(children[i], names[j]));
+      }
+      ASSERT_TRUE(List(dbs_[i + 1], other_prefix_).empty());
+      total += static_cast<int>(names.size());
+    }
+    std::vector<std::string> rest = List(dbs_[0], prefix_);
+    for (size_t j = 0; j < rest.size(); j++) {
+      for (int i = 0; i < kNumTargets; i++) {
+        ASSERT_TRUE(!InPartition(children[i], rest[j]));
+      }
+    }
+    ASSERT_EQ(total + static_cast<int>(rest.size()), n);
+    ASSERT_EQ(List(dbs_[0], other_prefix_).size(), n);
+
+    // Temporary tables are gone
+    std::vector<std::string> files;
+    split_options_.env->GetChildren(split_options_.tmp_dir.c_str(), &files);
+    for (size_t j = 0; j < files.size(); j++) {
+      ASSERT_TRUE(files[j] == "." || files[j] == "..");
+    }
+  }
+
+  std::string dbname_;
+  std::string prefix_;
+  std::string other_prefix_;
+  DirSplitOptions split_options_;
+  ThreadPool* pool_;
+  DB* dbs_[kNumTargets + 1];
+};
+
+TEST(DirSplitTest, SplitNames) {
+  split_options_.suffix_is_hash = false;
+  CheckConcurrentSplits();
+}
+
+TEST(DirSplitTest, SplitHashes) {
+  split_options_.suffix_is_hash = true;
+  CheckConcurrentSplits();
+}
+
+TEST(DirSplitTest, SplitFromMemTable) {
+  split_options_.suffix_is_hash = true;
+  Populate(200);
+  DirSplit split;
+  split.prefix = prefix_;
+  split.child = 1;
+  split.source = dbs_[0];
+  split.target = dbs_[1];
+  DirSplitter splitter(split_options_);
+  ASSERT_OK(splitter.Split(&split));
+  ASSERT_TRUE(split.num_moved > 0 && split.num_moved < 200);
+  ASSERT_EQ(List(dbs_[1], prefix_).size(), split.num_moved);
+  ASSERT_EQ(List(dbs_[0], prefix_).size() + split.num_moved, 200);
+}
+
+TEST(DirSplitTest, NothingToMove) {
+  Populate(100);
+  DirSplit split;
+  split.prefix = Key(9, kDirEntType).prefix().ToString();
+  split.child = 1;
+  split.source = dbs_[0];
+  split.target = dbs_[1];
+  DirSplitter splitter(split_options_);
+  ASSERT_OK(splitter.Split(&split));
+  ASSERT_EQ(split.num_moved, 0);
+  // Partitions sharing a db move no data
+  split.prefix = prefix_;
+  split.target = dbs_[0];
+  ASSERT_OK(splitter.Split(&split));
+  ASSERT_EQ(split.num_moved, 0);
+  ASSERT_EQ(List(dbs_[0], prefix_).size(), 100);
+}
+
+// Migrate the entries of children 1, 2, 4, ... out of partition 0 of a
+// directory with "num" entries, using one target db per child.
+static void BM_Split(int num, bool suffix_is_hash, int num_children) {
+  const std::string dbname = test::TmpDir() + "/dirsplit_test_benchmark";
+  DBOptions options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 32 << 20;
+  std::vector<DB*> dbs(num_children + 1);
+  for (int i = 0; i <= num_children; i++) {
+    const std::string name = dbname + NumberToString(i);
+    DestroyDB(name, DBOptions());
+    ASSERT_OK(DB::Open(options, name, &dbs[i]));
+  }
+  const std::string prefix = Key(7, kDirEntType).prefix().ToString();
+  const std::string value(64, 'x');
+  WriteBatch batch;
+  std::string key;
+  char tmp[30];
+  for (int i = 0; i < num; i++) {
+    snprintf(tmp, sizeof(tmp), "file%010d", i);
+    key = prefix;
+    if (suffix_is_hash) {
+      DirIndex::PutHash(&key, tmp);
+    } else {
+      key += tmp;
+    }
+    batch.Put(key, value);
+    if ((i + 1) % 10000 == 0 || i == num - 1) {
+      ASSERT_OK(dbs[0]->Write(WriteOptions(), &batch));
+      batch.Clear();
+    }
+  }
+  dbs[0]->CompactRange(NULL, NULL);
+
+  ThreadPool* const pool = ThreadPool::NewFixed(num_children);
+  DirSplitOptions split_options;
+  split_options.suffix_is_hash = suffix_is_hash;
+  split_options.tmp_dir = test::PrepareTmpDir("dirsplit_test_benchmark_tmp");
+  split_options.thread_pool = pool;
+  split_options.table_file_size = 8 << 20;
+  std::vector<DirSplit> splits(num_children);
+  for (int i = 0; i < num_children; i++) {
+    splits[i].prefix = prefix;
+    splits[i].child = 1 << i;
+    splits[i].source = dbs[0];
+    splits[i].target = dbs[i + 1];
+  }
+  DirSplitter splitter(split_options);
+  const uint64_t start = CurrentMicros();
+  ASSERT_OK(splitter.SplitAll(&splits[0], num_children));
+  const uint64_t micros = CurrentMicros() - start;
+  uint64_t moved = 0;
+  for (int i = 0; i < num_children; i++) {
+    moved += splits[i].num_moved;
+  }
+  fprintf(stderr,
+          "%-6s %9d entries, %d children: %9llu moved in %9llu us "
+          "(%.0f entries/s)\n",
+          suffix_is_hash ? "hash" : "name", num, num_children,
+          static_cast<unsigned long long>(moved),
+          static_cast<unsigned long long>(micros),
+          micros != 0 ? moved * 1e6 / micros : 0.0);
+
+  for (int i = 0; i <= num_children; i++) {
+    delete dbs[i];
+    DestroyDB(dbname + NumberToString(i), DBOptions());
+  }
+  delete pool;
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const int num = argc > 2 ? atoi(argv[2]) : 1000000;
+    const int children[] = {1, 2, 4};
+    for (size_t i = 0; i < 3; i++) {
+      ::pdlfs::BM_Split(num, true, children[i]);
+      ::pdlfs::BM_Split(num, false, children[i]);
+    }
+    return 0;
+  }
+
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
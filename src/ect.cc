@@ -11,8 +11,10 @@
 #include "ectrie/bit_vector.h"
 #include "ectrie/trie.h"
 
+#include "pdlfs-common/coding.h"
 #include "pdlfs-common/ect.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace pdlfs {
@@ -58,6 +60,10 @@ class ECTIndex : public ECT {
 
   virtual size_t MemUsage() const { return bitvec_.size(); }
 
+  virtual size_t KeyLength() const { return key_len_; }
+
+  virtual size_t NumKeys() const { return n_; }
+
   size_t Locate(const uint8_t* key) const {
     return ECTCoder::Get()->Decode(bitvec_, key, key_len_, n_);
   }
@@ -73,6 +79,34 @@ class ECTIndex : public ECT {
     n_ = n;
   }
 
+  // Bits are stored in 32-bit words so that the encoding does not depend on
+  // the byte order of the machine.
+  virtual void EncodeTo(std::string* dst) const {
+    PutVarint64(dst, key_len_);
+    PutVarint64(dst, n_);
+    const size_t bits = bitvec_.size();
+    PutVarint64(dst, bits);
+    for (size_t i = 0; i < bits; i += 32) {
+      const size_t len = std::min<size_t>(32, bits - i);
+      PutFixed32(dst, bitvec_.get<uint32_t>(i, len));
+    }
+  }
+
+  bool DecodeBits(size_t n, Slice* input) {
+    uint64_t bits;
+    if (!GetVarint64(input, &bits) || (bits + 31) / 32 * 4 != input->size()) {
+      return false;
+    }
+    for (size_t i = 0; i < bits; i += 32) {
+      const size_t len = std::min<size_t>(32, bits - i);
+      bitvec_.append<uint32_t>(DecodeFixed32(input->data()), len);
+      input->remove_prefix(4);
+    }
+    bitvec_.compact();
+    n_ = n;
+    return true;
+  }
+
  private:
   typedef ectrie::bit_vector<> bitvec_t;
   bitvec_t bitvec_;
@@ -97,4 +131,20 @@ ECT* ECT::Default(size_t key_len, size_t n, const Slice* keys) {
   return ect;
 }
 
+ECT* ECT::Decode(const Slice& encoding) {
+  Slice input = encoding;
+  uint64_t key_len;
+  uint64_t n;
+  if (!GetVarint64(&input, &key_len) || !GetVarint64(&input, &n) ||
+      key_len == 0) {
+    return NULL;
+  }
+  ECTIndex* ect = new ECTIndex(key_len);
+  if (!ect->DecodeBits(n, &input)) {
+    delete ect;
+    return NULL;
+  }
+  return ect;
+}
+
 }  // namespace pdlfs
@@ -16,10 +16,9 @@
 #include "pdlfs-common/ect.h"
 #include "pdlfs-common/random.h"
 #include "pdlfs-common/slice.h"
+#include "pdlfs-common/spooky.h"
 #include "pdlfs-common/testharness.h"
 
-#include "spooky_impl.h"
-
 namespace pdlfs {
 
 class ECTTest {};
@@ -41,6 +40,15 @@ class TrieWrapper {
 
   size_t MemUsage() const { return ect_->MemUsage(); }
 
+  // Replace the index with one decoded from its own encoding.
+  void Reload() {
+    std::string encoding;
+    ect_->EncodeTo(&encoding);
+    delete ect_;
+    ect_ = ECT::Decode(encoding);
+    ASSERT_TRUE(ect_ != NULL);
+  }
+
   void Insert(const Slice& key) {
     k_offs_.push_back(k_buffer_.size());
     k_buffer_.append(key.data(), key.size());
@@ -138,17 +146,35 @@ static std::string RandomKey(Random* rnd, int k_len) {
 #else
 static std::string RandomKey(Random* rnd, int k_len) {
   uint32_t seed = rnd->Next();
-  uint64_t h1 = 301;
-  uint64_t h2 = 103;
-  SpookyHash::Hash128(&seed, sizeof(seed), &h1, &h2);
-  std::string result;
-  result.append((char*)&h1, sizeof(h1));
-  result.append((char*)&h2, sizeof(h2));
+  char h[16];
+  Spooky128(&seed, sizeof(seed), 301, 103, h);
+  std::string result(h, sizeof(h));
   result.resize(k_len);
   return result;
 }
 #endif
 
+TEST(ECTTest, EncodeDecode) {
+  Random rnd(301);
+  std::set<std::string> keys;
+  while (keys.size() < 1000) keys.insert(RandomKey(&rnd, 16));
+  TrieWrapper trie(16);
+  std::set<std::string>::const_iterator iter;
+  for (iter = keys.begin(); iter != keys.end(); ++iter) {
+    trie.Insert(*iter);
+  }
+  trie.Flush();
+  const size_t bits = trie.MemUsage();
+  trie.Reload();
+  ASSERT_EQ(trie.MemUsage(), bits);
+  size_t rank = 0;
+  for (iter = keys.begin(); iter != keys.end(); ++iter) {
+    ASSERT_EQ(trie.Locate(*iter), rank);
+    rank++;
+  }
+  ASSERT_TRUE(ECT::Decode(Slice("\x10\x02\x40", 3)) == NULL);
+}
+
 TEST(ECTTest, ECTBench) {
   for (int k_len = 4; k_len <= 16; k_len += 4) {
     for (int num_k = 16; num_k <= 8192; num_k *= 2) {
@@ -42,12 +42,24 @@ SequentialFile::~SequentialFile() {}
 
 RandomAccessFile::~RandomAccessFile() {}
 
+void RandomAccessFile::MultiRead(ReadRequest* reqs, size_t n) const {
+  for (size_t i = 0; i < n; i++) {
+    reqs[i].status =
+        Read(reqs[i].offset, reqs[i].n, &reqs[i].result, reqs[i].scratch);
+  }
+}
+
 WritableFile::~WritableFile() {}
 
 WritableFileWrapper::~WritableFileWrapper() {}
 
 Logger::~Logger() {}
 
+AsyncLoggerOptions::AsyncLoggerOptions()
+    : buffer_size(64 << 10),
+      block_when_full(false),
+      flush_interval_micros(10000) {}
+
 FileLock::~FileLock() {}
 
 ServerUDPSocket::~ServerUDPSocket() {}
@@ -56,6 +68,11 @@ UDPSocket::~UDPSocket() {}
 
 ThreadPool::~ThreadPool() {}
 
+void ThreadPool::ScheduleWithPriority(void (*function)(void*), void* arg,
+                                      Priority pri) {
+  Schedule(function, arg);
+}
+
 EnvWrapper::~EnvWrapper() {}
 
 Env* Env::Open(const char* name, const char* conf, bool* is_system) {
@@ -237,4 +254,21 @@ Logger* Logger::Default() {
 #endif
 }
 
+Status Logger::NewAsync(const AsyncLoggerOptions& options, const char* fname,
+                        Logger** result) {
+#if defined(PDLFS_PLATFORM_POSIX)
+  FILE* const f = fopen(fname, "w");
+  if (f == NULL) {
+    *result = NULL;
+    return PosixError(fname, errno);
+  } else {
+    *result = new PosixAsyncLogger(options, f, port::PthreadId);
+    return Status::OK();
+  }
+#else
+  *result = NULL;
+  return Status::NotSupported(Slice());
+#endif
+}
+
 }  // namespace pdlfs
@@ -15,8 +15,21 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include "posix/posix_batchio.h"
+#include "posix/posix_logger.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
 
 namespace pdlfs {
 
@@ -108,8 +121,352 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+namespace {
+struct PoolState {
+  PoolState() : cv(&mu), num_done(0) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  std::vector<int> order;  // Order in which items have run
+  int num_done;
+};
+
+struct PoolItem {
+  PoolState* state;
+  int id;
+};
+
+void RunPoolItem(void* arg) {
+  PoolItem* const item = reinterpret_cast<PoolItem*>(arg);
+  MutexLock ml(&item->state->mu);
+  item->state->order.push_back(item->id);
+  item->state->num_done++;
+  item->state->cv.SignalAll();
+}
+}  // namespace
+
+TEST(EnvPosixTest, ThreadPoolPriorities) {
+  ThreadPool* pool = ThreadPool::NewFixed(1, true);
+  PoolState state;
+  PoolItem items[6];
+  pool->Pause();
+  // Low priority items are queued first but should run last
+  for (int i = 0; i < 6; i++) {
+    items[i].state = &state;
+    items[i].id = i;
+    pool->ScheduleWithPriority(&RunPoolItem, &items[i],
+                               i < 3 ? ThreadPool::kLow : ThreadPool::kHigh);
+  }
+  SleepForMicroseconds(kDelayMicros);
+  {
+    MutexLock ml(&state.mu);
+    ASSERT_EQ(state.num_done, 0);  // Paused
+  }
+  pool->Resume();
+  MutexLock ml(&state.mu);
+  while (state.num_done != 6) {
+    state.cv.Wait();
+  }
+  const int expected[6] = {3, 4, 5, 0, 1, 2};
+  for (int i = 0; i < 6; i++) {
+    ASSERT_EQ(state.order[i], expected[i]);
+  }
+  delete pool;
+}
+
+namespace {
+struct FanOutState {
+  ThreadPool* pool;
+  PoolState* state;
+  PoolItem* items;
+  int n;
+};
+
+void FanOut(void* arg) {
+  FanOutState* const f = reinterpret_cast<FanOutState*>(arg);
+  // Items scheduled from a pool thread land in that thread's own queue and
+  // must be stolen by the others
+  for (int i = 0; i < f->n; i++) {
+    f->pool->Schedule(&RunPoolItem, &f->items[i]);
+  }
+  // Keep this thread busy so that its queue can only be drained by others
+  MutexLock ml(&f->state->mu);
+  while (f->state->num_done != f->n) {
+    f->state->cv.Wait();
+  }
+}
+}  // namespace
+
+TEST(EnvPosixTest, ThreadPoolWorkStealing) {
+  ThreadPool* pool = ThreadPool::NewFixed(4, true);
+  PoolState state;
+  const int n = 1000;
+  std::vector<PoolItem> items(n);
+  for (int i = 0; i < n; i++) {
+    items[i].state = &state;
+    items[i].id = i;
+  }
+  FanOutState f;
+  f.pool = pool;
+  f.state = &state;
+  f.items = &items[0];
+  f.n = n;
+  pool->Schedule(&FanOut, &f);
+  {
+    MutexLock ml(&state.mu);
+    while (state.num_done != n) {
+      state.cv.Wait();
+    }
+  }
+  // The fan-out thread stays busy until every item is done, so all items
+  // must have been stolen from its queue. Steals are counted as items are
+  // taken, which happens before they run.
+  const std::string info = pool->ToDebugString();
+  const size_t pos = info.find("steals=");
+  ASSERT_TRUE(pos != std::string::npos);
+  const unsigned long long steals = strtoull(info.c_str() + pos + 7, NULL, 10);
+  ASSERT_TRUE(steals >= static_cast<unsigned long long>(n));
+  delete pool;
+}
+
+static void CheckMultiRead(const std::string& data, ReadRequest* reqs,
+                           size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    ASSERT_OK(reqs[i].status);
+    const size_t off = static_cast<size_t>(reqs[i].offset);
+    const std::string expected =
+        off < data.size() ? data.substr(off, reqs[i].n) : std::string();
+    ASSERT_EQ(reqs[i].result.ToString(), expected);
+  }
+}
+
+TEST(EnvPosixTest, MultiRead) {
+  const std::string fname = test::TmpDir() + "/env_multiread";
+  Random rnd(301);
+  std::string data;
+  test::RandomString(&rnd, 1 << 20, &data);
+  ASSERT_OK(WriteStringToFile(env_, data, fname.c_str()));
+  const size_t n = 200;  // More reads than can be in flight at once
+  std::vector<ReadRequest> reqs(n);
+  std::string scratch(n * 4096, 0);
+  for (size_t i = 0; i < n; i++) {
+    reqs[i].n = 1 + rnd.Uniform(4096);
+    reqs[i].offset = rnd.Uniform(data.size() - reqs[i].n);
+    reqs[i].scratch = &scratch[i * 4096];
+  }
+  RandomAccessFile* file;
+  ASSERT_OK(env_->NewRandomAccessFile(fname.c_str(), &file));
+  file->MultiRead(&reqs[0], n);
+  CheckMultiRead(data, &reqs[0], n);
+  delete file;
+
+  // Go through the batch io path directly with some reads crossing or
+  // starting at the end of the file
+  for (size_t i = 0; i < n; i += 10) {
+    reqs[i].offset = data.size() - rnd.Uniform(2 * reqs[i].n);
+  }
+  int fd = open(fname.c_str(), O_RDONLY);
+  ASSERT_TRUE(fd != -1);
+  PosixMultiRead(fname, fd, &reqs[0], n);
+  CheckMultiRead(data, &reqs[0], n);
+  close(fd);
+  env_->DeleteFile(fname.c_str());
+}
+
+namespace {
+struct LogThreadState {
+  LogThreadState(Logger* logger, int num_threads, int n)
+      : logger(logger), n(n), cv(&mu), next_id(0), num_running(num_threads) {}
+  Logger* const logger;
+  const int n;  // Messages per thread
+  port::Mutex mu;
+  port::CondVar cv;
+  int next_id;
+  int num_running;
+};
+
+void LogThreadBody(void* arg) {
+  LogThreadState* const state = reinterpret_cast<LogThreadState*>(arg);
+  state->mu.Lock();
+  const int id = state->next_id++;
+  state->mu.Unlock();
+  for (int i = 0; i < state->n; i++) {
+    Log(state->logger, 0, "thread %d message %d", id, i);
+  }
+  MutexLock l(&state->mu);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+// Log "n" messages from each of "num_threads" threads and wait for them to
+// finish. Return the time taken in microseconds.
+uint64_t RunLogThreads(Logger* logger, int num_threads, int n) {
+  LogThreadState state(logger, num_threads, n);
+  const uint64_t start = CurrentMicros();
+  for (int i = 0; i < num_threads; i++) {
+    Env::Default()->StartThread(&LogThreadBody, &state);
+  }
+  MutexLock l(&state.mu);
+  while (state.num_running != 0) {
+    state.cv.Wait();
+  }
+  return CurrentMicros() - start;
+}
+
+PosixAsyncLogger* OpenAsyncLogger(const AsyncLoggerOptions& options,
+                                  const std::string& fname) {
+  FILE* const f = fopen(fname.c_str(), "w");
+  ASSERT_TRUE(f != NULL);
+  return new PosixAsyncLogger(options, f, port::PthreadId);
+}
+
+// Return the lines of a log file after checking that messages from each
+// thread appear in order. Lines reporting dropped messages are skipped and
+// the total they report is stored in *dropped if it is not NULL.
+std::vector<std::string> ReadLogLines(const std::string& fname,
+                                      uint64_t* dropped = NULL) {
+  std::string data;
+  ASSERT_OK(ReadFileToString(Env::Default(), fname.c_str(), &data));
+  std::vector<std::string> lines;
+  std::vector<int> last;
+  if (dropped != NULL) {
+    *dropped = 0;
+  }
+  size_t start = 0;
+  while (start < data.size()) {
+    const size_t end = data.find('\n', start);
+    ASSERT_TRUE(end != std::string::npos);
+    const std::string line = data.substr(start, end - start);
+    start = end + 1;
+    // Skip the time and thread id prefixing each line
+    unsigned long long n;
+    if (sscanf(line.c_str(), "%*s %*s %llu messages dropped", &n) == 1) {
+      ASSERT_TRUE(dropped != NULL);
+      *dropped += n;
+      continue;
+    }
+    lines.push_back(line);
+    int id, i;
+    const char* const msg = strstr(lines.back().c_str(), "thread ");
+    ASSERT_TRUE(msg != NULL);
+    ASSERT_EQ(sscanf(msg, "thread %d message %d", &id, &i), 2);
+    ASSERT_TRUE(strstr(msg, "env_test.cc:") != NULL);
+    if (id >= static_cast<int>(last.size())) {
+      last.resize(id + 1, -1);
+    }
+    ASSERT_TRUE(i > last[id]);
+    last[id] = i;
+  }
+  return lines;
+}
+}  // namespace
+
+TEST(EnvPosixTest, AsyncLogger) {
+  const std::string fname = test::TmpDir() + "/env_async_log";
+  AsyncLoggerOptions options;
+  options.block_when_full = true;
+  PosixAsyncLogger* logger = OpenAsyncLogger(options, fname);
+  RunLogThreads(logger, 4, 1000);
+  logger->Flush();
+  ASSERT_EQ(ReadLogLines(fname).size(), 4000);
+  ASSERT_EQ(logger->NumDropped(), 0);
+  Log(logger, 0, "thread 4 message 0");
+  delete logger;  // Writes out the last message
+  ASSERT_EQ(ReadLogLines(fname).size(), 4001);
+  env_->DeleteFile(fname.c_str());
+}
+
+// Thread-specific keys of deleted loggers are reused by later loggers. Rings
+// left behind by earlier loggers must not be written to.
+TEST(EnvPosixTest, AsyncLoggerReusesKeys) {
+  const std::string fname = test::TmpDir() + "/env_async_log";
+  AsyncLoggerOptions options;
+  options.block_when_full = true;
+  for (int r = 0; r < 3; r++) {
+    PosixAsyncLogger* logger = OpenAsyncLogger(options, fname);
+    Log(logger, 0, "thread 4 message 0");
+    RunLogThreads(logger, 4, 100);
+    delete logger;
+    ASSERT_EQ(ReadLogLines(fname).size(), 401);
+  }
+  env_->DeleteFile(fname.c_str());
+}
+
+TEST(EnvPosixTest, AsyncLoggerDropsWhenFull) {
+  const std::string fname = test::TmpDir() + "/env_async_log";
+  AsyncLoggerOptions options;
+  options.buffer_size = 1024;
+  options.flush_interval_micros = 1000000;
+  PosixAsyncLogger* logger = OpenAsyncLogger(options, fname);
+  RunLogThreads(logger, 4, 5000);
+  logger->Flush();
+  const uint64_t dropped = logger->NumDropped();
+  uint64_t reported;
+  ASSERT_EQ(ReadLogLines(fname, &reported).size() + dropped, 20000);
+  ASSERT_EQ(reported, dropped);
+  delete logger;
+  env_->DeleteFile(fname.c_str());
+}
+
+TEST(EnvPosixTest, AsyncLoggerBlocksWhenFull) {
+  const std::string fname = test::TmpDir() + "/env_async_log";
+  AsyncLoggerOptions options;
+  options.buffer_size = 1024;
+  options.block_when_full = true;
+  options.flush_interval_micros = 1000000;
+  PosixAsyncLogger* logger = OpenAsyncLogger(options, fname);
+  RunLogThreads(logger, 4, 5000);
+  logger->Flush();
+  ASSERT_EQ(logger->NumDropped(), 0);
+  ASSERT_EQ(ReadLogLines(fname).size(), 20000);
+  delete logger;
+  env_->DeleteFile(fname.c_str());
+}
+
+// Measure the rate at which "num_threads" threads can log messages through
+// the synchronous logger and the asynchronous logger under both overflow
+// policies.
+static void BM_Log(int num_threads, int n) {
+  const std::string fname = test::TmpDir() + "/env_log_benchmark";
+  for (int i = 0; i < 3; i++) {
+    Logger* logger;
+    const char* name;
+    PosixAsyncLogger* async_logger = NULL;
+    if (i == 0) {
+      FILE* const f = fopen(fname.c_str(), "w");
+      ASSERT_TRUE(f != NULL);
+      logger = new PosixLogger(f, port::PthreadId);
+      name = "sync";
+    } else {
+      AsyncLoggerOptions options;
+      options.block_when_full = (i == 2);
+      async_logger = OpenAsyncLogger(options, fname);
+      logger = async_logger;
+      name = options.block_when_full ? "async-block" : "async-drop";
+    }
+    const uint64_t micros = RunLogThreads(logger, num_threads, n);
+    const uint64_t dropped = async_logger ? async_logger->NumDropped() : 0;
+    delete logger;
+    const double total = static_cast<double>(num_threads) * n;
+    fprintf(stderr,
+            "%-11s %d threads: %9.0f msgs/s (%.3f us/msg/thread), "
+            "%llu dropped\n",
+            name, num_threads, micros != 0 ? total * 1e6 / micros : 0.0,
+            total != 0 ? micros * num_threads / total : 0.0,
+            static_cast<unsigned long long>(dropped));
+  }
+  Env::Default()->DeleteFile(fname.c_str());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const int n = argc > 2 ? atoi(argv[2]) : 200000;
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+      ::pdlfs::BM_Log(num_threads, n);
+    }
+    return 0;
+  }
+
   return ::pdlfs::test::RunAllTests(&argc, &argv);
 }
@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/fsdb0.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/options.h"
+#include "pdlfs-common/leveldb/snapshot.h"
+#include "pdlfs-common/leveldb/write_batch.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/testharness.h"
+
+#include <set>
+
+namespace pdlfs {
+
+struct MXDBTx {
+  const Snapshot* snap;
+  WriteBatch bat;
+};
+
+struct MXDBPerf {
+  MXDBPerf()
+      : putkeybytes(0), putbytes(0), puts(0), getkeybytes(0), getbytes(0),
+        gets(0) {}
+  uint64_t putkeybytes;
+  uint64_t putbytes;
+  uint64_t puts;
+  uint64_t getkeybytes;
+  uint64_t getbytes;
+  uint64_t gets;
+};
+
+template <MXDBFormat fmt>
+class MXDBTest {
+ public:
+  typedef MXDB<DB, Slice, Status, fmt> MDB;
+
+  MXDBTest() : dir_(1) {
+    dbname_ = test::TmpDir() + "/fsdb0_test";
+    DestroyDB(dbname_, DBOptions());
+    DBOptions options;
+    options.create_if_missing = true;
+    ASSERT_OK(DB::Open(options, dbname_, &db_));
+    mdb_ = new MDB(db_);
+  }
+
+  ~MXDBTest() {
+    delete mdb_;
+    delete db_;
+    DestroyDB(dbname_, DBOptions());
+  }
+
+  static Stat MakeStat(uint64_t ino) {
+    Stat stat;
+#if defined(DELTAFS_PROTO)
+    stat.SetDnodeNo(0);
+#endif
+#if defined(DELTAFS)
+    stat.SetRegId(0);
+    stat.SetSnapId(0);
+#endif
+    stat.SetInodeNo(ino);
+    stat.SetFileSize(ino * 100);
+    stat.SetFileMode(0644);
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+    stat.SetZerothServer(0);
+#endif
+    stat.SetUserId(1);
+    stat.SetGroupId(2);
+    stat.SetModifyTime(ino);
+    stat.SetChangeTime(ino);
+    stat.AssertAllSet();
+    return stat;
+  }
+
+  Status Put(const std::string& name, uint64_t ino, MXDBTx* tx = NULL) {
+    WriteOptions options;
+    return mdb_->template PUT<Key>(dir_, name, MakeStat(ino), name, &options,
+                                   tx, &perf_);
+  }
+
+  // Return "name:ino", or "NOT_FOUND", or the error status of the GET
+  std::string Get(const std::string& name, MXDBTx* tx = NULL) {
+    ReadOptions options;
+    Stat stat;
+    std::string result;
+    Status s = mdb_->template GET<Key>(dir_, name, &stat, &result, &options,
+                                       tx, &perf_);
+    if (s.IsNotFound()) {
+      return "NOT_FOUND";
+    } else if (!s.ok()) {
+      return s.ToString();
+    }
+    ASSERT_EQ(stat.FileSize(), stat.InodeNo() * 100);
+    return result + ":" + NumberToString(stat.InodeNo());
+  }
+
+  bool Exists(const std::string& name) {
+    ReadOptions options;
+    Status s =
+        mdb_->template EXISTS<Key>(dir_, name, &options, (MXDBTx*)NULL);
+    ASSERT_TRUE(s.ok() || s.IsNotFound());
+    return s.ok();
+  }
+
+  void Flush() { db_->CompactRange(NULL, NULL); }
+
+  void RunGetTest() {
+    ASSERT_OK(Put("a", 1));
+    ASSERT_OK(Put("b", 2));
+    ASSERT_EQ("a:1", Get("a"));
+    ASSERT_EQ("b:2", Get("b"));
+    ASSERT_TRUE(Exists("a"));
+    ASSERT_TRUE(!Exists("c"));
+    Flush();
+    ASSERT_EQ("a:1", Get("a"));
+    ASSERT_TRUE(Exists("b"));
+    MXDBTx* tx = mdb_->template STARTTX<MXDBTx>(true);
+    ASSERT_OK(Put("a", 3));
+    ASSERT_EQ("a:3", Get("a"));
+    ASSERT_EQ("a:1", Get("a", tx));
+    mdb_->RELEASE(tx);
+    WriteOptions options;
+    ASSERT_OK(
+        mdb_->template DELETE<Key>(dir_, "a", &options, (MXDBTx*)NULL));
+    ASSERT_TRUE(!Exists("a"));
+    ASSERT_EQ("NOT_FOUND", Get("a"));
+    ASSERT_EQ(6, perf_.gets);
+    ASSERT_TRUE(perf_.getbytes > 0);
+  }
+
+  void RunBatchTest() {
+    typename MDB::EntryKeyList keys;
+    typename MDB::StatList stats;
+    typename MDB::NameList names;
+    // Names are deliberately out of key order
+    const char* const input[] = {"x", "c", "m", "a", "q"};
+    for (size_t i = 0; i < 5; i++) {
+      keys.push_back(std::make_pair(dir_, Slice(input[i])));
+      stats.push_back(MakeStat(i + 1));
+      names.push_back(input[i]);
+    }
+    WriteOptions wopts;
+    ASSERT_OK(mdb_->template BATCHPUT<Key>(keys, stats, names, &wopts,
+                                           (MXDBTx*)NULL, &perf_));
+    ASSERT_EQ(5, perf_.puts);
+    ASSERT_EQ("m:3", Get("m"));
+    Flush();
+    ASSERT_OK(Put("b", 6));  // Keep one entry in the memtable
+
+    typename MDB::EntryKeyList lookups;
+    const char* const query[] = {"q", "b", "missing", "x", "a", "q", "zz"};
+    for (size_t i = 0; i < 7; i++) {
+      lookups.push_back(std::make_pair(dir_, Slice(query[i])));
+    }
+    typename MDB::StatList results;
+    typename MDB::NameList result_names;
+    typename MDB::StatusList statuses;
+    ReadOptions ropts;
+    ASSERT_EQ(5, (mdb_->template BATCHGET<Iterator, Key>(
+                     lookups, &results, &result_names, &statuses, &ropts,
+                     (MXDBTx*)NULL, &perf_)));
+    ASSERT_EQ(7, statuses.size());
+    const uint64_t inos[] = {5, 6, 0, 1, 4, 5, 0};
+    for (size_t i = 0; i < 7; i++) {
+      if (inos[i] == 0) {
+        ASSERT_TRUE(statuses[i].IsNotFound());
+      } else {
+        ASSERT_OK(statuses[i]);
+        ASSERT_EQ(results[i].InodeNo(), inos[i]);
+        ASSERT_EQ(result_names[i], query[i]);
+      }
+    }
+    ASSERT_EQ(8, perf_.gets);  // Including the GET of "m"
+
+    // Deletes and puts in a TX are only applied on commit
+    MXDBTx* tx = mdb_->template STARTTX<MXDBTx>(false);
+    keys.resize(2);  // "x" and "c"
+    ASSERT_OK(mdb_->template BATCHDELETE<Key>(keys, &wopts, tx));
+    ASSERT_EQ("c:2", Get("c"));
+    ASSERT_OK(mdb_->COMMIT(&wopts, tx));
+    mdb_->RELEASE(tx);
+    ASSERT_EQ("NOT_FOUND", Get("x"));
+    ASSERT_EQ("NOT_FOUND", Get("c"));
+    ASSERT_EQ("a:4", Get("a"));
+  }
+
+  void RunReaddirPlusTest() {
+    std::set<std::string> expected;
+    char tmp[20];
+    for (int i = 0; i < 10; i++) {
+      snprintf(tmp, sizeof(tmp), "f%d", i);
+      ASSERT_OK(Put(tmp, i + 1));
+      expected.insert(tmp);
+    }
+    Flush();
+    // Entries of neighboring directories
+    WriteOptions wopts;
+    ASSERT_OK(mdb_->template PUT<Key>(DirId(0), "x", MakeStat(100), "x",
+                                      &wopts, (MXDBTx*)NULL, &perf_));
+    ASSERT_OK(mdb_->template PUT<Key>(DirId(2), "y", MakeStat(200), "y",
+                                      &wopts, (MXDBTx*)NULL, &perf_));
+    ReadOptions ropts;
+    ropts.readahead = 4096;
+    typename MDB::template Dir<Iterator>* dir =
+        mdb_->template OPENDIR<Iterator, Key>(dir_, &ropts, (MXDBTx*)NULL);
+    ASSERT_TRUE(dir != NULL);
+    Stat stats[4];
+    Slice names[4];
+    std::set<std::string> results;
+    size_t batches[] = {4, 4, 2};
+    for (int b = 0; b < 3; b++) {
+      size_t n;
+      ASSERT_OK(mdb_->READDIRPLUS(dir, stats, names, 4, &n));
+      ASSERT_EQ(n, batches[b]);
+      for (size_t i = 0; i < n; i++) {
+        ASSERT_EQ(names[i].ToString(),
+                  "f" + NumberToString(stats[i].InodeNo() - 1));
+        results.insert(names[i].ToString());
+      }
+    }
+    size_t n;
+    ASSERT_TRUE(mdb_->READDIRPLUS(dir, stats, names, 4, &n).IsNotFound());
+    ASSERT_EQ(0, n);
+    ASSERT_EQ(10, dir->n);
+    mdb_->CLOSEDIR(dir);
+    ASSERT_TRUE(results == expected);
+    ASSERT_EQ(10, (mdb_->template LIST<Iterator, Key>(
+                      dir_, NULL, NULL, &ropts, (MXDBTx*)NULL, 100)));
+  }
+
+  std::string dbname_;
+  DirId dir_;
+  MXDBPerf perf_;
+  DB* db_;
+  MDB* mdb_;
+};
+
+typedef MXDBTest<kNameInValue> MXDBNameInValueTest;
+typedef MXDBTest<kNameInKey> MXDBNameInKeyTest;
+
+TEST(MXDBNameInValueTest, GetNameInValue) { RunGetTest(); }
+
+TEST(MXDBNameInKeyTest, GetNameInKey) { RunGetTest(); }
+
+TEST(MXDBNameInValueTest, BatchNameInValue) { RunBatchTest(); }
+
+TEST(MXDBNameInKeyTest, BatchNameInKey) { RunBatchTest(); }
+
+TEST(MXDBNameInValueTest, ReaddirPlusNameInValue) { RunReaddirPlusTest(); }
+
+TEST(MXDBNameInKeyTest, ReaddirPlusNameInKey) { RunReaddirPlusTest(); }
+
+// A DB offering no MultiGet(), for which batched lookups go through a shared
+// iterator.
+class IterOnlyDB {
+ public:
+  explicit IterOnlyDB(DB* db) : db_(db) {}
+  Iterator* NewIterator(const ReadOptions& options) {
+    return db_->NewIterator(options);
+  }
+  Status Write(const WriteOptions& options, WriteBatch* updates) {
+    return db_->Write(options, updates);
+  }
+
+ private:
+  DB* db_;
+};
+
+class MXDBIterTest : public MXDBTest<kNameInValue> {};
+
+TEST(MXDBIterTest, BatchGetWithIterator) {
+  typedef MXDB<IterOnlyDB, Slice, Status, kNameInValue> IterMDB;
+  IterOnlyDB idb(db_);
+  IterMDB imdb(&idb);
+  IterMDB::EntryKeyList keys;
+  IterMDB::StatList stats;
+  IterMDB::NameList names;
+  char tmp[20];
+  for (int i = 0; i < 100; i += 2) {  // Even numbers only
+    snprintf(tmp, sizeof(tmp), "f%03d", i);
+    names.push_back(tmp);
+    stats.push_back(MakeStat(i + 1));
+  }
+  for (size_t i = 0; i < names.size(); i++) {
+    keys.push_back(std::make_pair(dir_, Slice(names[i])));
+  }
+  WriteOptions wopts;
+  ASSERT_OK(imdb.BATCHPUT<Key>(keys, stats, names, &wopts, (MXDBTx*)NULL,
+                               &perf_));
+  Flush();
+  IterMDB::NameList query;
+  for (int i = 99; i >= 0; i--) {  // All numbers, in reverse
+    snprintf(tmp, sizeof(tmp), "f%03d", i);
+    query.push_back(tmp);
+  }
+  query.push_back("f999");
+  query.push_back("f000");
+  IterMDB::EntryKeyList lookups;
+  for (size_t i = 0; i < query.size(); i++) {
+    lookups.push_back(std::make_pair(dir_, Slice(query[i])));
+  }
+  IterMDB::StatList results;
+  IterMDB::StatusList statuses;
+  ReadOptions ropts;
+  ASSERT_EQ(51, (imdb.BATCHGET<Iterator, Key>(lookups, &results, NULL,
+                                              &statuses, &ropts,
+                                              (MXDBTx*)NULL, &perf_)));
+  for (int i = 0; i < 100; i++) {
+    const int num = 99 - i;
+    if (num % 2 == 0) {
+      ASSERT_OK(statuses[i]);
+      ASSERT_EQ(results[i].InodeNo(), num + 1);
+    } else {
+      ASSERT_TRUE(statuses[i].IsNotFound());
+    }
+  }
+  ASSERT_TRUE(statuses[100].IsNotFound());
+  ASSERT_OK(statuses[101]);
+}
+
+// A DB type whose point lookups can only copy values out.
+class StringGetDB {
+ public:
+  explicit StringGetDB(DB* db) : db_(db) {}
+  Status Get(const ReadOptions& options, const Slice& key,
+             std::string* value) {
+    return db_->Get(options, key, value);
+  }
+  Status Write(const WriteOptions& options, WriteBatch* updates) {
+    return db_->Write(options, updates);
+  }
+
+ private:
+  DB* db_;
+};
+
+class MXDBStringGetTest : public MXDBTest<kNameInValue> {};
+
+TEST(MXDBStringGetTest, GetIntoString) {
+  typedef MXDB<StringGetDB, Slice, Status, kNameInValue> StringMDB;
+  StringGetDB sdb(db_);
+  StringMDB smdb(&sdb);
+  ASSERT_OK(Put("a", 1));
+  ReadOptions ropts;
+  Stat stat;
+  std::string name;
+  ASSERT_OK(smdb.GET<Key>(dir_, "a", &stat, &name, &ropts, (MXDBTx*)NULL,
+                          &perf_));
+  ASSERT_EQ(name, "a");
+  ASSERT_EQ(stat.InodeNo(), 1);
+  ASSERT_OK(smdb.EXISTS<Key>(dir_, "a", &ropts, (MXDBTx*)NULL));
+  ASSERT_TRUE(
+      smdb.EXISTS<Key>(dir_, "b", &ropts, (MXDBTx*)NULL).IsNotFound());
+}
+
+static void BM_Report(const char* name, int num, uint64_t micros) {
+  fprintf(stderr, "%-24s %8d ops : %9llu us (%7.3f us / op)\n", name, num,
+          static_cast<unsigned long long>(micros),
+          static_cast<double>(micros) / num);
+}
+
+// Insert, stat, and remove num entries of a single directory, either one
+// entry at a time or in batches of batch_size entries.
+template <MXDBFormat fmt>
+static void BM_Batch(int num, int batch_size) {
+  typedef MXDB<DB, Slice, Status, fmt> MDB;
+  const std::string dbname = test::TmpDir() + "/fsdb0_test_benchmark";
+  DestroyDB(dbname, DBOptions());
+  DBOptions options;
+  options.create_if_missing = true;
+  DB* db;
+  ASSERT_OK(DB::Open(options, dbname, &db));
+  MDB mdb(db);
+  MXDBPerf perf;
+  const DirId dir(1);
+  typename MDB::NameList names;
+  char tmp[30];
+  Random rnd(301);
+  for (int i = 0; i < num; i++) {
+    snprintf(tmp, sizeof(tmp), "file%010u", rnd.Next());
+    names.push_back(tmp);
+  }
+  Stat stat = MXDBTest<fmt>::MakeStat(1);
+  WriteOptions wopts;
+  ReadOptions ropts;
+  char label[50];
+  uint64_t start;
+  if (batch_size <= 1) {
+    start = CurrentMicros();
+    for (int i = 0; i < num; i++) {
+      ASSERT_OK(mdb.template PUT<Key>(dir, names[i], stat, names[i], &wopts,
+                                      (MXDBTx*)NULL, &perf));
+    }
+    BM_Report("PUT", num, CurrentMicros() - start);
+    db->CompactRange(NULL, NULL);
+    std::string name;
+    start = CurrentMicros();
+    for (int i = 0; i < num; i++) {
+      ASSERT_OK(mdb.template GET<Key>(dir, names[i], &stat, &name, &ropts,
+                                      (MXDBTx*)NULL, &perf));
+    }
+    BM_Report("GET", num, CurrentMicros() - start);
+    start = CurrentMicros();
+    for (int i = 0; i < num; i++) {
+      ASSERT_OK(mdb.template DELETE<Key>(dir, names[i], &wopts,
+                                         (MXDBTx*)NULL));
+    }
+    BM_Report("DELETE", num, CurrentMicros() - start);
+  } else {
+    std::vector<typename MDB::EntryKeyList> batches;
+    std::vector<typename MDB::NameList> batch_names;
+    for (int i = 0; i < num; i += batch_size) {
+      batches.resize(batches.size() + 1);
+      batch_names.resize(batch_names.size() + 1);
+      for (int j = i; j < num && j < i + batch_size; j++) {
+        batches.back().push_back(std::make_pair(dir, Slice(names[j])));
+        batch_names.back().push_back(names[j]);
+      }
+    }
+    typename MDB::StatList stats(batch_size, stat);
+    start = CurrentMicros();
+    for (size_t b = 0; b < batches.size(); b++) {
+      stats.resize(batches[b].size(), stat);
+      ASSERT_OK(mdb.template BATCHPUT<Key>(batches[b], stats, batch_names[b],
+                                           &wopts, (MXDBTx*)NULL, &perf));
+    }
+    snprintf(label, sizeof(label), "BATCHPUT/%d", batch_size);
+    BM_Report(label, num, CurrentMicros() - start);
+    db->CompactRange(NULL, NULL);
+    typename MDB::NameList result_names;
+    typename MDB::StatusList statuses;
+    start = CurrentMicros();
+    for (size_t b = 0; b < batches.size(); b++) {
+      size_t n = mdb.template BATCHGET<Iterator, Key>(
+          batches[b], &stats, &result_names, &statuses, &ropts,
+          (MXDBTx*)NULL, &perf);
+      ASSERT_EQ(n, batches[b].size());
+    }
+    snprintf(label, sizeof(label), "BATCHGET/%d", batch_size);
+    BM_Report(label, num, CurrentMicros() - start);
+    start = CurrentMicros();
+    for (size_t b = 0; b < batches.size(); b++) {
+      ASSERT_OK(mdb.template BATCHDELETE<Key>(batches[b], &wopts,
+                                              (MXDBTx*)NULL));
+    }
+    snprintf(label, sizeof(label), "BATCHDELETE/%d", batch_size);
+    BM_Report(label, num, CurrentMicros() - start);
+  }
+
+  delete db;
+  DestroyDB(dbname, DBOptions());
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const int batch_sizes[] = {1, 16, 128, 1024};
+    for (size_t i = 0; i < 4; i++) {
+      fprintf(stderr, "== kNameInValue\n");
+      ::pdlfs::BM_Batch< ::pdlfs::kNameInValue>(100000, batch_sizes[i]);
+      fprintf(stderr, "== kNameInKey\n");
+      ::pdlfs::BM_Batch< ::pdlfs::kNameInKey>(100000, batch_sizes[i]);
+    }
+    return 0;
+  }
+
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -17,6 +17,7 @@
 #include <math.h>
 #include <string.h>
 #include <algorithm>
+#include <vector>
 
 namespace pdlfs {
 
@@ -48,6 +49,19 @@ static inline unsigned char Reverse(unsigned char byte) {
 
 /* clang-format on */
 
+// Reverse() of every byte value, used by the batch index calculation.
+struct ReverseTable {
+  ReverseTable() {
+    for (int i = 0; i < 256; i++) {
+      bytes[i] = Reverse(static_cast<unsigned char>(i));
+    }
+  }
+
+  uint16_t bytes[256];
+};
+
+static const ReverseTable kReverseTable;
+
 // The number of bits necessary to hold the given index.
 //
 // ------------------------
@@ -265,24 +279,32 @@ struct DirIndex::Rep {
     return off + (i * 8);
   }
 
-  void TurnOffBit(size_t index) {
+  // Return true iff the bit was previously on.
+  bool TurnOffBit(size_t index) {
     assert(index != 0 && index < kMaxPartitions);
     if (index < bitmap_size() * 8) {
       size_t i = index / 8;
       size_t off = index % 8;
       assert(i < bitmap_capacity_);
       // Won't try to shrink memory when bits are turned off.
+      const bool was_on = (bitmap_[i] & kBits[off]) != 0;
+      if (was_on) {
+        log_.erase(std::find(log_.begin(), log_.end(), index));
+        epoch_++;  // Versions handed out so far no longer match the log
+      }
       bitmap_[i] &= (~kBits[off]);
       // Update radix if necessary
       if (radix() == ToRadix(index)) {
         SetRadix(ToRadix(HighestBit()));
       }
+      return was_on;
     } else {
-      // Do nothing
+      return false;
     }
   }
 
-  void TurnOnBit(size_t index) {
+  // Return true iff the bit was previously off.
+  bool TurnOnBit(size_t index) {
     assert(index < kMaxPartitions);
     if (index >= bitmap_capacity_ * 8) {
       assert(index < 2 * bitmap_capacity_ * 8);
@@ -297,38 +319,115 @@ struct DirIndex::Rep {
     size_t i = index / 8;
     size_t off = index % 8;
     assert(i < bitmap_capacity_);
+    const bool was_off = (bitmap_[i] & kBits[off]) == 0;
+    if (was_off) {
+      log_.push_back(static_cast<uint16_t>(index));
+    }
     bitmap_[i] |= kBits[off];
     assert(radix() == ToRadix(HighestBit()));
+    return was_off;
+  }
+
+  // Turn on the bits of a set of partitions that may skip radices. Used to
+  // merge deltas, which only list bits that are newly set. Return true iff
+  // any bit was previously off.
+  bool TurnOnBits(const std::vector<uint16_t>& indices) {
+    bool changed = false;
+    int r = radix();
+    for (size_t j = 0; j < indices.size(); j++) {
+      r = std::max(r, ToRadix(indices[j]));
+    }
+    ScaleToSize(((1 << r) + 7) / 8);
+    SetRadix(r);
+    for (size_t j = 0; j < indices.size(); j++) {
+      const size_t i = indices[j] / 8;
+      const size_t off = indices[j] % 8;
+      if ((bitmap_[i] & kBits[off]) == 0) {
+        log_.push_back(indices[j]);
+        bitmap_[i] |= kBits[off];
+        changed = true;
+      }
+    }
+    return changed;
   }
 
+  // Return true iff "other" has bits that were not set here.
   template <class T>
-  void DoMerge(const T& other) {
+  bool DoMerge(const T& other) {
     assert(zeroth_server() == other.zeroth_server());
     size_t new_capacity = std::max(bitmap_size(), other.bitmap_size());
     ScaleToSize(new_capacity);
     SetRadix(std::max(radix(), other.radix()));
     assert(new_capacity >= bitmap_size());
+    bool changed = false;
     for (size_t i = 0; i < new_capacity; i++) {
+      const unsigned char added = other.byte(i) & ~bitmap_[i];
+      for (size_t off = 0; added != 0 && off < 8; off++) {
+        if ((added & kBits[off]) != 0) {
+          log_.push_back(static_cast<uint16_t>(i * 8 + off));
+        }
+      }
+      changed |= (added != 0);
       bitmap_[i] |= other.byte(i);
     }
+    return changed;
   }
 
-  void Merge(const DirIndex::View& other) {
-    DoMerge(other);
+  bool Merge(const DirIndex::View& other) {
+    const bool changed = DoMerge(other);
     assert(radix() == ToRadix(HighestBit()));
+    return changed;
   }
 
-  void Merge(const Rep& other) {
-    DoMerge(other);
+  bool Merge(const Rep& other) {
+    const bool changed = DoMerge(other);
     assert(radix() == ToRadix(HighestBit()));
+    return changed;
   }
 
   uint16_t zeroth_server() const { return DecodeFixed16(rep_); }
   uint16_t radix() const { return DecodeFixed16(rep_ + 2); }
 
+  // Return the number of times the log has been rewritten, which happens
+  // each time a partition bit is turned off.
+  uint32_t epoch() const { return epoch_; }
+  void set_epoch(uint32_t epoch) { epoch_ = epoch; }
+
+  // Return the number of partitions currently set.
+  uint32_t log_size() const { return static_cast<uint32_t>(log_.size()); }
+
+  // Return the partitions set after the first "since" ones, in the order
+  // they were set.
+  const uint16_t* log(uint32_t since) const { return log_.data() + since; }
+
+  // Return a table mapping each index at the current radix to the partition
+  // responsible for it.
+  const uint16_t* table() const {
+    assert(table_.size() == (1u << radix()));
+    return &table_[0];
+  }
+
+  // Recompute the table. Must be called after each update that changes the
+  // bitmap and before the next call to table(). A partition that is not set
+  // is covered by its closest ancestor that is set, and ancestors have
+  // smaller indices.
+  void RebuildTable() {
+    const size_t n = 1u << radix();
+    table_.resize(n);
+    table_[0] = 0;
+    for (size_t i = 1; i < n; i++) {
+      table_[i] = bit(i) ? static_cast<uint16_t>(i) : table_[ToParentIndex(i)];
+    }
+  }
+
  private:
   enum { kInitBitmapCapacity = (1 << 7) / 8 };
 
+  std::vector<uint16_t> table_;
+  // Partitions in the order their bits were set
+  std::vector<uint16_t> log_;
+  uint32_t epoch_;
+
   char* rep_;
   char* bitmap_;
   size_t bitmap_capacity_;
@@ -380,13 +479,14 @@ struct DirIndex::Rep {
   Rep(const Rep&);
 };
 
-DirIndex::Rep::Rep(uint16_t zeroth_server) {
+DirIndex::Rep::Rep(uint16_t zeroth_server) : epoch_(0) {
   memset(static_buf_, 0, sizeof(static_buf_));
   rep_ = NULL;
   Reset(static_buf_, sizeof(static_buf_) - kHeadSize);
   SetZerothServer(zeroth_server);
   SetRadix(0);
   TurnOnBit(0);
+  RebuildTable();
 }
 
 bool DirIndex::IsSet(int index) const {
@@ -430,7 +530,9 @@ bool DirIndex::Update(const Slice& other) {
     } else if (rep_->zeroth_server() != view.zeroth_server()) {
       return false;
     } else {
-      rep_->Merge(view);
+      if (rep_->Merge(view)) {
+        rep_->RebuildTable();
+      }
       return true;
     }
   }
@@ -441,14 +543,98 @@ bool DirIndex::Update(const Slice& other) {
 void DirIndex::Update(const DirIndex& other) {
   const Rep& other_rep = *other.rep_;
   if (rep_ == NULL) {
-    Rep* new_rep = new Rep(other_rep.zeroth_server());
-    new_rep->Merge(other_rep);
-    rep_ = new_rep;
-  } else {
-    rep_->Merge(other_rep);
+    rep_ = new Rep(other_rep.zeroth_server());
+  }
+  if (rep_->Merge(other_rep)) {
+    rep_->RebuildTable();
+  }
+}
+
+uint64_t DirIndex::Version() const {
+  assert(rep_ != NULL);
+  return (static_cast<uint64_t>(rep_->epoch()) << 32) | rep_->log_size();
+}
+
+// Each delta has the form
+//     zeroth_server: uint16_t
+//     epoch: varint32
+//     num_set: varint32
+//     num_partitions: varint32
+//     partitions: varint32[num_partitions]
+// Partitions are sorted and each is stored as the difference from the
+// previous one. The epoch and num_set form the version of the sender.
+void DirIndex::EncodeDelta(uint64_t since, std::string* dst) const {
+  assert(rep_ != NULL);
+  const uint32_t epoch = rep_->epoch();
+  const uint32_t num_set = rep_->log_size();
+  uint32_t start = static_cast<uint32_t>(since);
+  if (static_cast<uint32_t>(since >> 32) != epoch || start > num_set) {
+    start = 0;  // Not a version of the current log; send everything
+  }
+  std::vector<uint16_t> partitions(rep_->log(start), rep_->log(num_set));
+  std::sort(partitions.begin(), partitions.end());
+  char tmp[2];
+  EncodeFixed16(tmp, rep_->zeroth_server());
+  dst->append(tmp, sizeof(tmp));
+  PutVarint32(dst, epoch);
+  PutVarint32(dst, num_set);
+  PutVarint32(dst, static_cast<uint32_t>(partitions.size()));
+  uint32_t last = 0;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    PutVarint32(dst, partitions[i] - last);
+    last = partitions[i];
   }
 }
 
+bool DirIndex::UpdateDelta(const Slice& delta, uint64_t* version) {
+  Slice input = delta;
+  uint32_t epoch;
+  uint32_t num_set;
+  uint32_t n;
+  if (input.size() < 2) {
+    return false;
+  }
+  const uint16_t zeroth_server = DecodeFixed16(input.data());
+  input.remove_prefix(2);
+  if (!GetVarint32(&input, &epoch) || !GetVarint32(&input, &num_set) ||
+      !GetVarint32(&input, &n) || n > kMaxPartitions) {
+    return false;
+  }
+  std::vector<uint16_t> partitions;
+  partitions.reserve(n);
+  uint32_t partition = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t diff;
+    if (!GetVarint32(&input, &diff)) {
+      return false;
+    }
+    partition += diff;
+    if (partition >= kMaxPartitions || (i != 0 && diff == 0)) {
+      return false;
+    } else if (options_->paranoid_checks &&
+               partition >= static_cast<uint32_t>(
+                                options_->num_virtual_servers)) {
+      return false;
+    }
+    partitions.push_back(static_cast<uint16_t>(partition));
+  }
+  if (!input.empty()) {
+    return false;
+  }
+  if (rep_ == NULL) {
+    rep_ = new Rep(zeroth_server);
+  } else if (rep_->zeroth_server() != zeroth_server) {
+    return false;
+  }
+  if (rep_->TurnOnBits(partitions)) {
+    rep_->RebuildTable();
+  }
+  if (version != NULL) {
+    *version = (static_cast<uint64_t>(epoch) << 32) | num_set;
+  }
+  return true;
+}
+
 // Reset index states.
 bool DirIndex::TEST_Reset(const Slice& other) {
   View view;
@@ -458,6 +644,11 @@ bool DirIndex::TEST_Reset(const Slice& other) {
   } else {
     Rep* new_rep = new Rep(view.zeroth_server());
     new_rep->Merge(view);
+    new_rep->RebuildTable();
+    if (rep_ != NULL) {
+      // Invalidate versions handed out by the old rep
+      new_rep->set_epoch(rep_->epoch() + 1);
+    }
     delete rep_;
     rep_ = new_rep;
     return true;
@@ -467,27 +658,39 @@ bool DirIndex::TEST_Reset(const Slice& other) {
 void DirIndex::Set(int index) {
   assert(rep_ != NULL);
   assert(index >= 0 && index < options_->num_virtual_servers);
-  rep_->TurnOnBit(index);
+  if (rep_->TurnOnBit(index)) {
+    rep_->RebuildTable();
+  }
 }
 
 void DirIndex::SetAll() {
   assert(rep_ != NULL);
   rep_->Reserve(options_->num_virtual_servers);
+  bool changed = false;
   for (int i = 0; i < options_->num_virtual_servers; ++i) {
-    rep_->TurnOnBit(i);
+    changed |= rep_->TurnOnBit(i);
+  }
+  if (changed) {
+    rep_->RebuildTable();
   }
 }
 
 void DirIndex::TEST_Unset(int index) {
   assert(rep_ != NULL);
   assert(index > 0 && index < options_->num_virtual_servers);
-  rep_->TurnOffBit(index);
+  if (rep_->TurnOffBit(index)) {
+    rep_->RebuildTable();
+  }
 }
 
 void DirIndex::TEST_RevertAll() {
   assert(rep_ != NULL);
+  bool changed = false;
   for (int i = rep_->HighestBit(); i > 0; --i) {
-    rep_->TurnOffBit(i);
+    changed |= rep_->TurnOffBit(i);
+  }
+  if (changed) {
+    rep_->RebuildTable();
   }
 }
 
@@ -564,6 +767,42 @@ int DirIndex::HashToServer(const Slice& hash) const {
   return GetServerForIndex(HashToIndex(hash));
 }
 
+// Batch versions of SelectServer() and HashToServer(). Names are hashed in
+// chunks before their indices are computed so that each step runs as a
+// tight loop. Indices are resolved through a precomputed table instead of
+// walking up the parent partitions one at a time.
+static const int kHashChunk = 64;
+
+void DirIndex::SelectServers(const Slice* names, int n, int* servers) const {
+  char hashes[kHashChunk * 8];
+  Slice slices[kHashChunk];
+  for (int i = 0; i < n; i += kHashChunk) {
+    const int m = std::min(n - i, kHashChunk);
+    for (int j = 0; j < m; j++) {
+      slices[j] = DirIndex::Hash(names[i + j], hashes + j * 8);
+    }
+    HashesToServers(slices, m, servers + i);
+  }
+}
+
+void DirIndex::HashesToServers(const Slice* hashes, int n,
+                               int* servers) const {
+  assert(rep_ != NULL);
+  assert(rep_->radix() <= kMaxRadix);
+  const uint16_t* const table = rep_->table();
+  const int mask = (1 << rep_->radix()) - 1;
+  const int zeroth_server = rep_->zeroth_server();
+  const int num_servers = options_->num_servers;
+  const uint16_t* const rev = kReverseTable.bytes;
+  for (int i = 0; i < n; i++) {
+    assert(hashes[i].size() >= 2);
+    const unsigned char* const h =
+        reinterpret_cast<const unsigned char*>(hashes[i].data());
+    const int index = (rev[h[0]] | (rev[h[1]] << 8)) & mask;
+    servers[i] = (table[index] + zeroth_server) % num_servers;
+  }
+}
+
 // Return true if a file represented by the specified hash will be
 // migrated to the given child partition once its parent partition splits.
 // The given index marks this child partition. It is easy to deduce the
@@ -572,6 +811,37 @@ bool DirIndex::ToBeMigrated(int index, const char* hash) {
   return ComputeIndexFromHash(hash, ToRadix(index)) == index;
 }
 
+// The first "r" bits of a hash, taken from the most significant bit of each
+// byte, are the first "r" bits of the partition index, starting from its
+// least significant bit. Hashes of a partition therefore share a common bit
+// prefix and form a contiguous range.
+void DirIndex::PutHashRange(int index, std::string* start,
+                            std::string* limit) {
+  const int r = ToRadix(index);
+  char tmp[8];
+  memset(tmp, 0, sizeof(tmp));
+  for (int i = 0; i < r; i++) {
+    if (index & (1 << i)) {
+      tmp[i / 8] |= static_cast<char>(0x80 >> (i % 8));
+    }
+  }
+  start->append(tmp, sizeof(tmp));
+  // Increment the prefix to obtain the limit
+  int i = r - 1;
+  for (; i >= 0; i--) {
+    const char bit = static_cast<char>(0x80 >> (i % 8));
+    if ((tmp[i / 8] & bit) != 0) {
+      tmp[i / 8] &= ~bit;
+    } else {
+      tmp[i / 8] |= bit;
+      break;
+    }
+  }
+  if (i >= 0) {
+    limit->append(tmp, sizeof(tmp));
+  }
+}
+
 // Insert the corresponding hash value into *dst.
 void DirIndex::PutHash(std::string* dst, const Slice& name) {
   char tmp[8];
@@ -10,12 +10,15 @@
  */
 
 #include "pdlfs-common/gigaplus.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
 #include <stdio.h>
 #include <algorithm>
 #include <iostream>
 #include <set>
+#include <vector>
 
 namespace pdlfs {
 
@@ -465,6 +468,158 @@ TEST(DirIndexTest, Migration4) {
   ASSERT_TRUE(moved > 0 && moved < 10000);
 }
 
+TEST(DirIndexTest, HashRange) {
+  const int indices[] = {1, 2, 3, 4, 6, 7, 12, 255, 256, 1000, 16383};
+  for (size_t k = 0; k < sizeof(indices) / sizeof(int); k++) {
+    const int index = indices[k];
+    std::string start, limit;
+    DirIndex::PutHashRange(index, &start, &limit);
+    ASSERT_EQ(start.size(), 8);
+    ASSERT_TRUE(Migrate(index, start.data()));
+    if (!limit.empty()) {
+      ASSERT_EQ(limit.size(), 8);
+      ASSERT_TRUE(!Migrate(index, limit.data()));
+    }
+    for (int i = 0; i < 10000; i++) {
+      char hash[40];
+      const Slice h = DirIndex::Hash(File(i), hash);
+      const bool in_range = h.compare(start) >= 0 &&
+                            (limit.empty() || h.compare(limit) < 0);
+      ASSERT_EQ(Migrate(index, hash), in_range);
+    }
+  }
+}
+
+// Check batch server selection against the scalar path.
+static void CheckBatchSelect(const DirIndex& idx, int num) {
+  std::vector<std::string> names;
+  std::vector<std::string> hashes;
+  for (int i = 0; i < num; i++) {
+    names.push_back(File(i));
+    hashes.resize(hashes.size() + 1);
+    DirIndex::PutHash(&hashes.back(), names.back());
+  }
+  std::vector<Slice> name_slices(names.begin(), names.end());
+  std::vector<Slice> hash_slices(hashes.begin(), hashes.end());
+  std::vector<int> servers(num);
+  std::vector<int> hash_servers(num);
+  idx.SelectServers(&name_slices[0], num, &servers[0]);
+  idx.HashesToServers(&hash_slices[0], num, &hash_servers[0]);
+  for (int i = 0; i < num; i++) {
+    ASSERT_EQ(servers[i], idx.SelectServer(names[i]));
+    ASSERT_EQ(hash_servers[i], servers[i]);
+  }
+}
+
+TEST(DirIndexTest, BatchSelectServers) {
+  CheckBatchSelect(*idx_, 1000);
+  Random rnd(301);
+  for (int i = 0; i < 2000; i++) {
+    const int index = rnd.Uniform(1 << idx_->Radix());
+    if (idx_->IsSet(index) && idx_->IsSplittable(index)) {
+      idx_->Set(idx_->NewIndexForSplitting(index));
+    }
+    if (i % 500 == 0) {
+      CheckBatchSelect(*idx_, 1000);
+    }
+  }
+  ASSERT_TRUE(idx_->Radix() > 2);
+  CheckBatchSelect(*idx_, 3000);
+  DirIndex* const recovered = Recover();
+  CheckBatchSelect(*recovered, 3000);
+  // Updates that set no new bits leave the table as is
+  ASSERT_TRUE(recovered->Update(idx_->Encode()));
+  recovered->Update(*idx_);
+  recovered->Set(0);
+  CheckBatchSelect(*recovered, 3000);
+  delete recovered;
+  idx_->TEST_Unset(idx_->NewIndexForSplitting(0) / 2);
+  CheckBatchSelect(*idx_, 3000);
+  idx_->SetAll();
+  CheckBatchSelect(*idx_, 3000);
+}
+
+TEST(DirIndexTest, Delta) {
+  DirIndex* const client = Recover();
+  ASSERT_EQ(idx_->Version(), 1);
+  uint64_t known = idx_->Version();
+  Random rnd(301);
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 200; i++) {
+      const int index = rnd.Uniform(1 << idx_->Radix());
+      if (idx_->IsSet(index) && idx_->IsSplittable(index)) {
+        idx_->Set(idx_->NewIndexForSplitting(index));
+      }
+    }
+    std::string delta;
+    idx_->EncodeDelta(known, &delta);
+    ASSERT_TRUE(delta.size() < idx_->Encode().size() || round == 0);
+    ASSERT_TRUE(client->UpdateDelta(delta, &known));
+    ASSERT_EQ(known, idx_->Version());
+    ASSERT_EQ(client->Encode().ToString(), idx_->Encode().ToString());
+    CheckBatchSelect(*client, 100);
+  }
+  // Nothing new
+  std::string delta;
+  idx_->EncodeDelta(known, &delta);
+  ASSERT_TRUE(delta.size() <= 6);
+  ASSERT_TRUE(client->UpdateDelta(delta));
+  ASSERT_EQ(client->Encode().ToString(), idx_->Encode().ToString());
+  // Deltas are idempotent and need not be applied in order
+  delta.clear();
+  idx_->EncodeDelta(1, &delta);
+  ASSERT_TRUE(client->UpdateDelta(delta));
+  ASSERT_EQ(client->Version(), idx_->Version());
+  // Unsetting a partition starts a new epoch, after which older versions
+  // get everything
+  int unset = idx_->NewIndexForSplitting(0) / 2;
+  while (!idx_->IsSet(unset)) unset /= 2;
+  ASSERT_TRUE(unset != 0);
+  idx_->TEST_Unset(unset);
+  int added = -1;
+  for (int i = 0; added == -1 || added == unset; i++) {
+    if (idx_->IsSet(i) && idx_->IsSplittable(i)) {
+      added = idx_->NewIndexForSplitting(i);
+    }
+  }
+  idx_->Set(added);  // Same number of partitions set as before
+  ASSERT_TRUE(idx_->Version() != known);
+  ASSERT_TRUE(!client->IsSet(added));
+  delta.clear();
+  idx_->EncodeDelta(known, &delta);
+  ASSERT_TRUE(client->UpdateDelta(delta, &known));
+  ASSERT_EQ(known, idx_->Version());
+  ASSERT_TRUE(client->IsSet(added));
+  idx_->Set(unset);
+  delta.clear();
+  idx_->EncodeDelta(known, &delta);
+  ASSERT_TRUE(client->UpdateDelta(delta, &known));
+  ASSERT_EQ(client->Encode().ToString(), idx_->Encode().ToString());
+  delta.clear();
+  idx_->EncodeDelta(known, &delta);
+  ASSERT_TRUE(delta.size() <= 6);
+  // So do versions from the future
+  delta.clear();
+  idx_->EncodeDelta(known + 1, &delta);
+  DirIndex fresh(&options_);
+  ASSERT_TRUE(fresh.UpdateDelta(delta));
+  ASSERT_EQ(fresh.Encode().ToString(), idx_->Encode().ToString());
+  delete client;
+
+  // Empty indices can be rebuilt from a full delta
+  DirIndex empty(&options_);
+  delta.clear();
+  idx_->EncodeDelta(0, &delta);
+  ASSERT_TRUE(empty.UpdateDelta(delta));
+  ASSERT_EQ(empty.Encode().ToString(), idx_->Encode().ToString());
+
+  // Bad deltas
+  ASSERT_TRUE(!empty.UpdateDelta(Slice(delta.data(), delta.size() - 1)));
+  ASSERT_TRUE(!empty.UpdateDelta(delta + "x"));
+  DirIndex other(zeroth_server_ + 1, &options_);
+  ASSERT_TRUE(!other.UpdateDelta(delta));
+}
+
 static void PrintStates(const std::vector<int>& states) {
   static int run = 0;
   fprintf(stderr, "case %02d: ", ++run);
@@ -527,8 +682,56 @@ TEST(DirIndexTest, RandomServer2) {
   }
 }
 
+// Route "num" names through an index with "num_partitions" partitions, one
+// name at a time and in batches of "batch_size" names.
+static void BM_SelectServers(int num, int num_partitions, int batch_size) {
+  DirIndexOptions options;
+  options.num_servers = 1 << 14;
+  options.num_virtual_servers = 1 << 14;
+  DirIndex idx(0, &options);
+  for (int i = 1; i < num_partitions; i++) {
+    idx.Set(i);
+  }
+  std::vector<std::string> names;
+  for (int i = 0; i < num; i++) {
+    names.push_back(File(i));
+  }
+  std::vector<Slice> slices(names.begin(), names.end());
+  std::vector<int> servers(num);
+  uint64_t start = CurrentMicros();
+  for (int i = 0; i < num; i++) {
+    servers[i] = idx.SelectServer(slices[i]);
+  }
+  const uint64_t scalar = CurrentMicros() - start;
+  int checksum = 0;
+  for (int i = 0; i < num; i++) {
+    checksum += servers[i];
+  }
+  start = CurrentMicros();
+  for (int i = 0; i < num; i += batch_size) {
+    idx.SelectServers(&slices[i], std::min(batch_size, num - i),
+                      &servers[i]);
+  }
+  const uint64_t batch = CurrentMicros() - start;
+  for (int i = 0; i < num; i++) {
+    checksum -= servers[i];
+  }
+  ASSERT_EQ(checksum, 0);
+  fprintf(stderr,
+          "%5d partitions: scalar %7.2f ns/name, batch/%d %7.2f ns/name\n",
+          num_partitions, scalar * 1e3 / num, batch_size, batch * 1e3 / num);
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const int partitions[] = {1, 16, 1000, 16384};
+    for (size_t i = 0; i < 4; i++) {
+      ::pdlfs::BM_SelectServers(1000000, partitions[i], 1024);
+    }
+    return 0;
+  }
+
   return ::pdlfs::test::RunAllTests(&argc, &argv);
 }
@@ -116,6 +116,20 @@ Slice AbstractBlockBuilder::Finish(CompressionType compression, bool force) {
         compressed.clear();
       }
       break;
+    case kLZ4Compression:
+      if (!port::LZ4_Compress(contents.data(), sz, &compressed) ||
+          (compressed.size() >= (sz - sz / 8u) && !force)) {
+        compression = kNoCompression;
+        compressed.clear();
+      }
+      break;
+    case kZstdCompression:
+      if (!port::Zstd_Compress(contents.data(), sz, NULL, &compressed) ||
+          (compressed.size() >= (sz - sz / 8u) && !force)) {
+        compression = kNoCompression;
+        compressed.clear();
+      }
+      break;
   }
 
   if (!compressed.empty()) {
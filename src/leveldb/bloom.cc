@@ -18,6 +18,13 @@
 
 #include "pdlfs-common/hash.h"
 #include "pdlfs-common/slice.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PDLFS_BLOOM_AVX2
+#endif
 
 namespace pdlfs {
 
@@ -95,10 +102,165 @@ class BloomFilterPolicy : public FilterPolicy {
     return true;
   }
 };
+
+// A blocked bloom filter consists of an array of 64-byte lines followed
+// by a single byte storing the number of probes (k). The upper half of a
+// 64-bit key hash picks a line and all k probes of a key land in that line,
+// so a lookup touches a single cache line. Each probe j takes the top 9 bits
+// of (h * kBlockedBloomSalts[j]), where h is the lower half of the hash, as
+// a bit position within the line. The k positions are independent of one
+// another and can be computed and tested in parallel using SIMD.
+static const size_t kCacheLineBytes = 64;
+static const size_t kCacheLineBits = kCacheLineBytes * 8;
+static const size_t kMaxBlockedProbes = 16;
+
+static const uint32_t kBlockedBloomSalts[kMaxBlockedProbes] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+    0x9e3779b1U, 0x85ebca77U, 0xc2b2ae3dU, 0x27d4eb2fU,
+    0x165667b1U, 0xd3a2646dU, 0xfd7046c5U, 0xb55a4f09U};
+
+static inline uint64_t BlockedBloomHash(const Slice& key) {
+  return xxhash64(key.data(), key.size(), 0);
+}
+
+// Map the upper half of the hash to [0, num_lines) without a division.
+static inline size_t CacheLineIndex(uint64_t hash, size_t num_lines) {
+  return static_cast<size_t>(((hash >> 32) * num_lines) >> 32);
+}
+
+static inline uint32_t ProbeBitPos(uint32_t h, size_t j) {
+  return (h * kBlockedBloomSalts[j]) >> 23;  // 9 bits: [0, 512)
+}
+
+static bool BlockedProbePortable(const char* line, uint32_t h, size_t k) {
+  for (size_t j = 0; j < k; j++) {
+    const uint32_t bitpos = ProbeBitPos(h, j);
+    if ((line[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+  }
+  return true;
+}
+
+#if defined(PDLFS_BLOOM_AVX2)
+// Test 8 probes at a time: multiply the hash by 8 salts in parallel,
+// gather the 32-bit words holding the resulting bits, and check all of
+// them with a single compare. Lanes beyond k are masked off. Bits are
+// addressed in little-endian byte order, which matches the portable path
+// on x86.
+__attribute__((target("avx2"))) static bool BlockedProbeAVX2(
+    const char* line, uint32_t h, size_t k) {
+  const __m256i hash = _mm256_set1_epi32(static_cast<int>(h));
+  const __m256i ones = _mm256_set1_epi32(1);
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (size_t j = 0; j < k; j += 8) {
+    const __m256i salts = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(&kBlockedBloomSalts[j]));
+    const __m256i bitpos =
+        _mm256_srli_epi32(_mm256_mullo_epi32(hash, salts), 23);
+    const __m256i word = _mm256_srli_epi32(bitpos, 5);
+    const __m256i bits = _mm256_sllv_epi32(
+        ones, _mm256_and_si256(bitpos, _mm256_set1_epi32(31)));
+    const __m256i active = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(static_cast<int>(k - j)), lane);
+    const __m256i words = _mm256_mask_i32gather_epi32(
+        _mm256_setzero_si256(), reinterpret_cast<const int*>(line), word,
+        active, 4);
+    const __m256i missing =
+        _mm256_and_si256(_mm256_andnot_si256(words, bits), active);
+    if (!_mm256_testz_si256(missing, missing)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool HasAVX2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ private:
+  size_t bits_per_key_;
+  size_t k_;
+  bool use_simd_;
+
+ public:
+  BlockedBloomFilterPolicy(int bits_per_key, bool use_simd)
+      : bits_per_key_(bits_per_key), use_simd_(use_simd) {
+    // Probes landing in a single line collide more often than probes
+    // spread over the whole filter, so we do not round down k here.
+    k_ = static_cast<size_t>(bits_per_key * 0.69 + 0.5);  // 0.69 =~ ln(2)
+    if (k_ < 1) k_ = 1;
+    if (k_ > kMaxBlockedProbes) k_ = kMaxBlockedProbes;
+#if defined(PDLFS_BLOOM_AVX2)
+    use_simd_ = use_simd_ && HasAVX2();
+#else
+    use_simd_ = false;
+#endif
+  }
+
+  virtual const char* Name() const { return "pdlfs.BlockedBloomFilter"; }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    size_t bits = n * bits_per_key_;
+    const size_t num_lines = (bits + kCacheLineBits - 1) / kCacheLineBits;
+    const size_t bytes = (num_lines != 0 ? num_lines : 1) * kCacheLineBytes;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + bytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    char* array = &(*dst)[init_size];
+    for (int i = 0; i < n; i++) {
+      const uint64_t hash = BlockedBloomHash(keys[i]);
+      char* const line =
+          array + CacheLineIndex(hash, bytes / kCacheLineBytes) *
+                      kCacheLineBytes;
+      const uint32_t h = static_cast<uint32_t>(hash);
+      for (size_t j = 0; j < k_; j++) {
+        const uint32_t bitpos = ProbeBitPos(h, j);
+        line[bitpos / 8] |= (1 << (bitpos % 8));
+      }
+    }
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& bloom_filter) const {
+    const size_t len = bloom_filter.size();
+    if (len < kCacheLineBytes + 1) return false;
+    const size_t num_lines = (len - 1) / kCacheLineBytes;
+    if (num_lines * kCacheLineBytes + 1 != len) {
+      return true;  // Not a filter we know about; consider it a match
+    }
+
+    const char* array = bloom_filter.data();
+    const size_t k = static_cast<unsigned char>(array[len - 1]);
+    if (k == 0 || k > kMaxBlockedProbes) {
+      // Reserved for potentially new encodings. Consider it a match.
+      return true;
+    }
+
+    const uint64_t hash = BlockedBloomHash(key);
+    const char* const line =
+        array + CacheLineIndex(hash, num_lines) * kCacheLineBytes;
+    const uint32_t h = static_cast<uint32_t>(hash);
+#if defined(PDLFS_BLOOM_AVX2)
+    if (use_simd_) {
+      return BlockedProbeAVX2(line, h, k);
+    }
+#endif
+    return BlockedProbePortable(line, h, k);
+  }
+};
 }  // namespace
 
 const FilterPolicy* NewBloomFilterPolicy(int bits_per_key) {
   return new BloomFilterPolicy(bits_per_key);
 }
 
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key,
+                                                bool use_simd) {
+  return new BlockedBloomFilterPolicy(bits_per_key, use_simd);
+}
+
 }  // namespace pdlfs
@@ -39,6 +39,7 @@ class BloomTest {
 
  public:
   BloomTest() : policy_(NewBloomFilterPolicy(10)) {}
+  explicit BloomTest(const FilterPolicy* policy) : policy_(policy) {}
 
   ~BloomTest() { delete policy_; }
 
@@ -80,6 +81,14 @@ class BloomTest {
     return policy_->KeyMayMatch(s, filter_);
   }
 
+  // Check the filter with another policy reading the same format.
+  bool Matches(const FilterPolicy* policy, const Slice& s) {
+    if (!keys_.empty()) {
+      Build();
+    }
+    return policy->KeyMayMatch(s, filter_);
+  }
+
   double FalsePositiveRate() {
     char buffer[sizeof(int)];
     int result = 0;
@@ -163,6 +172,93 @@ TEST(BloomTest, VaryingLengths) {
 
 // Different bits-per-byte
 
+class BlockedBloomTest : public BloomTest {
+ public:
+  BlockedBloomTest() : BloomTest(NewBlockedBloomFilterPolicy(10)) {}
+};
+
+TEST(BlockedBloomTest, EmptyBlockedFilter) {
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
+}
+
+TEST(BlockedBloomTest, SmallBlockedFilter) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+  // Filters are a sequence of 64-byte blocks followed by the # of probes
+  ASSERT_EQ(FilterSize(), 65);
+}
+
+TEST(BlockedBloomTest, BlockedVaryingLengths) {
+  char buffer[sizeof(int)];
+
+  // Count number of filters that significantly exceed the false positive rate
+  int mediocre_filters = 0;
+  int good_filters = 0;
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + 65))
+        << length;
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    // Check false positive rate
+    double rate = FalsePositiveRate();
+    if (kVerbose >= 1) {
+      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+              rate * 100.0, length, static_cast<int>(FilterSize()));
+    }
+    ASSERT_LE(rate, 0.02);  // Must not be over 2%
+    if (rate > 0.0125)
+      mediocre_filters++;  // Allowed, but not too often
+    else
+      good_filters++;
+  }
+  if (kVerbose >= 1) {
+    fprintf(stderr, "Filters: %d good, %d mediocre\n", good_filters,
+            mediocre_filters);
+  }
+  ASSERT_LE(mediocre_filters, good_filters / 5);
+}
+
+// The simd and the portable probe paths must agree on every key.
+TEST(BlockedBloomTest, SimdMatchesPortable) {
+  const FilterPolicy* portable = NewBlockedBloomFilterPolicy(10, false);
+  char buffer[sizeof(int)];
+  for (int i = 0; i < 5000; i++) {
+    Add(Key(i, buffer));
+  }
+  Build();
+  for (int i = 0; i < 20000; i++) {
+    Slice key = Key(i + 1000000000 * (i & 1), buffer);
+    ASSERT_EQ(Matches(key), Matches(portable, key)) << i;
+  }
+  delete portable;
+}
+
+// Filters of one policy are not mistaken for filters of the other.
+TEST(BlockedBloomTest, DistinctName) {
+  const FilterPolicy* bloom = NewBloomFilterPolicy(10);
+  const FilterPolicy* blocked = NewBlockedBloomFilterPolicy(10);
+  ASSERT_NE(std::string(bloom->Name()), std::string(blocked->Name()));
+  delete blocked;
+  delete bloom;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -30,7 +30,7 @@ namespace pdlfs {
 Status BuildTable(const std::string& dbname, Env* env, const DBOptions& options,
                   TableCache* table_cache, Iterator* iter,
                   SequenceNumber* min_seq, SequenceNumber* max_seq,
-                  FileMetaData* meta) {
+                  FileMetaData* meta, uint64_t* compression_micros) {
   Status s;
   assert(meta->number != 0);
   meta->file_size = 0;
@@ -60,6 +60,9 @@ Status BuildTable(const std::string& dbname, Env* env, const DBOptions& options,
     } else {
       builder->Abandon();
     }
+    if (compression_micros != NULL) {
+      *compression_micros += builder->CompressionMicros();
+    }
 
     // Obtain table properties
     if (s.ok()) {
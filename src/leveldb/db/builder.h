@@ -20,6 +20,8 @@
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/status.h"
 
+#include <atomic>
+
 namespace pdlfs {
 
 class TableCache;
@@ -28,8 +30,24 @@ class Iterator;
 struct FileMetaData {
   FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0), seq_off(0) {}
 
+  FileMetaData(const FileMetaData& other) { *this = other; }
+
+  FileMetaData& operator=(const FileMetaData& other) {
+    refs = other.refs;
+    allowed_seeks.store(other.allowed_seeks.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+    number = other.number;
+    file_size = other.file_size;
+    seq_off = other.seq_off;
+    smallest = other.smallest;
+    largest = other.largest;
+    return *this;
+  }
+
   int refs;
-  int allowed_seeks;  // Max seeks until compaction
+  // Max seeks until compaction. Charged by concurrent readers without
+  // holding the db mutex.
+  std::atomic<int> allowed_seeks;
   uint64_t number;
   // File size in bytes
   uint64_t file_size;
@@ -55,9 +73,12 @@ struct FileMetaData {
 // named according to meta->number. On success, the rest of *meta will be
 // filled with metadata about the generated table. If no data is present in
 // *iter, meta->file_size will be set to zero, and no file will be produced.
+// If "compression_micros" is not NULL, the CPU time spent compressing the
+// blocks of the table is added to it.
 extern Status BuildTable(  ///
     const std::string& dbname, Env* env, const DBOptions& options,
     TableCache* table_cache, Iterator* iter, SequenceNumber* min_seq,
-    SequenceNumber* max_seq, FileMetaData* meta);
+    SequenceNumber* max_seq, FileMetaData* meta,
+    uint64_t* compression_micros = NULL);
 
 }  // namespace pdlfs
@@ -18,6 +18,7 @@
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/testharness.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 namespace pdlfs {
@@ -36,6 +37,7 @@ class BulkTest {
     DestroyDB(dbloc_, DBOptions());
     dbtmp_ = dbloc_ + "/tmp";
     DestroyDB(dbtmp_, DBOptions());
+    Env::Default()->DeleteFile(DumpManifestFileName(dbtmp_).c_str());
     empty_cache_ = NewLRUCache(0);
     options_.block_cache = empty_cache_;
     options_.create_if_missing = true;
@@ -105,6 +107,21 @@ class BulkTest {
     return atoi(property.c_str());
   }
 
+  // Return the number of table files in the db directory.
+  int NumTableFiles() {
+    std::vector<std::string> filenames;
+    ASSERT_OK(options_.env->GetChildren(dbloc_.c_str(), &filenames));
+    uint64_t number;
+    FileType type;
+    int num = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (ParseFileName(filenames[i], &number, &type) && type == kTableFile) {
+        num++;
+      }
+    }
+    return num;
+  }
+
   // Return total number of files copied.
   int CopyDbToTmp() {
     Env* env = options_.env;
@@ -215,6 +232,298 @@ TEST(BulkTest, OverlappingKeys) {
   ASSERT_EQ("v3", Get("p"));
 }
 
+TEST(BulkTest, ParallelDump) {
+  options_.write_buffer_size = 32 << 10;
+  options_.table_file_size = 32 << 10;
+  Reopen(true);
+  char key[20];
+  const std::string value(100, 'x');
+  const int n = 4000;
+  for (int i = 0; i < n; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    Put(key, value + key);
+  }
+  for (int i = 0; i < n; i += 7) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    Delete(key);
+  }
+  Flush();
+  int num_files = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    num_files += NumTableFilesAtLevel(level);
+  }
+  ASSERT_TRUE(num_files > 4);
+
+  ThreadPool* const pool = ThreadPool::NewFixed(2);
+  DumpOptions opt;
+  opt.table_file_size = 16 << 10;
+  opt.max_parallelism = 4;
+  opt.thread_pool = pool;
+  SequenceNumber min_seq, max_seq;
+  ASSERT_OK(db_->Dump(opt, Range("k000100", "k003900"), dbtmp_, &min_seq,
+                      &max_seq));
+  ASSERT_TRUE(min_seq <= max_seq);
+  delete pool;
+
+  std::vector<DumpedTable> tables;
+  ASSERT_OK(ReadDumpManifest(options_.env, dbtmp_, &tables));
+  ASSERT_TRUE(tables.size() > 4);
+  const InternalKeyComparator icmp(BytewiseComparator());
+  for (size_t i = 0; i < tables.size(); i++) {
+    ASSERT_TRUE(icmp.Compare(tables[i].smallest, tables[i].largest) <= 0);
+    if (i != 0) {
+      ASSERT_TRUE(icmp.user_comparator()->Compare(
+                      tables[i - 1].largest.user_key(),
+                      tables[i].smallest.user_key()) < 0);
+    }
+    uint64_t file_size;
+    ASSERT_OK(options_.env->GetFileSize(
+        TableFileName(dbtmp_, tables[i].number).c_str(), &file_size));
+    ASSERT_EQ(file_size, tables[i].file_size);
+  }
+  ASSERT_EQ("k000100", tables.front().smallest.user_key().ToString());
+  ASSERT_EQ("k003898", tables.back().largest.user_key().ToString());
+
+  Reopen(true);
+  BulkInsert();
+  for (int i = 0; i < n; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    if (i < 100 || i >= 3900 || i % 7 == 0) {
+      ASSERT_EQ("NOT_FOUND", Get(key));
+    } else {
+      ASSERT_EQ(value + key, Get(key));
+    }
+  }
+  Reopen();
+  Compact();
+  snprintf(key, sizeof(key), "k%06d", 2000);
+  ASSERT_EQ(value + key, Get(key));
+}
+
+TEST(BulkTest, DeepestLevelPlacement) {
+  options_.write_buffer_size = 32 << 10;
+  Reopen(true);
+  char key[20];
+  const std::string value(100, 'x');
+  const int n = 2000;
+  for (int i = 0; i < n; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    Put(key, value + key);
+  }
+  DumpOptions dopt;
+  dopt.table_file_size = 16 << 10;
+  ASSERT_OK(db_->Dump(dopt, Range(), dbtmp_, NULL, NULL));
+  std::vector<DumpedTable> tables;
+  ASSERT_OK(ReadDumpManifest(options_.env, dbtmp_, &tables));
+  ASSERT_TRUE(tables.size() > 2);
+
+  Reopen(true);
+  Put("a", "v1");
+  Flush();
+  Put("z", "v1");
+  Flush();
+  // Overlaps with exactly one of the tables to be inserted
+  Put(tables[1].smallest.user_key().ToString() + "x", "v1");
+  Flush();
+  const int bottom = config::kNumLevels - 1;
+  int level = 0;
+  while (NumTableFilesAtLevel(level) == 0) level++;
+  ASSERT_TRUE(level > 0 && level < bottom);
+  ASSERT_EQ(0, NumTableFilesAtLevel(bottom));
+
+  InsertOptions opt;
+  opt.place_in_deepest_level = true;
+  ASSERT_OK(db_->AddL0Tables(opt, dbtmp_));
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_EQ(static_cast<int>(tables.size()) - 1,
+            NumTableFilesAtLevel(bottom));
+  ASSERT_EQ(1, NumTableFilesAtLevel(level - 1));
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.stats", &stats));
+  ASSERT_TRUE(stats.find("Bulk Insertions") != std::string::npos);
+  for (int i = 0; i < n; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    ASSERT_EQ(value + key, Get(key));
+  }
+  ASSERT_EQ("v1", Get("a"));
+  ASSERT_EQ("v1", Get("z"));
+  Reopen();
+  snprintf(key, sizeof(key), "k%06d", n - 1);
+  ASSERT_EQ(value + key, Get(key));
+}
+
+TEST(BulkTest, OverlappingTablesStayAtLevel0) {
+  Put("a", "v1");
+  Put("p", "v1");
+  Flush();
+  Put("b", "v1");
+  Put("q", "v1");
+  Flush();
+  ASSERT_EQ(2, CopyDbToTmp());
+  Reopen(true);
+  InsertOptions opt;
+  opt.place_in_deepest_level = true;
+  ASSERT_OK(db_->AddL0Tables(opt, dbtmp_));
+  ASSERT_EQ(2, NumTableFilesAtLevel(0));
+  ASSERT_EQ("v1", Get("a"));
+  ASSERT_EQ("v1", Get("q"));
+}
+
+namespace {
+struct CompactionThread {
+  DBImpl* db;
+  int level;
+  port::AtomicPointer done;
+};
+
+void CompactLevel(void* arg) {
+  CompactionThread* const t = reinterpret_cast<CompactionThread*>(arg);
+  t->db->TEST_CompactRange(t->level, NULL, NULL);
+  t->done.Release_Store(t);
+}
+}  // namespace
+
+TEST(BulkTest, DeepestLevelPlacementWithPausedCompaction) {
+  Put("m", "v1");
+  Flush();
+  ASSERT_EQ(1, CopyDbToTmp());
+  Reopen(true);
+  DBImpl* const impl = reinterpret_cast<DBImpl*>(db_);
+  Put("l", "v1");
+  Put("n", "v1");
+  Flush();
+  impl->TEST_CompactRange(2, NULL, NULL);
+  ASSERT_EQ(1, NumTableFilesAtLevel(3));
+  Put("a", "v1");
+  Put("b", "v1");
+  Flush();
+  Put("y", "v1");
+  Put("z", "v1");
+  Flush();
+  ASSERT_EQ(2, NumTableFilesAtLevel(2));
+  Put("b", "v2");
+  Put("c", "v2");
+  Flush();
+  Put("x", "v2");
+  Put("y", "v2");
+  Flush();
+  ASSERT_EQ(2, NumTableFilesAtLevel(1));
+
+  // The compaction of level 1 will write [a,z] at level 2 while the table
+  // to be inserted falls into a gap at both levels
+  CompactionThread thread;
+  thread.db = impl;
+  thread.level = 1;
+  thread.done.Release_Store(NULL);
+  impl->TEST_PauseNextCompaction();
+  Env::Default()->StartThread(&CompactLevel, &thread);
+  impl->TEST_WaitForPausedCompaction();
+  InsertOptions opt;
+  opt.place_in_deepest_level = true;
+  ASSERT_OK(db_->AddL0Tables(opt, dbtmp_));
+  impl->TEST_ResumeCompaction();
+  while (thread.done.Acquire_Load() == NULL) {
+    SleepForMicroseconds(10000);
+  }
+  // The inserted table stays at level 1 rather than overlapping the
+  // compaction output at level 2
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+  ASSERT_EQ(1, NumTableFilesAtLevel(3));
+  ASSERT_EQ("v1", Get("m"));
+  ASSERT_EQ("v2", Get("b"));
+  ASSERT_EQ("v2", Get("y"));
+  ASSERT_EQ("v1", Get("z"));
+  Reopen();
+  ASSERT_EQ("v1", Get("m"));
+}
+
+// Subcompactions run by helper threads must pause along with the thread
+// owning the compaction so that a bulk insertion does not wait for the
+// entire compaction to finish.
+TEST(BulkTest, SplitCompactionPausedForBulkInsert) {
+  Put("m", "v1");
+  Flush();
+  ASSERT_EQ(1, CopyDbToTmp());
+  ThreadPool* const pool = ThreadPool::NewFixed(3, true);
+  options_.compaction_pool = pool;
+  options_.max_subcompactions = 4;
+  options_.max_mem_compact_level = 0;
+  options_.disable_compaction = true;
+  Reopen(true);
+  DBImpl* const impl = reinterpret_cast<DBImpl*>(db_);
+  char key[20];
+  for (int round = 0; round < 4; round++) {
+    for (int i = round; i < 4000; i += 4) {
+      snprintf(key, sizeof(key), "k%06d", i);
+      Put(key, key);
+    }
+    Flush();
+  }
+  ASSERT_EQ(4, NumTableFilesAtLevel(0));
+  const int num_tables = NumTableFiles();
+
+  CompactionThread thread;
+  thread.db = impl;
+  thread.level = 0;
+  thread.done.Release_Store(NULL);
+  impl->TEST_PauseNextCompaction();
+  Env::Default()->StartThread(&CompactLevel, &thread);
+  impl->TEST_WaitForPausedCompaction();
+  // No subcompaction writes anything while the compaction is paused
+  SleepForMicroseconds(100000);
+  ASSERT_EQ(num_tables, NumTableFiles());
+  BulkInsert();
+  ASSERT_EQ(num_tables + 1, NumTableFiles());
+  impl->TEST_ResumeCompaction();
+  while (thread.done.Acquire_Load() == NULL) {
+    SleepForMicroseconds(10000);
+  }
+  ASSERT_GT(NumTableFilesAtLevel(1), 0);
+  ASSERT_EQ("v1", Get("m"));
+  for (int i = 0; i < 4000; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    ASSERT_EQ(key, Get(key));
+  }
+  delete db_;
+  db_ = NULL;
+  delete pool;
+}
+
+namespace {
+// Selects keys ending with an even digit.
+class EvenKeyFilter : public DumpFilter {
+ public:
+  virtual bool Select(const Slice& key, const Slice& value) const {
+    return !key.empty() && (key[key.size() - 1] - '0') % 2 == 0;
+  }
+};
+}  // namespace
+
+TEST(BulkTest, FilteredDump) {
+  char key[20];
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    Put(key, key);
+  }
+  Flush();
+  Delete("k000010");
+  EvenKeyFilter filter;
+  DumpOptions opt;
+  opt.filter = &filter;
+  ASSERT_OK(db_->Dump(opt, Range(), dbtmp_, NULL, NULL));
+  Reopen(true);
+  BulkInsert();
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    if (i % 2 != 0 || i == 10) {
+      ASSERT_EQ("NOT_FOUND", Get(key));
+    } else {
+      ASSERT_EQ(key, Get(key));
+    }
+  }
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -17,6 +17,7 @@
 #include "pdlfs-common/leveldb/db.h"
 
 #include "pdlfs-common/leveldb/filenames.h"
+#include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/leveldb/snapshot.h"
 #include "pdlfs-common/leveldb/write_batch.h"
@@ -45,6 +46,40 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::Get(const ReadOptions& options, const Slice& key,
+               PinnedSlice* value) {
+  value->Reset();
+  Status s = Get(options, key, &value->buf_);
+  if (s.ok()) {
+    value->data_ = value->buf_;
+  }
+  return s;
+}
+
+void DB::MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                  std::string* values, Status* statuses) {
+  for (size_t i = 0; i < n; i++) {
+    statuses[i] = Get(options, keys[i], &values[i]);
+  }
+}
+
+PinnedSlice::~PinnedSlice() { delete pin_; }
+
+void PinnedSlice::Reset() {
+  delete pin_;
+  pin_ = NULL;
+  data_ = Slice();
+}
+
+void PinnedSlice::Fill(const char* data, size_t size) {
+  data_ = Slice(data, size);
+}
+
+void PinnedSlice::Pin(Iterator* pin) {
+  assert(pin_ == NULL);
+  pin_ = pin;
+}
+
 Status DestroyDB(const std::string& dbname, const DBOptions& options) {
   Env* env = options.env;
   if (!env) env = Env::Default();
@@ -56,9 +56,12 @@ struct DBImpl::Writer {
   WriteBatch* batch;
   bool sync;
   bool done;
+  // Set by the leader of a write group when this writer should insert its
+  // own batch into the memtable concurrently with other group members
+  MemTable* mem;
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) {}
+  explicit Writer(port::Mutex* mu) : mem(NULL), cv(mu) {}
 };
 
 struct DBImpl::CompactionState {
@@ -83,11 +86,92 @@ struct DBImpl::CompactionState {
   TableBuilder* builder;
 
   uint64_t total_bytes;
+  uint64_t compression_micros;
+
+  // User key range (start, end] processed by a subcompaction. An empty
+  // bound means the range is unbounded on that side.
+  bool has_start, has_end;
+  std::string start, end;
+  Compaction::Cursor cursor;
+  uint64_t micros;
+  Status status;
 
   Output* current_output() { return &outputs[outputs.size() - 1]; }
 
   explicit CompactionState(Compaction* c)
-      : compaction(c), outfile(NULL), builder(NULL), total_bytes(0) {}
+      : compaction(c),
+        outfile(NULL),
+        builder(NULL),
+        total_bytes(0),
+        compression_micros(0),
+        has_start(false),
+        has_end(false),
+        micros(0) {}
+};
+
+// Key ranges of a compaction to be processed concurrently. Ranges are
+// claimed one at a time by the background thread that owns the compaction
+// and by helper threads scheduled on the compaction pool. The owner waits
+// until every range is done, but helpers that have not yet started may
+// still hold a reference to this object after that.
+struct DBImpl::SubcompactionJob {
+  explicit SubcompactionJob(DBImpl* db)
+      : db(db), cv(&mu), refs(1), next(0), done(0) {}
+  DBImpl* const db;
+  std::vector<CompactionState*> slices;
+  port::Mutex mu;
+  port::CondVar cv;
+  int refs;     // Protected by mu
+  size_t next;  // Index of the next range to claim; protected by mu
+  size_t done;  // Number of ranges finished; protected by mu
+};
+
+// Key sub-ranges of a dump to be processed concurrently. Claimed and
+// reference counted the same way as a SubcompactionJob. All sub-ranges read
+// from the same view so the dump stays consistent.
+struct DBImpl::DumpJob {
+  DumpJob(DBImpl* db, const DumpOptions& options, const std::string& dir)
+      : db(db),
+        options(options),
+        dir(dir),
+        cv(&mu),
+        refs(1),
+        next(0),
+        done(0),
+        next_file_number(1) {}
+  DBImpl* const db;
+  const DumpOptions options;
+  const std::string dir;
+  ReadView* view;
+  SequenceNumber seq;
+  // Sub-range i covers [starts[i], limits[i]). An empty start or limit
+  // means the sub-range is unbounded on that side.
+  std::vector<std::string> starts;
+  std::vector<std::string> limits;
+  std::vector<std::vector<DumpedTable> > outputs;
+  std::vector<Status> statuses;
+  port::Mutex mu;
+  port::CondVar cv;
+  int refs;                   // Protected by mu
+  size_t next;                // Index of the next range to claim
+  size_t done;                // Number of ranges finished
+  uint64_t next_file_number;  // Protected by mu
+};
+
+struct DBImpl::ReadView {
+  MemTable* mem;  // May be NULL
+  MemTable* imm;  // May be NULL
+  Version* current;
+  uint64_t epoch;
+  std::atomic<int> refs;
+};
+
+// A per-thread cache of a referenced read view. Padded to avoid false
+// sharing among threads using different slots.
+struct DBImpl::ReadViewSlot {
+  ReadViewSlot() : view(NULL) {}
+  std::atomic<ReadView*> view;
+  char padding[64 - sizeof(std::atomic<ReadView*>)];
 };
 
 struct DBImpl::InsertionState {
@@ -96,6 +180,8 @@ struct DBImpl::InsertionState {
   // Source table files involved in this bulk insertion
   const std::string& source_dir;
   std::vector<std::string> source_names;
+  // Tables listed by the manifest of a dump, if any
+  std::vector<DumpedTable> dumped_tables;
 
   // Table info
   struct File {
@@ -131,15 +217,26 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_number_(0),
       log_(NULL),
       seed_(0),
+      pending_inserts_(0),
       l0_soft_limits_(0),
       l0_hard_limits_(0),
       l0_waits_(0),
       bg_compaction_disabled_(0),
       bg_compaction_paused_(0),
       bg_compaction_scheduled_(false),
+      bg_running_(false),
       bg_compaction_in_progress_(false),
+      bg_subcompactions_running_(0),
       bulk_insert_in_progress_(false),
-      manual_compaction_(NULL) {
+      running_compaction_(NULL),
+      pause_next_compaction_(false),
+      manual_compaction_(NULL),
+      read_view_slots_(new ReadViewSlot[kNumReadViewSlots]),
+      read_view_(NULL),
+      read_view_epoch_(0) {
+  for (int p = 0; p < ThreadPool::kNumPriorities; p++) {
+    bg_queued_[p] = 0;
+  }
   if (!options_.no_memtable) {
     mem_ = new MemTable(internal_comparator_);
     mem_->Ref();
@@ -165,8 +262,14 @@ DBImpl::~DBImpl() {
   while (bg_compaction_scheduled_ || bg_compaction_paused_) {
     bg_cv_.Wait();
   }
+  EmptyReadViewSlots();
+  if (read_view_ != NULL) {
+    UnrefReadViewLocked(read_view_);
+    read_view_ = NULL;
+  }
   mutex_.Unlock();
 
+  delete[] read_view_slots_;
   delete versions_;
   if (mem_ != NULL) mem_->Unref();
   if (imm_ != NULL) imm_->Unref();
@@ -591,10 +694,11 @@ Status DBImpl::WriteLevel0Table(Iterator* iter, VersionEdit* edit,
 #endif
 
   Status s;
+  uint64_t compression_micros = 0;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, min_seq,
-                   max_seq, &meta);
+    s = BuildTable(dbname_, env_, TableOptions(0), table_cache_, iter, min_seq,
+                   max_seq, &meta, &compression_micros);
     mutex_.Lock();
   }
 #if VERBOSE >= 2
@@ -608,6 +712,7 @@ Status DBImpl::WriteLevel0Table(Iterator* iter, VersionEdit* edit,
   pending_outputs_.erase(meta.number);
   CompactionStats stats;
   stats.n = 1;
+  stats.compression_micros = compression_micros;
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
@@ -669,6 +774,7 @@ void DBImpl::CompactMemTable() {
     imm_->Unref();
     imm_ = NULL;
     has_imm_.Release_Store(NULL);
+    InstallReadView();
     DeleteObsoleteFiles();
 #if VERBOSE >= 1
     VersionSet::LevelSummaryStorage tmp;
@@ -777,8 +883,20 @@ bool DBImpl::HasCompaction() {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_ || bg_compaction_paused_) {
-    // Already scheduled or paused
+  if (bg_compaction_paused_) {
+    // Paused
+  } else if (bg_compaction_scheduled_) {
+    // A memtable flush must not wait behind low priority work queued in a
+    // shared pool, so queue another item at high priority. A running item
+    // will flush the memtable by itself.
+    if (imm_ != NULL && bg_queued_[ThreadPool::kLow] != 0 &&
+        bg_queued_[ThreadPool::kHigh] == 0 && !bg_running_ &&
+        options_.compaction_pool != NULL &&
+        !shutting_down_.Acquire_Load() && bg_error_.ok()) {
+      bg_queued_[ThreadPool::kHigh]++;
+      options_.compaction_pool->ScheduleWithPriority(&DBImpl::BGWork, this,
+                                                     ThreadPool::kHigh);
+    }
   } else if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
   } else if (!bg_error_.ok()) {
@@ -788,20 +906,42 @@ void DBImpl::MaybeScheduleCompaction() {
   } else {
     bg_compaction_scheduled_ = true;
     if (options_.compaction_pool != NULL) {
-      options_.compaction_pool->Schedule(&DBImpl::BGWork, this);
+      // Memtable flushes unblock writers so they go ahead of other queued
+      // work such as level compactions from other db instances.
+      if (imm_ != NULL) {
+        bg_queued_[ThreadPool::kHigh]++;
+        options_.compaction_pool->ScheduleWithPriority(&DBImpl::BGWork, this,
+                                                       ThreadPool::kHigh);
+      } else {
+        bg_queued_[ThreadPool::kLow]++;
+        options_.compaction_pool->ScheduleWithPriority(
+            &DBImpl::BGWorkLow, this, ThreadPool::kLow);
+      }
     } else {
+      bg_queued_[ThreadPool::kHigh]++;
       env_->Schedule(&DBImpl::BGWork, this);
     }
   }
 }
 
 void DBImpl::BGWork(void* db) {
-  reinterpret_cast<DBImpl*>(db)->BackgroundCall();
+  reinterpret_cast<DBImpl*>(db)->BackgroundCall(ThreadPool::kHigh);
+}
+
+void DBImpl::BGWorkLow(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundCall(ThreadPool::kLow);
 }
 
-void DBImpl::BackgroundCall() {
+void DBImpl::BackgroundCall(int pri) {
   MutexLock l(&mutex_);
   assert(bg_compaction_scheduled_);
+  assert(bg_queued_[pri] > 0);
+  bg_queued_[pri]--;
+  if (bg_running_) {
+    // Another item is already doing the work
+    return;
+  }
+  bg_running_ = true;
   if (shutting_down_.Acquire_Load()) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
@@ -812,7 +952,10 @@ void DBImpl::BackgroundCall() {
     BackgroundCompactionWrapper();
   }
 
-  bg_compaction_scheduled_ = false;
+  bg_running_ = false;
+  if (bg_queued_[ThreadPool::kHigh] == 0 && bg_queued_[ThreadPool::kLow] == 0) {
+    bg_compaction_scheduled_ = false;
+  }
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
   MaybeScheduleCompaction();
@@ -868,7 +1011,9 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->seq_off,
                        f->smallest, f->largest);
     status = versions_->LogAndApply(c->edit(), &mutex_);
-    if (!status.ok()) {
+    if (status.ok()) {
+      InstallReadView();
+    } else {
       RecordBackgroundError(status);
     }
 #if VERBOSE >= 3
@@ -931,6 +1076,15 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
   delete compact;
 }
 
+DBOptions DBImpl::TableOptions(int level) const {
+  DBOptions options = options_;
+  const std::vector<CompressionType>& c = options_.compression_per_level;
+  if (!c.empty()) {
+    options.compression = c[std::min(static_cast<size_t>(level), c.size() - 1)];
+  }
+  return options;
+}
+
 Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   assert(compact != NULL);
   assert(compact->builder == NULL);
@@ -955,7 +1109,8 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname.c_str(), &compact->outfile);
   if (s.ok()) {
-    compact->builder = new TableBuilder(options_, compact->outfile);
+    compact->builder = new TableBuilder(
+        TableOptions(compact->compaction->level() + 1), compact->outfile);
   }
   return s;
 }
@@ -985,6 +1140,7 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   const uint64_t current_bytes = compact->builder->FileSize();
   compact->current_output()->file_size = current_bytes;
   compact->total_bytes += current_bytes;
+  compact->compression_micros += compact->builder->CompressionMicros();
   delete compact->builder;
   compact->builder = NULL;
 
@@ -1037,7 +1193,11 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          off, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  Status s = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  if (s.ok()) {
+    InstallReadView();
+  }
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -1058,12 +1218,282 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   } else {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
+  running_compaction_ = compact->compaction;
+  if (pause_next_compaction_) {
+    pause_next_compaction_ = false;
+    bg_compaction_paused_++;  // Undone by TEST_ResumeCompaction()
+  }
 
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
+  std::vector<std::string> boundaries;
+  if (options_.max_subcompactions > 1 && options_.compaction_pool != NULL) {
+    GenSubcompactionBoundaries(compact, &boundaries);
+  }
+  CompactionStats stats;
+  Status status;
+  if (boundaries.empty()) {
+    status = DoSubcompactionWork(compact, true, &imm_micros, &paused_micros);
+  } else {
+    status = RunSubcompactions(compact, boundaries, &stats, &imm_micros,
+                               &paused_micros);
+  }
+
+  stats.micros = CurrentMicros() - start_micros - paused_micros - imm_micros;
+  stats.in0 = compact->compaction->num_input_files(0);
+  stats.in1 = compact->compaction->num_input_files(1);
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  stats.files = compact->outputs.size();
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  stats.compression_micros = compact->compression_micros;
+  stats.n = 1;
+
+  mutex_.Lock();
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  running_compaction_ = NULL;
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+#if VERBOSE >= 1
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log, 1, "Compaction done: L%d->L%d, db => %s",
+      compact->compaction->level(), compact->compaction->level() + 1,
+      versions_->LevelSummary(&tmp));
+#endif
+  return status;
+}
+
+namespace {
+struct UserKeyLess {
+  explicit UserKeyLess(const Comparator* ucmp) : ucmp(ucmp) {}
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+  const Comparator* ucmp;
+};
+}  // namespace
+
+// Cut the user key space of a compaction into at most
+// options_.max_subcompactions ranges. Cut points are chosen among the largest
+// keys of the compaction's input files so that each range covers roughly the
+// same number of input files. All entries of a user key always fall into the
+// same range. Leave *boundaries empty if the compaction cannot be split.
+void DBImpl::GenSubcompactionBoundaries(CompactionState* compact,
+                                        std::vector<std::string>* boundaries) {
+  Compaction* const c = compact->compaction;
+  const Comparator* const ucmp = user_comparator();
+  std::vector<Slice> keys;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < c->num_input_files(which); i++) {
+      keys.push_back(c->input(which, i)->largest.user_key());
+    }
+  }
+  std::sort(keys.begin(), keys.end(), UserKeyLess(ucmp));
+  size_t n = 0;  // Number of distinct keys
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (n == 0 || ucmp->Compare(keys[n - 1], keys[i]) != 0) {
+      keys[n++] = keys[i];
+    }
+  }
+  // The overall largest key does not cut anything
+  if (n < 2) {
+    return;
+  }
+  n--;
+  const size_t num_ranges =
+      std::min(static_cast<size_t>(options_.max_subcompactions), n + 1);
+  for (size_t i = 1; i < num_ranges; i++) {
+    boundaries->push_back(keys[i * (n + 1) / num_ranges - 1].ToString());
+  }
+}
+
+Status DBImpl::RunSubcompactions(CompactionState* compact,
+                                 const std::vector<std::string>& boundaries,
+                                 CompactionStats* stats, int64_t* imm_micros,
+                                 int64_t* paused_micros) {
+  const size_t num_ranges = boundaries.size() + 1;
+  SubcompactionJob* const job = new SubcompactionJob(this);
+  for (size_t i = 0; i < num_ranges; i++) {
+    CompactionState* slice = new CompactionState(compact->compaction);
+    slice->smallest_snapshot = compact->smallest_snapshot;
+    if (i != 0) {
+      slice->has_start = true;
+      slice->start = boundaries[i - 1];
+    }
+    if (i != num_ranges - 1) {
+      slice->has_end = true;
+      slice->end = boundaries[i];
+    }
+    job->slices.push_back(slice);
+  }
+  job->refs += num_ranges - 1;
+  for (size_t i = 1; i < num_ranges; i++) {
+    options_.compaction_pool->ScheduleWithPriority(
+        &DBImpl::BGSubcompactionWork, job, ThreadPool::kLow);
+  }
+
+  // Work on unclaimed ranges ourselves. This guarantees progress even if
+  // the compaction pool is busy or has no other thread than us.
+  job->mu.Lock();
+  while (job->next < num_ranges) {
+    CompactionState* const slice = job->slices[job->next++];
+    job->mu.Unlock();
+    slice->status = DoSubcompactionWork(slice, true, imm_micros, paused_micros);
+    job->mu.Lock();
+    job->done++;
+  }
+  // Wait for helpers. Keep serving memtable compactions in the meantime so
+  // writers won't stall behind a long compaction.
+  while (job->done < num_ranges) {
+    if (has_imm_.NoBarrier_Load() != NULL) {
+      job->mu.Unlock();
+      const uint64_t imm_start = CurrentMicros();
+      mutex_.Lock();
+      if (imm_ != NULL) {
+        CompactMemTable();
+        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+      }
+      mutex_.Unlock();
+      *imm_micros += (CurrentMicros() - imm_start);
+      job->mu.Lock();
+    } else if (bg_compaction_paused_) {
+      job->mu.Unlock();
+      const uint64_t pause_start = CurrentMicros();
+      mutex_.Lock();
+      PauseCompactionWork();
+      mutex_.Unlock();
+      *paused_micros += (CurrentMicros() - pause_start);
+      job->mu.Lock();
+    } else {
+      job->cv.TimedWait(10000);
+    }
+  }
+  job->mu.Unlock();
+
+  // Collect results. Ranges are in key order so are their outputs.
+  Status status;
+  for (size_t i = 0; i < num_ranges; i++) {
+    CompactionState* const slice = job->slices[i];
+    if (status.ok()) {
+      status = slice->status;
+    }
+    if (slice->builder != NULL) {
+      slice->builder->Abandon();
+      delete slice->builder;
+    }
+    delete slice->outfile;
+    compact->outputs.insert(compact->outputs.end(), slice->outputs.begin(),
+                            slice->outputs.end());
+    compact->total_bytes += slice->total_bytes;
+    compact->compression_micros += slice->compression_micros;
+    stats->subcompactions++;
+    stats->subcompaction_micros += slice->micros;
+    stats->max_subcompaction_micros = std::max(
+        stats->max_subcompaction_micros, static_cast<int64_t>(slice->micros));
+#if VERBOSE >= 3
+    Log(options_.info_log, 3,
+        "Subcompaction %d/%d: L%d->L%d, %d tables, %llu bytes, %llu us: %s",
+        static_cast<int>(i + 1), static_cast<int>(num_ranges),
+        compact->compaction->level(), compact->compaction->level() + 1,
+        static_cast<int>(slice->outputs.size()),
+        static_cast<unsigned long long>(slice->total_bytes),
+        static_cast<unsigned long long>(slice->micros),
+        slice->status.ToString().c_str());
+#endif
+    delete slice;
+  }
+
+  job->mu.Lock();
+  job->slices.clear();
+  const bool last_ref = (--job->refs == 0);
+  job->mu.Unlock();
+  if (last_ref) {
+    delete job;
+  }
+  return status;
+}
+
+void DBImpl::BGSubcompactionWork(void* arg) {
+  SubcompactionJob* const job = reinterpret_cast<SubcompactionJob*>(arg);
+  job->mu.Lock();
+  while (job->next < job->slices.size()) {
+    CompactionState* const slice = job->slices[job->next++];
+    job->mu.Unlock();
+    slice->status = job->db->DoSubcompactionWork(slice, false, NULL, NULL);
+    job->mu.Lock();
+    job->done++;
+    job->cv.SignalAll();
+  }
+  const bool last_ref = (--job->refs == 0);
+  job->mu.Unlock();
+  if (last_ref) {
+    delete job;
+  }
+}
+
+// Pause the compaction owned by the calling thread until compactions are
+// resumed. Subcompaction helpers are waited for first so that no compaction
+// work is done once bg_compaction_in_progress_ is cleared.
+// REQUIRES: mutex_ has been locked.
+void DBImpl::PauseCompactionWork() {
+  mutex_.AssertHeld();
+  while (bg_compaction_paused_ && bg_subcompactions_running_ != 0) {
+    bg_cv_.Wait();
+  }
+  if (!bg_compaction_paused_) {
+    return;
+  }
+  assert(bg_compaction_in_progress_);
+  bg_compaction_in_progress_ = false;
+  bg_cv_.SignalAll();
+  while (bg_compaction_paused_) {
+    bg_cv_.Wait();
+  }
+  bg_compaction_in_progress_ = true;
+}
+
+// Merge and write out all entries within the key range of a compaction
+// state. Only the background thread owning the compaction (bg_owner) runs
+// memtable compactions along the way. The time it spends doing so and being
+// paused is added to *imm_micros and *paused_micros. Helper threads pause
+// whenever the owner does.
+Status DBImpl::DoSubcompactionWork(CompactionState* compact, bool bg_owner,
+                                   int64_t* imm_micros,
+                                   int64_t* paused_micros) {
+  if (!bg_owner) {
+    mutex_.Lock();
+    while (bg_compaction_paused_) {
+      bg_cv_.Wait();
+    }
+    bg_subcompactions_running_++;
+    mutex_.Unlock();
+  }
+  const uint64_t start_micros = CurrentMicros();
+  uint64_t skipped_micros = 0;
+  const Comparator* const ucmp = user_comparator();
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  if (compact->has_start) {
+    // Skip entries of the start key, which belong to the previous range
+    InternalKey start(compact->start, 0, kTypeDeletion);
+    input->Seek(start.Encode());
+    while (input->Valid() &&
+           ucmp->Compare(ExtractUserKey(input->key()), compact->start) <= 0) {
+      input->Next();
+    }
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
@@ -1071,7 +1501,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load();) {
     // Prioritize memtable compactions and bulk insertion work
-    if (has_imm_.NoBarrier_Load() != NULL) {
+    if (bg_owner && has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = CurrentMicros();
       mutex_.Lock();
       if (imm_ != NULL) {
@@ -1079,24 +1509,37 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (CurrentMicros() - imm_start);
+      const uint64_t imm = CurrentMicros() - imm_start;
+      skipped_micros += imm;
+      *imm_micros += imm;
     }
     if (bg_compaction_paused_) {
       const uint64_t pause_start = CurrentMicros();
       mutex_.Lock();
-      assert(bg_compaction_in_progress_);
-      bg_compaction_in_progress_ = false;
-      bg_cv_.SignalAll();
-      while (bg_compaction_paused_) {
-        bg_cv_.Wait();
+      if (bg_owner) {
+        PauseCompactionWork();
+      } else {
+        bg_subcompactions_running_--;
+        bg_cv_.SignalAll();
+        while (bg_compaction_paused_) {
+          bg_cv_.Wait();
+        }
+        bg_subcompactions_running_++;
       }
-      bg_compaction_in_progress_ = true;
       mutex_.Unlock();
-      paused_micros += (CurrentMicros() - pause_start);
+      const uint64_t paused = CurrentMicros() - pause_start;
+      skipped_micros += paused;
+      if (bg_owner) {
+        *paused_micros += paused;
+      }
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->has_end &&
+        ucmp->Compare(ExtractUserKey(key), compact->end) > 0) {
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->cursor) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -1126,7 +1569,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;  // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                       &compact->cursor)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -1145,7 +1589,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key, &compact->cursor),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
@@ -1185,88 +1629,161 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   delete input;
   input = NULL;
 
-  CompactionStats stats;
-  stats.micros = CurrentMicros() - start_micros - paused_micros - imm_micros;
-  stats.in0 = compact->compaction->num_input_files(0);
-  stats.in1 = compact->compaction->num_input_files(1);
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  stats.files = compact->outputs.size();
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
+  compact->micros = CurrentMicros() - start_micros - skipped_micros;
+  if (!bg_owner) {
+    mutex_.Lock();
+    bg_subcompactions_running_--;
+    bg_cv_.SignalAll();
+    mutex_.Unlock();
   }
-  stats.n = 1;
+  return status;
+}
 
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+namespace {
+// Marks a slot whose view is being used by a thread
+char in_use_marker;
+void* const kViewInUse = &in_use_marker;
+
+// Return an id for the calling thread used to pick read view slots.
+unsigned ThreadId() {
+  static std::atomic<unsigned> next_id(0);
+  thread_local unsigned id = next_id.fetch_add(1, std::memory_order_relaxed);
+  return id;
+}
+}  // namespace
 
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
+DBImpl::ReadView* DBImpl::AcquireReadView() {
+  ReadViewSlot* const slot = &read_view_slots_[ThreadId() % kNumReadViewSlots];
+  ReadView* const in_use = static_cast<ReadView*>(kViewInUse);
+  ReadView* v = slot->view.exchange(in_use, std::memory_order_acquire);
+  if (v != NULL && v != in_use) {
+    if (v->epoch == read_view_epoch_.load(std::memory_order_acquire)) {
+      return v;
+    }
+    // A stale view cached by a thread that raced with InstallReadView()
+    UnrefReadView(v);
+  }
+  // Slot is empty either because a new view has been installed or
+  // because another thread sharing the slot is using the cached view
+  view_mu_.Lock();
+  v = read_view_;
+  v->refs.fetch_add(1, std::memory_order_relaxed);
+  view_mu_.Unlock();
+  return v;
+}
+
+void DBImpl::ReleaseReadView(ReadView* v) {
+  ReadViewSlot* const slot = &read_view_slots_[ThreadId() % kNumReadViewSlots];
+  ReadView* expected = static_cast<ReadView*>(kViewInUse);
+  if (v->epoch != read_view_epoch_.load(std::memory_order_acquire)) {
+    // A newer view has been installed since v was acquired. The slot may
+    // have been emptied and then marked by another thread sharing it, so
+    // never cache v.
+    slot->view.compare_exchange_strong(expected, NULL,
+                                       std::memory_order_relaxed);
+    UnrefReadView(v);
+  } else if (!slot->view.compare_exchange_strong(expected, v,
+                                                 std::memory_order_release)) {
+    // The slot has been emptied by InstallReadView() or has been
+    // refilled by another thread in the meantime
+    UnrefReadView(v);
   }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
+}
+
+void DBImpl::UnrefReadView(ReadView* v) {
+  if (v->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    MutexLock l(&mutex_);
+    if (v->mem != NULL) v->mem->Unref();
+    if (v->imm != NULL) v->imm->Unref();
+    v->current->Unref();
+    delete v;
   }
-#if VERBOSE >= 1
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log, 1, "Compaction done: L%d->L%d, db => %s",
-      compact->compaction->level(), compact->compaction->level() + 1,
-      versions_->LevelSummary(&tmp));
-#endif
-  return status;
 }
 
-namespace {
-struct IterState {
-  port::Mutex* mu;
-  Version* version;
-  MemTable* mem;
-  MemTable* imm;
-};
+void DBImpl::UnrefReadViewLocked(ReadView* v) {
+  mutex_.AssertHeld();
+  if (v->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    if (v->mem != NULL) v->mem->Unref();
+    if (v->imm != NULL) v->imm->Unref();
+    v->current->Unref();
+    delete v;
+  }
+}
 
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  if (state->mem != NULL) state->mem->Unref();
-  if (state->imm != NULL) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
+void DBImpl::CleanupReadView(void* db, void* v) {
+  reinterpret_cast<DBImpl*>(db)->UnrefReadView(reinterpret_cast<ReadView*>(v));
 }
-}  // namespace
 
-Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
-                                      SequenceNumber* latest_snapshot,
-                                      uint32_t* seed) {
-  IterState* cleanup = new IterState;
-  mutex_.Lock();
-  *latest_snapshot = versions_->LastSequence();
+void DBImpl::InstallReadView() {
+  mutex_.AssertHeld();
+  Version* const current = versions_->current();
+  ReadView* const old = read_view_;
+  if (old != NULL && old->mem == mem_ && old->imm == imm_ &&
+      old->current == current) {
+    return;  // Nothing changed
+  }
+  ReadView* v = new ReadView;
+  v->mem = mem_;
+  if (v->mem != NULL) v->mem->Ref();
+  v->imm = imm_;
+  if (v->imm != NULL) v->imm->Ref();
+  v->current = current;
+  v->current->Ref();
+  v->epoch = read_view_epoch_.load(std::memory_order_relaxed) + 1;
+  v->refs.store(1, std::memory_order_relaxed);  // Owned by us
+  view_mu_.Lock();
+  read_view_ = v;
+  read_view_epoch_.store(v->epoch, std::memory_order_release);
+  view_mu_.Unlock();
+  EmptyReadViewSlots();
+  if (old != NULL) {
+    UnrefReadViewLocked(old);
+  }
+}
+
+// Threads pick up the latest view once their slots are emptied. A thread
+// currently using its cached view will find its slot emptied when it
+// hands back the view and will drop the view itself.
+void DBImpl::EmptyReadViewSlots() {
+  mutex_.AssertHeld();
+  for (int i = 0; i < kNumReadViewSlots; i++) {
+    ReadView* cached =
+        read_view_slots_[i].view.exchange(NULL, std::memory_order_acq_rel);
+    if (cached != NULL && cached != kViewInUse) {
+      UnrefReadViewLocked(cached);
+    }
+  }
+}
 
+Iterator* DBImpl::NewViewIterator(const ReadOptions& options, ReadView* v) {
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  if (mem_ != NULL) {
-    list.push_back(mem_->NewIterator());
-    mem_->Ref();
+  if (v->mem != NULL) {
+    list.push_back(v->mem->NewIterator());
   }
-  if (imm_ != NULL) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  if (v->imm != NULL) {
+    list.push_back(v->imm->NewIterator());
   }
-  versions_->current()->AddIterators(options, &list);
+  v->current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
+  // The iterator holds its own reference
+  v->refs.fetch_add(1, std::memory_order_relaxed);
+  internal_iter->RegisterCleanup(CleanupReadView, this, v);
+  return internal_iter;
+}
 
-  cleanup->mu = &mutex_;
-  cleanup->mem = mem_;
-  cleanup->imm = imm_;
-  cleanup->version = versions_->current();
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
+Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
+                                      SequenceNumber* latest_snapshot,
+                                      uint32_t* seed) {
+  // Sequence must be obtained before the view so that the view covers
+  // all updates up to the sequence
+  *latest_snapshot = versions_->LastSequence();
+  ReadView* v = AcquireReadView();
+  Iterator* internal_iter = NewViewIterator(options, v);
+  ReleaseReadView(v);
 
   *seed = ++seed_;
-  mutex_.Unlock();
   return internal_iter;
 }
 
@@ -1276,6 +1793,26 @@ Iterator* DBImpl::TEST_NewInternalIterator() {
   return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed);
 }
 
+void DBImpl::TEST_PauseNextCompaction() {
+  MutexLock l(&mutex_);
+  pause_next_compaction_ = true;
+}
+
+void DBImpl::TEST_WaitForPausedCompaction() {
+  MutexLock l(&mutex_);
+  while (pause_next_compaction_ || bg_compaction_in_progress_) {
+    bg_cv_.Wait();
+  }
+}
+
+void DBImpl::TEST_ResumeCompaction() {
+  MutexLock l(&mutex_);
+  assert(bg_compaction_paused_ > 0);
+  bg_compaction_paused_--;
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
 int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   MutexLock l(&mutex_);
   return versions_->MaxNextLevelOverlappingBytes();
@@ -1284,97 +1821,62 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 Status DBImpl::Get(const ReadOptions& options, const LookupKey& lkey,
                    Buffer* value) {
   Status s;
-  MutexLock l(&mutex_);
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  if (mem != NULL) mem->Ref();
-  if (imm != NULL) imm->Ref();
-  current->Ref();
-
+  ReadView* v = AcquireReadView();
   bool have_stat_update = false;
   Version::GetStats stats;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    if (mem != NULL && mem->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else {
-      current->Get(options, lkey, value, &s, &stats);
-      have_stat_update = true;
+  // First look in the memtable, then in the immutable memtable (if any).
+  if ((v->mem != NULL && v->mem->Get(lkey, value, options.limit, &s)) ||
+      (v->imm != NULL && v->imm->Get(lkey, value, options.limit, &s))) {
+    if (s.ok() && value->Pinnable()) {
+      // The value stays in the memtable for as long as the view is alive
+      Iterator* pin = NewEmptyIterator();
+      v->refs.fetch_add(1, std::memory_order_relaxed);
+      pin->RegisterCleanup(CleanupReadView, this, v);
+      value->Pin(pin);
     }
-    mutex_.Lock();
+  } else {
+    v->current->Get(options, lkey, value, &s, &stats);
+    have_stat_update = true;
   }
 
-  if (have_stat_update && current->UpdateStats(stats)) {
-    if (!options_.disable_seek_compaction) {
+  // Only lock once a file has been charged for enough seeks
+  if (have_stat_update && !options_.disable_seek_compaction &&
+      v->current->ChargeSeek(stats)) {
+    MutexLock l(&mutex_);
+    if (v->current->PickSeekCompaction(stats)) {
       MaybeScheduleCompaction();
     }
   }
-  if (mem != NULL) mem->Unref();
-  if (imm != NULL) imm->Unref();
-  current->Unref();
+  ReleaseReadView(v);
   return s;
 }
 
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    Buffer* value) {
-  Status s;
-  MutexLock l(&mutex_);
   SequenceNumber snapshot;
   if (options.snapshot != NULL) {
     snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
   } else {
     snapshot = versions_->LastSequence();
   }
+  // Sequence must be obtained before the read view
+  LookupKey lkey(key, snapshot);
+  return Get(options, lkey, value);
+}
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  if (mem != NULL) mem->Ref();
-  if (imm != NULL) imm->Ref();
-  current->Ref();
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   std::string* value) {
+  db::StringBuf buf(value);
+  Status s = Get(options, key, &buf);
+  return s;
+}
 
-  bool have_stat_update = false;
-  Version::GetStats stats;
-
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem != NULL && mem->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else {
-      current->Get(options, lkey, value, &s, &stats);
-      have_stat_update = true;
-    }
-    mutex_.Lock();
-  }
-
-  if (have_stat_update && current->UpdateStats(stats)) {
-    if (!options_.disable_seek_compaction) {
-      MaybeScheduleCompaction();
-    }
-  }
-  if (mem != NULL) mem->Unref();
-  if (imm != NULL) imm->Unref();
-  current->Unref();
-  return s;
-}
-
-Status DBImpl::Get(const ReadOptions& options, const Slice& key,
-                   std::string* value) {
-  db::StringBuf buf(value);
-  Status s = Get(options, key, &buf);
-  return s;
-}
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   PinnedSlice* value) {
+  value->Reset();
+  return Get(options, key, static_cast<Buffer*>(value));
+}
 
 Status DBImpl::Get(const ReadOptions& options, const Slice& key, Slice* value,
                    char* scratch, size_t scratch_size) {
@@ -1389,6 +1891,79 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key, Slice* value,
   return s;
 }
 
+void DBImpl::MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                      std::string* values, Status* statuses) {
+  if (n == 0) return;
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+  ReadView* v = AcquireReadView();
+
+  std::vector<LookupKey*> lkeys;
+  std::vector<db::StringBuf*> bufs;
+  std::vector<size_t> rest;  // Keys not found in memtables
+  lkeys.reserve(n);
+  bufs.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    lkeys.push_back(new LookupKey(keys[i], snapshot));
+    bufs.push_back(new db::StringBuf(&values[i]));
+    // First look in the memtable, then in the immutable memtable (if any).
+    if (v->mem != NULL &&
+        v->mem->Get(*lkeys[i], bufs[i], options.limit, &statuses[i])) {
+      // Done
+    } else if (v->imm != NULL &&
+               v->imm->Get(*lkeys[i], bufs[i], options.limit, &statuses[i])) {
+      // Done
+    } else {
+      rest.push_back(i);
+    }
+  }
+  std::vector<Version::GetStats> stats(rest.size());
+  if (!rest.empty()) {
+    std::vector<const LookupKey*> restkeys;
+    std::vector<Buffer*> restbufs;
+    std::vector<Status> reststatuses(rest.size());
+    for (size_t j = 0; j < rest.size(); j++) {
+      restkeys.push_back(lkeys[rest[j]]);
+      restbufs.push_back(bufs[rest[j]]);
+    }
+    v->current->MultiGet(options, rest.size(), &restkeys[0], &restbufs[0],
+                         &reststatuses[0], &stats[0]);
+    for (size_t j = 0; j < rest.size(); j++) {
+      statuses[rest[j]] = reststatuses[j];
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    delete bufs[i];
+    delete lkeys[i];
+  }
+
+  // Only lock once a file has been charged for enough seeks
+  std::vector<size_t> exhausted;
+  for (size_t j = 0; j < stats.size(); j++) {
+    if (!options_.disable_seek_compaction &&
+        v->current->ChargeSeek(stats[j])) {
+      exhausted.push_back(j);
+    }
+  }
+  if (!exhausted.empty()) {
+    MutexLock l(&mutex_);
+    bool need_compaction = false;
+    for (size_t j = 0; j < exhausted.size(); j++) {
+      if (v->current->PickSeekCompaction(stats[exhausted[j]])) {
+        need_compaction = true;
+      }
+    }
+    if (need_compaction) {
+      MaybeScheduleCompaction();
+    }
+  }
+  ReleaseReadView(v);
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1398,16 +1973,23 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
       (options.snapshot != NULL
            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
            : latest_snapshot),
-      seed);
+      seed, options.prefix);
 }
 
 void DBImpl::RecordReadSample(Slice key) {
-  MutexLock l(&mutex_);
-  if (versions_->current()->RecordReadSample(key)) {
-    if (!options_.disable_seek_compaction) {
+  if (options_.disable_seek_compaction) {
+    return;
+  }
+  ReadView* v = AcquireReadView();
+  Version::GetStats stats;
+  // Only lock once a file has been charged for enough seeks
+  if (v->current->RecordReadSample(key, &stats)) {
+    MutexLock l(&mutex_);
+    if (v->current->PickSeekCompaction(stats)) {
       MaybeScheduleCompaction();
     }
   }
+  ReleaseReadView(v);
 }
 
 const Snapshot* DBImpl::GetSnapshot() {
@@ -1447,7 +2029,25 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   MutexLock l(&mutex_);
   writers_.push_back(&w);
   while (!w.done && &w != writers_.front()) {
-    w.cv.Wait();
+    if (w.mem != NULL) {
+      // The leader of our write group has assigned us a sequence number and
+      // wants us to insert our own batch into the memtable in parallel.
+      MemTable* const mem = w.mem;
+      w.mem = NULL;
+      mutex_.Unlock();
+      w.status = WriteBatchInternal::InsertIntoConcurrently(w.batch, mem);
+      mutex_.Lock();
+      if (!w.status.ok() && group_insert_status_.ok()) {
+        group_insert_status_ = w.status;
+      }
+      assert(pending_inserts_ > 0);
+      pending_inserts_--;
+      if (pending_inserts_ == 0) {
+        writers_.front()->cv.Signal();
+      }
+    } else {
+      w.cv.Wait();
+    }
   }
   if (w.done) {
     return w.status;
@@ -1471,6 +2071,30 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
 
       if (!options_.no_memtable) {
         bool sync_error = false;
+        // With concurrent memtable writes, each writer in the group inserts
+        // its own batch while we are appending the group's log record. We
+        // assign every batch its sequence numbers before anyone starts.
+        const bool parallel =
+            options_.allow_concurrent_memtable_write && last_writer != &w;
+        if (parallel) {
+          group_insert_status_ = Status::OK();
+          SequenceNumber seq = WriteBatchInternal::Sequence(final_batch);
+          std::deque<Writer*>::iterator iter = writers_.begin();
+          for (; iter != writers_.end(); ++iter) {
+            Writer* const f = *iter;
+            WriteBatchInternal::SetSequence(f->batch, seq);
+            seq += WriteBatchInternal::Count(f->batch);
+            if (f != &w) {
+              f->mem = mem_;
+              pending_inserts_++;
+              f->cv.Signal();
+            }
+            if (f == last_writer) {
+              break;
+            }
+          }
+          assert(seq == last_sequence + 1);
+        }
         // Add to log and apply to memtable. We can release the lock during
         // this phase since &w is currently responsible for logging and
         // protects against concurrent loggers and concurrent writes into
@@ -1486,13 +2110,26 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           }
         }
         if (status.ok()) {
-          status = WriteBatchInternal::InsertInto(final_batch, mem_);
+          if (parallel) {
+            status = WriteBatchInternal::InsertIntoConcurrently(w.batch, mem_);
+          } else {
+            status = WriteBatchInternal::InsertInto(final_batch, mem_);
+          }
         }
         mutex_.Lock();
-        if (sync_error) {
+        // Wait for all group members to finish their memtable insertion
+        while (pending_inserts_ != 0) {
+          w.cv.Wait();
+        }
+        if (parallel && status.ok()) {
+          status = group_insert_status_;
+        }
+        if (sync_error || (parallel && !status.ok())) {
           // The state of the log file is unclear: the log record we just
           // added may or may not show up when the DB is re-opened. So we
-          // force the db into a mode where all future writes fail.
+          // force the db into a mode where all future writes fail. In
+          // parallel mode, the memtable may also contain updates that have
+          // not been logged, or a partially applied batch that has.
           RecordBackgroundError(status);
         }
 
@@ -1516,6 +2153,9 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           if (status.ok()) {
             versions_->SetLastSequence(last_sequence);
             status = versions_->LogAndApply(&edit, &mutex_);
+            if (status.ok()) {
+              InstallReadView();
+            }
           } else {
             RecordBackgroundError(status);
           }
@@ -1555,7 +2195,9 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     Writer* ready = writers_.front();
     writers_.pop_front();
     if (ready != &w) {
-      ready->status = status;
+      if (ready->status.ok()) {
+        ready->status = status;
+      }
       ready->done = true;
       ready->cv.Signal();
     }
@@ -1702,6 +2344,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       has_imm_.Release_Store(imm_);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      InstallReadView();
       force = false;  // Do not force another compaction if have room
       MaybeScheduleCompaction();
     } else {
@@ -1731,6 +2374,9 @@ Status DBImpl::BulkInsert(Iterator* iter) {
       versions_->SetLastSequence(max_seq);
     }
     s = versions_->LogAndApply(&edit, &mutex_);
+    if (s.ok()) {
+      InstallReadView();
+    }
   }
 
   if (!s.ok()) {
@@ -1800,6 +2446,72 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
         value->append(buf);
       }
     }
+    bool has_ingested_files = false;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      if (stats_[level].ingested_files > 0) {
+        has_ingested_files = true;
+        break;
+      }
+    }
+    if (has_ingested_files) {
+      snprintf(buf, sizeof(buf),
+               "\n        Bulk Insertions\n"
+               "Level  Files Size(MB)\n"
+               "---------------------\n");
+      value->append(buf);
+      for (int level = 0; level < config::kNumLevels; level++) {
+        if (stats_[level].ingested_files > 0) {
+          snprintf(buf, sizeof(buf), "%3d %8lld %8.0f\n", level,
+                   static_cast<long long>(stats_[level].ingested_files),
+                   stats_[level].ingested_bytes / 1048576.0);
+          value->append(buf);
+        }
+      }
+    }
+    bool has_subcompactions = false;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      if (stats_[level].subcompactions > 0) {
+        has_subcompactions = true;
+        break;
+      }
+    }
+    if (has_subcompactions) {
+      snprintf(buf, sizeof(buf),
+               "\n                  Subcompactions\n"
+               "Level  Counts Time(sec) Slowest(sec)\n"
+               "------------------------------------\n");
+      value->append(buf);
+      for (int level = 0; level < config::kNumLevels; level++) {
+        if (stats_[level].subcompactions > 0) {
+          snprintf(buf, sizeof(buf), "%3d %9lld %9.0f %12.0f\n", level,
+                   static_cast<long long>(stats_[level].subcompactions),
+                   stats_[level].subcompaction_micros / 1e6,
+                   stats_[level].max_subcompaction_micros / 1e6);
+          value->append(buf);
+        }
+      }
+    }
+    bool has_compression = false;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      if (stats_[level].compression_micros > 0) {
+        has_compression = true;
+        break;
+      }
+    }
+    if (has_compression) {
+      snprintf(buf, sizeof(buf),
+               "\n     Compression\n"
+               "Level  CPU(sec)\n"
+               "---------------\n");
+      value->append(buf);
+      for (int level = 0; level < config::kNumLevels; level++) {
+        if (stats_[level].compression_micros > 0) {
+          snprintf(buf, sizeof(buf), "%3d %11.3f\n", level,
+                   stats_[level].compression_micros / 1e6);
+          value->append(buf);
+        }
+      }
+    }
     return true;
   } else if (in == "l0-events") {
     char buf[200];
@@ -1940,8 +2652,11 @@ Status DBImpl::LoadLevel0Table(InsertionState* insert) {
   return s;
 }
 
+// Move or copy a table into the db. If "dumped" is not NULL, table info is
+// taken from it instead of being read from the table.
 Status DBImpl::MigrateLevel0Table(InsertionState* insert,
-                                  const std::string& source) {
+                                  const std::string& source,
+                                  const DumpedTable* dumped) {
   mutex_.AssertHeld();
   uint64_t file_number = versions_->NewFileNumber();
   pending_outputs_.insert(file_number);
@@ -1966,6 +2681,8 @@ Status DBImpl::MigrateLevel0Table(InsertionState* insert,
   if (s.ok()) {
     if (file_size == 0) {
       s = Status::Corruption(source, "file is empty");
+    } else if (dumped != NULL && file_size != dumped->file_size) {
+      s = Status::Corruption(source, "file size mismatch");
     } else {
       switch (insert->options->method) {
         case kCopy:
@@ -1977,8 +2694,16 @@ Status DBImpl::MigrateLevel0Table(InsertionState* insert,
       }
     }
     if (s.ok()) {
-      insert->current_file()->file_size = file_size;
-      s = LoadLevel0Table(insert);
+      InsertionState::File* const info = insert->current_file();
+      info->file_size = file_size;
+      if (dumped != NULL) {
+        info->min_seq = dumped->min_seq;
+        info->max_seq = dumped->max_seq;
+        info->smallest = dumped->smallest;
+        info->largest = dumped->largest;
+      } else {
+        s = LoadLevel0Table(insert);
+      }
     }
   }
 
@@ -1997,6 +2722,105 @@ Status DBImpl::MigrateLevel0Table(InsertionState* insert,
   return s;
 }
 
+// Choose a level for each table being inserted. A table is placed at the
+// deepest level L such that no existing table at levels 0 to L overlaps it.
+// Newer data thus always stays above older data with the same keys. Tables
+// overlapping each other are left at level 0 where overlaps are allowed.
+void DBImpl::PickInsertionLevels(InsertionState* insert, Version* base,
+                                 std::vector<int>* levels) {
+  mutex_.AssertHeld();
+  const Comparator* const ucmp = user_comparator();
+  const std::vector<InsertionState::File>& files = insert->files;
+  std::vector<size_t> order;
+  for (size_t i = 0; i < files.size(); i++) {
+    order.push_back(i);
+  }
+  struct BySmallestKey {
+    const InternalKeyComparator* icmp;
+    const std::vector<InsertionState::File>* files;
+    bool operator()(size_t a, size_t b) const {
+      return icmp->Compare((*files)[a].smallest, (*files)[b].smallest) < 0;
+    }
+  };
+  BySmallestKey cmp;
+  cmp.icmp = &internal_comparator_;
+  cmp.files = &files;
+  std::sort(order.begin(), order.end(), cmp);
+
+  // A paused compaction will write its outputs at the level below its inputs
+  // and they may span the entire key range of its inputs. Tables falling
+  // into that range must stay above that level.
+  const Compaction* const c = running_compaction_;
+  Slice c_smallest;
+  Slice c_largest;
+  if (c != NULL) {
+    bool first = true;
+    for (int which = 0; which < 2; which++) {
+      for (int i = 0; i < c->num_input_files(which); i++) {
+        const FileMetaData* const f = c->input(which, i);
+        const Slice smallest = f->smallest.user_key();
+        const Slice largest = f->largest.user_key();
+        if (first || ucmp->Compare(smallest, c_smallest) < 0) {
+          c_smallest = smallest;
+        }
+        if (first || ucmp->Compare(largest, c_largest) > 0) {
+          c_largest = largest;
+        }
+        first = false;
+      }
+    }
+  }
+
+  // Find tables overlapping another table of the same insertion
+  std::vector<bool> overlapped(files.size(), false);
+  size_t max_largest = 0;  // Table with the largest key seen so far
+  for (size_t j = 1; j < order.size(); j++) {
+    const InsertionState::File& prev = files[order[max_largest]];
+    const InsertionState::File& f = files[order[j]];
+    if (ucmp->Compare(prev.largest.user_key(), f.smallest.user_key()) >= 0) {
+      overlapped[order[max_largest]] = true;
+      overlapped[order[j]] = true;
+    }
+    if (ucmp->Compare(f.largest.user_key(), prev.largest.user_key()) > 0) {
+      max_largest = j;
+    }
+  }
+
+  uint64_t moved_bytes = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    int level = 0;
+    if (!overlapped[i]) {
+      const Slice smallest = files[i].smallest.user_key();
+      const Slice largest = files[i].largest.user_key();
+      while (level < config::kNumLevels &&
+             !base->OverlapInLevel(level, &smallest, &largest)) {
+        level++;
+      }
+      if (level != 0) {
+        level--;
+      }
+      if (c != NULL && level == c->level() + 1 &&
+          ucmp->Compare(largest, c_smallest) >= 0 &&
+          ucmp->Compare(smallest, c_largest) <= 0) {
+        level = c->level();
+      }
+    }
+    (*levels)[i] = level;
+    if (level != 0) {
+      moved_bytes += files[i].file_size;
+    }
+#if VERBOSE >= 2
+    Log(options_.info_log, 2, "Inserting table #%llu at L%d",
+        static_cast<unsigned long long>(files[i].number), level);
+#endif
+  }
+#if VERBOSE >= 1
+  Log(options_.info_log, 1,
+      "Inserted %llu bytes below level 0 bypassing compaction",
+      static_cast<unsigned long long>(moved_bytes));
+#endif
+}
+
 Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
   mutex_.AssertHeld();
 
@@ -2007,7 +2831,16 @@ Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
   std::string fname = insert->source_dir;
   fname.push_back('/');
   size_t prefix = fname.size();
-  for (size_t i = 0; i < insert->source_names.size(); i++) {
+  // Tables listed by a dump manifest need not be opened
+  for (size_t i = 0; i < insert->dumped_tables.size(); i++) {
+    const DumpedTable* const dumped = &insert->dumped_tables[i];
+    s = MigrateLevel0Table(
+        insert, TableFileName(insert->source_dir, dumped->number), dumped);
+    if (!s.ok()) {
+      break;
+    }
+  }
+  for (size_t i = 0; s.ok() && i < insert->source_names.size(); i++) {
     uint64_t ignored_number;
     FileType type;
     if (!ParseFileName(insert->source_names[i], &ignored_number, &type)) {
@@ -2017,7 +2850,7 @@ Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
       fname.append(insert->source_names[i]);
       switch (type) {
         case kTableFile:
-          s = MigrateLevel0Table(insert, fname);
+          s = MigrateLevel0Table(insert, fname, NULL);
           break;
         default:
           // Skip all other types of file
@@ -2029,11 +2862,16 @@ Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
     }
   }
 
+  std::vector<int> levels(insert->files.size(), 0);
+  if (s.ok() && insert->options->place_in_deepest_level) {
+    PickInsertionLevels(insert, base, &levels);
+  }
+
   if (s.ok()) {
-    const int level = 0;
     VersionEdit edit;
     SequenceNumber next = versions_->LastSequence() + 1;
     for (size_t i = 0; i < insert->files.size(); i++) {
+      const int level = levels[i];
       SequenceOff off = 0;
       if (!insert->options->no_seq_adjustment) {
         assert(insert->files[i].min_seq <= insert->files[i].max_seq);
@@ -2044,10 +2882,19 @@ Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
       edit.AddFile(level, insert->files[i].number, insert->files[i].file_size,
                    off, insert->files[i].smallest, insert->files[i].largest);
     }
+    // Persist the new sequence along with the tables so that it survives
+    // db restarts
+    const SequenceNumber last_seq =
+        std::max(next, insert->options->suggested_max_seq);
+    edit.SetLastSequence(last_seq);
     s = versions_->LogAndApply(&edit, &mutex_);
     if (s.ok()) {
-      versions_->SetLastSequence(
-          std::max(next, insert->options->suggested_max_seq));
+      InstallReadView();
+      versions_->SetLastSequence(last_seq);
+      for (size_t i = 0; i < insert->files.size(); i++) {
+        stats_[levels[i]].ingested_files++;
+        stats_[levels[i]].ingested_bytes += insert->files[i].file_size;
+      }
     }
   }
 
@@ -2067,7 +2914,10 @@ Status DBImpl::AddL0Tables(const InsertOptions& options,
     // Ignore error since we may have already mounted the directory before
     env_->AttachDir(bulk_dir.c_str());
   }
-  s = env_->GetChildren(bulk_dir.c_str(), names);
+  s = ReadDumpManifest(env_, bulk_dir, &insert.dumped_tables);
+  if (s.IsNotFound()) {
+    s = env_->GetChildren(bulk_dir.c_str(), names);
+  }
   if (!s.ok()) {
     return s;
   }
@@ -2097,104 +2947,386 @@ Status DBImpl::AddL0Tables(const InsertOptions& options,
   return s;
 }
 
-Status DBImpl::Dump(const DumpOptions& options, const Range& r,
-                    const std::string& dump_dir, SequenceNumber* min_seq,
-                    SequenceNumber* max_seq) {
-  Status s;
-  SequenceNumber seq;
-  uint32_t ignored_seed;
-  ReadOptions opt;
-  opt.verify_checksums = options.verify_checksums;
-  IteratorWrapper iter(NewInternalIterator(opt, &seq, &ignored_seed));
-  if (options.snapshot != NULL) {
-    seq = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+// Pick up to options.max_parallelism-1 user keys splitting a dump range into
+// sub-ranges of roughly equal size. Candidates are the largest keys of the
+// table files in "v" that fall strictly within the range.
+void DBImpl::GenDumpBoundaries(const DumpOptions& options, const Range& r,
+                               Version* v,
+                               std::vector<std::string>* boundaries) {
+  if (options.max_parallelism <= 1) {
+    return;
   }
+  const Comparator* const ucmp = user_comparator();
+  InternalKey begin(r.start, kMaxSequenceNumber, kValueTypeForSeek);
+  InternalKey end(r.limit, kMaxSequenceNumber, kValueTypeForSeek);
+  std::vector<std::string> candidates;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    std::vector<FileMetaData*> files;
+    v->GetOverlappingInputs(level, r.start.empty() ? NULL : &begin,
+                            r.limit.empty() ? NULL : &end, &files);
+    for (size_t i = 0; i < files.size(); i++) {
+      const Slice k = files[i]->largest.user_key();
+      if ((r.start.empty() || ucmp->Compare(k, r.start) > 0) &&
+          (r.limit.empty() || ucmp->Compare(k, r.limit) < 0)) {
+        candidates.push_back(k.ToString());
+      }
+    }
+  }
+  if (candidates.empty()) {
+    return;
+  }
+  struct Cmp {
+    const Comparator* ucmp;
+    bool operator()(const std::string& a, const std::string& b) const {
+      return ucmp->Compare(a, b) < 0;
+    }
+  };
+  Cmp cmp;
+  cmp.ucmp = ucmp;
+  std::sort(candidates.begin(), candidates.end(), cmp);
+
+  // Weight candidates by their approximate offsets within the db
+  const uint64_t start = versions_->ApproximateOffsetOf(v, begin);
+  uint64_t limit = 0;
+  if (!r.limit.empty()) {
+    limit = versions_->ApproximateOffsetOf(v, end);
+  } else {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      std::vector<FileMetaData*> files;
+      v->GetOverlappingInputs(level, NULL, NULL, &files);
+      for (size_t i = 0; i < files.size(); i++) {
+        limit += files[i]->file_size;
+      }
+    }
+  }
+  if (limit <= start) {
+    return;
+  }
+  const size_t n = std::min(static_cast<size_t>(options.max_parallelism),
+                            candidates.size() + 1);
+  const uint64_t target = (limit - start) / n;
+  uint64_t last = start;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (boundaries->size() == n - 1) {
+      break;
+    }
+    if (!boundaries->empty() &&
+        ucmp->Compare(candidates[i], boundaries->back()) == 0) {
+      continue;
+    }
+    const uint64_t off = versions_->ApproximateOffsetOf(
+        v, InternalKey(candidates[i], kMaxSequenceNumber, kValueTypeForSeek));
+    if (off >= last + target && off < limit) {
+      boundaries->push_back(candidates[i]);
+      last = off;
+    }
+  }
+}
 
-  uint64_t file_size = 0;
-  uint64_t file_number = 1;
-  const std::string fname = TableFileName(dump_dir, file_number);
-  env_->CreateDir(dump_dir.c_str());
+void DBImpl::BGDumpWork(void* arg) {
+  DumpJob* const job = reinterpret_cast<DumpJob*>(arg);
+  job->mu.Lock();
+  while (job->next < job->starts.size()) {
+    const size_t i = job->next++;
+    job->mu.Unlock();
+    job->statuses[i] = job->db->DumpRange(job, i);
+    job->mu.Lock();
+    job->done++;
+    job->cv.SignalAll();
+  }
+  const bool last_ref = (--job->refs == 0);
+  job->mu.Unlock();
+  if (last_ref) {
+    delete job;
+  }
+}
+
+namespace {
+Status FinishDumpTable(TableBuilder* builder, WritableFile* file,
+                       uint64_t* file_size) {
+  Status s = builder->Finish();
+  if (s.ok()) {
+    *file_size = builder->FileSize();
+    assert(*file_size != 0);
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  return s;
+}
+}  // namespace
+
+// Write the newest visible value of every key within the i-th sub-range of a
+// dump into one or more tables.
+Status DBImpl::DumpRange(DumpJob* job, size_t i) {
+  Status s;
+  ReadOptions opt;
+  opt.verify_checksums = job->options.verify_checksums;
+  IteratorWrapper iter(NewViewIterator(opt, job->view));
+  const std::string& start = job->starts[i];
+  const Slice limit = job->limits[i];
+  std::vector<DumpedTable>* const outputs = &job->outputs[i];
+  const DumpFilter* const filter = job->options.filter;
 
   std::string key_buf;
-  if (r.start.empty()) {
+  if (start.empty()) {
     iter.SeekToFirst();
   } else {
-    ParsedInternalKey ikey(r.start, kMaxSequenceNumber, kValueTypeForSeek);
+    ParsedInternalKey ikey(start, kMaxSequenceNumber, kValueTypeForSeek);
     AppendInternalKey(&key_buf, ikey);
     iter.Seek(key_buf);
   }
 
   key_buf.resize(0);
-  if (iter.Valid() && BeforeUserLimit(iter.key(), r.limit)) {
-    WritableFile* file;
-    s = env_->NewWritableFile(fname.c_str(), &file);
-    if (!s.ok()) {
-      return s;
-    }
-
-    if (min_seq != NULL) {
-      *min_seq = kMaxSequenceNumber;
-    }
-    if (max_seq != NULL) {
-      *max_seq = 0;
-    }
-    TableBuilder* builder = new TableBuilder(options_, file);
-    std::string* last_user_key = &key_buf;
-    while (s.ok() && iter.Valid() && BeforeUserLimit(iter.key(), r.limit)) {
-      ParsedInternalKey ikey;
-      if (!ParseInternalKey(iter.key(), &ikey)) {
-        s = Status::Corruption(Slice());
-      } else if (ikey.sequence <= seq) {
-        if (last_user_key->empty() ||
-            user_comparator()->Compare(ikey.user_key, *last_user_key) > 0) {
-          last_user_key->assign(ikey.user_key.data(), ikey.user_key.size());
-          switch (ikey.type) {
-            case kTypeDeletion:
-              break;
-            case kTypeValue:
-              builder->Add(iter.key(), iter.value());
-              if (min_seq != NULL) {
-                *min_seq = std::min(*min_seq, ikey.sequence);
-              }
-              if (max_seq != NULL) {
-                *max_seq = std::max(*max_seq, ikey.sequence);
-              }
-              break;
+  std::string* last_user_key = &key_buf;
+  bool has_last_user_key = false;
+  WritableFile* file = NULL;
+  TableBuilder* builder = NULL;
+  DumpedTable* table = NULL;
+  while (s.ok() && iter.Valid() && BeforeUserLimit(iter.key(), limit)) {
+    ParsedInternalKey ikey;
+    if (!ParseInternalKey(iter.key(), &ikey)) {
+      s = Status::Corruption(Slice());
+      break;
+    } else if (ikey.sequence <= job->seq &&
+               (!has_last_user_key ||
+                user_comparator()->Compare(ikey.user_key, *last_user_key) >
+                    0)) {
+      has_last_user_key = true;
+      last_user_key->assign(ikey.user_key.data(), ikey.user_key.size());
+      if (ikey.type == kTypeValue &&
+          (filter == NULL || filter->Select(ikey.user_key, iter.value()))) {
+        if (builder == NULL) {
+          job->mu.Lock();
+          const uint64_t number = job->next_file_number++;
+          job->mu.Unlock();
+          const std::string fname = TableFileName(job->dir, number);
+          s = env_->NewWritableFile(fname.c_str(), &file);
+          if (!s.ok()) {
+            break;
           }
+          outputs->resize(outputs->size() + 1);
+          table = &outputs->back();
+          table->number = number;
+          table->file_size = 0;
+          table->min_seq = kMaxSequenceNumber;
+          table->max_seq = 0;
+          table->smallest.DecodeFrom(iter.key());
+          builder = new TableBuilder(options_, file);
+        }
+        builder->Add(iter.key(), iter.value());
+        table->largest.DecodeFrom(iter.key());
+        table->min_seq = std::min(table->min_seq, ikey.sequence);
+        table->max_seq = std::max(table->max_seq, ikey.sequence);
+        if (job->options.table_file_size != 0 &&
+            builder->FileSize() >= job->options.table_file_size) {
+          s = FinishDumpTable(builder, file, &table->file_size);
+          delete builder;
+          builder = NULL;
+          delete file;
+          file = NULL;
         }
       }
-      iter.Next();
     }
+    iter.Next();
+  }
 
-    if (s.ok() && builder->NumEntries() != 0) {
-      s = builder->Finish();
-      if (s.ok()) {
-        file_size = builder->FileSize();
-        assert(file_size != 0);
-      }
+  if (s.ok()) {
+    s = iter.status();
+  }
+  if (builder != NULL) {
+    if (s.ok()) {
+      s = FinishDumpTable(builder, file, &table->file_size);
     } else {
       builder->Abandon();
     }
     delete builder;
+    delete file;
+  }
+  return s;
+}
 
-    if (s.ok()) {
-      s = file->Sync();
+namespace {
+// Each manifest record describes one table: number, file size, min seq, max
+// seq, followed by its length-prefixed smallest and largest internal keys.
+Status WriteDumpManifest(Env* env, const std::string& dir,
+                         const std::vector<DumpedTable>& tables) {
+  const std::string fname = DumpManifestFileName(dir);
+  WritableFile* file;
+  Status s = env->NewWritableFile(fname.c_str(), &file);
+  if (!s.ok()) {
+    return s;
+  }
+  log::Writer writer(file);
+  std::string record;
+  for (size_t i = 0; s.ok() && i < tables.size(); i++) {
+    record.clear();
+    PutVarint64(&record, tables[i].number);
+    PutVarint64(&record, tables[i].file_size);
+    PutVarint64(&record, tables[i].min_seq);
+    PutVarint64(&record, tables[i].max_seq);
+    PutLengthPrefixedSlice(&record, tables[i].smallest.Encode());
+    PutLengthPrefixedSlice(&record, tables[i].largest.Encode());
+    s = writer.AddRecord(record);
+  }
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+  if (!s.ok()) {
+    env->DeleteFile(fname.c_str());
+  }
+  return s;
+}
+}  // namespace
+
+Status ReadDumpManifest(Env* env, const std::string& dir,
+                        std::vector<DumpedTable>* tables) {
+  struct ManifestReporter : public log::Reader::Reporter {
+    Status* status;
+    virtual void Corruption(size_t bytes, const Status& s) {
+      if (this->status->ok()) {
+        *this->status = s;
+      }
     }
-    if (s.ok()) {
-      s = file->Close();
+  };
+
+  const std::string fname = DumpManifestFileName(dir);
+  SequentialFile* file;
+  Status s = env->NewSequentialFile(fname.c_str(), &file);
+  if (!s.ok()) {
+    if (!env->FileExists(fname.c_str())) {
+      s = Status::NotFound(fname, "no dump manifest");
     }
-    delete file;
+    return s;
   }
 
-  if (s.ok()) {
-    s = iter.status();
+  ManifestReporter reporter;
+  reporter.status = &s;
+  log::Reader reader(file, &reporter, true /*checksum*/, 0 /*initial_offset*/);
+  std::string scratch;
+  Slice record;
+  tables->clear();
+  while (s.ok() && reader.ReadRecord(&record, &scratch)) {
+    DumpedTable table;
+    Slice smallest;
+    Slice largest;
+    if (!GetVarint64(&record, &table.number) ||
+        !GetVarint64(&record, &table.file_size) ||
+        !GetVarint64(&record, &table.min_seq) ||
+        !GetVarint64(&record, &table.max_seq) ||
+        !GetLengthPrefixedSlice(&record, &smallest) ||
+        !GetLengthPrefixedSlice(&record, &largest) || !record.empty()) {
+      s = Status::Corruption(fname, "bad dump manifest record");
+    } else if (table.min_seq > table.max_seq) {
+      s = Status::Corruption(fname, "min seq > max seq");
+    } else {
+      table.smallest.DecodeFrom(smallest);
+      table.largest.DecodeFrom(largest);
+      tables->push_back(table);
+    }
   }
-  if (s.ok() && file_size != 0) {
-    // OK
-  } else {
-    env_->DeleteFile(fname.c_str());
+
+  delete file;
+  return s;
+}
+
+Status DBImpl::Dump(const DumpOptions& options, const Range& r,
+                    const std::string& dump_dir, SequenceNumber* min_seq,
+                    SequenceNumber* max_seq) {
+  DumpJob* const job = new DumpJob(this, options, dump_dir);
+  // Sequence must be obtained before the view so that the view covers all
+  // updates up to the sequence
+  job->seq = versions_->LastSequence();
+  if (options.snapshot != NULL) {
+    job->seq = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
   }
+  ReadView* const v = AcquireReadView();
+  job->view = v;
 
+  std::vector<std::string> boundaries;
+  GenDumpBoundaries(options, r, v->current, &boundaries);
+  const size_t num_ranges = boundaries.size() + 1;
+  for (size_t i = 0; i < num_ranges; i++) {
+    job->starts.push_back(i != 0 ? boundaries[i - 1] : r.start.ToString());
+    job->limits.push_back(i != num_ranges - 1 ? boundaries[i]
+                                              : r.limit.ToString());
+  }
+  job->outputs.resize(num_ranges);
+  job->statuses.resize(num_ranges);
+  env_->CreateDir(dump_dir.c_str());
+  // Remove any manifest left by an earlier dump
+  env_->DeleteFile(DumpManifestFileName(dump_dir).c_str());
+
+  ThreadPool* const pool = options.thread_pool != NULL
+                               ? options.thread_pool
+                               : options_.compaction_pool;
+  if (pool != NULL) {
+    job->refs += num_ranges - 1;
+    for (size_t i = 1; i < num_ranges; i++) {
+      pool->ScheduleWithPriority(&DBImpl::BGDumpWork, job, ThreadPool::kLow);
+    }
+  }
+
+  // Work on unclaimed ranges ourselves
+  job->mu.Lock();
+  while (job->next < num_ranges) {
+    const size_t i = job->next++;
+    job->mu.Unlock();
+    job->statuses[i] = DumpRange(job, i);
+    job->mu.Lock();
+    job->done++;
+  }
+  while (job->done < num_ranges) {
+    job->cv.Wait();
+  }
+  job->mu.Unlock();
+
+  // Collect results. Ranges are in key order so are their outputs.
+  Status s;
+  std::vector<DumpedTable> tables;
+  for (size_t i = 0; i < num_ranges; i++) {
+    if (s.ok()) {
+      s = job->statuses[i];
+    }
+    tables.insert(tables.end(), job->outputs[i].begin(),
+                  job->outputs[i].end());
+  }
+  if (s.ok() && !tables.empty()) {
+    s = WriteDumpManifest(env_, dump_dir, tables);
+  }
+  if (!s.ok()) {
+    for (size_t i = 0; i < tables.size(); i++) {
+      env_->DeleteFile(TableFileName(dump_dir, tables[i].number).c_str());
+    }
+  } else if (!tables.empty()) {
+    if (min_seq != NULL) {
+      *min_seq = kMaxSequenceNumber;
+    }
+    if (max_seq != NULL) {
+      *max_seq = 0;
+    }
+    for (size_t i = 0; i < tables.size(); i++) {
+      if (min_seq != NULL) {
+        *min_seq = std::min(*min_seq, tables[i].min_seq);
+      }
+      if (max_seq != NULL) {
+        *max_seq = std::max(*max_seq, tables[i].max_seq);
+      }
+    }
+  }
+
+  job->mu.Lock();
+  const bool last_ref = (--job->refs == 0);
+  job->mu.Unlock();
+  if (last_ref) {
+    delete job;
+  }
+  ReleaseReadView(v);
   return s;
 }
 
@@ -2226,6 +3358,7 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
       s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
     }
     if (s.ok()) {
+      impl->InstallReadView();
       impl->DeleteObsoleteFiles();
       impl->MaybeScheduleCompaction();
     }
@@ -26,8 +26,12 @@
 #include "pdlfs-common/log_writer.h"
 #include "pdlfs-common/port.h"
 
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <set>
+#include <string>
+#include <vector>
 
 namespace pdlfs {
 // Sanitize db options. The caller should delete result.info_log if it is not
@@ -40,6 +44,7 @@ extern DBOptions SanitizeOptions(const std::string& dbname,
                                  const InternalFilterPolicy* ipolicy,
                                  const DBOptions& raw_options,
                                  bool create_infolog);
+class Compaction;
 class MemTable;
 class TableCache;
 class Version;
@@ -58,8 +63,11 @@ class DBImpl : public DB {
   virtual Status Delete(const WriteOptions&, const Slice& key);
   virtual Status Write(const WriteOptions&, WriteBatch* updates);
   virtual Status Get(const ReadOptions&, const Slice& key, std::string* value);
+  virtual Status Get(const ReadOptions&, const Slice& key, PinnedSlice* value);
   virtual Status Get(const ReadOptions&, const Slice& key, Slice* value,
                      char* scratch, size_t scratch_size);
+  virtual void MultiGet(const ReadOptions&, size_t n, const Slice* keys,
+                        std::string* values, Status* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -92,15 +100,28 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Make the next compaction pause as soon as it starts its work, as if a
+  // bulk insertion had paused it, and keep it paused until
+  // TEST_ResumeCompaction() is called. TEST_WaitForPausedCompaction() returns
+  // once that compaction has paused.
+  void TEST_PauseNextCompaction();
+  void TEST_WaitForPausedCompaction();
+  void TEST_ResumeCompaction();
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
-  // bytes.
+  // bytes. Does not lock mutex_ unless a seek compaction is due.
   void RecordReadSample(Slice key);
 
  protected:
   friend class DB;
   struct CompactionState;
+  struct CompactionStats;
+  struct DumpJob;
   struct InsertionState;
+  struct ReadView;
+  struct ReadViewSlot;
+  struct SubcompactionJob;
   struct Writer;
 
   Status Get(const ReadOptions&, const Slice& key, Buffer* buf);
@@ -110,6 +131,26 @@ class DBImpl : public DB {
                                 SequenceNumber* latest_snapshot,
                                 uint32_t* seed);
 
+  // Return a referenced view of mem_, imm_, and the current version. Does
+  // not lock mutex_. The result must be handed back to ReleaseReadView() by
+  // the same thread, or referenced again and later passed to
+  // UnrefReadView().
+  ReadView* AcquireReadView();
+  void ReleaseReadView(ReadView* v);
+  void UnrefReadView(ReadView* v);  // REQUIRES: mutex_ not held
+  void UnrefReadViewLocked(ReadView* v);
+  static void CleanupReadView(void* db, void* v);
+  // Return an internal iterator over a view. The iterator holds its own
+  // reference to the view.
+  Iterator* NewViewIterator(const ReadOptions&, ReadView* v);
+  // Publish a new read view if mem_, imm_, or the current version has
+  // changed since the last call. Must be called after any such change and
+  // before the new state is made visible through the last sequence number.
+  // REQUIRES: mutex_ held
+  void InstallReadView();
+  // Drop all views cached by threads. REQUIRES: mutex_ held
+  void EmptyReadViewSlots();
+
   // Bulk insert a list of pre-ordered and pre-sequenced updates.
   Status BulkInsert(Iterator* updates);
 
@@ -144,19 +185,40 @@ class DBImpl : public DB {
   bool HasCompaction();
   void MaybeScheduleCompaction();
   static void BGWork(void* db);
-  void BackgroundCall();
+  static void BGWorkLow(void* db);
+  void BackgroundCall(int pri);
   void BackgroundCompactionWrapper();
   void BackgroundCompaction();
   void CleanupCompaction(CompactionState* compact);
   Status DoCompactionWork(CompactionState* compact);
-
+  void GenSubcompactionBoundaries(CompactionState* compact,
+                                  std::vector<std::string>* boundaries);
+  Status RunSubcompactions(CompactionState* compact,
+                           const std::vector<std::string>& boundaries,
+                           CompactionStats* stats, int64_t* imm_micros,
+                           int64_t* paused_micros);
+  static void BGSubcompactionWork(void* job);
+  Status DoSubcompactionWork(CompactionState* compact, bool bg_owner,
+                             int64_t* imm_micros, int64_t* paused_micros);
+  void PauseCompactionWork();
+
+  // Return the options for building tables to be placed at a given level.
+  Options TableOptions(int level) const;
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact);
 
   Status LoadLevel0Table(InsertionState* insert);
-  Status MigrateLevel0Table(InsertionState* insert, const std::string& fname);
+  Status MigrateLevel0Table(InsertionState* insert, const std::string& fname,
+                            const DumpedTable* dumped);
   Status InsertLevel0Tables(InsertionState* insert);
+  void PickInsertionLevels(InsertionState* insert, Version* base,
+                           std::vector<int>* levels);
+
+  void GenDumpBoundaries(const DumpOptions& options, const Range& range,
+                         Version* v, std::vector<std::string>* boundaries);
+  static void BGDumpWork(void* job);
+  Status DumpRange(DumpJob* job, size_t i);
 
   // Constant after construction
   Env* const env_;
@@ -184,7 +246,11 @@ class DBImpl : public DB {
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
-  uint32_t seed_;  // For sampling.
+  std::atomic<uint32_t> seed_;  // For sampling.
+  // Number of group members still inserting into mem_ concurrently
+  int pending_inserts_;
+  // First error hit by a group member inserting into mem_ concurrently
+  Status group_insert_status_;
 
   // Queue of writers.
   std::deque<Writer*> writers_;
@@ -212,11 +278,26 @@ class DBImpl : public DB {
   unsigned int bg_compaction_paused_;
   // Has a background compaction been scheduled and not yet completed?
   bool bg_compaction_scheduled_;
+  // Number of background work items queued at each priority but not yet
+  // started, and whether one of them is running. A memtable flush queues an
+  // additional high priority item when only low priority items are queued.
+  // Whichever item runs first does the work.
+  int bg_queued_[ThreadPool::kNumPriorities];
+  bool bg_running_;
   // Is there an active background compaction job? Background compaction work
   // may be paused (inactive) in the middle
   bool bg_compaction_in_progress_;
+  // Number of subcompactions being run by helper threads that are not
+  // paused. A compaction is only considered paused once this drops to 0.
+  int bg_subcompactions_running_;
   // Is there an active foreground bulk insertion job?
   bool bulk_insert_in_progress_;
+  // The compaction being processed by DoCompactionWork(), which may be
+  // paused, or NULL. Bulk insertions must not place tables where its outputs
+  // will go.
+  Compaction* running_compaction_;
+  // Pause the next compaction as it starts. Only set by tests.
+  bool pause_next_compaction_;
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -230,6 +311,18 @@ class DBImpl : public DB {
 
   VersionSet* versions_;
 
+  // Readers get mem_, imm_, and the current version through ref-counted read
+  // views so they never need mutex_. Each thread caches a referenced view
+  // in one of the slots below, which are emptied when a new view is
+  // installed. Threads only take view_mu_ (never mutex_) on a slot miss.
+  // Each view is stamped with the epoch at which it was installed so that
+  // views made stale by a racing install are neither used nor cached again.
+  enum { kNumReadViewSlots = 64 };
+  ReadViewSlot* read_view_slots_;
+  port::Mutex view_mu_;
+  ReadView* read_view_;  // Protected by view_mu_; modified with mutex_ held
+  std::atomic<uint64_t> read_view_epoch_;  // Epoch of read_view_
+
   // Have we encountered a background error in paranoid mode?
   Status bg_error_;
 
@@ -247,6 +340,18 @@ class DBImpl : public DB {
     int64_t in1;
     // Number of compactions.
     int64_t n;
+    // Number of key ranges processed by compactions that were split.
+    int64_t subcompactions;
+    // Total time spent processing the key ranges of split compactions.
+    int64_t subcompaction_micros;
+    // Longest time spent processing a single key range of a split compaction.
+    int64_t max_subcompaction_micros;
+    // Number of files bulk inserted directly into this level.
+    int64_t ingested_files;
+    // Total size of files bulk inserted directly into this level.
+    int64_t ingested_bytes;
+    // CPU time spent compressing the blocks of the files produced.
+    int64_t compression_micros;
 
     CompactionStats()
         : micros(0),
@@ -255,7 +360,13 @@ class DBImpl : public DB {
           files(0),
           in0(0),
           in1(0),
-          n(0) {}
+          n(0),
+          subcompactions(0),
+          subcompaction_micros(0),
+          max_subcompaction_micros(0),
+          ingested_files(0),
+          ingested_bytes(0),
+          compression_micros(0) {}
 
     void Add(const CompactionStats& c) {
       this->micros += c.micros;
@@ -265,6 +376,13 @@ class DBImpl : public DB {
       this->in0 += c.in0;
       this->in1 += c.in1;
       this->n += c.n;
+      this->subcompactions += c.subcompactions;
+      this->subcompaction_micros += c.subcompaction_micros;
+      this->max_subcompaction_micros =
+          std::max(this->max_subcompaction_micros, c.max_subcompaction_micros);
+      this->ingested_files += c.ingested_files;
+      this->ingested_bytes += c.ingested_bytes;
+      this->compression_micros += c.compression_micros;
     }
   };
   CompactionStats stats_[config::kNumLevels];
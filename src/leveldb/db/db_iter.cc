@@ -59,11 +59,12 @@ class DBIter : public Iterator {
   enum Direction { kForward, kReverse };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, const Slice& prefix)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        prefix_(prefix.data(), prefix.size()),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
@@ -97,6 +98,13 @@ class DBIter : public Iterator {
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
+  void SetReverseNotSupported() {
+    valid_ = false;
+    saved_key_.clear();
+    ClearSavedValue();
+    status_ = Status::NotSupported("Reverse iteration with a prefix");
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
@@ -117,6 +125,8 @@ class DBIter : public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  // If non-empty, only keys starting with prefix_ are returned
+  const std::string prefix_;
 
   Status status_;
   std::string saved_key_;    // == current key when direction_==kReverse
@@ -183,7 +193,11 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   assert(direction_ == kForward);
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+    if (!ParseKey(&ikey)) {
+      // Skip
+    } else if (!prefix_.empty() && !ikey.user_key.starts_with(prefix_)) {
+      break;  // Past the prefix
+    } else if (ikey.sequence <= sequence_) {
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -211,6 +225,10 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
 
 void DBIter::Prev() {
   assert(valid_);
+  if (!prefix_.empty()) {
+    SetReverseNotSupported();
+    return;
+  }
 
   if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
@@ -282,8 +300,12 @@ void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
+  Slice start = target;
+  if (!prefix_.empty() && user_comparator_->Compare(start, prefix_) < 0) {
+    start = prefix_;
+  }
   AppendInternalKey(&saved_key_,
-                    ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+                    ParsedInternalKey(start, sequence_, kValueTypeForSeek));
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
@@ -293,6 +315,10 @@ void DBIter::Seek(const Slice& target) {
 }
 
 void DBIter::SeekToFirst() {
+  if (!prefix_.empty()) {
+    Seek(prefix_);
+    return;
+  }
   direction_ = kForward;
   ClearSavedValue();
   iter_->SeekToFirst();
@@ -304,6 +330,10 @@ void DBIter::SeekToFirst() {
 }
 
 void DBIter::SeekToLast() {
+  if (!prefix_.empty()) {
+    SetReverseNotSupported();
+    return;
+  }
   direction_ = kReverse;
   ClearSavedValue();
   iter_->SeekToLast();
@@ -319,8 +349,10 @@ Iterator* NewDBIterator(
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+    uint32_t seed,
+    const Slice& prefix) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    prefix);
 }
 
 /* clang-format on */
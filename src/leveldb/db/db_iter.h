@@ -27,9 +27,10 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number into
-// appropriate user keys.
+// appropriate user keys. If "prefix" is not empty, the returned iterator
+// only yields user keys starting with it (see ReadOptions::prefix).
 extern Iterator* NewDBIterator(  ///
     DBImpl* db, const Comparator* user_key_comparator, Iterator* internal_iter,
-    SequenceNumber sequence, uint32_t seed);
+    SequenceNumber sequence, uint32_t seed, const Slice& prefix);
 
 }  // namespace pdlfs
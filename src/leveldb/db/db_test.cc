@@ -190,6 +190,11 @@ class SpecialEnv : public EnvWrapper {
         counter_->Increment();
         return target_->Read(offset, n, result, scratch);
       }
+      // A batch of reads counts as one
+      virtual void MultiRead(ReadRequest* reqs, size_t n) const {
+        counter_->Increment();
+        target_->MultiRead(reqs, n);
+      }
     };
 
     Status s = target()->NewRandomAccessFile(f, r);
@@ -206,9 +211,20 @@ class DBTest {
 
  private:
   const FilterPolicy* filter_policy_;
+  const FilterPolicy* blocked_filter_policy_;
+  ThreadPool* compression_pool_;
 
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kFilter,
+    kBlockedFullFilter,
+    kUncompressed,
+    kConcurrentMemTableWrite,
+    kCompressionPool,
+    kCompressionPerLevel,
+    kEnd
+  };
   int option_config_;
 
  public:
@@ -220,6 +236,8 @@ class DBTest {
 
   DBTest() : option_config_(kDefault), env_(new SpecialEnv(Env::Default())) {
     filter_policy_ = NewBloomFilterPolicy(10);
+    blocked_filter_policy_ = NewBlockedBloomFilterPolicy(10);
+    compression_pool_ = ThreadPool::NewFixed(2);
     dbname_ = test::TmpDir() + "/db_test";
     DestroyDB(dbname_, Options());
     db_ = NULL;
@@ -231,6 +249,8 @@ class DBTest {
     DestroyDB(dbname_, Options());
     delete env_;
     delete filter_policy_;
+    delete blocked_filter_policy_;
+    delete compression_pool_;
   }
 
   // Switch to a fresh database with the next option configuration to
@@ -252,9 +272,27 @@ class DBTest {
       case kFilter:
         options.filter_policy = filter_policy_;
         break;
+      case kBlockedFullFilter:
+        options.filter_policy = blocked_filter_policy_;
+        options.full_filter = true;
+        break;
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kConcurrentMemTableWrite:
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kCompressionPool:
+        options.filter_policy = filter_policy_;
+        options.compression_pool = compression_pool_;
+        options.max_inflight_blocks = 4;
+        break;
+      case kCompressionPerLevel:
+        options.compression_per_level.push_back(kNoCompression);
+        options.compression_per_level.push_back(kLZ4Compression);
+        options.compression_per_level.push_back(kZstdCompression);
+        options.compression_dict_size = 4096;
+        break;
       default:
         break;
     }
@@ -311,6 +349,27 @@ class DBTest {
     return result;
   }
 
+  // Lookup all keys with a single MultiGet() call and check that each result
+  // is identical to what Get() returns.
+  void CheckMultiGet(const std::vector<std::string>& keys,
+                     const Snapshot* snapshot = NULL) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values(keys.size());
+    std::vector<Status> statuses(keys.size());
+    db_->MultiGet(options, keys.size(), &slices[0], &values[0], &statuses[0]);
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::string result = values[i];
+      if (statuses[i].IsNotFound()) {
+        result = "NOT_FOUND";
+      } else if (!statuses[i].ok()) {
+        result = statuses[i].ToString();
+      }
+      ASSERT_EQ(Get(keys[i], snapshot), result) << keys[i];
+    }
+  }
+
   int FetchSize(const std::string& k) {
     ReadOptions options;
     char buf[1];
@@ -465,9 +524,11 @@ class DBTest {
   }
 
   // Prevent pushing of new sstables into deeper levels by adding
-  // tables that cover a specified range to all levels.
+  // tables that cover a specified range to all levels. Waits for the level-0
+  // compaction these tables trigger so it cannot race with the caller.
   void FillLevels(const std::string& smallest, const std::string& largest) {
     MakeTables(config::kNumLevels, smallest, largest);
+    ASSERT_OK(db_->DrainCompactions());
   }
 
   void DumpFileCounts(const char* label) {
@@ -696,6 +757,81 @@ TEST(DBTest, GetEncountersEmptyLevel) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, MultiGet) {
+  do {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 200; i++) {
+      char tmp[20];
+      snprintf(tmp, sizeof(tmp), "key%06d", i);
+      keys.push_back(tmp);
+    }
+    // Spread keys and overwrites over several levels and the memtable.
+    // Values are large enough for each table to have many data blocks.
+    const std::string pad(300, 'x');
+    for (int i = 0; i < 200; i += 2) ASSERT_OK(Put(keys[i], "v1" + pad));
+    Compact(keys.front(), keys.back());
+    for (int i = 0; i < 200; i += 3) ASSERT_OK(Put(keys[i], "v2" + pad));
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 200; i += 5) ASSERT_OK(Delete(keys[i]));
+    dbfull()->TEST_CompactMemTable();
+    const Snapshot* snap = db_->GetSnapshot();
+    for (int i = 0; i < 200; i += 7) ASSERT_OK(Put(keys[i], "v3" + pad));
+    std::vector<std::string> lookups(keys);
+    lookups.push_back("a-missing");
+    lookups.push_back("key000004");  // Duplicates are allowed
+    lookups.push_back("z-missing");
+    CheckMultiGet(lookups);
+    CheckMultiGet(lookups, snap);
+    ASSERT_EQ("v3" + pad, Get(keys[0]));
+    ASSERT_EQ("NOT_FOUND", Get(keys[0], snap));
+    db_->ReleaseSnapshot(snap);
+    dbfull()->TEST_CompactMemTable();
+    CheckMultiGet(lookups);
+    // A single key and an empty batch
+    CheckMultiGet(std::vector<std::string>(1, keys[1]));
+    db_->MultiGet(ReadOptions(), 0, NULL, NULL, NULL);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, PinnedGet) {
+  do {
+    const std::string big(1000, 'b');
+    ASSERT_OK(Put("foo", "v1"));
+    ASSERT_OK(Put("bar", "v1"));
+    ASSERT_OK(Put("baz", big));
+    PinnedSlice mem_value;
+    ASSERT_OK(db_->Get(ReadOptions(), "foo", &mem_value));
+    ASSERT_TRUE(mem_value.pinned());
+    ASSERT_EQ("v1", mem_value.ToString());
+    dbfull()->TEST_CompactMemTable();
+    PinnedSlice table_value;
+    ASSERT_OK(db_->Get(ReadOptions(), "baz", &table_value));
+    ASSERT_TRUE(table_value.pinned());
+    ASSERT_EQ(big, table_value.ToString());
+    // Reuse
+    ASSERT_OK(db_->Get(ReadOptions(), "bar", &mem_value));
+    ASSERT_EQ("v1", mem_value.ToString());
+    ASSERT_OK(db_->Get(ReadOptions(), "foo", &mem_value));
+    // Pinned values outlive overwrites, memtable compactions, and the
+    // removal of the tables that held them
+    ASSERT_OK(Put("foo", "v2"));
+    ASSERT_OK(Put("baz", "v2"));
+    dbfull()->TEST_CompactMemTable();
+    Compact("a", "z");
+    ASSERT_EQ("v2", Get("baz"));
+    ASSERT_EQ("v1", mem_value.ToString());
+    ASSERT_EQ(big, table_value.ToString());
+    PinnedSlice missing;
+    ASSERT_TRUE(db_->Get(ReadOptions(), "missing", &missing).IsNotFound());
+    ASSERT_TRUE(!missing.pinned());
+    ASSERT_EQ(0, missing.size());
+    table_value.Reset();
+    ASSERT_EQ(0, table_value.size());
+    ASSERT_OK(db_->Get(ReadOptions(), "foo", &mem_value));
+    ASSERT_EQ("v2", mem_value.ToString());
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, IterEmpty) {
   Iterator* iter = db_->NewIterator(ReadOptions());
 
@@ -1157,6 +1293,183 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+namespace {
+// Occupies the only thread of a pool until released.
+struct PoolBlocker {
+  PoolBlocker() : cv(&mu), blocked(true) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  bool blocked;
+};
+
+void BlockPool(void* arg) {
+  PoolBlocker* const b = reinterpret_cast<PoolBlocker*>(arg);
+  MutexLock l(&b->mu);
+  while (b->blocked) {
+    b->cv.Wait();
+  }
+}
+
+struct CompactionThread {
+  DBImpl* db;
+  port::AtomicPointer done;
+};
+
+void CompactLevel0(void* arg) {
+  CompactionThread* const t = reinterpret_cast<CompactionThread*>(arg);
+  t->db->TEST_CompactRange(0, NULL, NULL);
+  t->done.Release_Store(t);
+}
+
+// Wait until a pool's debug string reports a given queue state.
+bool WaitForPoolState(ThreadPool* pool, const char* state) {
+  for (int i = 0; i < 1000; i++) {
+    if (pool->ToDebugString().find(state) != std::string::npos) {
+      return true;
+    }
+    SleepForMicroseconds(10000);
+  }
+  return false;
+}
+}  // namespace
+
+TEST(DBTest, FlushOvertakesQueuedCompaction) {
+  ThreadPool* const pool = ThreadPool::NewFixed(1, true);
+  Options options = CurrentOptions();
+  options.compaction_pool = pool;
+  options.write_buffer_size = 100000;
+  Reopen(&options);
+  PoolBlocker blocker;
+  pool->Schedule(&BlockPool, &blocker);
+  // Queue a low priority item for a manual compaction
+  CompactionThread thread;
+  thread.db = dbfull();
+  thread.done.Release_Store(NULL);
+  env_->StartThread(&CompactLevel0, &thread);
+  ASSERT_TRUE(WaitForPoolState(pool, "queued=[high=0, low=1]"));
+  // Fill the memtable so that it is handed over for flushing
+  ASSERT_OK(Put("a", std::string(150000, 'a')));
+  ASSERT_OK(Put("b", std::string(150000, 'b')));
+  // The flush is queued at high priority ahead of the compaction
+  ASSERT_TRUE(WaitForPoolState(pool, "queued=[high=1, low=1]"));
+  blocker.mu.Lock();
+  blocker.blocked = false;
+  blocker.cv.Signal();
+  blocker.mu.Unlock();
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  while (thread.done.Acquire_Load() == NULL) {
+    DelayMilliseconds(10);
+  }
+  ASSERT_EQ(Get("a"), std::string(150000, 'a'));
+  ASSERT_EQ(Get("b"), std::string(150000, 'b'));
+  Close();
+  delete pool;
+}
+
+TEST(DBTest, Subcompactions) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3, true);
+  Options options = CurrentOptions();
+  options.compaction_pool = pool;
+  options.max_subcompactions = 4;
+  options.max_mem_compact_level = 0;  // Keep all memtable outputs at level-0
+  options.disable_compaction = true;  // Only compact when asked to
+  Reopen(&options);
+
+  // Build overlapping level-0 tables holding overwrites and deletions
+  std::map<std::string, std::string> model;
+  for (int round = 0; round < 5; round++) {
+    for (int i = 100 * round; i < 100 * round + 500; i += round % 2 + 1) {
+      std::string k = Key(i);
+      if (round != 0 && i % 7 == 0) {
+        ASSERT_OK(Delete(k));
+        model.erase(k);
+      } else {
+        std::string v = "v" + NumberToString(round) + "_" + k;
+        ASSERT_OK(Put(k, v));
+        model[k] = v;
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ(NumTableFilesAtLevel(0), 5);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_GT(NumTableFilesAtLevel(1), 0);
+
+  // Every key should be found exactly once in the compacted level
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  std::map<std::string, std::string>::const_iterator it = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_TRUE(it != model.end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->value().ToString(), it->second);
+    ++it;
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_TRUE(it == model.end());
+  delete iter;
+  for (int i = 0; i < 1000; i++) {
+    std::string k = Key(i);
+    ASSERT_EQ(Get(k), model.count(k) != 0 ? model[k] : "NOT_FOUND");
+  }
+
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.stats", &stats));
+  ASSERT_TRUE(stats.find("Subcompactions") != std::string::npos) << stats;
+
+  Close();
+  delete pool;
+}
+
+TEST(DBTest, ECTIndexLookups) {
+  Options options = CurrentOptions();
+  options.ect_index = true;
+  options.block_size = 256;
+  Reopen(&options);
+
+  // Keys have the same length. Many versions of the same key are written
+  // so that they span multiple table blocks.
+  std::map<std::string, std::string> model;
+  char key[20];
+  for (int i = 0; i < 2000; i += 2) {
+    snprintf(key, sizeof(key), "%016d", i);
+    ASSERT_OK(Put(key, std::string(20, 'a')));
+    model[key] = std::string(20, 'a');
+  }
+  snprintf(key, sizeof(key), "%016d", 1000);
+  const Snapshot* snap = db_->GetSnapshot();
+  for (int v = 0; v < 100; v++) {
+    ASSERT_OK(Put(key, "v" + NumberToString(v)));
+  }
+  model[key] = "v99";
+  for (int i = 0; i < 2000; i += 10) {
+    snprintf(key, sizeof(key), "%016d", i);
+    ASSERT_OK(Delete(key));
+    model.erase(key);
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  for (int i = -1; i < 2002; i++) {
+    snprintf(key, sizeof(key), "%016d", i);
+    std::map<std::string, std::string>::iterator it = model.find(key);
+    ASSERT_EQ(Get(key), it != model.end() ? it->second : "NOT_FOUND");
+  }
+  snprintf(key, sizeof(key), "%016d", 1000);
+  ASSERT_EQ(Get(key, snap), std::string(20, 'a'));
+  ASSERT_EQ(Get("short"), "NOT_FOUND");
+  db_->ReleaseSnapshot(snap);
+
+  // Iterators use the regular index
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  std::map<std::string, std::string>::iterator it = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != model.end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+  }
+  ASSERT_TRUE(it == model.end());
+  delete iter;
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -1540,6 +1853,61 @@ TEST(DBTest, L0_CompactionBug_Issue44_b) {
   ASSERT_EQ("(->)(c->cv)", Contents());
 }
 
+TEST(DBTest, PrefixIterationWithCustomComparator) {
+  // Orders keys bytewise except that '0' sorts before '/'. Keys sharing a
+  // prefix remain adjacent but the bytewise successor of "b/" ("b0") sorts
+  // before all keys starting with "b/".
+  class SwappedComparator : public Comparator {
+   public:
+    virtual const char* Name() const { return "test.SwappedComparator"; }
+    virtual int Compare(const Slice& a, const Slice& b) const {
+      const size_t n = std::min(a.size(), b.size());
+      for (size_t i = 0; i < n; i++) {
+        const int r = Rank(a[i]) - Rank(b[i]);
+        if (r != 0) return r;
+      }
+      return static_cast<int>(a.size()) - static_cast<int>(b.size());
+    }
+    virtual void FindShortestSeparator(std::string* s, const Slice& l) const {}
+    virtual void FindShortSuccessor(std::string* key) const {}
+
+   private:
+    static int Rank(char c) {
+      if (c == '/') return '0';
+      if (c == '0') return '/';
+      return static_cast<unsigned char>(c);
+    }
+  };
+  SwappedComparator cmp;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.comparator = &cmp;
+  options.block_size = 256;
+  options.max_mem_compact_level = 0;
+  DestroyAndReopen(&options);
+  char key[20];
+  const char* const prefixes[] = {"a/", "b/", "c/"};
+  for (int p = 0; p < 3; p++) {
+    for (int i = 0; i < 100; i++) {
+      snprintf(key, sizeof(key), "%s%03d", prefixes[p], i);
+      ASSERT_OK(Put(key, std::string(50, 'v')));
+    }
+  }
+  Compact("a", "z");
+  ASSERT_OK(Put("b/new", "v"));
+  ReadOptions bounded;
+  bounded.prefix = "b/";
+  Iterator* iter = db_->NewIterator(bounded);
+  int n = 0;
+  for (iter->Seek("b/"); iter->Valid(); iter->Next()) {
+    ASSERT_TRUE(iter->key().starts_with("b/"));
+    n++;
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(101, n);
+}
+
 TEST(DBTest, ComparatorCheck) {
   class NewComparator : public Comparator {
    public:
@@ -1856,6 +2224,111 @@ TEST(DBTest, FilesDeletedAfterCompaction) {
   ASSERT_EQ(CountFiles(), num_files);
 }
 
+TEST(DBTest, PrefixIteration) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_size = 256;
+  options.max_mem_compact_level = 0;
+  Reopen(&options);
+  char key[20];
+  const char* const prefixes[] = {"a/", "b/", "c/"};
+  for (int p = 0; p < 3; p++) {
+    for (int i = 0; i < 100; i++) {
+      snprintf(key, sizeof(key), "%s%03d", prefixes[p], i);
+      ASSERT_OK(Put(key, std::string(50, 'v')));
+    }
+  }
+  Compact("a", "z");
+  // Tables without keys of the prefix are skipped by bounded iterators
+  ASSERT_OK(Put("c/500", "v"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Put("d/000", "v"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(2, NumTableFilesAtLevel(0));
+  ASSERT_OK(Put("b/new", "v"));
+  ASSERT_OK(Delete("b/005"));
+
+  // Returns the number of entries and random reads made by a scan of "b/"
+  struct Scan {
+    static int Run(DB* db, const ReadOptions& options, AtomicCounter* reads,
+                   int* num_reads) {
+      Iterator* iter = db->NewIterator(options);
+      int n = 0;
+      reads->Reset();
+      for (iter->Seek("b/"); iter->Valid(); iter->Next()) {
+        if (!iter->key().starts_with("b/")) break;
+        n++;
+      }
+      *num_reads = reads->Read();
+      delete iter;
+      return n;
+    }
+  };
+  ReadOptions unbounded;
+  unbounded.fill_cache = false;
+  ReadOptions bounded = unbounded;
+  bounded.prefix = "b/";
+  int unbounded_reads;
+  int bounded_reads;
+  Reopen(&options);
+  ASSERT_EQ(100, Scan::Run(db_, unbounded, &env_->random_read_counter_,
+                           &unbounded_reads));
+  Reopen(&options);
+  ASSERT_EQ(100, Scan::Run(db_, bounded, &env_->random_read_counter_,
+                           &bounded_reads));
+  fprintf(stderr, "unbounded => %d reads, bounded => %d reads\n",
+          unbounded_reads, bounded_reads);
+  ASSERT_LT(bounded_reads, unbounded_reads);
+
+  // Blocks read ahead are fetched using batched reads. Blocks of mmap-ed
+  // files are never read ahead.
+  SpecialEnv unbuffered_env(Env::GetUnBufferedIoEnv());
+  unbuffered_env.count_random_reads_ = true;
+  options.env = &unbuffered_env;
+  ReadOptions cached = bounded;
+  cached.fill_cache = true;
+  ReadOptions readahead = cached;
+  readahead.readahead = 64 << 10;
+  int cached_reads;
+  int readahead_reads;
+  Reopen(&options);
+  ASSERT_EQ(100, Scan::Run(db_, cached, &unbuffered_env.random_read_counter_,
+                           &cached_reads));
+  Reopen(&options);
+  ASSERT_EQ(100, Scan::Run(db_, readahead,
+                           &unbuffered_env.random_read_counter_,
+                           &readahead_reads));
+  fprintf(stderr, "no readahead => %d reads, readahead => %d reads\n",
+          cached_reads, readahead_reads);
+  ASSERT_LT(readahead_reads, cached_reads);
+  options.env = env_;
+  Reopen(&options);
+
+  Iterator* iter = db_->NewIterator(bounded);
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "b/000->" + std::string(50, 'v'));
+  iter->Seek("a/050");
+  ASSERT_EQ(iter->key().ToString(), "b/000");
+  iter->Seek("b/004");
+  iter->Next();
+  ASSERT_EQ(iter->key().ToString(), "b/006");
+  iter->Seek("b/099");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b/new->v");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  iter->Seek("c/000");
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  ASSERT_OK(iter->status());
+  iter->Seek("b/010");
+  iter->Prev();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(iter->status().IsNotSupported());
+  delete iter;
+  env_->count_random_reads_ = false;
+}
+
 TEST(DBTest, BloomFilter) {
   env_->count_random_reads_ = true;
   Options options = CurrentOptions();
@@ -2002,6 +2475,147 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+// Readers obtain memtables and versions without locking. Check that a
+// reader always sees writes completed before its read started while
+// memtables are switched and compacted underneath it.
+namespace {
+
+static const int kNumReaders = 16;
+
+struct ReadViewState {
+  DB* db;
+  port::AtomicPointer stop;
+  port::AtomicPointer last_written;  // Last key written
+  port::AtomicPointer readers_done[kNumReaders];
+  port::AtomicPointer reads[kNumReaders];
+};
+
+struct ReadViewReader {
+  ReadViewState* state;
+  int id;
+};
+
+static void ReadViewReaderBody(void* arg) {
+  ReadViewReader* r = reinterpret_cast<ReadViewReader*>(arg);
+  ReadViewState* state = r->state;
+  Random rnd(301 + r->id);
+  uintptr_t reads = 0;
+  std::string value;
+  while (state->stop.Acquire_Load() == NULL) {
+    uintptr_t last =
+        reinterpret_cast<uintptr_t>(state->last_written.Acquire_Load());
+    if (last != 0) {
+      // Either read the latest key or some older key
+      const int k =
+          static_cast<int>(rnd.OneIn(2) ? last : 1 + rnd.Uniform(last));
+      char key[20];
+      snprintf(key, sizeof(key), "%016d", k);
+      ASSERT_OK(state->db->Get(ReadOptions(), key, &value)) << k;
+      ASSERT_EQ(Slice(key), Slice(value.data(), 16));
+      reads++;
+    }
+  }
+  state->reads[r->id].Release_Store(reinterpret_cast<void*>(reads));
+  state->readers_done[r->id].Release_Store(r);
+}
+
+}  // namespace
+
+TEST(DBTest, ReadViewsFollowWrites) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 32 << 10;  // Frequent memtable switches
+  Reopen(&options);
+  ReadViewState state;
+  state.db = db_;
+  state.stop.Release_Store(NULL);
+  state.last_written.Release_Store(NULL);
+  ReadViewReader readers[kNumReaders];
+  for (int id = 0; id < kNumReaders; id++) {
+    state.readers_done[id].Release_Store(NULL);
+    readers[id].state = &state;
+    readers[id].id = id;
+    env_->StartThread(ReadViewReaderBody, &readers[id]);
+  }
+  const std::string pad(200, 'x');
+  for (uintptr_t k = 1; k <= 5000; k++) {
+    char key[20];
+    snprintf(key, sizeof(key), "%016d", static_cast<int>(k));
+    ASSERT_OK(Put(key, key + pad));
+    state.last_written.Release_Store(reinterpret_cast<void*>(k));
+  }
+  state.stop.Release_Store(&state);
+  uintptr_t total_reads = 0;
+  for (int id = 0; id < kNumReaders; id++) {
+    while (state.readers_done[id].Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+    total_reads += reinterpret_cast<uintptr_t>(state.reads[id].Acquire_Load());
+  }
+  fprintf(stderr, "%d reads, files per level: %s\n",
+          static_cast<int>(total_reads), FilesPerLevel().c_str());
+  ASSERT_GT(NumTableFilesAtLevel(0) + NumTableFilesAtLevel(1) +
+                NumTableFilesAtLevel(2),
+            0);
+}
+
+// Threads sharing a read view slot must not cache views made stale by a
+// racing install. Check that each thread reads its own writes while more
+// threads than there are read view slots write and read concurrently.
+namespace {
+
+static const int kNumSharers = 96;  // More than DBImpl's 64 read view slots
+
+struct SharedSlotState {
+  DB* db;
+  port::AtomicPointer done[kNumSharers];
+};
+
+struct SharedSlotThread {
+  SharedSlotState* state;
+  int id;
+};
+
+static void SharedSlotThreadBody(void* arg) {
+  SharedSlotThread* t = reinterpret_cast<SharedSlotThread*>(arg);
+  DB* const db = t->state->db;
+  char key[20];
+  snprintf(key, sizeof(key), "%016d", t->id);
+  const std::string pad(200, 'x');
+  std::string value;
+  for (int i = 0; i < 100; i++) {
+    const std::string expected = NumberToString(i) + pad;
+    ASSERT_OK(db->Put(WriteOptions(), key, expected));
+    ASSERT_OK(db->Get(ReadOptions(), key, &value));
+    ASSERT_EQ(value, expected) << key;
+  }
+  t->state->done[t->id].Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, ReadViewsSharedSlots) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 32 << 10;  // Frequent memtable switches
+  Reopen(&options);
+  SharedSlotState state;
+  state.db = db_;
+  SharedSlotThread threads[kNumSharers];
+  for (int id = 0; id < kNumSharers; id++) {
+    state.done[id].Release_Store(NULL);
+    threads[id].state = &state;
+    threads[id].id = id;
+    env_->StartThread(SharedSlotThreadBody, &threads[id]);
+  }
+  for (int id = 0; id < kNumSharers; id++) {
+    while (state.done[id].Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+  ASSERT_GT(NumTableFilesAtLevel(0) + NumTableFilesAtLevel(1) +
+                NumTableFilesAtLevel(2),
+            0);
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -35,6 +35,32 @@ void AppendInternalKey(std::string* result, const ParsedInternalKey& key) {
   PutFixed64(result, PackSequenceAndType(key.sequence, key.type));
 }
 
+void PrefixSuccessor(const Slice& prefix, std::string* result) {
+  result->assign(prefix.data(), prefix.size());
+  // Increment the last byte that is not 0xff and drop all bytes after it
+  while (!result->empty()) {
+    const size_t n = result->size() - 1;
+    const uint8_t byte = static_cast<uint8_t>((*result)[n]);
+    if (byte != static_cast<uint8_t>(0xff)) {
+      (*result)[n] = static_cast<char>(byte + 1);
+      return;
+    }
+    result->resize(n);
+  }
+}
+
+void InternalPrefixUpperBound(const Comparator* ucmp, const Slice& prefix,
+                              std::string* result) {
+  result->clear();
+  if (ucmp == BytewiseComparator()) {
+    PrefixSuccessor(prefix, result);
+    if (!result->empty()) {
+      PutFixed64(result,
+                 PackSequenceAndType(kMaxSequenceNumber, kValueTypeForSeek));
+    }
+  }
+}
+
 Slice AppendInternalKeyPtr(char* result, const ParsedInternalKey& key) {
   const Slice& user_key = key.user_key;
   memcpy(result, user_key.data(), user_key.size());
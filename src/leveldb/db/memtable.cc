@@ -18,6 +18,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 
 #include <algorithm>
 
@@ -84,20 +85,22 @@ class MemTableIterator : public Iterator {
 
 Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
 
-void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
-                   const Slice& value) {
-  // Format of an entry is concatenation of:
-  //  key_size     : varint32 of internal_key.size()
-  //  key bytes    : char[internal_key.size()]
-  //  value_size   : varint32 of value.size()
-  //  value bytes  : char[value.size()]
+// Format of an entry is concatenation of:
+//  key_size     : varint32 of internal_key.size()
+//  key bytes    : char[internal_key.size()]
+//  value_size   : varint32 of value.size()
+//  value bytes  : char[value.size()]
+static size_t EntryLength(const Slice& key, const Slice& value) {
+  size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+         VarintLength(value.size()) + value.size();
+}
+
+static char* EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                         const Slice& key, const Slice& value) {
   size_t key_size = key.size();
   size_t val_size = value.size();
   size_t internal_key_size = key_size + 8;
-  const size_t encoded_len = VarintLength(internal_key_size) +
-                             internal_key_size + VarintLength(val_size) +
-                             val_size;
-  char* buf = arena_.Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -105,10 +108,33 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   p += 8;
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
-  assert((p + val_size) - buf == encoded_len);
+  return p + val_size;
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
+                   const Slice& value) {
+  const size_t encoded_len = EntryLength(key, value);
+  char* buf = arena_.Allocate(encoded_len);
+  char* p = EncodeEntry(buf, s, type, key, value);
+  assert(p - buf == encoded_len);
+  (void)p;
   table_.Insert(buf);
 }
 
+void MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+                               const Slice& key, const Slice& value) {
+  const size_t encoded_len = EntryLength(key, value);
+  char* buf;
+  {
+    MutexLock ml(&arena_mutex_);
+    buf = arena_.Allocate(encoded_len);
+  }
+  char* p = EncodeEntry(buf, s, type, key, value);
+  assert(p - buf == encoded_len);
+  (void)p;
+  table_.InsertConcurrently(buf, &arena_mutex_);
+}
+
 bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s) {
   Slice memkey = key.memtable_key();
   Table::Iterator iter(&table_);
@@ -21,6 +21,7 @@
 #include "pdlfs-common/arena.h"
 #include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
+#include "pdlfs-common/port.h"
 
 #include <string>
 
@@ -68,6 +69,11 @@ class MemTable {
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
            const Slice& value);
 
+  // Same as Add(), but may be called by multiple threads at the same time.
+  // REQUIRES: no concurrent calls to Add().
+  void AddConcurrently(SequenceNumber seq, ValueType type, const Slice& key,
+                       const Slice& value);
+
   // If memtable contains a value for key, store a prefix of it in *value
   // and return true. If memtable contains a deletion for key,
   // store a NotFound() error in *status and return true.
@@ -88,6 +94,8 @@ class MemTable {
 
   KeyComparator comparator_;
   int refs_;
+  // Serializes arena allocations made by concurrent inserters
+  port::Mutex arena_mutex_;
   Arena arena_;
   Table table_;
 
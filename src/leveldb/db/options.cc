@@ -40,8 +40,16 @@ DBOptions::DBOptions()
       block_size(4 * 1024),
       block_restart_interval(16),
       index_block_restart_interval(1),
+      index_partition_size(0),
+      ect_index(false),
       compression(kSnappyCompression),
+      compression_dict_size(0),
+      compression_dict_sample_size(1 << 20),
+      compression_pool(NULL),
+      max_inflight_blocks(8),
       filter_policy(NULL),
+      full_filter(false),
+      allow_concurrent_memtable_write(false),
       no_memtable(false),
       gc_skip_deletion(false),
       skip_lock_file(false),
@@ -53,19 +61,22 @@ DBOptions::DBOptions()
       table_builder_skip_verification(false),
       prefetch_compaction_input(false),
       table_bulk_read_size(256 * 1024),
+      mmap_table_bytes(0),
       table_file_size(2 * 1048576),
       max_mem_compact_level(2),
       level_factor(10),
       l1_compaction_trigger(5),
       l0_compaction_trigger(4),
       l0_soft_limit(8),
-      l0_hard_limit(12) {}
+      l0_hard_limit(12),
+      max_subcompactions(1) {}
 
 ReadOptions::ReadOptions()
     : verify_checksums(false),
       fill_cache(true),
       limit(1 << 30),
-      snapshot(NULL) {}
+      snapshot(NULL),
+      readahead(0) {}
 
 WriteOptions::WriteOptions() : sync(false) {}
 
@@ -77,7 +88,8 @@ InsertOptions::InsertOptions(InsertMethod method)
       verify_checksums(false),
       attach_dir_on_start(false),
       detach_dir_on_complete(false),
-      method(method) {}
+      method(method),
+      place_in_deepest_level(false) {}
 
 InsertOptions::InsertOptions()
     : no_seq_adjustment(false),
@@ -85,9 +97,18 @@ InsertOptions::InsertOptions()
       verify_checksums(false),
       attach_dir_on_start(false),
       detach_dir_on_complete(false),
-      method(kRename) {}
+      method(kRename),
+      place_in_deepest_level(false) {}
 
-DumpOptions::DumpOptions() : verify_checksums(false), snapshot(NULL) {}
+DumpOptions::DumpOptions()
+    : verify_checksums(false),
+      snapshot(NULL),
+      table_file_size(0),
+      max_parallelism(1),
+      thread_pool(NULL),
+      filter(NULL) {}
+
+DumpFilter::~DumpFilter() {}
 
 // Fix user-supplied options to be reasonable
 template <class T, class V>
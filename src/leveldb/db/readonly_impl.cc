@@ -28,13 +28,33 @@
 
 namespace pdlfs {
 
+namespace {
+Env* NewTableEnv(const DBOptions& options) {
+  if (options.mmap_table_bytes != 0) {
+    return Env::NewMmapIoEnvWrapper(options.env, options.mmap_table_bytes);
+  } else {
+    return NULL;
+  }
+}
+
+DBOptions WithTableEnv(const DBOptions& raw_options, Env* table_env) {
+  DBOptions result = raw_options;
+  if (table_env != NULL) {
+    result.env = table_env;
+  }
+  return result;
+}
+}  // namespace
+
 ReadonlyDBImpl::ReadonlyDBImpl(const Options& raw_options,
                                const std::string& dbname)
     : env_(raw_options.env),
+      table_env_(NewTableEnv(raw_options)),
       internal_comparator_(raw_options.comparator),
       internal_filter_policy_(raw_options.filter_policy),
       options_(SanitizeOptions(dbname, &internal_comparator_,
-                               &internal_filter_policy_, raw_options, false)),
+                               &internal_filter_policy_,
+                               WithTableEnv(raw_options, table_env_), false)),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       owns_table_cache_(options_.table_cache != raw_options.table_cache),
       dbname_(dbname),
@@ -47,6 +67,15 @@ ReadonlyDBImpl::ReadonlyDBImpl(const Options& raw_options,
 }
 
 ReadonlyDBImpl::~ReadonlyDBImpl() {
+  if (table_env_ != NULL && !owns_table_cache_) {
+    // Tables in a shared table cache must not outlive their mappings
+    std::set<uint64_t> live;
+    versions_->AddLiveFiles(&live);
+    for (std::set<uint64_t>::iterator it = live.begin(); it != live.end();
+         ++it) {
+      table_cache_->Evict(*it);
+    }
+  }
   delete versions_;
   delete log_;
   delete logfile_;
@@ -55,15 +84,27 @@ ReadonlyDBImpl::~ReadonlyDBImpl() {
   if (owns_cache_) delete options_.block_cache;
   if (owns_table_cache_) delete options_.table_cache;
 
+  delete table_env_;
+
   if (options_.detach_dir_on_close) {
     env_->DetachDir(dbname_.c_str());
   }
 }
 
 Status ReadonlyDBImpl::Load() {
+  MutexLock ml(&mutex_);
+  return LoadLocked();
+}
+
+Status ReadonlyDBImpl::Reload() {
+  MutexLock ml(&mutex_);
+  return ReloadLocked();
+}
+
+Status ReadonlyDBImpl::LoadLocked() {
   mutex_.AssertHeld();
   if (log_ != NULL) {
-    return Reload();
+    return ReloadLocked();
   }
 
   env_->AttachDir(dbname_.c_str());
@@ -112,14 +153,16 @@ Status ReadonlyDBImpl::Load() {
   }
 }
 
-Status ReadonlyDBImpl::Reload() {
+Status ReadonlyDBImpl::ReloadLocked() {
   mutex_.AssertHeld();
   if (log_ == NULL) {
-    return Load();
+    return LoadLocked();
   }
 
   env_->DetachDir(dbname_.c_str());
   env_->AttachDir(dbname_.c_str());
+  std::set<uint64_t> old_live;
+  versions_->AddLiveFiles(&old_live);
   Status s;
   Slice record;
   std::string scratch;
@@ -133,9 +176,23 @@ Status ReadonlyDBImpl::Reload() {
     ignore_EOF = false;
   }
 
+  // Tables of unchanged files stay open, along with their mappings
+  EvictObsoleteTables(old_live);
   return s;
 }
 
+void ReadonlyDBImpl::EvictObsoleteTables(const std::set<uint64_t>& old_live) {
+  mutex_.AssertHeld();
+  std::set<uint64_t> live;
+  versions_->AddLiveFiles(&live);
+  for (std::set<uint64_t>::const_iterator it = old_live.begin();
+       it != old_live.end(); ++it) {
+    if (live.count(*it) == 0) {
+      table_cache_->Evict(*it);
+    }
+  }
+}
+
 Status ReadonlyDBImpl::InternalGet(const ReadOptions& options, const Slice& key,
                                    Buffer* value) {
   Status s;
@@ -170,6 +227,12 @@ Status ReadonlyDBImpl::Get(const ReadOptions& options, const Slice& key,
   return s;
 }
 
+Status ReadonlyDBImpl::Get(const ReadOptions& options, const Slice& key,
+                           PinnedSlice* value) {
+  value->Reset();
+  return InternalGet(options, key, value);
+}
+
 Status ReadonlyDBImpl::Get(const ReadOptions& options, const Slice& key,
                            Slice* value, char* scratch, size_t scratch_size) {
   db::DirectBuf buf(scratch, scratch_size);
@@ -183,6 +246,45 @@ Status ReadonlyDBImpl::Get(const ReadOptions& options, const Slice& key,
   return s;
 }
 
+void ReadonlyDBImpl::MultiGet(const ReadOptions& options, size_t n,
+                              const Slice* keys, std::string* values,
+                              Status* statuses) {
+  if (n == 0) return;
+  MutexLock ml(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  Version* current = versions_->current();
+  current->Ref();
+
+  // Unlock while reading from files
+  {
+    mutex_.Unlock();
+    std::vector<LookupKey*> lkeys;
+    std::vector<db::StringBuf*> bufs;
+    lkeys.reserve(n);
+    bufs.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      lkeys.push_back(new LookupKey(keys[i], snapshot));
+      bufs.push_back(new db::StringBuf(&values[i]));
+    }
+    std::vector<Version::GetStats> ignored(n);
+    std::vector<Buffer*> tmp(bufs.begin(), bufs.end());
+    current->MultiGet(options, n, &lkeys[0], &tmp[0], statuses, &ignored[0]);
+    for (size_t i = 0; i < n; i++) {
+      delete bufs[i];
+      delete lkeys[i];
+    }
+    mutex_.Lock();
+  }
+
+  current->Unref();
+}
+
 namespace {
 struct IterState {
   port::Mutex* mu;
@@ -227,7 +329,7 @@ Iterator* ReadonlyDBImpl::NewIterator(const ReadOptions& options) {
       (options.snapshot != NULL
            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
            : latest_snapshot),
-      0);
+      0, options.prefix);
 }
 
 const Snapshot* ReadonlyDBImpl::GetSnapshot() {
@@ -281,9 +383,7 @@ Status ReadonlyDB::Open(const Options& options, const std::string& dbname,
 #if VERBOSE >= 1
   Log(options.info_log, 1, "Opening db at %s ...", dbname.c_str());
 #endif
-  impl->mutex_.Lock();
   Status s = impl->Load();
-  impl->mutex_.Unlock();
   if (s.ok()) {
     *dbptr = impl;
   } else {
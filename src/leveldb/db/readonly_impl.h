@@ -16,6 +16,8 @@
 #include "pdlfs-common/log_reader.h"
 #include "pdlfs-common/port.h"
 
+#include <set>
+
 namespace pdlfs {
 
 class TableCache;
@@ -36,8 +38,11 @@ class ReadonlyDBImpl : public ReadonlyDB {
   virtual Status Load();
   virtual Status Reload();
   virtual Status Get(const ReadOptions&, const Slice& key, std::string* value);
+  virtual Status Get(const ReadOptions&, const Slice& key, PinnedSlice* value);
   virtual Status Get(const ReadOptions&, const Slice& key, Slice* value,
                      char* scratch, size_t scratch_size);
+  virtual void MultiGet(const ReadOptions&, size_t n, const Slice* keys,
+                        std::string* values, Status* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -50,12 +55,19 @@ class ReadonlyDBImpl : public ReadonlyDB {
  private:
   friend class ReadonlyDB;
 
+  Status LoadLocked();
+  Status ReloadLocked();
+  // Evict tables that are no longer referenced by any version.
+  void EvictObsoleteTables(const std::set<uint64_t>& old_live);
+
   Status InternalGet(const ReadOptions&, const Slice& key, Buffer* buf);
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot);
 
   // Constant after construction
   Env* const env_;
+  // Env wrapper for mmapping tables, or NULL if tables are not mmapped
+  Env* const table_env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
   const Options options_;  // options_.comparator == &internal_comparator_
@@ -17,6 +17,8 @@
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
+#include <set>
+
 namespace pdlfs {
 
 class ReadonlyTest {
@@ -82,6 +84,34 @@ class ReadonlyTest {
     ASSERT_GE(max_expected, correct);
   }
 
+  // Lookup every "stride"-th key in [0, end + stride) in batches and check
+  // that exactly keys in [0, end) are found with the right values.
+  void CheckMultiGet(DB* db, int end, int stride) {
+    const int kBatch = 64;
+    std::string key_space[kBatch];
+    Slice keys[kBatch];
+    std::string values[kBatch];
+    Status statuses[kBatch];
+    std::string value_space;
+    for (int i = 0; i < end + stride;) {
+      int n = 0;
+      for (; n < kBatch && i < end + stride; n++, i += stride) {
+        keys[n] = Key(i, &key_space[n]);
+        values[n].clear();
+      }
+      db->MultiGet(ReadOptions(), n, keys, values, statuses);
+      for (int j = 0; j < n; j++) {
+        int k = i - (n - j) * stride;
+        if (k < end) {
+          ASSERT_OK(statuses[j]);
+          ASSERT_EQ(values[j], Value(k, &value_space));
+        } else {
+          ASSERT_TRUE(statuses[j].IsNotFound());
+        }
+      }
+    }
+  }
+
   Slice Key(int i, std::string* storage) {
     char buf[100];
     snprintf(buf, sizeof(buf), "%016d", i);
@@ -121,6 +151,117 @@ TEST(ReadonlyTest, Readonly) {
   delete db;
 }
 
+TEST(ReadonlyTest, MultiGet) {
+  Status s;
+  DB* db;
+  s = DB::Open(options_, dbname_, &db);
+  ASSERT_OK(s);
+  BuildImage(db, 0, 10000);
+  dbfull(db)->TEST_CompactMemTable();
+  BuildImage(db, 5000, 15000);
+  dbfull(db)->TEST_CompactMemTable();
+  delete db;
+  db = NULL;
+  s = ReadonlyDB::Open(options_, dbname_, &db);
+  ASSERT_OK(s);
+  CheckMultiGet(db, 15000, 1);
+  CheckMultiGet(db, 15000, 37);
+  delete db;
+}
+
+namespace {
+// Counts the tables opened through an env.
+class TableOpenCountingEnv : public EnvWrapper {
+ public:
+  explicit TableOpenCountingEnv(Env* base) : EnvWrapper(base), opens(0) {}
+
+  virtual Status NewRandomAccessFile(const char* f, RandomAccessFile** r) {
+    Count(f);
+    return target()->NewRandomAccessFile(f, r);
+  }
+
+  // The mmap env wrapper only asks its base env for file sizes
+  virtual Status GetFileSize(const char* f, uint64_t* size) {
+    Count(f);
+    return target()->GetFileSize(f, size);
+  }
+
+  void Count(const char* f) {
+    if (Slice(f).ends_with(".ldb")) {
+      opens++;
+      names.insert(f);
+    }
+  }
+
+  int opens;
+  std::set<std::string> names;
+};
+
+// Counts the blocks inserted into a cache.
+class InsertCountingCache : public Cache {
+ public:
+  explicit InsertCountingCache(Cache* base) : base_(base), inserts(0) {}
+  virtual ~InsertCountingCache() { delete base_; }
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    inserts++;
+    return base_->Insert(key, value, charge, deleter);
+  }
+  virtual Handle* Lookup(const Slice& key) { return base_->Lookup(key); }
+  virtual void Release(Handle* handle) { base_->Release(handle); }
+  virtual void* Value(Handle* handle) { return base_->Value(handle); }
+  virtual void Erase(const Slice& key) { base_->Erase(key); }
+  virtual uint64_t NewId() { return base_->NewId(); }
+
+ private:
+  Cache* const base_;
+
+ public:
+  int inserts;
+};
+}  // namespace
+
+TEST(ReadonlyTest, MmapTables) {
+  InsertCountingCache cache(NewLRUCache(8 << 20));
+  options_.env = Env::GetUnBufferedIoEnv();
+  options_.compression = kNoCompression;
+  DB* db;
+  ASSERT_OK(DB::Open(options_, dbname_, &db));
+  BuildImage(db, 0, 10000);
+  dbfull(db)->TEST_CompactMemTable();
+
+  TableOpenCountingEnv env(options_.env);
+  DBOptions options = options_;
+  options.env = &env;
+  options.block_cache = &cache;
+  options.mmap_table_bytes = 64 << 20;
+  DB* rdb;
+  ASSERT_OK(ReadonlyDB::Open(options, dbname_, &rdb));
+  Check(rdb, 10000, 10000);
+  CheckMultiGet(rdb, 10000, 7);
+  // Blocks are served directly from the mappings
+  ASSERT_EQ(cache.inserts, 0);
+  ASSERT_TRUE(env.opens > 0);
+
+  BuildImage(db, 10000, 20000);
+  dbfull(db)->TEST_CompactMemTable();
+  ASSERT_OK(reinterpret_cast<ReadonlyDB*>(rdb)->Reload());
+  Check(rdb, 20000, 20000);
+  // Tables of unchanged files are not mapped again
+  ASSERT_EQ(env.opens, env.names.size());
+  ASSERT_EQ(cache.inserts, 0);
+  delete rdb;
+  delete db;
+
+  // Tables beyond the mmap limit are read and cached as usual
+  options.mmap_table_bytes = 1;
+  ASSERT_OK(ReadonlyDB::Open(options, dbname_, &rdb));
+  Check(rdb, 20000, 20000);
+  ASSERT_TRUE(cache.inserts > 0);
+  delete rdb;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
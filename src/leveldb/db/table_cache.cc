@@ -255,7 +255,18 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   }
 
   Table* table = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-  Iterator* result = table->NewIterator(options);
+  Iterator* result;
+  if (!options.prefix.empty() || options.readahead != 0) {
+    // Options are sanitized so keys are ordered by an internal comparator
+    const Comparator* const ucmp =
+        static_cast<const InternalKeyComparator*>(options_->comparator)
+            ->user_comparator();
+    std::string bound;
+    InternalPrefixUpperBound(ucmp, options.prefix, &bound);
+    result = table->NewIterator(options, bound);
+  } else {
+    result = table->NewIterator(options);
+  }
   result->RegisterCleanup(&UnrefEntry, cache_, handle);
   if (seq_off != 0) {
     result = new SequenceOffsetter(seq_off, result);
@@ -345,7 +356,7 @@ void ApplyOffset(void* arg, const Slice& key, const Slice& value) {
 
 Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
                        uint64_t fsize, SequenceOff off, const Slice& key,
-                       void* arg, Saver saver) {
+                       void* arg, Saver saver, Iterator** pin) {
   Cache::Handle* handle;
   Status s = FindTable(fnum, fsize, off, &handle);
   if (!s.ok()) {
@@ -354,8 +365,8 @@ Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
 
   Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
   if (off == 0) {
-    s = t->InternalGet(options, key, arg, saver);
-    cache_->Release(handle);
+    s = t->InternalGet(options, key, arg, saver, pin);
+    ReleaseOrPin(handle, pin);
     return s;
   }
 
@@ -397,12 +408,46 @@ Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
   }
 
   if (s.ok()) {
-    s = t->InternalGet(options, _key, _arg, _saver);
+    s = t->InternalGet(options, _key, _arg, _saver, pin);
   }
-  cache_->Release(handle);
+  ReleaseOrPin(handle, pin);
   return s;
 }
 
+// Release a table handle, or hand it over to the pinned entry of the table
+// if there is one.
+void TableCache::ReleaseOrPin(Cache::Handle* handle, Iterator** pin) {
+  if (pin != NULL && *pin != NULL) {
+    (*pin)->RegisterCleanup(&UnrefEntry, cache_, handle);
+  } else {
+    cache_->Release(handle);
+  }
+}
+
+void TableCache::MultiGet(const ReadOptions& options, uint64_t fnum,
+                          uint64_t fsize, SequenceOff off, size_t n,
+                          const Slice* keys, void* const* args, Saver saver,
+                          Status* statuses) {
+  if (off != 0) {
+    // Sequence offsets must be applied key by key
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = Get(options, fnum, fsize, off, keys[i], args[i], saver);
+    }
+    return;
+  }
+  Cache::Handle* handle;
+  Status s = FindTable(fnum, fsize, off, &handle);
+  if (!s.ok()) {
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = s;
+    }
+    return;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  t->InternalMultiGet(options, n, keys, args, saver, statuses);
+  cache_->Release(handle);
+}
+
 void TableCache::Evict(uint64_t fnum) {
   char buf[16];
   EncodeFixed64(buf, id_);
@@ -55,10 +55,22 @@ class TableCache {
                               SequenceOff seq_off, Table** tableptr = NULL);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value). If "pin" is not NULL
+  // and such a call is made, *pin is set to an iterator keeping the entry
+  // and its table in memory until the caller deletes it.
   Status Get(const ReadOptions& options, uint64_t file_number,
              uint64_t file_size, SequenceOff seq_off, const Slice& k, void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             Iterator** pin = NULL);
+
+  // Same as calling Get() for each of keys[0,n-1] with args[i] and storing
+  // the result in statuses[i], except that data blocks missing from the
+  // block cache are fetched using a single batched read.
+  void MultiGet(const ReadOptions& options, uint64_t file_number,
+                uint64_t file_size, SequenceOff seq_off, size_t n,
+                const Slice* keys, void* const* args,
+                void (*handle_result)(void*, const Slice&, const Slice&),
+                Status* statuses);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
@@ -76,6 +88,8 @@ class TableCache {
   Status FindTable(uint64_t file_number, uint64_t file_size,
                    SequenceOff seq_off, Cache::Handle**);
 
+  void ReleaseOrPin(Cache::Handle* handle, Iterator** pin);
+
   // No copying allowed
   TableCache(const TableCache&);
   void operator=(const TableCache&);
@@ -251,27 +251,67 @@ Iterator* GetFileIterator(void* arg, const ReadOptions& options,
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
+  if (!options.prefix.empty()) {
+    // Tables following one whose largest key is past the prefix are never
+    // opened
+    std::string bound;
+    InternalPrefixUpperBound(vset_->icmp_.user_comparator(), options.prefix,
+                             &bound);
+    return NewBoundedTwoLevelIterator(
+        new LevelFileNumIterator(vset_->icmp_, &files_[level]),
+        &GetFileIterator, NULL, vset_->table_cache_, options, &vset_->icmp_,
+        bound);
+  }
   return NewTwoLevelIterator(
       new LevelFileNumIterator(vset_->icmp_, &files_[level]), &GetFileIterator,
       vset_->table_cache_, options);
 }
 
+// Return true iff "f" may hold user keys starting with "prefix". Keys
+// starting with "prefix" are assumed to be adjacent in the order of "ucmp".
+static bool FileOverlapsPrefix(const Comparator* ucmp, const Slice& prefix,
+                               const FileMetaData* f) {
+  Slice smallest = f->smallest.user_key();
+  return ucmp->Compare(f->largest.user_key(), prefix) >= 0 &&
+         (smallest.starts_with(prefix) || ucmp->Compare(smallest, prefix) < 0);
+}
+
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
+  const Comparator* const ucmp = vset_->icmp_.user_comparator();
+  const Slice& prefix = options.prefix;
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
+    if (!prefix.empty() && !FileOverlapsPrefix(ucmp, prefix, files_[0][i])) {
+      continue;  // Never read by a prefix-bounded iterator
+    }
     iters->push_back(vset_->table_cache_->NewIterator(
         options, files_[0][i]->number, files_[0][i]->file_size,
         files_[0][i]->seq_off));
   }
 
+  std::string start;
+  if (!prefix.empty()) {
+    AppendInternalKey(&start, ParsedInternalKey(prefix, kMaxSequenceNumber,
+                                                kValueTypeForSeek));
+  }
   // For levels > 0, we can use a concatenating iterator that sequentially
   // walks through the non-overlapping files in the level, opening them
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
-    if (!files_[level].empty()) {
-      iters->push_back(NewConcatenatingIterator(options, level));
+    if (files_[level].empty()) {
+      continue;
     }
+    if (!prefix.empty()) {
+      // If the first file whose largest key is at or after the prefix
+      // starts past the prefix, so do all files that follow
+      const size_t i = FindFile(vset_->icmp_, files_[level], start);
+      if (i >= files_[level].size() ||
+          !FileOverlapsPrefix(ucmp, prefix, files_[level][i])) {
+        continue;
+      }
+    }
+    iters->push_back(NewConcatenatingIterator(options, level));
   }
 }
 
@@ -426,8 +466,19 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.buf = buf;
+      // Pinnable buffers reference the value in its table block, so the
+      // block must be kept in memory
+      Iterator* pin = NULL;
       *s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                    f->seq_off, ikey, &saver, SaveValue);
+                                    f->seq_off, ikey, &saver, SaveValue,
+                                    buf->Pinnable() ? &pin : NULL);
+      if (pin != NULL) {
+        if (s->ok() && saver.state == kFound) {
+          buf->Pin(pin);
+        } else {
+          delete pin;
+        }
+      }
       if (!s->ok()) {
         return true;  // Read error
       }
@@ -450,20 +501,208 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
   return false;
 }
 
+namespace {
+// Per-key lookup state shared by all files searched by Version::MultiGet().
+struct MultiGetState {
+  MultiGetState(const ReadOptions& o, const Comparator* ucmp, size_t n,
+                const LookupKey* const* k, Buffer* const* vals, Status* s,
+                Version::GetStats* st)
+      : options(o),
+        keys(k),
+        statuses(s),
+        stats(st),
+        savers(n),
+        last_file_read(n, NULL),
+        last_file_read_level(n, -1),
+        resolved(n, 0) {
+    for (size_t i = 0; i < n; i++) {
+      savers[i].options = &options;
+      savers[i].ucmp = ucmp;
+      savers[i].user_key = keys[i]->user_key();
+      savers[i].buf = vals[i];
+      stats[i].seek_file = NULL;
+      stats[i].seek_file_level = -1;
+    }
+  }
+
+  // Search file "f" for all keys in "batch". Mark keys whose result
+  // becomes known as resolved.
+  void Search(TableCache* table_cache, FileMetaData* f, int level,
+              const std::vector<size_t>& batch) {
+    ikeys.clear();
+    args.clear();
+    for (size_t j = 0; j < batch.size(); j++) {
+      const size_t i = batch[j];
+      if (last_file_read[i] != NULL && stats[i].seek_file == NULL) {
+        // We have had more than one seek for this read.  Charge the 1st file.
+        stats[i].seek_file = last_file_read[i];
+        stats[i].seek_file_level = last_file_read_level[i];
+      }
+      last_file_read[i] = f;
+      last_file_read_level[i] = level;
+      savers[i].state = kNotFound;
+      ikeys.push_back(keys[i]->internal_key());
+      args.push_back(&savers[i]);
+    }
+    results.resize(batch.size());
+    table_cache->MultiGet(options, f->number, f->file_size, f->seq_off,
+                          batch.size(), &ikeys[0], &args[0], SaveValue,
+                          &results[0]);
+    for (size_t j = 0; j < batch.size(); j++) {
+      const size_t i = batch[j];
+      resolved[i] = 1;
+      if (!results[j].ok()) {
+        statuses[i] = results[j];  // Read error
+        continue;
+      }
+      switch (savers[i].state) {
+        case kNotFound:
+          resolved[i] = 0;  // Keep searching in other files
+          break;
+        case kFound:
+          statuses[i] = Status::OK();
+          break;
+        case kDeleted:
+          statuses[i] = Status::NotFound(Slice());
+          break;
+        case kCorrupt:
+          statuses[i] =
+              Status::Corruption("Corrupted key for ", savers[i].user_key);
+          break;
+      }
+    }
+  }
+
+  // Remove resolved keys from "pending".
+  void Prune(std::vector<size_t>* pending) const {
+    size_t m = 0;
+    for (size_t j = 0; j < pending->size(); j++) {
+      if (!resolved[(*pending)[j]]) (*pending)[m++] = (*pending)[j];
+    }
+    pending->resize(m);
+  }
+
+  const ReadOptions& options;
+  const LookupKey* const* keys;
+  Status* statuses;
+  Version::GetStats* stats;
+  std::vector<Saver> savers;
+  std::vector<FileMetaData*> last_file_read;
+  std::vector<int> last_file_read_level;
+  std::vector<char> resolved;
+  // Scratch space reused across files
+  std::vector<Slice> ikeys;
+  std::vector<void*> args;
+  std::vector<Status> results;
+};
+}  // namespace
+
+void Version::MultiGet(const ReadOptions& options, size_t n,
+                       const LookupKey* const* keys, Buffer* const* vals,
+                       Status* statuses, GetStats* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  MultiGetState state(options, ucmp, n, keys, vals, statuses, stats);
+  std::vector<size_t> pending;  // Keys yet to be resolved
+  pending.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    pending.push_back(i);
+  }
+
+  // We can search level-by-level since entries never hop across
+  // levels.  Therefore we are guaranteed that if we find data
+  // in an smaller level, later levels are irrelevant.
+  std::vector<size_t> batch;
+  for (int level = 0; level < config::kNumLevels && !pending.empty();
+       level++) {
+    const size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+
+    if (level == 0) {
+      // Level-0 files may overlap each other.  Process them in order from
+      // newest to oldest, each with all pending keys that it overlaps.
+      std::vector<FileMetaData*> tmp(files_[0]);
+      std::sort(tmp.begin(), tmp.end(), NewestFirst);
+      for (size_t k = 0; k < tmp.size() && !pending.empty(); k++) {
+        FileMetaData* f = tmp[k];
+        batch.clear();
+        for (size_t j = 0; j < pending.size(); j++) {
+          const Slice& user_key = state.savers[pending[j]].user_key;
+          if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
+              ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
+            batch.push_back(pending[j]);
+          }
+        }
+        if (!batch.empty()) {
+          state.Search(vset_->table_cache_, f, 0, batch);
+          state.Prune(&pending);
+        }
+      }
+    } else {
+      // Binary search to find earliest index whose largest key >= ikey
+      // and group keys by the file they fall into.
+      std::vector<std::pair<uint32_t, size_t> > targets;
+      for (size_t j = 0; j < pending.size(); j++) {
+        const size_t i = pending[j];
+        uint32_t index =
+            FindFile(vset_->icmp_, files_[level], keys[i]->internal_key());
+        if (index < num_files &&
+            ucmp->Compare(state.savers[i].user_key,
+                          files_[level][index]->smallest.user_key()) >= 0) {
+          targets.push_back(std::make_pair(index, i));
+        }
+      }
+      std::sort(targets.begin(), targets.end());
+      for (size_t j = 0; j < targets.size();) {
+        const uint32_t index = targets[j].first;
+        batch.clear();
+        for (; j < targets.size() && targets[j].first == index; j++) {
+          batch.push_back(targets[j].second);
+        }
+        state.Search(vset_->table_cache_, files_[level][index], level, batch);
+      }
+      state.Prune(&pending);
+    }
+  }
+
+  for (size_t j = 0; j < pending.size(); j++) {
+    statuses[pending[j]] = Status::NotFound(Slice());
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
+  return ChargeSeek(stats) && PickSeekCompaction(stats);
+}
+
+bool Version::ChargeSeek(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
-  if (f != NULL) {
-    f->allowed_seeks--;
-    if (f->allowed_seeks <= 0 && file_to_compact_ == NULL) {
-      file_to_compact_ = f;
-      file_to_compact_level_ = stats.seek_file_level;
-      return true;
-    }
+  if (f == NULL) {
+    return false;
+  } else if (file_to_compact_.load(std::memory_order_relaxed) != NULL) {
+    return false;  // No more seek compactions for this version
+  } else if (f->allowed_seeks.load(std::memory_order_relaxed) <= 0) {
+    return false;  // Already reported
+  }
+  // Concurrent readers may charge the same file but only the one that
+  // exhausts it reports it
+  return f->allowed_seeks.fetch_sub(1, std::memory_order_relaxed) == 1;
+}
+
+bool Version::PickSeekCompaction(const GetStats& stats) {
+  FileMetaData* f = stats.seek_file;
+  if (f == NULL) {
+    return false;
+  } else if (file_to_compact_.load(std::memory_order_relaxed) != NULL) {
+    // Another file got picked first. Let this one be reported again
+    // once the next version is installed.
+    f->allowed_seeks.store(1, std::memory_order_relaxed);
+    return false;
   }
-  return false;
+  file_to_compact_level_ = stats.seek_file_level;
+  file_to_compact_.store(f, std::memory_order_relaxed);
+  return true;
 }
 
-bool Version::RecordReadSample(Slice internal_key) {
+bool Version::RecordReadSample(Slice internal_key, GetStats* stats) {
   ParsedInternalKey ikey;
   if (!ParseInternalKey(internal_key, &ikey)) {
     return false;
@@ -496,7 +735,8 @@ bool Version::RecordReadSample(Slice internal_key) {
   // finding such files?
   if (state.matches >= 2) {
     // 1MB cost is about 1 seek (see comment in Builder::Apply).
-    return UpdateStats(state.stats);
+    *stats = state.stats;
+    return ChargeSeek(state.stats);
   }
   return false;
 }
@@ -712,8 +952,9 @@ class VersionSet::Builder {
       // same as the compaction of 40KB of data.  We are a little
       // conservative and allow approximately one seek for every 16KB
       // of data before triggering a compaction.
-      f->allowed_seeks = (f->file_size / 16384);
-      if (f->allowed_seeks < 100) f->allowed_seeks = 100;
+      int allowed_seeks = static_cast<int>(f->file_size / 16384);
+      if (allowed_seeks < 100) allowed_seeks = 100;
+      f->allowed_seeks.store(allowed_seeks, std::memory_order_relaxed);
 
       levels_[level].deleted_files.erase(f->number);
       levels_[level].added_files->insert(f);
@@ -892,7 +1133,10 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  // An edit may carry a larger sequence number that is about to be used
+  if (!edit->has_last_sequence_ || edit->last_sequence_ < last_sequence_) {
+    edit->SetLastSequence(last_sequence_);
+  }
 
   Version* v = new Version(this);
   {
@@ -1439,7 +1683,9 @@ Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
   // We prefer compactions triggered by too much data in a level over
   // the compactions triggered by seeks.
   const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
+  FileMetaData* const seek_file =
+      current_->file_to_compact_.load(std::memory_order_relaxed);
+  const bool seek_compaction = (seek_file != NULL);
   if (size_compaction) {
     level = current_->compaction_level_;
     assert(level >= 0);
@@ -1462,7 +1708,7 @@ Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
   } else if (allow_seek_compaction && seek_compaction) {
     level = current_->file_to_compact_level_;
     c = new Compaction(options_, level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
+    c->inputs_[0].push_back(seek_file);
   } else {
     return NULL;
   }
@@ -1586,12 +1832,12 @@ Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       max_grand_parent_overlap_bytes_(MaxGrandParentOverlapBytes(options)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      input_version_(NULL) {}
+
+Compaction::Cursor::Cursor()
+    : grandparent_index(0), seen_key(false), overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
@@ -1617,13 +1863,13 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key, Cursor* cursor) {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size();) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; cursor->level_ptrs[lvl] < files.size();) {
+      FileMetaData* f = files[cursor->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1632,29 +1878,30 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      cursor->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key, Cursor* cursor) {
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &input_version_->vset_->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
-         icmp->Compare(internal_key,
-                       grandparents_[grandparent_index_]->largest.Encode()) >
-             0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+  while (cursor->grandparent_index < grandparents_.size()) {
+    FileMetaData* f = grandparents_[cursor->grandparent_index];
+    if (icmp->Compare(internal_key, f->largest.Encode()) <= 0) {
+      break;
+    }
+    if (cursor->seen_key) {
+      cursor->overlapped_bytes += f->file_size;
     }
-    grandparent_index_++;
+    cursor->grandparent_index++;
   }
-  seen_key_ = true;
+  cursor->seen_key = true;
 
-  if (overlapped_bytes_ > max_grand_parent_overlap_bytes_) {
+  if (cursor->overlapped_bytes > max_grand_parent_overlap_bytes_) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    cursor->overlapped_bytes = 0;
     return true;
   } else {
     return false;
@@ -22,6 +22,7 @@
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
@@ -86,16 +87,42 @@ class Version {
   bool Get(const ReadOptions& options, const LookupKey& key, Buffer* val,
            Status* s, GetStats* stats);
 
+  // Lookup the values for keys[0,n-1]. Fills statuses[i], vals[i], and
+  // stats[i] as if by Get(options, *keys[i], vals[i], &statuses[i],
+  // &stats[i]). Files are searched level by level and all keys that must be
+  // looked up in the same table are passed to the table cache at once.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions& options, size_t n,
+                const LookupKey* const* keys, Buffer* const* vals,
+                Status* statuses, GetStats* stats);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
   bool UpdateStats(const GetStats& stats);
 
+  // Charge the seek recorded in "stats" to its file.  Returns true if that
+  // file has just run out of allowed seeks, in which case the caller should
+  // call PickSeekCompaction(stats) with the lock held.  Each file is
+  // reported once and no seeks are charged while a file is already
+  // scheduled for compaction, so readers only rarely need the lock.
+  // REQUIRES: lock is not necessarily held
+  bool ChargeSeek(const GetStats& stats);
+
+  // Schedule the file recorded in "stats" for compaction if no other file
+  // is already scheduled.  Returns true if a new compaction may need to be
+  // triggered, false otherwise.
+  // REQUIRES: lock is held
+  bool PickSeekCompaction(const GetStats& stats);
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
-  // bytes.  Returns true if a new compaction may need to be triggered.
-  // REQUIRES: lock is held
-  bool RecordReadSample(Slice key);
+  // bytes.  The sample is charged as a seek to the first file overlapping
+  // the key, which is stored in *stats.  Returns true if that file has just
+  // run out of allowed seeks, in which case the caller should call
+  // PickSeekCompaction(*stats) with the lock held.
+  // REQUIRES: lock is not necessarily held
+  bool RecordReadSample(Slice key, GetStats* stats);
 
   // Reference count management (so Versions do not disappear out from
   // under live iterators)
@@ -149,7 +176,7 @@ class Version {
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
   // Next file to compact based on seek stats.
-  FileMetaData* file_to_compact_;
+  std::atomic<FileMetaData*> file_to_compact_;
   int file_to_compact_level_;
 
   // Level that should be compacted next and its compaction score.
@@ -228,13 +255,16 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
-  // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // Return the last sequence number. May be called without holding
+  // the lock.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= LastSequence());
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -272,7 +302,9 @@ class VersionSet {
   bool NeedsCompaction(bool allow_seek_compaction) const {
     Version* v = current_;
     if (v->compaction_score_ >= 1) return true;
-    if (allow_seek_compaction && v->file_to_compact_ != NULL) return true;
+    if (allow_seek_compaction &&
+        v->file_to_compact_.load(std::memory_order_relaxed) != NULL)
+      return true;
     return false;
   }
 
@@ -320,7 +352,7 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
@@ -370,14 +402,43 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // State kept by a sequential scan over the keys of this compaction.
+  // Keys must be presented to a cursor in increasing order. Disjoint key
+  // ranges of the same compaction may be processed concurrently as long as
+  // each range uses its own cursor.
+  struct Cursor {
+    Cursor();
+
+    // State used to check for number of of overlapping grandparent files
+    // (parent == level_ + 1, grandparent == level_ + 2)
+    size_t grandparent_index;  // Index in grandparents_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // State for implementing IsBaseLevelForKey
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L >= level_ + 2).
+    size_t level_ptrs[config::kNumLevels];
+  };
+
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key, Cursor* cursor);
+  bool IsBaseLevelForKey(const Slice& user_key) {
+    return IsBaseLevelForKey(user_key, &cursor_);
+  }
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, Cursor* cursor);
+  bool ShouldStopBefore(const Slice& internal_key) {
+    return ShouldStopBefore(internal_key, &cursor_);
+  }
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -398,21 +459,11 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];  // The two sets of inputs
 
-  // State used to check for number of of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // Files at level_ + 2 that overlap with this compaction
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
+
+  // Default cursor for compactions processed as a single key range
+  Cursor cursor_;
 };
 
 }  // namespace pdlfs
@@ -122,15 +122,21 @@ class MemTableInserter : public WriteBatch::Handler {
  public:
   SequenceNumber sequence_;
   MemTable* mem_;
+  bool concurrent_;
 
-  virtual void Put(const Slice& key, const Slice& value) {
-    mem_->Add(sequence_, kTypeValue, key, value);
+  void Add(ValueType type, const Slice& key, const Slice& value) {
+    if (concurrent_) {
+      mem_->AddConcurrently(sequence_, type, key, value);
+    } else {
+      mem_->Add(sequence_, type, key, value);
+    }
     sequence_++;
   }
-  virtual void Delete(const Slice& key) {
-    mem_->Add(sequence_, kTypeDeletion, key, Slice());
-    sequence_++;
+
+  virtual void Put(const Slice& key, const Slice& value) {
+    Add(kTypeValue, key, value);
   }
+  virtual void Delete(const Slice& key) { Add(kTypeDeletion, key, Slice()); }
 };
 }  // namespace
 
@@ -138,6 +144,16 @@ Status WriteBatchInternal::InsertInto(const WriteBatch* b, MemTable* memtable) {
   MemTableInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(b);
   inserter.mem_ = memtable;
+  inserter.concurrent_ = false;
+  return b->Iterate(&inserter);
+}
+
+Status WriteBatchInternal::InsertIntoConcurrently(const WriteBatch* b,
+                                                  MemTable* memtable) {
+  MemTableInserter inserter;
+  inserter.sequence_ = WriteBatchInternal::Sequence(b);
+  inserter.mem_ = memtable;
+  inserter.concurrent_ = true;
   return b->Iterate(&inserter);
 }
 
@@ -48,6 +48,11 @@ class WriteBatchInternal {
 
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
 
+  // Same as InsertInto(), but may run in parallel with other
+  // InsertIntoConcurrently() calls against the same memtable.
+  static Status InsertIntoConcurrently(const WriteBatch* batch,
+                                       MemTable* memtable);
+
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
 
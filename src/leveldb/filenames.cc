@@ -75,6 +75,10 @@ std::string OldInfoLogFileName(const std::string& dbname) {
   return dbname + "/LOG.old";
 }
 
+std::string DumpManifestFileName(const std::string& dir) {
+  return dir + "/DUMP";
+}
+
 // Owned filenames have the form:
 //    dbname/CURRENT
 //    dbname/LOCK
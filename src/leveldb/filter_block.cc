@@ -28,10 +28,11 @@ namespace pdlfs {
 static const size_t kFilterBaseLg = 11;
 static const size_t kFilterBase = 1 << kFilterBaseLg;
 
-FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy)
-    : policy_(policy) {}
+FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy, bool full)
+    : policy_(policy), full_(full) {}
 
 void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
+  if (full_) return;  // All keys go into a single filter
   uint64_t filter_index = (block_offset / kFilterBase);
   assert(filter_index >= filter_offsets_.size());
   while (filter_index > filter_offsets_.size()) {
@@ -46,6 +47,11 @@ void FilterBlockBuilder::AddKey(const Slice& key) {
 }
 
 Slice FilterBlockBuilder::Finish() {
+  if (full_) {
+    GenerateFilter();
+    return Slice(result_);
+  }
+
   if (!start_.empty()) {
     GenerateFilter();
   }
@@ -63,7 +69,11 @@ Slice FilterBlockBuilder::Finish() {
 
 void FilterBlockBuilder::GenerateFilter() {
   const size_t num_keys = start_.size();
-  if (num_keys == 0) {
+  if (num_keys == 0 && full_) {
+    // An empty filter does not match any keys
+    policy_->CreateFilter(NULL, 0, &result_);
+    return;
+  } else if (num_keys == 0) {
     // Fast path if there are no keys for this filter
     filter_offsets_.push_back(result_.size());
     return;
@@ -88,8 +98,15 @@ void FilterBlockBuilder::GenerateFilter() {
 }
 
 FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
-                                     const Slice& contents)
-    : policy_(policy), data_(NULL), offset_(NULL), num_(0), base_lg_(0) {
+                                     const Slice& contents, bool full)
+    : policy_(policy),
+      full_(full),
+      contents_(contents),
+      data_(NULL),
+      offset_(NULL),
+      num_(0),
+      base_lg_(0) {
+  if (full_) return;
   size_t n = contents.size();
   if (n < 5) return;  // 1 byte for base_lg_ and 4 for start of offset array
   base_lg_ = contents[n - 1];
@@ -101,6 +118,9 @@ FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
 }
 
 bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
+  if (full_) {
+    return policy_->KeyMayMatch(key, contents_);
+  }
   uint64_t index = block_offset >> base_lg_;
   if (index < num_) {
     uint32_t start = DecodeFixed32(offset_ + index * 4);
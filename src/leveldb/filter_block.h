@@ -37,9 +37,13 @@ class FilterPolicy;
 //
 // The sequence of calls to FilterBlockBuilder must match the regexp:
 //      (StartBlock AddKey*)* Finish
+//
+// If "full" is true, a single filter is built for all keys of the table
+// instead of one filter for every 2KB of data. The result is then the
+// filter itself.
 class FilterBlockBuilder {
  public:
-  explicit FilterBlockBuilder(const FilterPolicy*);
+  explicit FilterBlockBuilder(const FilterPolicy*, bool full = false);
 
   void StartBlock(uint64_t block_offset);
   void AddKey(const Slice& key);
@@ -49,6 +53,7 @@ class FilterBlockBuilder {
   void GenerateFilter();
 
   const FilterPolicy* policy_;
+  const bool full_;
   std::string keys_;             // Flattened key contents
   std::vector<size_t> start_;    // Starting index in keys_ of each key
   std::string result_;           // Filter data computed so far
@@ -63,11 +68,16 @@ class FilterBlockBuilder {
 class FilterBlockReader {
  public:
   // REQUIRES: "contents" and *policy must stay live while *this is live.
-  FilterBlockReader(const FilterPolicy* policy, const Slice& contents);
+  // If "full" is true, "contents" must be a filter built for all keys of
+  // a table and "block_offset" is ignored during lookups.
+  FilterBlockReader(const FilterPolicy* policy, const Slice& contents,
+                    bool full = false);
   bool KeyMayMatch(uint64_t block_offset, const Slice& key);
 
  private:
   const FilterPolicy* policy_;
+  const bool full_;
+  Slice contents_;
   const char* data_;    // Pointer to filter data (at block-start)
   const char* offset_;  // Pointer to beginning of offset array (at block-end)
   size_t num_;          // Number of entries in offset array
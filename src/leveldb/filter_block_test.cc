@@ -131,6 +131,36 @@ TEST(FilterBlockTest, MultiChunk) {
   ASSERT_TRUE(!reader.KeyMayMatch(9000, "bar"));
 }
 
+TEST(FilterBlockTest, FullFilter) {
+  FilterBlockBuilder builder(&policy_, true);
+  builder.StartBlock(0);
+  builder.AddKey("foo");
+  builder.StartBlock(3100);
+  builder.AddKey("box");
+  builder.StartBlock(9000);
+  builder.AddKey("hello");
+  Slice block = builder.Finish();
+  // The result is the filter itself
+  ASSERT_EQ(block.size(), 3 * sizeof(uint32_t));
+  FilterBlockReader reader(&policy_, block, true);
+
+  // Block offsets make no difference
+  ASSERT_TRUE(reader.KeyMayMatch(0, "foo"));
+  ASSERT_TRUE(reader.KeyMayMatch(0, "box"));
+  ASSERT_TRUE(reader.KeyMayMatch(9000, "foo"));
+  ASSERT_TRUE(reader.KeyMayMatch(100000, "hello"));
+  ASSERT_TRUE(!reader.KeyMayMatch(0, "bar"));
+  ASSERT_TRUE(!reader.KeyMayMatch(9000, "missing"));
+}
+
+TEST(FilterBlockTest, EmptyFullFilter) {
+  FilterBlockBuilder builder(&policy_, true);
+  Slice block = builder.Finish();
+  FilterBlockReader reader(&policy_, block, true);
+  ASSERT_TRUE(!reader.KeyMayMatch(0, "foo"));
+  ASSERT_TRUE(!reader.KeyMayMatch(100, "bar"));
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -23,6 +23,8 @@
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/port.h"
 
+#include <vector>
+
 namespace pdlfs {
 
 void BlockHandle::EncodeTo(std::string* dst) const {
@@ -48,8 +50,11 @@ void Footer::EncodeTo(std::string* dst) const {
   metaindex_handle_.EncodeTo(dst);
   index_handle_.EncodeTo(dst);
   dst->resize(2 * BlockHandle::kMaxEncodedLength);  // Padding
-  PutFixed32(dst, static_cast<uint32_t>(kTableMagicNumber & 0xffffffffu));
-  PutFixed32(dst, static_cast<uint32_t>(kTableMagicNumber >> 32));
+  const uint64_t magic = (index_type_ == kTwoLevelIndex)
+                             ? kTwoLevelIndexTableMagicNumber
+                             : kTableMagicNumber;
+  PutFixed32(dst, static_cast<uint32_t>(magic & 0xffffffffu));
+  PutFixed32(dst, static_cast<uint32_t>(magic >> 32));
   assert(dst->size() == original_size + kEncodedLength);
 }
 
@@ -59,7 +64,11 @@ Status Footer::DecodeFrom(Slice* input) {
   const uint32_t magic_hi = DecodeFixed32(magic_ptr + 4);
   const uint64_t magic = ((static_cast<uint64_t>(magic_hi) << 32) |
                           (static_cast<uint64_t>(magic_lo)));
-  if (magic != kTableMagicNumber) {
+  if (magic == kTableMagicNumber) {
+    index_type_ = kFlatIndex;
+  } else if (magic == kTwoLevelIndexTableMagicNumber) {
+    index_type_ = kTwoLevelIndex;
+  } else {
     return Status::Corruption("not an sstable (bad magic number)");
   }
 
@@ -75,22 +84,42 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
-Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                 const BlockHandle& handle, BlockContents* result) {
-  result->data = Slice();
-  result->cachable = false;
-  result->heap_allocated = false;
+static bool GetUncompressedLength(char type, const char* data, size_t n,
+                                  size_t* result) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_GetUncompressedLength(data, n, result);
+    case kLZ4Compression:
+      return port::LZ4_GetUncompressedLength(data, n, result);
+    case kZstdCompression:
+      return port::Zstd_GetUncompressedLength(data, n, result);
+    default:
+      return false;
+  }
+}
 
-  // Read the block contents as well as the type/crc footer.
-  // See table_builder.cc for the code that built this structure.
-  size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
-  Slice contents;
-  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
-  if (!s.ok()) {
-    delete[] buf;
-    return s;
+static bool Uncompress(char type, const char* data, size_t n,
+                       const port::ZstdUncompressionDict* dict, char* output) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Uncompress(data, n, output);
+    case kLZ4Compression:
+      return port::LZ4_Uncompress(data, n, output);
+    case kZstdCompression:
+      return port::Zstd_Uncompress(data, n, dict, output);
+    default:
+      return false;
   }
+}
+
+// Verify and uncompress the raw contents of a block just read into "buf".
+// Takes ownership of "buf".
+static Status DecodeBlock(const ReadOptions& options, const BlockHandle& handle,
+                          char* buf, const Slice& contents,
+                          const port::ZstdUncompressionDict* dict,
+                          BlockContents* result) {
+  Status s;
+  size_t n = static_cast<size_t>(handle.size());
   if (contents.size() != n + kBlockTrailerSize) {
     delete[] buf;
     return Status::Corruption("truncated block read");
@@ -126,14 +155,16 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
 
       // Ok
       break;
-    case kSnappyCompression: {
+    case kSnappyCompression:
+    case kLZ4Compression:
+    case kZstdCompression: {
       size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
+      if (!GetUncompressedLength(data[n], data, n, &ulength)) {
         delete[] buf;
         return Status::Corruption("corrupted compressed block contents");
       }
       char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
+      if (!Uncompress(data[n], data, n, dict, ubuf)) {
         delete[] buf;
         delete[] ubuf;
         return Status::Corruption("corrupted compressed block contents");
@@ -152,4 +183,51 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
   return Status::OK();
 }
 
+Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
+                 const BlockHandle& handle, BlockContents* result,
+                 const port::ZstdUncompressionDict* dict) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  // Read the block contents as well as the type/crc footer.
+  // See table_builder.cc for the code that built this structure.
+  size_t n = static_cast<size_t>(handle.size());
+  char* buf = new char[n + kBlockTrailerSize];
+  Slice contents;
+  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
+  if (!s.ok()) {
+    delete[] buf;
+    return s;
+  }
+  return DecodeBlock(options, handle, buf, contents, dict, result);
+}
+
+void ReadBlocks(RandomAccessFile* file, const ReadOptions& options,
+                const BlockHandle* handles, size_t num_blocks,
+                BlockContents* results, Status* statuses,
+                const port::ZstdUncompressionDict* dict) {
+  std::vector<ReadRequest> reqs(num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) {
+    results[i].data = Slice();
+    results[i].cachable = false;
+    results[i].heap_allocated = false;
+    reqs[i].offset = handles[i].offset();
+    reqs[i].n = static_cast<size_t>(handles[i].size()) + kBlockTrailerSize;
+    reqs[i].scratch = new char[reqs[i].n];
+  }
+  if (num_blocks != 0) {
+    file->MultiRead(&reqs[0], num_blocks);
+  }
+  for (size_t i = 0; i < num_blocks; i++) {
+    if (!reqs[i].status.ok()) {
+      delete[] reqs[i].scratch;
+      statuses[i] = reqs[i].status;
+    } else {
+      statuses[i] = DecodeBlock(options, handles[i], reqs[i].scratch,
+                                reqs[i].result, dict, &results[i]);
+    }
+  }
+}
+
 }  // namespace pdlfs
@@ -10,6 +10,16 @@
  */
 #include "index_block.h"
 
+#include "pdlfs-common/leveldb/internal_types.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/ect.h"
+#include "pdlfs-common/pdlfs_config.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
 namespace pdlfs {
 
 void IndexBlockBuilder::AddIndexEntry(std::string* last_key,
@@ -27,4 +37,184 @@ void IndexBlockBuilder::AddIndexEntry(std::string* last_key,
   builder_.Add(*last_key, encoding);
 }
 
+// Index block format:
+//    num_blocks: varint64
+//    first_block_offset: varint64
+//    num_blocks * {
+//        block_size: varint64
+//        last_rank_delta: varint64
+//    }
+//    ect: encoded ECT of all distinct user keys
+// Data blocks are stored back to back so only their sizes are recorded.
+static const uint64_t kMaxUint32 = 0xffffffffull;
+
+ECTIndexBuilder::ECTIndexBuilder() : ok_(true), key_len_(0), num_keys_(0) {}
+
+void ECTIndexBuilder::OnKeyAdded(const Slice& key) {
+  if (!ok_) return;
+  ParsedInternalKey ikey;
+  if (!ParseInternalKey(key, &ikey)) {
+    ok_ = false;
+    return;
+  }
+  const Slice& user_key = ikey.user_key;
+  if (num_keys_ == 0) {
+    if (user_key.empty()) {
+      ok_ = false;
+      return;
+    }
+    key_len_ = user_key.size();
+  } else if (user_key.size() != key_len_) {
+    ok_ = false;
+  } else {
+    const int r = memcmp(&keys_[keys_.size() - key_len_], user_key.data(),
+                         key_len_);
+    if (r == 0) {
+      return;  // Another version of the last key
+    } else if (r > 0) {
+      ok_ = false;  // Not in bytewise order
+    }
+  }
+  if (ok_) {
+    keys_.append(user_key.data(), user_key.size());
+    num_keys_++;
+  } else {
+    keys_.clear();
+    block_offsets_.clear();
+    block_last_ranks_.clear();
+  }
+}
+
+void ECTIndexBuilder::OnDataBlockFinished(const BlockHandle& handle) {
+  if (!ok_) return;
+  if (num_keys_ == 0 ||
+      (!block_offsets_.empty() && block_offsets_.back() != handle.offset())) {
+    ok_ = false;
+    return;
+  }
+  if (block_offsets_.empty()) {
+    block_offsets_.push_back(handle.offset());
+  }
+  block_offsets_.push_back(handle.offset() + handle.size() +
+                           kBlockTrailerSize);
+  block_last_ranks_.push_back(num_keys_ - 1);
+}
+
+bool ECTIndexBuilder::Finish(std::string* contents) {
+#if defined(PDLFS_SILT_ECT)
+  if (!ok_ || block_last_ranks_.empty()) {
+    return false;
+  } else if (block_offsets_.back() > kMaxUint32 ||
+             num_keys_ > kMaxUint32) {
+    return false;  // Readers keep offsets and ranks as 32-bit integers
+  }
+  std::vector<Slice> keys;
+  keys.reserve(num_keys_);
+  for (size_t i = 0; i < num_keys_; i++) {
+    keys.push_back(Slice(&keys_[i * key_len_], key_len_));
+  }
+  ECT* const ect = ECT::Default(key_len_, keys.size(), &keys[0]);
+  contents->clear();
+  const size_t num_blocks = block_last_ranks_.size();
+  PutVarint64(contents, num_blocks);
+  PutVarint64(contents, block_offsets_[0]);
+  for (size_t i = 0; i < num_blocks; i++) {
+    PutVarint64(contents,
+                block_offsets_[i + 1] - block_offsets_[i] - kBlockTrailerSize);
+    PutVarint64(contents, block_last_ranks_[i] -
+                              (i != 0 ? block_last_ranks_[i - 1] : 0));
+  }
+  ect->EncodeTo(contents);
+  delete ect;
+  return true;
+#else
+  return false;
+#endif
+}
+
+Status ECTIndexReader::Open(const Slice& contents, ECTIndexReader** result) {
+  *result = NULL;
+#if defined(PDLFS_SILT_ECT)
+  Slice input = contents;
+  uint64_t num_blocks;
+  uint64_t offset;
+  if (!GetVarint64(&input, &num_blocks) || !GetVarint64(&input, &offset) ||
+      num_blocks == 0 || num_blocks > input.size()) {
+    return Status::Corruption("bad ect index block");
+  }
+  ECTIndexReader* const r = new ECTIndexReader;
+  r->block_offsets_.reserve(num_blocks + 1);
+  r->block_last_ranks_.reserve(num_blocks);
+  r->block_offsets_.push_back(static_cast<uint32_t>(offset));
+  uint64_t rank = 0;
+  for (uint64_t i = 0; i < num_blocks; i++) {
+    uint64_t size;
+    uint64_t delta;
+    if (!GetVarint64(&input, &size) || !GetVarint64(&input, &delta)) {
+      delete r;
+      return Status::Corruption("bad ect index block");
+    }
+    offset += size + kBlockTrailerSize;
+    rank += delta;
+    if (offset > kMaxUint32 || rank > kMaxUint32) {
+      delete r;
+      return Status::Corruption("bad ect index block");
+    }
+    r->block_offsets_.push_back(static_cast<uint32_t>(offset));
+    r->block_last_ranks_.push_back(static_cast<uint32_t>(rank));
+  }
+  r->ect_ = ECT::Decode(input);
+  if (r->ect_ == NULL || r->ect_->NumKeys() != rank + 1) {
+    delete r;
+    return Status::Corruption("bad ect index block");
+  }
+  r->key_len_ = r->ect_->KeyLength();
+  *result = r;
+  return Status::OK();
+#else
+  return Status::NotSupported("ect support not compiled in");
+#endif
+}
+
+ECTIndexReader::~ECTIndexReader() { delete ect_; }
+
+size_t ECTIndexReader::ApproximateMemoryUsage() const {
+  size_t result = sizeof(*this);
+  result += block_offsets_.capacity() * sizeof(uint32_t);
+  result += block_last_ranks_.capacity() * sizeof(uint32_t);
+  if (ect_ != NULL) {
+    result += (ect_->MemUsage() + 7) / 8;
+  }
+  return result;
+}
+
+BlockHandle ECTIndexReader::GetBlockHandle(size_t block) const {
+  assert(block < NumBlocks());
+  BlockHandle handle;
+  handle.set_offset(block_offsets_[block]);
+  handle.set_size(block_offsets_[block + 1] - block_offsets_[block] -
+                  kBlockTrailerSize);
+  return handle;
+}
+
+// Return the first block holding the key of the specified rank.
+size_t ECTIndexReader::FindBlock(uint64_t rank) const {
+  return std::lower_bound(block_last_ranks_.begin(), block_last_ranks_.end(),
+                          rank) -
+         block_last_ranks_.begin();
+}
+
+void ECTIndexReader::Locate(const Slice& user_key, size_t* start_block,
+                            size_t* target_block) const {
+  assert(user_key.size() == key_len_);
+  const uint64_t last_rank = block_last_ranks_.back();
+  // A key that is absent from the index may get the rank of its successor.
+  // Starting from the block of the preceding rank ensures that we won't skip
+  // the smallest key that is larger than it.
+  uint64_t rank = ect_->Find(user_key);
+  if (rank > last_rank) rank = last_rank;
+  *target_block = FindBlock(rank);
+  *start_block = (rank != 0) ? FindBlock(rank - 1) : 0;
+}
+
 }  // namespace pdlfs
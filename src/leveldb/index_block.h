@@ -16,8 +16,14 @@
 #include "pdlfs-common/leveldb/format.h"
 #include "pdlfs-common/status.h"
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 
+class ECT;
+
 class IndexBlockBuilder {
  public:
   IndexBlockBuilder(int restart_interval, const Comparator* cmp)
@@ -30,6 +36,11 @@ class IndexBlockBuilder {
 
   size_t CurrentSizeEstimate() const { return builder_.CurrentSizeEstimate(); }
 
+  bool empty() const { return builder_.empty(); }
+
+  // Reset the contents as if the builder was just constructed.
+  void Reset() { builder_.Reset(); }
+
   void ChangeRestartInterval(int interval) {
     builder_.ChangeRestartInterval(interval);
   }
@@ -56,4 +67,72 @@ class IndexBlockReader {
   Block block_;
 };
 
+// Builds an auxiliary table index mapping each distinct user key to the
+// data block holding it using an ECT (entropy-coded trie). Requires all user
+// keys of a table to have the same length and to be added in bytewise
+// order. Otherwise, or if ECT support is not compiled in, Finish() returns
+// false and the table should rely on its regular index alone. The ECT
+// itself takes only a few bits per key, though all distinct user keys of a
+// table are buffered in memory until the table is finished.
+class ECTIndexBuilder {
+ public:
+  ECTIndexBuilder();
+
+  // Add the next key of a table. REQUIRES: "key" is an internal key.
+  void OnKeyAdded(const Slice& key);
+
+  // Register the data block holding all keys added since the last call.
+  void OnDataBlockFinished(const BlockHandle& handle);
+
+  // Return true and set *contents to the encoded index if an index can be
+  // built for the table.
+  bool Finish(std::string* contents);
+
+ private:
+  bool ok_;
+  size_t key_len_;
+  size_t num_keys_;
+  std::string keys_;  // All distinct user keys back to back
+  std::vector<uint64_t> block_offsets_;
+  std::vector<uint64_t> block_last_ranks_;
+};
+
+// Locates data blocks through an index built by ECTIndexBuilder.
+class ECTIndexReader {
+ public:
+  // Decode an index from its contents. Return non-OK if the contents are
+  // corrupted or if ECT support is not compiled in.
+  static Status Open(const Slice& contents, ECTIndexReader** result);
+  ~ECTIndexReader();
+
+  size_t ApproximateMemoryUsage() const;
+
+  // Length of user keys indexed.
+  size_t key_length() const { return key_len_; }
+
+  size_t NumBlocks() const { return block_last_ranks_.size(); }
+
+  BlockHandle GetBlockHandle(size_t block) const;
+
+  // Set *target_block to the block that would hold "user_key", and
+  // *start_block to a block at or before it such that no earlier block
+  // holds any key larger than or equal to "user_key". REQUIRES:
+  // user_key.size() == key_length().
+  void Locate(const Slice& user_key, size_t* start_block,
+              size_t* target_block) const;
+
+ private:
+  ECTIndexReader() : ect_(NULL), key_len_(0) {}
+  size_t FindBlock(uint64_t rank) const;
+
+  ECT* ect_;
+  size_t key_len_;
+  std::vector<uint32_t> block_offsets_;  // One more entry than blocks
+  std::vector<uint32_t> block_last_ranks_;
+
+  // No copying allowed
+  void operator=(const ECTIndexReader&);
+  ECTIndexReader(const ECTIndexReader&);
+};
+
 }  // namespace pdlfs
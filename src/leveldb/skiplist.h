@@ -17,6 +17,7 @@
 #pragma once
 
 #include "pdlfs-common/arena.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/random.h"
 
@@ -27,6 +28,9 @@
 // -------------
 //
 // Writes require external synchronization, most likely a mutex.
+// The only exception is InsertConcurrently(), which may be called by
+// multiple threads at the same time as long as no thread is calling
+// Insert() during that period.
 // Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
@@ -63,6 +67,14 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Same as Insert(), but may be invoked concurrently with other
+  // InsertConcurrently() calls. Arena allocation and random height generation
+  // are serialized by "*mu", which must also protect all other allocations
+  // from the same arena during this period. Linking the new node into the list
+  // is lock-free.
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  void InsertConcurrently(const Key& key, port::Mutex* mu);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -140,6 +152,11 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting from "*prev" at "level", find the pair of adjacent nodes that
+  // brackets key. On return, *prev < key <= *next.
+  void FindSpliceForLevel(const Key& key, int level, Node** prev,
+                          Node** next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -185,6 +202,12 @@ struct SkipList<Key, Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Atomically replace the link at level n with x iff it is still "expected".
+  bool CasNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -292,6 +315,23 @@ SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindSpliceForLevel(const Key& key, int level,
+                                                   Node** prev,
+                                                   Node** next) const {
+  Node* x = *prev;
+  while (true) {
+    Node* n = x->Next(level);
+    if (KeyIsAfterNode(key, n)) {
+      x = n;
+    } else {
+      *prev = x;
+      *next = n;
+      return;
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::FindLessThan(const Key& key) const {
@@ -381,6 +421,53 @@ void SkipList<Key, Comparator>::Insert(const Key& key) {
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertConcurrently(const Key& key,
+                                                   port::Mutex* mu) {
+  int height;
+  Node* x;
+  {
+    MutexLock ml(mu);
+    height = RandomHeight();
+    x = NewNode(key, height);
+  }
+
+  // Raise max_height_ if needed. Concurrent inserters may race with us, so we
+  // retry until either we succeed or someone else has raised it even higher.
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      max_height = height;
+      break;
+    }
+    max_height = GetMaxHeight();
+  }
+
+  // Since max_height_ never decreases and is now at least "height", the
+  // search below fills prev[] for all levels we are going to link.
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* n = FindGreaterOrEqual(key, prev);
+  // Our data structure does not allow duplicate insertion
+  assert(n == NULL || !Equal(key, n->key));
+  (void)n;
+
+  // Link the new node bottom-up. A node becomes visible to readers once it is
+  // linked at level 0. Each link is published with a CAS; if it fails because
+  // of a concurrent insertion at that level, we re-locate the splice point
+  // starting from our previous predecessor and try again.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      FindSpliceForLevel(key, i, &prev[i], &next[i]);
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CasNext(i, next[i], x)) {
+        break;
+      }
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
@@ -374,6 +374,72 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Multiple writers inserting disjoint sets of keys at the same time
+// through InsertConcurrently().
+namespace {
+struct ConcurrentInsertState {
+  Arena arena;
+  port::Mutex mu;
+  SkipList<Key, Comparator>* list;
+  port::Mutex done_mu;
+  port::CondVar done_cv;
+  int num_done;
+  int num_threads;
+  int keys_per_thread;
+
+  ConcurrentInsertState() : list(NULL), done_cv(&done_mu), num_done(0) {}
+};
+
+struct ConcurrentInserter {
+  ConcurrentInsertState* state;
+  int id;
+};
+}  // namespace
+
+static void ConcurrentInsert(void* arg) {
+  ConcurrentInserter* inserter = reinterpret_cast<ConcurrentInserter*>(arg);
+  ConcurrentInsertState* state = inserter->state;
+  for (int i = 0; i < state->keys_per_thread; i++) {
+    Key k = static_cast<Key>(i) * state->num_threads + inserter->id;
+    state->list->InsertConcurrently(k, &state->mu);
+  }
+  state->done_mu.Lock();
+  state->num_done++;
+  state->done_cv.SignalAll();
+  state->done_mu.Unlock();
+}
+
+TEST(SkipTest, ConcurrentInsert) {
+  const int kThreads = 4;
+  ConcurrentInsertState state;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &state.arena);
+  state.list = &list;
+  state.num_threads = kThreads;
+  state.keys_per_thread = 20000;
+  ConcurrentInserter inserters[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    inserters[i].state = &state;
+    inserters[i].id = i;
+    Env::Default()->StartThread(ConcurrentInsert, &inserters[i]);
+  }
+  state.done_mu.Lock();
+  while (state.num_done < kThreads) {
+    state.done_cv.Wait();
+  }
+  state.done_mu.Unlock();
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  const Key total = static_cast<Key>(kThreads) * state.keys_per_thread;
+  for (Key k = 0; k < total; k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -22,6 +22,7 @@
 #include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/filter_policy.h"
 #include "pdlfs-common/leveldb/format.h"
+#include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/leveldb/table.h"
@@ -31,6 +32,9 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
 
+#include <utility>
+#include <vector>
+
 namespace pdlfs {
 
 struct Table::Rep {
@@ -42,16 +46,31 @@ struct Table::Rep {
   const char* filter_data;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
+  // For tables with a two-level index, this is the top-level index, which
+  // points to index partitions that are read through the block cache.
+  // NULL if the table has an ect index, in which case the index block is
+  // also read through the block cache and only when needed by iterators.
   IndexBlockReader* index_block;
+  BlockHandle index_handle;
+  bool two_level_index;
+  ECTIndexReader* ect_index;
 
   TableProperties props;  // All properties embedded in the table
   bool props_valid;
+  // Digested dictionary used to compress the table's zstd blocks. NULL if
+  // the table has no dictionary. Digested once per table since digesting is
+  // far more costly than uncompressing a block.
+  port::ZstdUncompressionDict* compression_dict;
   Rep() {}
 
   ~Rep() {
     delete filter;
     delete[] filter_data;
     delete index_block;
+    delete ect_index;
+    if (compression_dict != NULL) {
+      port::Zstd_DeleteUncompressionDict(compression_dict);
+    }
   }
 };
 
@@ -76,30 +95,43 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     return s;
   }
 
-  // Read the index block
-  BlockContents contents;
-  ReadOptions opt;
-  if (options.paranoid_checks) {
-    opt.verify_checksums = true;
+  Rep* rep = new Table::Rep;
+  rep->options = options;
+  rep->file = file;
+  rep->metaindex_handle = footer.metaindex_handle();
+  rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+  rep->index_block = NULL;
+  rep->index_handle = footer.index_handle();
+  rep->two_level_index = (footer.index_type() == Footer::kTwoLevelIndex);
+  rep->ect_index = NULL;
+  rep->compression_dict = NULL;
+  rep->filter_data = NULL;
+  rep->filter = NULL;
+  rep->props_valid = false;
+  Table* t = new Table(rep);
+  t->ReadMeta(footer);
+
+  // Read the index block unless we can do without it
+  if (rep->ect_index == NULL) {
+    BlockContents contents;
+    ReadOptions opt;
+    if (options.paranoid_checks) {
+      opt.verify_checksums = true;
+    }
+    s = ReadBlock(file, opt, footer.index_handle(), &contents,
+                  rep->compression_dict);
+    if (s.ok()) {
+      rep->index_block = new IndexBlockReader(contents);
+    }
   }
-  s = ReadBlock(file, opt, footer.index_handle(), &contents);
+
   if (s.ok()) {
-    // We've successfully read the footer and the index block: we're
+    // We've successfully read the footer and the index: we're
     // ready to serve requests.
-    Rep* rep = new Table::Rep;
-    rep->options = options;
-    rep->file = file;
-    rep->metaindex_handle = footer.metaindex_handle();
-    rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
-    rep->index_block = new IndexBlockReader(contents);
-    rep->filter_data = NULL;
-    rep->filter = NULL;
-    rep->props_valid = false;
-
-    *table = new Table(rep);
-    (*table)->ReadMeta(footer);
+    *table = t;
+  } else {
+    delete t;
   }
-
   return s;
 }
 
@@ -119,18 +151,37 @@ void Table::ReadMeta(const Footer& footer) {
   Block* meta = new Block(contents);
   Iterator* iter = meta->NewIterator(BytewiseComparator());
 
+  Slice dict_key("compression.dict");
+  iter->Seek(dict_key);
+  if (iter->Valid() && iter->key() == dict_key) {
+    ReadCompressionDict(iter->value());
+  }
+
   Slice props_key("table.properties");
   iter->Seek(props_key);
   if (iter->Valid() && iter->key() == props_key) {
     ReadProperties(iter->value());
   }
 
+  Slice ect_key("index.ect");
+  iter->Seek(ect_key);
+  if (iter->Valid() && iter->key() == ect_key) {
+    ReadECTIndex(iter->value());
+  }
+
   if (r->options.filter_policy != NULL) {
     std::string key = "filter.";
     key.append(r->options.filter_policy->Name());
     iter->Seek(key);
     if (iter->Valid() && iter->key() == Slice(key)) {
-      ReadFilter(iter->value());
+      ReadFilter(iter->value(), false);
+    } else {
+      key = "fullfilter.";
+      key.append(r->options.filter_policy->Name());
+      iter->Seek(key);
+      if (iter->Valid() && iter->key() == Slice(key)) {
+        ReadFilter(iter->value(), true);
+      }
     }
   }
 
@@ -138,7 +189,7 @@ void Table::ReadMeta(const Footer& footer) {
   delete meta;
 }
 
-void Table::ReadFilter(const Slice& handle_value) {
+void Table::ReadFilter(const Slice& handle_value, bool full) {
   Rep* r = rep_;
   Slice v = handle_value;
   BlockHandle handle;
@@ -156,12 +207,37 @@ void Table::ReadFilter(const Slice& handle_value) {
   if (!ReadBlock(r->file, opt, handle, &block).ok()) {
     return;
   }
-  r->filter = new FilterBlockReader(r->options.filter_policy, block.data);
+  r->filter =
+      new FilterBlockReader(r->options.filter_policy, block.data, full);
   if (block.heap_allocated) {
     r->filter_data = block.data.data();  // Will need to delete later
   }
 }
 
+void Table::ReadECTIndex(const Slice& handle_value) {
+  Rep* r = rep_;
+  Slice v = handle_value;
+  BlockHandle handle;
+  if (!handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  ReadOptions opt;
+  if (r->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  if (!ReadBlock(r->file, opt, handle, &block).ok()) {
+    return;
+  }
+  // Do not propagate errors since we can always fall back to the regular
+  // index block
+  ECTIndexReader::Open(block.data, &r->ect_index);
+  if (block.heap_allocated) {
+    delete[] block.data.data();
+  }
+}
+
 void Table::ReadProperties(const Slice& props_handle_value) {
   Rep* r = rep_;
   Slice v = props_handle_value;
@@ -186,6 +262,30 @@ void Table::ReadProperties(const Slice& props_handle_value) {
   }
 }
 
+void Table::ReadCompressionDict(const Slice& dict_handle_value) {
+  Rep* r = rep_;
+  Slice v = dict_handle_value;
+  BlockHandle handle;
+  if (!handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  ReadOptions opt;
+  if (r->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  // Errors are left to be reported when compressed blocks fail to decode
+  if (!ReadBlock(r->file, opt, handle, &block).ok()) {
+    return;
+  }
+  r->compression_dict =
+      port::Zstd_NewUncompressionDict(block.data.data(), block.data.size());
+  if (block.heap_allocated) {
+    delete[] block.data.data();
+  }
+}
+
 static void DeleteBlock(void* arg, void* ignored) {
   delete reinterpret_cast<Block*>(arg);
 }
@@ -227,7 +327,8 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        s = ReadBlock(table->rep_->file, options, handle, &contents,
+                      table->rep_->compression_dict);
         if (s.ok()) {
           block = new Block(contents);
           if (contents.cachable && options.fill_cache) {
@@ -237,7 +338,8 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = ReadBlock(table->rep_->file, options, handle, &contents,
+                    table->rep_->compression_dict);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -258,16 +360,159 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   return iter;
 }
 
+// Return an iterator over the index entries of all data blocks. Index
+// partitions, if any, are loaded via BlockReader() just like data blocks.
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter;
+  if (rep_->index_block != NULL) {
+    iter = rep_->index_block->NewIterator(rep_->options.comparator);
+  } else {
+    std::string handle_encoding;
+    rep_->index_handle.EncodeTo(&handle_encoding);
+    iter = BlockReader(const_cast<Table*>(this), options, handle_encoding);
+  }
+  if (rep_->two_level_index) {
+    iter = NewTwoLevelIterator(iter, &Table::BlockReader,
+                               const_cast<Table*>(this), options);
+  }
+  return iter;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  return NewTwoLevelIterator(NewIndexIterator(options), &Table::BlockReader,
+                             const_cast<Table*>(this), options);
+}
+
+Iterator* Table::NewIterator(const ReadOptions& options,
+                             const Slice& upper_bound) const {
+  return NewBoundedTwoLevelIterator(
+      NewIndexIterator(options), &Table::BlockReader,
+      options.readahead != 0 ? &Table::PrefetchBlocks : NULL,
+      const_cast<Table*>(this), options, rep_->options.comparator,
+      upper_bound);
+}
+
+// Read the data block starting at index entry "index_key" along with the
+// blocks that follow, up to options.readahead bytes in total, and insert
+// them into the block cache. Blocks whose preceding index entry is at or
+// past "upper_bound" are not read. Return the number of blocks covered, or 0
+// if blocks cannot be cached (e.g., they are served from an mmap-ed file and
+// reading ahead is useless).
+size_t Table::PrefetchBlocks(void* arg, const ReadOptions& options,
+                             const Slice& index_key,
+                             const Slice& upper_bound) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  Rep* const r = table->rep_;
+  Cache* const block_cache = r->options.block_cache;
+  if (block_cache == NULL || !options.fill_cache) {
+    return 0;
+  }
+  const Comparator* const cmp = r->options.comparator;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, r->cache_id);
+  Slice cache_key(cache_key_buffer, sizeof(cache_key_buffer));
+
+  std::vector<BlockHandle> handles;  // Blocks to read
+  size_t num_blocks = 0;
+  uint64_t bytes = 0;
+  Iterator* iiter = table->NewIndexIterator(options);
+  for (iiter->Seek(index_key); iiter->Valid(); iiter->Next()) {
+    BlockHandle handle;
+    Slice handle_value = iiter->value();
+    if (!handle.DecodeFrom(&handle_value).ok()) {
+      break;
+    }
+    EncodeFixed64(cache_key_buffer + 8, handle.offset());
+    Cache::Handle* h = block_cache->Lookup(cache_key);
+    if (h != NULL) {
+      block_cache->Release(h);
+    } else {
+      handles.push_back(handle);
+    }
+    num_blocks++;
+    bytes += handle.size() + kBlockTrailerSize;
+    if (bytes >= options.readahead) {
+      break;
+    }
+    if (!upper_bound.empty() && cmp->Compare(iiter->key(), upper_bound) >= 0) {
+      break;
+    }
+  }
+  delete iiter;
+  if (handles.empty()) {
+    return num_blocks;
+  }
+
+  std::vector<BlockContents> contents(handles.size());
+  std::vector<Status> statuses(handles.size());
+  ReadBlocks(r->file, options, &handles[0], handles.size(), &contents[0],
+             &statuses[0], r->compression_dict);
+  for (size_t b = 0; b < handles.size(); b++) {
+    if (!statuses[b].ok()) {
+      // Leave the error to be reported when the block is read again
+      continue;
+    }
+    Block* block = new Block(contents[b]);
+    if (contents[b].cachable) {
+      EncodeFixed64(cache_key_buffer + 8, handles[b].offset());
+      block_cache->Release(block_cache->Insert(cache_key, block, block->size(),
+                                               &DeleteCachedBlock));
+    } else {
+      delete block;
+      num_blocks = 0;
+    }
+  }
+  return num_blocks;
+}
+
+// Look up a key using the ect index. Start from the block returned by the
+// index and move on to later blocks until an entry >= k is found.
+Status Table::ECTGet(const ReadOptions& options, const Slice& k, void* arg,
+                     void (*saver)(void*, const Slice&, const Slice&),
+                     Iterator** pin) {
+  const ECTIndexReader* const ect = rep_->ect_index;
+  size_t block;
+  size_t target_block;
+  ect->Locate(ExtractUserKey(k), &block, &target_block);
+  FilterBlockReader* filter = rep_->filter;
+  if (filter != NULL &&
+      !filter->KeyMayMatch(ect->GetBlockHandle(target_block).offset(), k)) {
+    return Status::OK();  // Not found
+  }
+  Status s;
+  std::string handle_encoding;
+  for (; block < ect->NumBlocks() && s.ok(); block++) {
+    handle_encoding.clear();
+    ect->GetBlockHandle(block).EncodeTo(&handle_encoding);
+    Iterator* block_iter = BlockReader(this, options, handle_encoding);
+    block_iter->Seek(k);
+    const bool found = block_iter->Valid();
+    if (found) {
+      Slice v = (options.limit != 0) ? block_iter->value() : Slice();
+      (*saver)(arg, block_iter->key(), v);
+    }
+    s = block_iter->status();
+    if (found && pin != NULL) {
+      *pin = block_iter;
+    } else {
+      delete block_iter;
+    }
+    if (found) {
+      break;
+    }
+  }
+  return s;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
-                          void (*saver)(void*, const Slice&, const Slice&)) {
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          Iterator** pin) {
+  if (rep_->ect_index != NULL && k.size() >= 8 &&
+      k.size() - 8 == rep_->ect_index->key_length()) {
+    return ECTGet(options, k, arg, saver, pin);
+  }
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = NewIndexIterator(options);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
@@ -279,12 +524,17 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
     } else {
       Iterator* block_iter = BlockReader(this, options, iiter->value());
       block_iter->Seek(k);
-      if (block_iter->Valid()) {
+      const bool found = block_iter->Valid();
+      if (found) {
         Slice v = (options.limit != 0) ? block_iter->value() : Slice();
         (*saver)(arg, block_iter->key(), v);
       }
       s = block_iter->status();
-      delete block_iter;
+      if (found && pin != NULL) {
+        *pin = block_iter;
+      } else {
+        delete block_iter;
+      }
     }
   }
   if (s.ok()) {
@@ -294,9 +544,125 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
   return s;
 }
 
+// Seek "k" in "block" and pass the first entry at or after it to "saver".
+static Status SearchBlock(Block* block, const Comparator* cmp,
+                          const ReadOptions& options, const Slice& k,
+                          void* arg,
+                          void (*saver)(void*, const Slice&, const Slice&)) {
+  Iterator* block_iter = block->NewIterator(cmp);
+  block_iter->Seek(k);
+  if (block_iter->Valid()) {
+    Slice v = (options.limit != 0) ? block_iter->value() : Slice();
+    (*saver)(arg, block_iter->key(), v);
+  }
+  Status s = block_iter->status();
+  delete block_iter;
+  return s;
+}
+
+// Look up many keys at once. Each key is first mapped to a data block
+// through the index and checked against the filter. Keys whose blocks are
+// in the block cache are served immediately. All remaining blocks are then
+// fetched using a single batched read before their keys are served.
+void Table::InternalMultiGet(const ReadOptions& options, size_t n,
+                             const Slice* keys, void* const* args,
+                             void (*saver)(void*, const Slice&, const Slice&),
+                             Status* statuses) {
+  if (rep_->ect_index != NULL || n < 2) {
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = InternalGet(options, keys[i], args[i], saver);
+    }
+    return;
+  }
+  const Comparator* const cmp = rep_->options.comparator;
+  Cache* const block_cache = rep_->options.block_cache;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  Slice cache_key(cache_key_buffer, sizeof(cache_key_buffer));
+
+  std::vector<BlockHandle> handles;  // Blocks to read
+  // Each key to serve once blocks are read: (index into handles, key)
+  std::vector<std::pair<size_t, size_t> > deferred;
+  Iterator* iiter = NewIndexIterator(options);
+  for (size_t i = 0; i < n; i++) {
+    statuses[i] = Status::OK();
+    iiter->Seek(keys[i]);
+    if (!iiter->Valid()) {
+      statuses[i] = iiter->status();
+      continue;
+    }
+    BlockHandle handle;
+    Slice handle_value = iiter->value();
+    statuses[i] = handle.DecodeFrom(&handle_value);
+    if (!statuses[i].ok()) {
+      continue;
+    }
+    FilterBlockReader* filter = rep_->filter;
+    if (filter != NULL && !filter->KeyMayMatch(handle.offset(), keys[i])) {
+      continue;  // Not found
+    }
+    if (block_cache != NULL) {
+      EncodeFixed64(cache_key_buffer + 8, handle.offset());
+      Cache::Handle* h = block_cache->Lookup(cache_key);
+      if (h != NULL) {
+        Block* block = reinterpret_cast<Block*>(block_cache->Value(h));
+        statuses[i] = SearchBlock(block, cmp, options, keys[i], args[i], saver);
+        block_cache->Release(h);
+        continue;
+      }
+    }
+    size_t b = 0;
+    // Consecutive keys often share a block
+    while (b < handles.size() && handles[b].offset() != handle.offset()) {
+      b++;
+    }
+    if (b == handles.size()) {
+      handles.push_back(handle);
+    }
+    deferred.push_back(std::make_pair(b, i));
+  }
+  delete iiter;
+  if (handles.empty()) {
+    return;
+  }
+
+  std::vector<BlockContents> contents(handles.size());
+  std::vector<Status> read_statuses(handles.size());
+  ReadBlocks(rep_->file, options, &handles[0], handles.size(), &contents[0],
+             &read_statuses[0], rep_->compression_dict);
+  std::vector<Block*> blocks(handles.size(), NULL);
+  std::vector<Cache::Handle*> cache_handles(handles.size(), NULL);
+  for (size_t b = 0; b < handles.size(); b++) {
+    if (read_statuses[b].ok()) {
+      blocks[b] = new Block(contents[b]);
+      if (block_cache != NULL && contents[b].cachable && options.fill_cache) {
+        EncodeFixed64(cache_key_buffer + 8, handles[b].offset());
+        cache_handles[b] = block_cache->Insert(
+            cache_key, blocks[b], blocks[b]->size(), &DeleteCachedBlock);
+      }
+    }
+  }
+  for (size_t j = 0; j < deferred.size(); j++) {
+    const size_t b = deferred[j].first;
+    const size_t i = deferred[j].second;
+    if (blocks[b] == NULL) {
+      statuses[i] = read_statuses[b];
+    } else {
+      statuses[i] =
+          SearchBlock(blocks[b], cmp, options, keys[i], args[i], saver);
+    }
+  }
+  for (size_t b = 0; b < handles.size(); b++) {
+    if (cache_handles[b] != NULL) {
+      block_cache->Release(cache_handles[b]);
+    } else {
+      delete blocks[b];
+    }
+  }
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -323,6 +689,17 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
 
 Table::~Table() { delete rep_; }
 
+size_t Table::ApproximateIndexMemoryUsage() const {
+  size_t result = 0;
+  if (rep_->index_block != NULL) {
+    result += rep_->index_block->ApproximateMemoryUsage();
+  }
+  if (rep_->ect_index != NULL) {
+    result += rep_->ect_index->ApproximateMemoryUsage();
+  }
+  return result;
+}
+
 const TableProperties* Table::GetProperties() const {
   Rep* r = rep_;
   if (r->props_valid) {
@@ -29,11 +29,146 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <deque>
+#include <string>
+#include <vector>
 
 namespace pdlfs {
 
+namespace {
+// Compress a block using *type and, for zstd, an optional digested
+// dictionary.
+// Return the contents to store, which either point to *compressed or to the
+// original block. *type is set to kNoCompression if the block is to be
+// stored uncompressed.
+Slice CompressBlock(const Slice& block_contents,
+                    const port::ZstdCompressionDict* dict,
+                    CompressionType* type, std::string* compressed) {
+  const char* const data = block_contents.data();
+  const size_t n = block_contents.size();
+  bool ok = false;
+  switch (*type) {
+    case kNoCompression:
+      break;
+    case kSnappyCompression:
+      ok = port::Snappy_Compress(data, n, compressed);
+      break;
+    case kLZ4Compression:
+      ok = port::LZ4_Compress(data, n, compressed);
+      break;
+    case kZstdCompression:
+      ok = port::Zstd_Compress(data, n, dict, compressed);
+      break;
+  }
+  if (ok && compressed->size() < n - (n / 8u)) {
+    return *compressed;
+  }
+  // Compression not supported, or compressed less than 12.5%, so just
+  // store uncompressed form
+  *type = kNoCompression;
+  return block_contents;
+}
+
+void EncodeBlockTrailer(const Slice& contents, CompressionType type,
+                        char* trailer) {
+  trailer[0] = type;
+  uint32_t crc = crc32c::Value(contents.data(), contents.size());
+  crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
+  EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+}
+}  // namespace
+
+// A data block handed over to options.compression_pool, or held until the
+// table's compression dictionary is trained. Blocks are written out by the
+// thread building the table in the order they are submitted. Everything the
+// table builder would have done with a block once it was written
+// (registering it with the filter, the ect index, and the index) is
+// deferred until then so that the resulting table does not depend on the
+// order in which blocks finish compressing.
+struct TableBuilder::PendingBlock {
+  enum State { kHeld, kQueued, kRunning, kDone };
+  State state;  // Protected by Pipeline::mu
+  CompressionType type;
+  std::string raw;  // Uncompressed block contents
+  std::string compressed;
+  Slice contents;  // Either raw or compressed
+  char trailer[kBlockTrailerSize];
+  uint64_t micros;  // Time spent compressing the block
+
+  std::string keys;  // Length-prefixed keys for the filter and ect index
+  std::string last_key;
+  bool has_next_key;  // False for the last block of a table
+  std::string next_key;
+
+  PendingBlock(State s, CompressionType t)
+      : state(s), type(t), micros(0), has_next_key(false) {}
+
+  void Compress(const port::ZstdCompressionDict* dict) {
+    const uint64_t start = CurrentThreadCpuMicros();
+    contents = CompressBlock(raw, dict, &type, &compressed);
+    micros = CurrentThreadCpuMicros() - start;
+    EncodeBlockTrailer(contents, type, trailer);
+  }
+};
+
+// Blocks of a table in flight. Shared between the thread building the table
+// and the pool threads compressing its blocks, and deleted by whoever drops
+// the last reference. The builder does not wait for scheduled pool work to
+// start: blocks not yet claimed by the pool are compressed by the builder
+// itself when it needs them.
+struct TableBuilder::Pipeline {
+  Pipeline(ThreadPool* pool, size_t max_inflight)
+      : pool(pool),
+        max_inflight(max_inflight),
+        cv(&mu),
+        cdict(NULL),
+        refs(1) {}
+
+  ~Pipeline() {
+    if (cdict != NULL) {
+      port::Zstd_DeleteCompressionDict(cdict);
+    }
+  }
+
+  // Return the first block that is not yet claimed, or NULL.
+  // REQUIRES: mu has been locked.
+  PendingBlock* ClaimLocked() {
+    for (size_t i = 0; i < blocks.size(); i++) {
+      if (blocks[i]->state == PendingBlock::kQueued) {
+        blocks[i]->state = PendingBlock::kRunning;
+        return blocks[i];
+      }
+    }
+    return NULL;
+  }
+
+  void Unref() {
+    mu.Lock();
+    const bool last_ref = (--refs == 0);
+    mu.Unlock();
+    if (last_ref) {
+      delete this;
+    }
+  }
+
+  ThreadPool* const pool;  // May be NULL
+  const size_t max_inflight;
+  port::Mutex mu;
+  port::CondVar cv;
+  std::deque<PendingBlock*> blocks;  // In table order
+  // Compression dictionary and its digested form, which is what blocks are
+  // compressed with. Set before any block is queued and never changed
+  // afterwards. cdict is NULL if there is no dictionary.
+  std::string dict;
+  port::ZstdCompressionDict* cdict;
+  int refs;
+};
+
 struct TableBuilder::Rep {
   Options options;
   WritableFile* file;
@@ -60,7 +195,30 @@ struct TableBuilder::Rep {
   bool pending_index_entry;
   BlockHandle pending_handle;  // Handle to add to index block
 
+  // Index partitions finished so far when options.index_partition_size is
+  // set, along with the last index key of each partition. Partitions are
+  // written out together at the end so that they won't shift the offsets
+  // of the data blocks already registered with the filter block.
+  std::vector<std::string> index_partitions;
+  std::vector<std::string> index_partition_keys;
+
+  ECTIndexBuilder* ect_index;  // NULL unless options.ect_index is set
+
   std::string compressed_output;
+  uint64_t compression_micros;
+
+  // Set when options.compression_pool is set or a compression dictionary
+  // is to be trained. Keys of the current data block are then kept in
+  // "block_keys" for the filter and the ect index until the block is
+  // written. "inflight_bytes" is the uncompressed size of blocks submitted
+  // but not yet written.
+  Pipeline* pipeline;
+  std::string block_keys;
+  uint64_t inflight_bytes;
+
+  // True while data blocks are held for training a compression dictionary.
+  bool sampling;
+  uint64_t sampled_bytes;
 
   Rep(const Options& options, WritableFile* f)
       : options(options),
@@ -72,9 +230,25 @@ struct TableBuilder::Rep {
         num_blocks(0),
         closed(false),
         filter_block(options.filter_policy != NULL
-                         ? new FilterBlockBuilder(options.filter_policy)
+                         ? new FilterBlockBuilder(options.filter_policy,
+                                                  options.full_filter)
                          : NULL),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        ect_index(options.ect_index ? new ECTIndexBuilder : NULL),
+        compression_micros(0),
+        pipeline(NULL),
+        inflight_bytes(0),
+        sampling(options.compression == kZstdCompression &&
+                 options.compression_dict_size != 0),
+        sampled_bytes(0) {
+    if (options.compression_pool != NULL) {
+      pipeline = new Pipeline(options.compression_pool,
+                              std::max(options.max_inflight_blocks, 1));
+    } else if (sampling) {
+      // Held blocks are compressed by the builder once the dictionary is
+      // trained. There is no point in keeping more than one block after that.
+      pipeline = new Pipeline(NULL, 1);
+    }
     assert(options.comparator != NULL);
   }
 };
@@ -85,7 +259,13 @@ uint64_t TableBuilder::NumEntries() const { return rep_->num_entries; }
 
 uint64_t TableBuilder::NumBlocks() const { return rep_->num_blocks; }
 
-uint64_t TableBuilder::FileSize() const { return rep_->offset; }
+uint64_t TableBuilder::FileSize() const {
+  return rep_->offset + rep_->inflight_bytes;
+}
+
+uint64_t TableBuilder::CompressionMicros() const {
+  return rep_->compression_micros;
+}
 
 const TableProperties* TableBuilder::properties() const {
   return &rep_->props_;
@@ -100,7 +280,12 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
+  if (rep_->pipeline != NULL) {
+    DrainBlocks(0, false);
+    rep_->pipeline->Unref();
+  }
   delete rep_->filter_block;
+  delete rep_->ect_index;
   delete rep_;
 }
 
@@ -138,17 +323,34 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
 
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
-    r->index_block.AddIndexEntry(&r->last_key, &key, r->pending_handle);
+    if (r->pipeline != NULL) {
+      // The index entry is added once the previous block is written
+      MutexLock l(&r->pipeline->mu);
+      PendingBlock* const b = r->pipeline->blocks.back();
+      b->next_key.assign(key.data(), key.size());
+      b->has_next_key = true;
+    } else {
+      AddIndexEntry(&r->last_key, &key, r->pending_handle);
+    }
     r->pending_index_entry = false;
   }
 
-  if (r->filter_block != NULL) {
-    r->filter_block->AddKey(key);
+  if (r->pipeline != NULL) {
+    if (r->filter_block != NULL || r->ect_index != NULL) {
+      PutLengthPrefixedSlice(&r->block_keys, key);
+    }
+  } else {
+    if (r->filter_block != NULL) {
+      r->filter_block->AddKey(key);
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
   r->index_block.OnKeyAdded(key);
+  if (r->ect_index != NULL && r->pipeline == NULL) {
+    r->ect_index->OnKeyAdded(key);
+  }
 
   r->data_block.Add(key, value);
   const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
@@ -163,9 +365,20 @@ void TableBuilder::Flush() {
   if (!ok()) return;
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
+  if (r->pipeline != NULL) {
+    SubmitBlock();
+    if (ok()) {
+      r->pending_index_entry = true;
+      r->num_blocks++;
+    }
+    return;
+  }
   AddBlock(&r->data_block, &r->pending_handle);
   if (ok()) {
     r->pending_index_entry = true;
+    if (r->ect_index != NULL) {
+      r->ect_index->OnDataBlockFinished(r->pending_handle);
+    }
     r->status = r->file->Flush();
     if (ok()) {
       r->num_blocks++;
@@ -176,6 +389,212 @@ void TableBuilder::Flush() {
   }
 }
 
+void TableBuilder::AddIndexEntry(std::string* last_key, const Slice* next_key,
+                                 const BlockHandle& handle) {
+  Rep* r = rep_;
+  r->index_block.AddIndexEntry(last_key, next_key, handle);
+  if (r->options.index_partition_size != 0 &&
+      r->index_block.CurrentSizeEstimate() >=
+          r->options.index_partition_size) {
+    CutIndexPartition(*last_key);
+  }
+}
+
+void TableBuilder::CutIndexPartition(const std::string& last_index_key) {
+  Rep* r = rep_;
+  assert(!r->index_block.empty());
+  // last_index_key is the key of the last index entry: it is >= all keys
+  // indexed by this partition and < all keys indexed by the next partition.
+  r->index_partitions.push_back(r->index_block.Finish().ToString());
+  r->index_partition_keys.push_back(last_index_key);
+  r->index_block.Reset();
+}
+
+void TableBuilder::BGWork(void* arg) {
+  Pipeline* const p = reinterpret_cast<Pipeline*>(arg);
+  p->mu.Lock();
+  PendingBlock* b;
+  while ((b = p->ClaimLocked()) != NULL) {
+    p->mu.Unlock();
+    b->Compress(p->cdict);
+    p->mu.Lock();
+    b->state = PendingBlock::kDone;
+    p->cv.SignalAll();
+  }
+  const bool last_ref = (--p->refs == 0);
+  p->mu.Unlock();
+  if (last_ref) {
+    delete p;
+  }
+}
+
+// Hand the current data block over to the compression pool after making
+// room for it in the pipeline. While a compression dictionary is being
+// sampled, the block is held instead.
+void TableBuilder::SubmitBlock() {
+  Rep* r = rep_;
+  Pipeline* const p = r->pipeline;
+  if (!r->sampling) {
+    DrainBlocks(p->max_inflight - 1, true);
+    if (!ok()) return;
+  }
+  PendingBlock* const b = new PendingBlock(
+      r->sampling ? PendingBlock::kHeld : PendingBlock::kQueued,
+      r->options.compression);
+  Slice raw = r->data_block.Finish();
+  b->raw.assign(raw.data(), raw.size());
+  r->data_block.Reset();
+  b->keys.swap(r->block_keys);
+  b->last_key = r->last_key;
+  r->inflight_bytes += b->raw.size() + kBlockTrailerSize;
+  const bool schedule = !r->sampling && p->pool != NULL;
+  p->mu.Lock();
+  p->blocks.push_back(b);
+  if (schedule) {
+    p->refs++;
+  }
+  p->mu.Unlock();
+  if (schedule) {
+    p->pool->Schedule(&TableBuilder::BGWork, p);
+  } else if (r->sampling) {
+    r->sampled_bytes += b->raw.size();
+    if (r->sampled_bytes >= r->options.compression_dict_sample_size) {
+      TrainDictionary();
+    }
+  }
+}
+
+// Train the compression dictionary using the blocks held so far and release
+// them for compression. Without enough samples, blocks are compressed
+// without a dictionary.
+void TableBuilder::TrainDictionary() {
+  Rep* r = rep_;
+  Pipeline* const p = r->pipeline;
+  assert(r->sampling);
+  r->sampling = false;
+  // Held blocks are never touched by pool threads
+  std::string samples;
+  std::vector<size_t> sample_sizes;
+  for (size_t i = 0; i < p->blocks.size(); i++) {
+    samples.append(p->blocks[i]->raw);
+    sample_sizes.push_back(p->blocks[i]->raw.size());
+  }
+  std::string dict;
+  if (!sample_sizes.empty()) {
+    port::Zstd_TrainDictionary(samples.data(), &sample_sizes[0],
+                               sample_sizes.size(),
+                               r->options.compression_dict_size, &dict);
+  }
+  // Digest the dictionary once for all blocks of the table. Skip the
+  // dictionary if it cannot be digested so it is not written to the table.
+  port::ZstdCompressionDict* cdict = NULL;
+  if (!dict.empty()) {
+    cdict = port::Zstd_NewCompressionDict(dict.data(), dict.size());
+    if (cdict == NULL) {
+      dict.clear();
+    }
+  }
+  int n = 0;
+  p->mu.Lock();
+  p->dict.swap(dict);
+  p->cdict = cdict;
+  for (size_t i = 0; i < p->blocks.size(); i++) {
+    if (p->blocks[i]->state == PendingBlock::kHeld) {
+      p->blocks[i]->state = PendingBlock::kQueued;
+      n++;
+    }
+  }
+  if (p->pool != NULL) {
+    p->refs += n;
+  } else {
+    n = 0;
+  }
+  p->mu.Unlock();
+  for (int i = 0; i < n; i++) {
+    p->pool->Schedule(&TableBuilder::BGWork, p);
+  }
+}
+
+// Remove finished blocks from the head of the pipeline until at most "n"
+// blocks remain in flight, writing them out if "write" is true and there
+// has been no error. Blocks not yet claimed by the pool are compressed by
+// the calling thread.
+// REQUIRES: no blocks are held for sampling unless "write" is false.
+void TableBuilder::DrainBlocks(size_t n, bool write) {
+  Rep* r = rep_;
+  Pipeline* const p = r->pipeline;
+  p->mu.Lock();
+  while (!p->blocks.empty()) {
+    PendingBlock* const b = p->blocks.front();
+    const bool emit = write && ok();
+    if (b->state != PendingBlock::kDone) {
+      if (p->blocks.size() <= n) {
+        break;
+      } else if (b->state == PendingBlock::kRunning) {
+        p->cv.Wait();
+        continue;
+      }
+      assert(!emit || b->state != PendingBlock::kHeld);
+      b->state = PendingBlock::kRunning;
+      if (emit) {
+        p->mu.Unlock();
+        b->Compress(p->cdict);
+        p->mu.Lock();
+      }
+      b->state = PendingBlock::kDone;
+    }
+    p->blocks.pop_front();
+    p->mu.Unlock();
+    r->inflight_bytes -= b->raw.size() + kBlockTrailerSize;
+    if (emit) {
+      EmitBlock(b);
+    }
+    delete b;
+    p->mu.Lock();
+  }
+  p->mu.Unlock();
+}
+
+// Write out a compressed block and register it the same way Add() and
+// Flush() would have had the block been written when it was cut.
+void TableBuilder::EmitBlock(PendingBlock* b) {
+  Rep* r = rep_;
+  BlockHandle handle;
+  r->compression_micros += b->micros;
+  AppendBlock(b->contents, b->trailer, &handle);
+  if (ok()) {
+    r->status = r->file->Flush();
+  }
+  if (!ok()) {
+    return;
+  }
+  Slice keys = b->keys;
+  Slice key;
+  while (GetLengthPrefixedSlice(&keys, &key)) {
+    if (r->filter_block != NULL) {
+      r->filter_block->AddKey(key);
+    }
+    if (r->ect_index != NULL) {
+      r->ect_index->OnKeyAdded(key);
+    }
+  }
+  if (r->ect_index != NULL) {
+    r->ect_index->OnDataBlockFinished(handle);
+  }
+  if (r->filter_block != NULL) {
+    r->filter_block->StartBlock(r->offset);
+  }
+  if (b->has_next_key) {
+    Slice next_key = b->next_key;
+    AddIndexEntry(&b->last_key, &next_key, handle);
+  } else {
+    // Only the last block of the table is still waiting for its index
+    // entry. Finish() will add it.
+    assert(r->pipeline->blocks.empty());
+    r->pending_handle = handle;
+  }
+}
+
 void TableBuilder::AddBlock(BlockBuilder* builder, BlockHandle* handle) {
   WriteBlock(builder->Finish(), handle);
   builder->Reset();
@@ -189,49 +608,36 @@ void TableBuilder::WriteBlock(const Slice& block_contents,
   //    crc: uint32
   assert(ok());
   Rep* r = rep_;
-  Slice raw_block_contents;
   CompressionType type = r->options.compression;
-  switch (type) {
-    case kNoCompression:
-      raw_block_contents = block_contents;
-      break;
-
-    case kSnappyCompression: {
-      std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(block_contents.data(), block_contents.size(),
-                                compressed) &&
-          compressed->size() <
-              block_contents.size() - (block_contents.size() / 8u)) {
-        raw_block_contents = *compressed;
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        raw_block_contents = block_contents;
-        type = kNoCompression;
-      }
-      break;
-    }
+  const port::ZstdCompressionDict* dict = NULL;
+  if (r->pipeline != NULL) {
+    dict = r->pipeline->cdict;
   }
+  const uint64_t start = CurrentThreadCpuMicros();
+  Slice raw_block_contents =
+      CompressBlock(block_contents, dict, &type, &r->compressed_output);
+  r->compression_micros += CurrentThreadCpuMicros() - start;
   WriteRawBlock(raw_block_contents, type, handle);
   r->compressed_output.clear();
 }
 
 void TableBuilder::WriteRawBlock(const Slice& raw_block_contents,
                                  CompressionType type, BlockHandle* handle) {
+  char trailer[kBlockTrailerSize];
+  EncodeBlockTrailer(raw_block_contents, type, trailer);
+  AppendBlock(raw_block_contents, trailer, handle);
+}
+
+void TableBuilder::AppendBlock(const Slice& contents, const char* trailer,
+                               BlockHandle* handle) {
   Rep* r = rep_;
   handle->set_offset(r->offset);
-  handle->set_size(raw_block_contents.size());
-  r->status = r->file->Append(raw_block_contents);
+  handle->set_size(contents.size());
+  r->status = r->file->Append(contents);
   if (r->status.ok()) {
-    char trailer[kBlockTrailerSize];
-    trailer[0] = type;
-    uint32_t crc =
-        crc32c::Value(raw_block_contents.data(), raw_block_contents.size());
-    crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
-    EncodeFixed32(trailer + 1, crc32c::Mask(crc));
     r->status = r->file->Append(Slice(trailer, kBlockTrailerSize));
     if (r->status.ok()) {
-      r->offset += raw_block_contents.size() + kBlockTrailerSize;
+      r->offset += contents.size() + kBlockTrailerSize;
     }
   }
 }
@@ -239,13 +645,31 @@ void TableBuilder::WriteRawBlock(const Slice& raw_block_contents,
 Status TableBuilder::Finish() {
   Rep* r = rep_;
   Flush();
+  if (r->pipeline != NULL) {
+    if (r->sampling && ok()) {
+      TrainDictionary();
+    }
+    DrainBlocks(0, true);
+  }
   assert(!r->closed);
   r->closed = true;
+  BlockHandle dict_block_handle;
+  bool has_dict = false;
   BlockHandle filter_block_handle;
+  BlockHandle ect_index_handle;
+  bool has_ect_index = false;
   BlockHandle props_block_handle;
   BlockHandle metaindex_block_handle;
   BlockHandle index_block_handle;
 
+  // Write compression dictionary
+  if (ok()) {
+    if (r->pipeline != NULL && !r->pipeline->dict.empty()) {
+      WriteRawBlock(r->pipeline->dict, kNoCompression, &dict_block_handle);
+      has_dict = true;
+    }
+  }
+
   // Write filter block
   if (ok()) {
     if (r->filter_block != NULL) {
@@ -254,6 +678,15 @@ Status TableBuilder::Finish() {
     }
   }
 
+  // Write ect index block
+  if (ok()) {
+    std::string contents;
+    if (r->ect_index != NULL && r->ect_index->Finish(&contents)) {
+      WriteRawBlock(contents, kNoCompression, &ect_index_handle);
+      has_ect_index = true;
+    }
+  }
+
   // Write stats
   if (ok()) {
     r->props_.SetLastKey(r->last_key);
@@ -266,15 +699,28 @@ Status TableBuilder::Finish() {
   if (ok()) {
     BlockBuilder meta_index_block(1);
 
+    if (has_dict) {
+      std::string handle_encoding;
+      dict_block_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add("compression.dict", handle_encoding);
+    }
+
     if (r->filter_block != NULL) {
-      // Add mapping from "filter.Name" to location of filter data
-      std::string key = "filter.";
+      // Add mapping from "filter.Name" or "fullfilter.Name" to location
+      // of filter data
+      std::string key = r->options.full_filter ? "fullfilter." : "filter.";
       key.append(r->options.filter_policy->Name());
       std::string handle_encoding;
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
 
+    if (has_ect_index) {
+      std::string handle_encoding;
+      ect_index_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add("index.ect", handle_encoding);
+    }
+
     std::string key = "table.properties";
     std::string handle_encoding;
     props_block_handle.EncodeTo(&handle_encoding);
@@ -285,12 +731,34 @@ Status TableBuilder::Finish() {
   }
 
   // Write index block
+  Footer::IndexType index_type = Footer::kFlatIndex;
   if (ok()) {
     if (r->pending_index_entry) {
       r->index_block.AddIndexEntry(&r->last_key, NULL, r->pending_handle);
       r->pending_index_entry = false;
     }
-    WriteBlock(r->index_block.Finish(), &index_block_handle);
+    if (r->index_partitions.empty()) {
+      WriteBlock(r->index_block.Finish(), &index_block_handle);
+    } else {
+      if (!r->index_block.empty()) {
+        CutIndexPartition(r->last_key);
+      }
+      // Write index partitions followed by the top-level index block
+      BlockBuilder top_index_block(r->options.index_block_restart_interval,
+                                   r->options.comparator);
+      BlockHandle partition_handle;
+      std::string handle_encoding;
+      for (size_t i = 0; i < r->index_partitions.size() && ok(); i++) {
+        WriteBlock(r->index_partitions[i], &partition_handle);
+        handle_encoding.clear();
+        partition_handle.EncodeTo(&handle_encoding);
+        top_index_block.Add(r->index_partition_keys[i], handle_encoding);
+      }
+      if (ok()) {
+        WriteBlock(top_index_block.Finish(), &index_block_handle);
+        index_type = Footer::kTwoLevelIndex;
+      }
+    }
   }
 
   // Write footer
@@ -298,6 +766,7 @@ Status TableBuilder::Finish() {
     Footer footer;
     footer.set_metaindex_handle(metaindex_block_handle);
     footer.set_index_handle(index_block_handle);
+    footer.set_index_type(index_type);
     std::string footer_encoding;
     footer.EncodeTo(&footer_encoding);
     r->status = r->file->Append(footer_encoding);
@@ -311,6 +780,9 @@ Status TableBuilder::Finish() {
 void TableBuilder::Abandon() {
   Rep* r = rep_;
   assert(!r->closed);
+  if (r->pipeline != NULL) {
+    DrainBlocks(0, false);
+  }
   r->closed = true;
 }
 
@@ -10,10 +10,17 @@
  */
 #include "pdlfs-common/leveldb/table.h"
 #include "pdlfs-common/leveldb/comparator.h"
+#include "pdlfs-common/leveldb/filter_policy.h"
+#include "pdlfs-common/leveldb/format.h"
 #include "pdlfs-common/leveldb/internal_types.h"
+#include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/leveldb/table_builder.h"
 #include "pdlfs-common/leveldb/table_properties.h"
+
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
@@ -95,6 +102,8 @@ class TableWriter {
 
   std::string contents() const { return file_.contents(); }
 
+  const KVMap& data() const { return data_; }
+
   void Put(const std::string& key, const std::string& value) {
     data_[key] = value;
   }
@@ -141,6 +150,8 @@ class TableReader {
 
   ~TableReader() { delete table_; }
 
+  Table* table() { return table_; }
+
   Slice SmallestKey() {
     const TableProperties* const props = table_->GetProperties();
     ASSERT_TRUE(props != NULL);
@@ -213,6 +224,225 @@ TEST(TableTest, ReadWrite) {
   ASSERT_EQ(reader.MaxSeq(), kMinSequenceNumber + kNumEntries - 1);
 }
 
+static Footer::IndexType GetIndexType(const std::string& contents) {
+  Footer footer;
+  Slice input(contents.data() + contents.size() - Footer::kEncodedLength,
+              Footer::kEncodedLength);
+  ASSERT_OK(footer.DecodeFrom(&input));
+  return footer.index_type();
+}
+
+static void CheckContents(TableWriter* writer, TableReader* reader) {
+  const KVMap& data = writer->data();
+  Iterator* iter = reader->table()->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  for (KVMap::const_iterator it = data.begin(); it != data.end(); ++it) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->value().ToString(), it->second);
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  uint64_t last_offset = 0;
+  for (KVMap::const_iterator it = data.begin(); it != data.end(); ++it) {
+    iter->Seek(it->first);
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    uint64_t offset = reader->table()->ApproximateOffsetOf(it->first);
+    ASSERT_GE(offset, last_offset);
+    last_offset = offset;
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+TEST(TableTest, FlatIndex) {
+  Options options;
+  options.block_size = 256;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  ASSERT_EQ(GetIndexType(contents), Footer::kFlatIndex);
+  TableReader reader(options, contents);
+  CheckContents(&writer, &reader);
+}
+
+TEST(TableTest, TwoLevelIndex) {
+  Cache* const cache = NewLRUCache(1 << 20);
+  Options options;
+  options.block_cache = cache;
+  options.block_size = 256;
+  options.index_partition_size = 256;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  ASSERT_EQ(GetIndexType(contents), Footer::kTwoLevelIndex);
+  {
+    TableReader reader(options, contents);
+    CheckContents(&writer, &reader);
+    CheckContents(&writer, &reader);  // Now with partitions in cache
+  }
+  options.block_cache = NULL;
+  {
+    TableReader reader(options, contents);
+    CheckContents(&writer, &reader);
+  }
+  delete cache;
+}
+
+TEST(TableTest, SmallTwoLevelIndex) {
+  Options options;
+  options.index_partition_size = 1 << 20;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  // The index fits in a single partition
+  ASSERT_EQ(GetIndexType(contents), Footer::kFlatIndex);
+  TableReader reader(options, contents);
+  CheckContents(&writer, &reader);
+}
+
+TEST(TableTest, ECTIndex) {
+  Cache* const cache = NewLRUCache(1 << 20);
+  Options options;
+  options.block_cache = cache;
+  options.block_size = 256;
+  options.ect_index = true;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  {
+    TableReader reader(options, contents);
+    // Iterators read the regular index through the block cache
+    CheckContents(&writer, &reader);
+  }
+  delete cache;
+}
+
+// Tables whose blocks are compressed by a thread pool must be identical to
+// those built by a single thread no matter how many blocks are in flight.
+TEST(TableTest, CompressionPool) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3);
+  const FilterPolicy* const policy = NewBloomFilterPolicy(10);
+  for (int i = 0; i < 4; i++) {
+    Options options;
+    options.block_size = 256;
+    options.index_partition_size = 256;
+    options.filter_policy = policy;
+    options.full_filter = (i & 1) != 0;
+    options.ect_index = (i & 2) != 0;
+    TableWriter writer(options);
+    const std::string expected = CreateTable(&writer);
+    options.compression_pool = pool;
+    for (int max_inflight = 1; max_inflight <= 16; max_inflight *= 4) {
+      options.max_inflight_blocks = max_inflight;
+      TableWriter pipelined_writer(options);
+      const std::string contents = CreateTable(&pipelined_writer);
+      ASSERT_TRUE(contents == expected);
+      TableReader reader(options, contents);
+      CheckContents(&pipelined_writer, &reader);
+    }
+  }
+  delete policy;
+  delete pool;
+}
+
+// Tables compressed with every codec read back correctly. Codecs not built
+// in fall back to storing blocks uncompressed.
+TEST(TableTest, Codecs) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3);
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  TableWriter plain_writer(options);
+  const std::string plain = CreateTable(&plain_writer);
+  const CompressionType types[] = {kSnappyCompression, kLZ4Compression,
+                                   kZstdCompression};
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    options.compression = types[i];
+    options.compression_pool = NULL;
+    TableWriter writer(options);
+    const std::string contents = CreateTable(&writer);
+    TableReader reader(options, contents);
+    CheckContents(&writer, &reader);
+    options.compression_pool = pool;
+    TableWriter pipelined_writer(options);
+    ASSERT_TRUE(CreateTable(&pipelined_writer) == contents);
+  }
+#if defined(PDLFS_LZ4)
+  options.compression = kLZ4Compression;
+  options.compression_pool = NULL;
+  TableWriter lz4_writer(options);
+  ASSERT_LT(CreateTable(&lz4_writer).size(), plain.size());
+#endif
+#if defined(PDLFS_ZSTD)
+  options.compression = kZstdCompression;
+  options.compression_pool = NULL;
+  TableWriter zstd_writer(options);
+  ASSERT_LT(CreateTable(&zstd_writer).size(), plain.size());
+#endif
+  delete pool;
+}
+
+// Tables compressed with a trained zstd dictionary read back correctly and
+// are identical whether or not blocks are compressed by a thread pool.
+TEST(TableTest, CompressionDict) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3);
+  const FilterPolicy* const policy = NewBloomFilterPolicy(10);
+  Options options;
+  options.block_size = 256;
+  options.index_partition_size = 256;
+  options.filter_policy = policy;
+  options.compression = kZstdCompression;
+  TableWriter zstd_writer(options);
+  const std::string zstd = CreateTable(&zstd_writer);
+  options.compression_dict_size = 2048;
+  // Sample part of the table, all of it, and more than all of it
+  const size_t sample_sizes[] = {16 << 10, 32 << 10, 1 << 20};
+  for (size_t i = 0; i < 3; i++) {
+    options.compression_dict_sample_size = sample_sizes[i];
+    options.compression_pool = NULL;
+    TableWriter writer(options);
+    const std::string contents = CreateTable(&writer);
+    TableReader reader(options, contents);
+    CheckContents(&writer, &reader);
+#if defined(PDLFS_ZSTD)
+    ASSERT_TRUE(contents != zstd);
+#else
+    ASSERT_TRUE(contents == zstd);
+#endif
+    options.compression_pool = pool;
+    for (int max_inflight = 1; max_inflight <= 16; max_inflight *= 4) {
+      options.max_inflight_blocks = max_inflight;
+      TableWriter pipelined_writer(options);
+      ASSERT_TRUE(CreateTable(&pipelined_writer) == contents);
+    }
+  }
+  delete policy;
+  delete pool;
+}
+
+// Compare the memory pinned by the regular index and the ect index of
+// tables with fixed-length keys. The ect index wins with small blocks.
+TEST(TableTest, IndexMemoryUsage) {
+  for (int block_size = 256; block_size <= 4096; block_size *= 4) {
+    Options options;
+    options.block_size = block_size;
+    TableWriter writer(options);
+    std::string contents = CreateTable(&writer);
+    TableReader reader(options, contents);
+    options.ect_index = true;
+    TableWriter ect_writer(options);
+    std::string ect_contents = CreateTable(&ect_writer);
+    TableReader ect_reader(options, ect_contents);
+    const size_t bytes = reader.table()->ApproximateIndexMemoryUsage();
+    const size_t ect_bytes = ect_reader.table()->ApproximateIndexMemoryUsage();
+    fprintf(stderr, "block_size=%d\tindex=%zu bytes\tect_index=%zu bytes\n",
+            block_size, bytes, ect_bytes);
+#if defined(PDLFS_SILT_ECT)
+    if (block_size == 256) {
+      ASSERT_LT(ect_bytes, bytes);
+    }
+#endif
+  }
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
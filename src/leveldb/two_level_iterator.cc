@@ -17,6 +17,7 @@
 #include "two_level_iterator.h"
 
 #include "pdlfs-common/leveldb/block.h"
+#include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/format.h"
 #include "pdlfs-common/leveldb/iterator_wrapper.h"
 #include "pdlfs-common/leveldb/options.h"
@@ -25,11 +26,17 @@ namespace pdlfs {
 namespace {
 
 typedef Iterator* (*BlockFunction)(void*, const ReadOptions&, const Slice&);
+typedef size_t (*PrefetchFunction)(void*, const ReadOptions&, const Slice&,
+                                   const Slice&);
 
 class TwoLevelIterator : public Iterator {
  public:
   TwoLevelIterator(Iterator* index_iter, BlockFunction block_function,
                    void* arg, const ReadOptions& options);
+  TwoLevelIterator(Iterator* index_iter, BlockFunction block_function,
+                   PrefetchFunction prefetch_function, void* arg,
+                   const ReadOptions& options, const Comparator* cmp,
+                   const Slice& upper_bound);
 
   virtual ~TwoLevelIterator();
 
@@ -67,10 +74,22 @@ class TwoLevelIterator : public Iterator {
   void SkipEmptyDataBlocksBackward();
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
+  void MaybePrefetch();
+  // True iff blocks after the current index entry can only hold keys past
+  // the upper bound
+  bool PastUpperBound() const {
+    return cmp_ != NULL && index_iter_.Valid() &&
+           cmp_->Compare(index_iter_.key(), upper_bound_) >= 0;
+  }
 
   BlockFunction block_function_;
+  PrefetchFunction prefetch_function_;
   void* arg_;
   const ReadOptions options_;
+  const Comparator* cmp_;  // NULL if there is no upper bound
+  std::string upper_bound_;
+  // Number of blocks read ahead by prefetch_function_ not yet consumed
+  size_t blocks_ahead_;
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_;  // May be NULL
@@ -83,15 +102,40 @@ TwoLevelIterator::TwoLevelIterator(Iterator* index_iter,
                                    BlockFunction block_function, void* arg,
                                    const ReadOptions& options)
     : block_function_(block_function),
+      prefetch_function_(NULL),
+      arg_(arg),
+      options_(options),
+      cmp_(NULL),
+      blocks_ahead_(0),
+      index_iter_(index_iter),
+      data_iter_(NULL) {}
+
+TwoLevelIterator::TwoLevelIterator(Iterator* index_iter,
+                                   BlockFunction block_function,
+                                   PrefetchFunction prefetch_function,
+                                   void* arg, const ReadOptions& options,
+                                   const Comparator* cmp,
+                                   const Slice& upper_bound)
+    : block_function_(block_function),
+      prefetch_function_(prefetch_function),
       arg_(arg),
       options_(options),
+      cmp_(upper_bound.empty() ? NULL : cmp),
+      upper_bound_(upper_bound.data(), upper_bound.size()),
+      blocks_ahead_(0),
       index_iter_(index_iter),
       data_iter_(NULL) {}
 
 TwoLevelIterator::~TwoLevelIterator() {}
 
 void TwoLevelIterator::Seek(const Slice& target) {
+  if (cmp_ != NULL && cmp_->Compare(target, upper_bound_) >= 0) {
+    SetDataIterator(NULL);
+    return;
+  }
   index_iter_.Seek(target);
+  blocks_ahead_ = 0;
+  MaybePrefetch();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.Seek(target);
   SkipEmptyDataBlocksForward();
@@ -99,6 +143,8 @@ void TwoLevelIterator::Seek(const Slice& target) {
 
 void TwoLevelIterator::SeekToFirst() {
   index_iter_.SeekToFirst();
+  blocks_ahead_ = 0;
+  MaybePrefetch();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
   SkipEmptyDataBlocksForward();
@@ -126,11 +172,12 @@ void TwoLevelIterator::Prev() {
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
+    if (!index_iter_.Valid() || PastUpperBound()) {
       SetDataIterator(NULL);
       return;
     }
     index_iter_.Next();
+    MaybePrefetch();
     InitDataBlock();
     if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
   }
@@ -154,6 +201,21 @@ void TwoLevelIterator::SetDataIterator(Iterator* data_iter) {
   data_iter_.Set(data_iter);
 }
 
+void TwoLevelIterator::MaybePrefetch() {
+  if (prefetch_function_ == NULL || !index_iter_.Valid()) {
+    return;
+  }
+  if (blocks_ahead_ == 0) {
+    blocks_ahead_ = (*prefetch_function_)(arg_, options_, index_iter_.key(),
+                                          upper_bound_);
+    if (blocks_ahead_ == 0) {  // Reading ahead is of no use
+      prefetch_function_ = NULL;
+      return;
+    }
+  }
+  blocks_ahead_--;
+}
+
 void TwoLevelIterator::InitDataBlock() {
   if (!index_iter_.Valid()) {
     SetDataIterator(NULL);
@@ -180,4 +242,16 @@ Iterator* NewTwoLevelIterator(/* clang-format off */
   return new TwoLevelIterator(index_iter, block_function, arg, options);
 } /* clang-format on */
 
+Iterator* NewBoundedTwoLevelIterator(/* clang-format off */
+    Iterator* index_iter,
+    BlockFunction block_function,
+    PrefetchFunction prefetch_function,
+    void* arg,
+    const ReadOptions& options,
+    const Comparator* cmp,
+    const Slice& upper_bound) {
+  return new TwoLevelIterator(index_iter, block_function, prefetch_function,
+                              arg, options, cmp, upper_bound);
+} /* clang-format on */
+
 }  // namespace pdlfs
@@ -16,8 +16,11 @@
  */
 #pragma once
 
+#include <stddef.h>
+
 namespace pdlfs {
 
+class Comparator;
 class Slice;
 class Iterator;
 struct ReadOptions;
@@ -37,4 +40,25 @@ extern Iterator* NewTwoLevelIterator(
                                 const Slice& index_value),
     void* arg, const ReadOptions& options);
 
+// Same as above, but the returned iterator stops moving forward once the key
+// of an index entry reaches "upper_bound" according to "cmp", since the
+// blocks that follow can only hold keys past the bound. Seeking to a target
+// at or past the bound yields an invalid iterator without reading any block.
+// An empty "upper_bound" means no bound.
+//
+// If "prefetch_function" is not NULL, a forward scan calls it with the key of
+// the index entry of the block it is about to read once the blocks read
+// ahead by the previous call have been consumed. The function may read that
+// block and some of the blocks that follow ahead of time and returns the
+// number of blocks it has covered. Returning 0 stops further read ahead.
+extern Iterator* NewBoundedTwoLevelIterator(
+    Iterator* index_iter,
+    Iterator* (*block_function)(void* arg, const ReadOptions& options,
+                                const Slice& index_value),
+    size_t (*prefetch_function)(void* arg, const ReadOptions& options,
+                                const Slice& index_key,
+                                const Slice& upper_bound),
+    void* arg, const ReadOptions& options, const Comparator* cmp,
+    const Slice& upper_bound);
+
 }  // namespace pdlfs
@@ -13,7 +13,18 @@
 namespace pdlfs {
 
 OfsOptions::OfsOptions()
-    : deferred_gc(false), sync_log_on_close(false), info_log(NULL) {}
+    : deferred_gc(false),
+      sync_log_on_close(false),
+      info_log(NULL),
+      max_log_size(0),
+      checkpoint_pool(NULL) {}
+
+FileSetStats::FileSetStats()
+    : mount_micros(0),
+      replayed_records(0),
+      replayed_ops(0),
+      num_checkpoints(0),
+      log_size(0) {}
 
 Ofs::Ofs(const OfsOptions& options, Osd* osd) {
   impl_ = new Impl(options, osd);
@@ -119,8 +130,7 @@ Status Ofs::MountFileSet(const MountOptions& options, const char* dirname) {
       return PathError(dirname);
     }
   }
-  FileSet* const fset =
-      new FileSet(options, name, impl_->options_.sync_log_on_close);
+  FileSet* const fset = new FileSet(impl_->options_, options, name);
   Status s = impl_->LinkFileSet(dirname, fset);
   if (!s.ok()) delete fset;
   return s;
@@ -138,6 +148,10 @@ Status Ofs::SynFileSet(const char* dirname) {
   return impl_->SynFileSet(dirname);
 }
 
+Status Ofs::GetFileSetStats(const char* dirname, FileSetStats* stats) {
+  return impl_->GetFileSetStats(dirname, stats);
+}
+
 Status Ofs::NewSequentialFile(const char* fname, SequentialFile** r) {
   ResolvedPath fp;
   if (!ResolvePath(fname, &fp.mntptr, &fp.base)) {
@@ -10,26 +10,75 @@
  */
 #include "ofs_impl.h"
 
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/log_scanner.h"
 #include "pdlfs-common/mutexlock.h"
 
+#include <algorithm>
+
 namespace pdlfs {
-std::string Ofs::Impl::TEST_GetObjectName(const OfsPath& fp) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
-  if (!fset) {
-    return std::string();
-  } else {
-    std::string r;
-    char* c = fset->files.Lookup(fp.base);
-    if (!c) {
-      r = c;
+
+// Upper bound on the size of a group-committed log record. A single large
+// update may still exceed it.
+static const size_t kMaxGroupBytes = 1 << 20;
+
+namespace {
+// Drops a file set reference when going out of scope.
+class FileSetRef {
+ public:
+  explicit FileSetRef(FileSet* fset) : fset_(fset) {}
+  ~FileSetRef() { fset_->Unref(); }
+
+ private:
+  FileSet* const fset_;
+};
+
+// Marks a file as being updated while in scope.
+class FileUpdate {
+ public:
+  FileUpdate(FileSet* fset, const Slice& lname) : fset_(fset), lname_(lname) {
+    fset_->BeginUpdate(lname_);
+  }
+
+  ~FileUpdate() { fset_->EndUpdate(lname_); }
+
+ private:
+  FileSet* const fset_;
+  const Slice lname_;
+};
+
+// Marks both files of a rename or a copy as being updated while in scope.
+// Files are marked in (file set address, name) order to avoid deadlocks.
+class FileUpdatePair {
+ public:
+  FileUpdatePair(FileSet* fset1, const Slice& lname1, FileSet* fset2,
+                 const Slice& lname2)
+      : fset1_(fset1), lname1_(lname1), fset2_(fset2), lname2_(lname2) {
+    if (fset2_ < fset1_ || (fset2_ == fset1_ && lname2_.compare(lname1_) < 0)) {
+      std::swap(fset1_, fset2_);
+      std::swap(lname1_, lname2_);
+    }
+    fset1_->BeginUpdate(lname1_);
+    if (!SameFile()) {
+      fset2_->BeginUpdate(lname2_);
     }
-    return r;
   }
-}
 
-namespace {
+  ~FileUpdatePair() {
+    if (!SameFile()) {
+      fset2_->EndUpdate(lname2_);
+    }
+    fset1_->EndUpdate(lname1_);
+  }
+
+ private:
+  bool SameFile() const { return fset1_ == fset2_ && lname1_ == lname2_; }
+  FileSet* fset1_;
+  Slice lname1_;
+  FileSet* fset2_;
+  Slice lname2_;
+};
+
 inline std::string ObjName(const FileSet* fset, const Slice& base) {
   std::string rv;
   const size_t n = fset->name.size() + 1 + base.size();
@@ -66,11 +115,13 @@ Status Access(const std::string& name, Osd* osd, uint64_t* time) {
   }
 }
 
-bool Execute(Slice* input, HashMap<char>* const files, HashSet* const garbage) {
+bool Execute(Slice* input, HashMap<char>* const files, HashSet* const garbage,
+             unsigned char* const type_out) {
   if (input->empty()) {
     return false;
   }
   unsigned char type = static_cast<unsigned char>((*input)[0]);
+  *type_out = type;
   input->remove_prefix(1);
   Slice name1;
   Slice name2;
@@ -115,13 +166,20 @@ bool Execute(Slice* input, HashMap<char>* const files, HashSet* const garbage) {
       garbage->Erase(name1);
       return true;
     case FileSet::kNoOp:
+    case FileSet::kCheckpoint:
       return true;
     default:
       return false;
   }
 }
 
-Status RedoUndo(const Slice& record, FileSet* fset, HashSet* garbage) {
+// Apply all operations of a log record. Store the number of operations
+// applied in *ops and set *checkpoint to true if any of them is a checkpoint
+// marker.
+Status RedoUndo(const Slice& record, HashMap<char>* files, HashSet* garbage,
+                uint32_t* ops, bool* checkpoint) {
+  *ops = 0;
+  *checkpoint = false;
   Slice input = record;
   if (input.size() < 8) {
     return Status::Corruption("Too short to be a record");
@@ -129,15 +187,19 @@ Status RedoUndo(const Slice& record, FileSet* fset, HashSet* garbage) {
     input.remove_prefix(8);
   }
 
-  HashMap<char>* files = &fset->files;
   uint32_t num_ops;
   bool error = input.size() < 4;
   if (!error) {
     num_ops = DecodeFixed32(input.data());
     input.remove_prefix(4);
     while (num_ops > 0) {
-      error = !Execute(&input, files, garbage);
+      unsigned char type;
+      error = !Execute(&input, files, garbage, &type);
       if (!error) {
+        if (type == FileSet::kCheckpoint) {
+          *checkpoint = true;
+        }
+        *ops = *ops + 1;
         num_ops--;
       } else {
         break;
@@ -151,6 +213,68 @@ Status RedoUndo(const Slice& record, FileSet* fset, HashSet* garbage) {
   }
 }
 
+// Replay a log into a file set. Set *complete to false if the log starts
+// with an online checkpoint that did not finish.
+Status ReplayLog(Osd* osd, const std::string& log_name, FileSet* fset,
+                 HashSet* garbage, bool* complete) {
+  SequentialFile* file;
+  Status s = osd->NewSequentialObj(log_name.c_str(), &file);
+  if (!s.ok()) {
+    if (s.IsNotFound()) {
+      s = Status::IOError(s.ToString());
+    }
+    return s;
+  }
+  *complete = true;
+  bool first = true;
+  log::Scanner sc(file);
+  for (; sc.Valid() && s.ok(); sc.Next()) {
+    uint32_t ops;
+    bool checkpoint;
+    s = RedoUndo(sc.record(), fset->RawFiles(), garbage, &ops, &checkpoint);
+    fset->replayed_records++;
+    fset->replayed_ops += ops;
+    if (checkpoint) {
+      *complete = !first;
+    }
+    first = false;
+  }
+  if (s.ok()) {
+    s = sc.status();
+  }
+  return s;
+}
+
+// Drop all state recovered from a log.
+void ResetFileSet(FileSet* fset, HashSet* garbage) {
+  struct Visitor : public FileSet::Visitor, public HashSet::Visitor {
+    std::vector<std::string> keys;
+    virtual void visit(const Slice& key, char* value) {
+      keys.push_back(key.ToString());
+    }
+    virtual void visit(const Slice& key) { keys.push_back(key.ToString()); }
+  };
+  Visitor v;
+  HashMap<char>* files = fset->RawFiles();
+  files->VisitAll(&v);
+  for (size_t i = 0; i < v.keys.size(); i++) {
+    char* const c = files->Erase(v.keys[i]);
+    if (c) {
+      free(c);
+    }
+  }
+  v.keys.clear();
+  garbage->VisitAll(&v);
+  for (size_t i = 0; i < v.keys.size(); i++) {
+    garbage->Erase(v.keys[i]);
+  }
+}
+
+inline void SwitchLogName(std::string* log_name) {
+  std::string::reverse_iterator it = log_name->rbegin();
+  *it = (*it == '1') ? '2' : '1';
+}
+
 Status RecoverFileSet(Osd* osd, FileSet* fset, HashSet* garbage,
                       std::string* next_log_name) {
   Status s;
@@ -179,32 +303,38 @@ Status RecoverFileSet(Osd* osd, FileSet* fset, HashSet* garbage,
     log_name.append("_2");
   }
 
-  SequentialFile* file;
-  s = osd->NewSequentialObj(log_name.c_str(), &file);
-  if (!s.ok()) {
-    if (s.IsNotFound()) {
-      s = Status::IOError(s.ToString());
+  bool complete;
+  s = ReplayLog(osd, log_name, fset, garbage, &complete);
+  if (s.ok() && !complete) {
+    // The newer log was being written by a checkpoint that did not finish.
+    // The older log still has everything.
+    if (time1 == 0 || time2 == 0) {
+      return Status::Corruption("Unfinished checkpoint", log_name);
+    }
+    ResetFileSet(fset, garbage);
+    SwitchLogName(&log_name);
+    s = ReplayLog(osd, log_name, fset, garbage, &complete);
+    if (s.ok() && !complete) {
+      s = Status::Corruption("Unfinished checkpoint", log_name);
     }
-    return s;
-  }
-  log::Scanner sc(file);
-  for (; sc.Valid() && s.ok(); sc.Next()) {
-    s = RedoUndo(sc.record(), fset, garbage);
   }
   if (s.ok()) {
-    s = sc.status();
-    if (s.ok()) {
-      std::string::reverse_iterator it = log_name.rbegin();
-      *it = (*it == '1') ? '2' : '1';
-      next_log_name->swap(log_name);
-    }
+    SwitchLogName(&log_name);
+    next_log_name->swap(log_name);
   }
   return s;
 }
 
-void MakeSnapshot(std::string* result, FileSet* fset, HashSet* garbage) {
+// Encode the state of a file set as a single log record. Snapshots written
+// by online checkpoints start with a checkpoint marker.
+void MakeSnapshot(std::string* result, HashMap<char>* files, HashSet* garbage,
+                  bool checkpoint) {
   result->resize(8 + 4);
   int num_ops = 0;
+  if (checkpoint) {
+    PutOp(result, FileSet::kCheckpoint, Slice());
+    num_ops++;
+  }
   {
     struct Visitor : public FileSet::Visitor {
       std::string* scratch;
@@ -219,7 +349,6 @@ void MakeSnapshot(std::string* result, FileSet* fset, HashSet* garbage) {
     Visitor v;
     v.num_ops = &num_ops;
     v.scratch = result;
-    HashMap<char>* files = &fset->files;
     files->VisitAll(&v);
   }
   {
@@ -252,7 +381,7 @@ Status OpenFileSetForWriting(  ///
 
   log::Writer* log = new log::Writer(file);
   std::string record;
-  MakeSnapshot(&record, fset, garbage);
+  MakeSnapshot(&record, fset->RawFiles(), garbage, false);
   s = log->AddRecord(record);
   if (!s.ok()) {
     delete log;
@@ -263,97 +392,413 @@ Status OpenFileSetForWriting(  ///
   }
   // Perform a garbage collection pass. If things go well, all garbage can be
   // purged here. Otherwise, we will re-attempt another pass the next time the
-  // set is loaded.
+  // set is loaded. Marking an object as deleted erases it from the garbage
+  // set, so names are copied out before any of them is deleted.
   struct Visitor : public HashSet::Visitor {
-    Osd* osd;
-    FileSet* fset;
-    virtual void visit(const Slice& key) {
-      const std::string objname = key.ToString();
-      Status s = osd->Delete(objname.c_str());
-      if (s.ok() || s.IsNotFound()) {
-        fset->DeletedObject(objname);  // Mark as deleted
-      } else {
-        // Empty
-      }
-    }
+    std::vector<std::string> objnames;
+    virtual void visit(const Slice& key) { objnames.push_back(key.ToString()); }
   };
+  fset->osd = osd;
+  fset->log_name = log_name;
   fset->xfile = file;
   fset->xlog = log;
+  fset->SetSnapshotSize(record.size());
   Visitor v;
-  v.osd = osd;
-  v.fset = fset;
   garbage->VisitAll(&v);
+  for (size_t i = 0; i < v.objnames.size(); i++) {
+    const std::string& objname = v.objnames[i];
+    Status s1 = osd->Delete(objname.c_str());
+    if (s1.ok() || s1.IsNotFound()) {
+      fset->DeletedObject(objname);  // Mark as deleted
+    } else {
+      // Empty
+    }
+  }
   return s;
 }
 }  // namespace
 
-bool Ofs::Impl::HasFileSet(const Slice& mntptr) {
-  MutexLock l(&mutex_);
-  FileSet* fset = mtable_.Lookup(mntptr);
-  if (fset == NULL) {
+struct FileSet::Writer {
+  Status status;
+  RecordType type;  // kNoOp for sync requests, kCheckpoint for checkpoints
+  Slice name1;
+  Slice name2;
+  bool sync;
+  bool done;
+  port::CondVar cv;
+
+  explicit Writer(port::Mutex* mu) : cv(mu) {}
+};
+
+// Append an update to the write-ahead log and then apply it to the in-memory
+// file map. The first writer in the queue becomes the leader of a commit
+// group: it packs the updates of all writers queued behind it into a single
+// log record, writes and syncs that record without holding mu_, and then
+// applies the record on behalf of the group the same way it would be
+// replayed at the next mount. The leader also schedules a background
+// checkpoint once the log has grown by max_log_size bytes since its snapshot.
+// Checkpoints are only taken when a checkpoint pool is configured.
+Status FileSet::Commit(RecordType type, const Slice& name1, const Slice& name2,
+                       bool force_sync) {
+  Writer w(&mu_);
+  w.type = type;
+  w.name1 = name1;
+  w.name2 = name2;
+  w.sync = force_sync || sync;
+  w.done = false;
+
+  MutexLock l(&mu_);
+  if (xlog == NULL) {
+    return Status::ReadOnly(Slice());
+  }
+  assert(!read_only);
+  writers_.push_back(&w);
+  while (!w.done && &w != writers_.front()) {
+    w.cv.Wait();
+  }
+  if (w.done) {
+    return w.status;
+  }
+
+  std::string record;
+  record.resize(8 + 4);
+  uint32_t num_ops = 0;
+  bool need_sync = false;
+  Writer* last_writer = &w;
+  std::deque<Writer*>::iterator iter = writers_.begin();
+  for (; iter != writers_.end(); ++iter) {
+    Writer* const f = *iter;
+    if (f != &w && record.size() >= kMaxGroupBytes) {
+      break;
+    } else if (f->type == kCheckpoint) {
+      break;  // Waiting to switch logs
+    }
+    if (f->type != kNoOp) {
+      PutOp(&record, f->type, f->name1, f->name2);
+      num_ops++;
+    }
+    need_sync = need_sync || f->sync;
+    last_writer = f;
+  }
+  EncodeFixed64(&record[0], CurrentMicros());
+  EncodeFixed32(&record[8], num_ops);
+
+  // Writers arriving during the write queue up behind the group. The log
+  // cannot be switched by a checkpoint until the group is done.
+  Log* const log = xlog;
+  WritableFile* const file = xfile;
+  Status s;
+  mu_.Unlock();
+  if (num_ops != 0) {
+    s = log->AddRecord(record);
+  }
+  if (s.ok() && need_sync) {
+    s = file->Sync();
+  }
+  mu_.Lock();
+
+  if (s.ok() && num_ops != 0) {
+    uint32_t ops;
+    bool checkpoint;
+    RedoUndo(record, &files_, &garbage_, &ops, &checkpoint);
+    log_size_ += record.size();
+    if (recording_tail_) {
+      tail_.push_back(record);
+    }
+  }
+  bool start_checkpoint = false;
+  if (s.ok() && max_log_size != 0 && checkpoint_pool != NULL &&
+      !checkpointing_ && log_size_ >= next_checkpoint_size_) {
+    checkpointing_ = true;
+    start_checkpoint = true;
+    refs_++;  // Dropped by the checkpoint
+  }
+
+  while (true) {
+    Writer* const f = writers_.front();
+    writers_.pop_front();
+    if (f != &w) {
+      f->status = s;
+      f->done = true;
+      f->cv.Signal();
+    }
+    if (f == last_writer) {
+      break;
+    }
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  if (start_checkpoint) {
+    checkpoint_pool->Schedule(&FileSet::BGCheckpoint, this);
+  }
+  return s;
+}
+
+void FileSet::BGCheckpoint(void* arg) {
+  FileSet* const fset = reinterpret_cast<FileSet*>(arg);
+  fset->Checkpoint();
+  fset->Unref();
+}
+
+// Write a snapshot of the file set to the other log and switch to that log.
+// The snapshot is written while updates keep going to the current log.
+// Updates committed after the snapshot was taken are also kept in memory.
+// Only these updates are copied to the new log while the commit queue is
+// blocked. Until the closing checkpoint marker is written, recovery ignores
+// the new log. Logs are switched under mu_ once the new log is synced. The
+// old log is closed after mu_ is released.
+void FileSet::Checkpoint() {
+  std::string new_log_name;
+  std::string snapshot;
+  mu_.Lock();
+  assert(checkpointing_);
+  new_log_name = log_name;
+  SwitchLogName(&new_log_name);
+  MakeSnapshot(&snapshot, &files_, &garbage_, true);
+  recording_tail_ = true;
+  mu_.Unlock();
+
+  WritableFile* file = NULL;
+  log::Writer* log = NULL;
+  Status s = osd->NewWritableObj(new_log_name.c_str(), &file);
+  if (s.ok()) {
+    log = new log::Writer(file);
+    s = log->AddRecord(snapshot);
+  }
+
+  // Take over the commit queue so nothing else is logged until we switch
+  Writer w(&mu_);
+  w.type = kCheckpoint;
+  w.sync = false;
+  w.done = false;
+  mu_.Lock();
+  writers_.push_back(&w);
+  while (&w != writers_.front()) {
+    w.cv.Wait();
+  }
+  std::vector<std::string> tail;
+  tail.swap(tail_);
+  recording_tail_ = false;
+  mu_.Unlock();
+  uint64_t new_log_size = snapshot.size();
+  for (size_t i = 0; i < tail.size() && s.ok(); i++) {
+    s = log->AddRecord(tail[i]);
+    new_log_size += tail[i].size();
+  }
+  if (s.ok()) {
+    const std::string marker = LogRecord(kCheckpoint, Slice());
+    s = log->AddRecord(marker);
+    new_log_size += marker.size();
+  }
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (!s.ok()) {
+    Log(info_log, 0, "Cannot checkpoint file set %s to %s: %s", name.c_str(),
+        new_log_name.c_str(), s.ToString().c_str());
+    delete log;
+    if (file != NULL) {
+      delete file;
+      osd->Delete(new_log_name.c_str());
+    }
+    log = NULL;
+    file = NULL;
+  }
+  mu_.Lock();
+  if (s.ok()) {
+    log::Writer* const old_log = xlog;
+    WritableFile* const old_file = xfile;
+    xlog = log;
+    xfile = file;
+    log = old_log;
+    file = old_file;
+    log_name.swap(new_log_name);
+    log_size_ = new_log_size;
+    next_checkpoint_size_ = snapshot.size() + max_log_size;
+    num_checkpoints_++;
+  } else {
+    next_checkpoint_size_ = log_size_ + max_log_size;
+  }
+  checkpointing_ = false;
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  mu_.Unlock();
+  // Close the old log
+  delete log;
+  delete file;
+}
+
+bool FileSet::GetObjectName(const Slice& lname, std::string* underlying_obj) {
+  MutexLock l(&mu_);
+  const char* const c = files_.Lookup(lname);
+  if (!c) {
     return false;
   } else {
+    *underlying_obj = c;
     return true;
   }
 }
 
+bool FileSet::HasFile(const Slice& lname) {
+  MutexLock l(&mu_);
+  return files_.Contains(lname);
+}
+
+bool FileSet::IsEmpty() {
+  MutexLock l(&mu_);
+  return files_.Empty();
+}
+
+void FileSet::ListFiles(std::vector<std::string>* names) {
+  struct Visitor : public FileSet::Visitor {
+    std::vector<std::string>* names;
+    virtual void visit(const Slice& key, char* const c) {
+      names->push_back(key.ToString());
+    }
+  };
+  Visitor v;
+  v.names = names;
+  MutexLock l(&mu_);
+  files_.VisitAll(&v);
+}
+
+void FileSet::GetStats(FileSetStats* stats) {
+  stats->mount_micros = mount_micros;
+  stats->replayed_records = replayed_records;
+  stats->replayed_ops = replayed_ops;
+  MutexLock l(&mu_);
+  stats->num_checkpoints = num_checkpoints_;
+  stats->log_size = log_size_;
+}
+
+void FileSet::BeginUpdate(const Slice& lname) {
+  MutexLock l(&mu_);
+  while (updating_.Contains(lname)) {
+    update_cv_.Wait();
+  }
+  updating_.Insert(lname);
+}
+
+void FileSet::EndUpdate(const Slice& lname) {
+  MutexLock l(&mu_);
+  updating_.Erase(lname);
+  update_cv_.SignalAll();
+}
+
+void FileSet::Ref() {
+  MutexLock l(&mu_);
+  refs_++;
+}
+
+void FileSet::Unref() {
+  MutexLock l(&mu_);
+  assert(refs_ > 0);
+  refs_--;
+  if (refs_ == 0) {
+    cv_.SignalAll();
+  }
+}
+
+void FileSet::WaitForUnrefs() {
+  MutexLock l(&mu_);
+  while (refs_ != 0) {
+    cv_.Wait();
+  }
+}
+
+Ofs::Impl::Shard* Ofs::Impl::ShardFor(const Slice& mntptr) {
+  return &shards_[Hash(mntptr.data(), mntptr.size(), 0) % kNumShards];
+}
+
+FileSet* Ofs::Impl::Lookup(const Slice& mntptr) {
+  Shard* const shard = ShardFor(mntptr);
+  MutexLock l(&shard->mu);
+  FileSet* const fset = shard->mtable.Lookup(mntptr);
+  if (fset != NULL) {
+    fset->Ref();
+  }
+  return fset;
+}
+
+std::string Ofs::Impl::TEST_GetObjectName(const OfsPath& fp) {
+  std::string r;
+  FileSet* const fset = Lookup(fp.mntptr);
+  if (fset != NULL) {
+    FileSetRef ref(fset);
+    fset->GetObjectName(fp.base, &r);
+  }
+  return r;
+}
+
+bool Ofs::Impl::HasFileSet(const Slice& mntptr) {
+  Shard* const shard = ShardFor(mntptr);
+  MutexLock l(&shard->mu);
+  return shard->mtable.Contains(mntptr);
+}
+
 bool Ofs::Impl::HasFile(const OfsPath& fp) {
-  MutexLock l(&mutex_);
-  FileSet* fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (fset == NULL) {
     return false;
   } else {
-    if (!fset->files.Contains(fp.base)) {
-      return false;
-    } else {
-      return true;
-    }
+    FileSetRef ref(fset);
+    return fset->HasFile(fp.base);
   }
 }
 
 Status Ofs::Impl::SynFileSet(const Slice& mntptr) {
-  MutexLock l(&mutex_);
-  FileSet* fset = mtable_.Lookup(mntptr);
+  FileSet* const fset = Lookup(mntptr);
   if (fset == NULL) {
     return Status::NotFound("Dir not mounted", mntptr);
   } else {
-    if (fset->xfile != NULL) {
-      return fset->xfile->Sync();
+    FileSetRef ref(fset);
+    if (!fset->read_only) {
+      return fset->Sync();
     } else {
       return Status::OK();
     }
   }
 }
 
+Status Ofs::Impl::GetFileSetStats(const Slice& mntptr, FileSetStats* stats) {
+  FileSet* const fset = Lookup(mntptr);
+  if (fset == NULL) {
+    return Status::NotFound("Dir not mounted", mntptr);
+  } else {
+    FileSetRef ref(fset);
+    fset->GetStats(stats);
+    return Status::OK();
+  }
+}
+
 Status Ofs::Impl::ListFileSet(  ///
     const Slice& mntptr, std::vector<std::string>* names) {
-  MutexLock l(&mutex_);
-  FileSet* fset = mtable_.Lookup(mntptr);
+  FileSet* const fset = Lookup(mntptr);
   if (fset == NULL) {
     return Status::NotFound("Dir not mounted", mntptr);
   } else {
-    struct Visitor : public FileSet::Visitor {
-      std::vector<std::string>* names;
-      virtual void visit(const Slice& key, char* const c) {
-        names->push_back(key.ToString());
-      }
-    };
-    Visitor v;
-    v.names = names;
-    fset->files.VisitAll(&v);
+    FileSetRef ref(fset);
+    fset->ListFiles(names);
     return Status::OK();
   }
 }
 
+// Mounts are serialized by mount_mu_ so a set being recovered cannot be
+// mounted twice. The set's shard is only locked to publish the set once it
+// is ready.
 Status Ofs::Impl::LinkFileSet(const Slice& mntptr, FileSet* fset) {
-  MutexLock l(&mutex_);
-  if (mtable_.Contains(mntptr)) {
+  MutexLock ml(&mount_mu_);
+  if (HasFileSet(mntptr)) {
     return Status::AlreadyExists("Dir already mounted", mntptr);
   } else {
+    const uint64_t start = CurrentMicros();
     // Try recovering from previous logs and determines the next log name.
-    HashSet garbage;
+    HashSet* const garbage = fset->RawGarbage();
     std::string next_log_name;
-    Status s = RecoverFileSet(osd_, fset, &garbage, &next_log_name);
+    Status s = RecoverFileSet(osd_, fset, garbage, &next_log_name);
     if (s.ok()) {
       if (fset->error_if_exists) {
         return Status::AlreadyExists(Slice());
@@ -369,65 +814,85 @@ Status Ofs::Impl::LinkFileSet(const Slice& mntptr, FileSet* fset) {
       s = Status::OK();
     }
     if (s.ok() && !fset->read_only) {
-      s = OpenFileSetForWriting(next_log_name, osd_, fset, &garbage);
+      s = OpenFileSetForWriting(next_log_name, osd_, fset, garbage);
     }
     if (s.ok()) {
-      mtable_.Insert(mntptr, fset);
+      fset->mount_micros = CurrentMicros() - start;
+      Log(options_.info_log, 1,
+          "Mounted file set %s: replayed %llu records (%llu ops) in %llu us",
+          fset->name.c_str(),
+          static_cast<unsigned long long>(fset->replayed_records),
+          static_cast<unsigned long long>(fset->replayed_ops),
+          static_cast<unsigned long long>(fset->mount_micros));
+      Shard* const shard = ShardFor(mntptr);
+      MutexLock l(&shard->mu);
+      shard->mtable.Insert(mntptr, fset);
     }
     return s;
   }
 }
 
+// A set is removed from the mount table before it is deleted so no new
+// operations can reach it. Operations that are already in flight are allowed
+// to finish first.
 Status Ofs::Impl::UnlinkFileSet(const Slice& mntptr, bool deletion) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(mntptr);
+  MutexLock ml(&mount_mu_);
+  FileSet* const fset = Lookup(mntptr);
   if (!fset) {
     return Status::NotFound("Dir not mounted", mntptr);
-  } else {
-    if (deletion) {
-      if (!fset->files.Empty()) {
-        return Status::DirNotEmpty(mntptr);
-      }
+  }
+  const bool empty = fset->IsEmpty();
+  fset->Unref();
+  if (deletion && !empty) {
+    return Status::DirNotEmpty(mntptr);
+  }
+  Shard* const shard = ShardFor(mntptr);
+  shard->mu.Lock();
+  shard->mtable.Erase(mntptr);
+  shard->mu.Unlock();
+  fset->WaitForUnrefs();
+  // Files may have been created while we were waiting
+  if (deletion && !fset->IsEmpty()) {
+    shard->mu.Lock();
+    shard->mtable.Insert(mntptr, fset);
+    shard->mu.Unlock();
+    return Status::DirNotEmpty(mntptr);
+  }
+  std::string parent = fset->name;
+  delete fset;
+  if (deletion) {
+    std::string obj1 = parent + "_1";
+    Status s1 = osd_->Delete(obj1.c_str());
+    if (s1.IsNotFound()) {
+      s1 = Status::OK();
     }
-    std::string parent = fset->name;
-    mtable_.Erase(mntptr);
-    delete fset;
-    if (deletion) {
-      std::string obj1 = parent + "_1";
-      Status s1 = osd_->Delete(obj1.c_str());
-      if (s1.IsNotFound()) {
-        s1 = Status::OK();
-      }
-      std::string obj2 = parent + "_2";
-      Status s2 = osd_->Delete(obj2.c_str());
-      if (s2.IsNotFound()) {
-        s2 = Status::OK();
-      }
-      if (!s1.ok()) {
-        return s1;
-      } else {
-        return s2;
-      }
+    std::string obj2 = parent + "_2";
+    Status s2 = osd_->Delete(obj2.c_str());
+    if (s2.IsNotFound()) {
+      s2 = Status::OK();
+    }
+    if (!s1.ok()) {
+      return s1;
     } else {
-      return Status::OK();
+      return s2;
     }
+  } else {
+    return Status::OK();
   }
 }
 
 // Atomically insert a named file into an underlying object store. Return OK on
 // success, or a non-OK status on errors.
 Status Ofs::Impl::PutFile(const OfsPath& fp, const Slice& data) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) {
     return Status::NotFound("Parent dir not mounted", fp.mntptr);
   } else {
+    FileSetRef ref(fset);
+    FileUpdate u(fset, fp.base);
     std::string objname;
-    char* const c = fset->files.Lookup(fp.base);
-    if (!c) {
+    if (!fset->GetObjectName(fp.base, &objname)) {
       objname = ObjName(fset, fp.base);
-    } else {
-      objname = c;
     }
     Status s = fset->TryCreateObject(objname);
     if (s.ok()) {
@@ -450,17 +915,15 @@ Status Ofs::Impl::PutFile(const OfsPath& fp, const Slice& data) {
 }
 
 Status Ofs::Impl::DeleteFile(const OfsPath& fp) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) {
     return Status::NotFound("Parent dir not mounted", fp.mntptr);
   } else {
+    FileSetRef ref(fset);
+    FileUpdate u(fset, fp.base);
     std::string objname;
-    char* const c = fset->files.Lookup(fp.base);
-    if (!c) {
+    if (!fset->GetObjectName(fp.base, &objname)) {
       return Status::NotFound("No such file", fp.base);
-    } else {
-      objname = c;
     }
     Status s = fset->UnlinkAndDelete(fp.base, objname);
     if (s.ok()) {
@@ -481,17 +944,15 @@ Status Ofs::Impl::DeleteFile(const OfsPath& fp) {
 }
 
 Status Ofs::Impl::NewWritableFile(const OfsPath& fp, WritableFile** r) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) {
     return Status::NotFound("Parent dir not mounted", fp.mntptr);
   } else {
+    FileSetRef ref(fset);
+    FileUpdate u(fset, fp.base);
     std::string objname;
-    char* const c = fset->files.Lookup(fp.base);
-    if (!c) {
+    if (!fset->GetObjectName(fp.base, &objname)) {
       objname = ObjName(fset, fp.base);
-    } else {
-      objname = c;
     }
     Status s = fset->TryCreateObject(objname);
     if (s.ok()) {
@@ -518,55 +979,65 @@ Status Ofs::Impl::NewWritableFile(const OfsPath& fp, WritableFile** r) {
 }
 
 Status Ofs::Impl::GetFile(const OfsPath& fp, std::string* data) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) return Status::NotFound("Parent dir not mounted", fp.mntptr);
-  char* const c = fset->files.Lookup(fp.base);
-  if (!c) return Status::NotFound("No such file", fp.base);
-  return osd_->Get(c, data);
+  FileSetRef ref(fset);
+  std::string objname;
+  if (!fset->GetObjectName(fp.base, &objname)) {
+    return Status::NotFound("No such file", fp.base);
+  }
+  return osd_->Get(objname.c_str(), data);
 }
 
 Status Ofs::Impl::FileSize(const OfsPath& fp, uint64_t* result) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) return Status::NotFound("Parent dir not mounted", fp.mntptr);
-  char* const c = fset->files.Lookup(fp.base);
-  if (!c) return Status::NotFound("No such file", fp.base);
-  return osd_->Size(c, result);
+  FileSetRef ref(fset);
+  std::string objname;
+  if (!fset->GetObjectName(fp.base, &objname)) {
+    return Status::NotFound("No such file", fp.base);
+  }
+  return osd_->Size(objname.c_str(), result);
 }
 
 Status Ofs::Impl::NewSequentialFile(const OfsPath& fp, SequentialFile** r) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) return Status::NotFound("Parent dir not mounted", fp.mntptr);
-  char* const c = fset->files.Lookup(fp.base);
-  if (!c) return Status::NotFound("No such file", fp.base);
-  return osd_->NewSequentialObj(c, r);
+  FileSetRef ref(fset);
+  std::string objname;
+  if (!fset->GetObjectName(fp.base, &objname)) {
+    return Status::NotFound("No such file", fp.base);
+  }
+  return osd_->NewSequentialObj(objname.c_str(), r);
 }
 
 Status Ofs::Impl::NewRandomAccessFile(const OfsPath& fp, RandomAccessFile** r) {
-  MutexLock l(&mutex_);
-  FileSet* const fset = mtable_.Lookup(fp.mntptr);
+  FileSet* const fset = Lookup(fp.mntptr);
   if (!fset) return Status::NotFound("Parent dir not mounted", fp.mntptr);
-  char* const c = fset->files.Lookup(fp.base);
-  if (!c) return Status::NotFound("No such file", fp.base);
-  return osd_->NewRandomAccessObj(c, r);
+  FileSetRef ref(fset);
+  std::string objname;
+  if (!fset->GetObjectName(fp.base, &objname)) {
+    return Status::NotFound("No such file", fp.base);
+  }
+  return osd_->NewRandomAccessObj(objname.c_str(), r);
 }
 
+// Source and destination sets are never locked at the same time. Both files
+// are marked as being updated so that no other update can create the
+// destination between the check and the link.
 Status Ofs::Impl::Rename(const OfsPath& sp, const OfsPath& dp) {
-  MutexLock l(&mutex_);
-  FileSet* const sset = mtable_.Lookup(sp.mntptr);
+  FileSet* const sset = Lookup(sp.mntptr);
   if (!sset) return Status::NotFound("Parent dir not mounted", sp.mntptr);
-  FileSet* const dset = mtable_.Lookup(dp.mntptr);
+  FileSetRef sref(sset);
+  FileSet* const dset = Lookup(dp.mntptr);
   if (!dset) return Status::NotFound("Parent dir not mounted", dp.mntptr);
+  FileSetRef dref(dset);
+  FileUpdatePair u(sset, sp.base, dset, dp.base);
   std::string objname;
-  char* const c = sset->files.Lookup(sp.base);
-  if (!c) {
+  if (!sset->GetObjectName(sp.base, &objname)) {
     return Status::NotFound("No such file", sp.base);
-  } else {
-    objname = c;
   }
-  if (dset->files.Contains(dp.base)) {
+  if (dset->HasFile(dp.base)) {
     return Status::AlreadyExists("File already exists", dp.base);
   }
   Status s = dset->Link(dp.base, objname);
@@ -577,24 +1048,20 @@ Status Ofs::Impl::Rename(const OfsPath& sp, const OfsPath& dp) {
 }
 
 Status Ofs::Impl::CopyFile(const OfsPath& sp, const OfsPath& dp) {
-  MutexLock l(&mutex_);
-  FileSet* const sset = mtable_.Lookup(sp.mntptr);
+  FileSet* const sset = Lookup(sp.mntptr);
   if (!sset) return Status::NotFound("Parent dir not mounted", sp.mntptr);
-  FileSet* const dset = mtable_.Lookup(dp.mntptr);
+  FileSetRef sref(sset);
+  FileSet* const dset = Lookup(dp.mntptr);
   if (!dset) return Status::NotFound("Parent dir not mounted", dp.mntptr);
+  FileSetRef dref(dset);
+  FileUpdatePair u(sset, sp.base, dset, dp.base);
   std::string sname;
-  char* const c = sset->files.Lookup(sp.base);
-  if (!c) {
+  if (!sset->GetObjectName(sp.base, &sname)) {
     return Status::NotFound("No such file", sp.base);
-  } else {
-    sname = c;
   }
   std::string dname;
-  char* const d = dset->files.Lookup(dp.base);
-  if (!d) {
+  if (!dset->GetObjectName(dp.base, &dname)) {
     dname = ObjName(dset, dp.base);
-  } else {
-    dname = d;
   }
   Status s = dset->TryCreateObject(dname);
   if (s.ok()) {
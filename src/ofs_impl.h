@@ -19,6 +19,10 @@
 #include "pdlfs-common/osd.h"
 #include "pdlfs-common/port.h"
 
+#include <deque>
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 
 class FileSet {
@@ -36,21 +40,45 @@ class FileSet {
     kUnlink = 0xf0,  // Metadata-only operation
     // Mark operation as committed, canceling undo and preventing redo
     kLink = 0xf1,
-    kObjDeleted = 0xf2
+    kObjDeleted = 0xf2,
+
+    // Brackets an online checkpoint. A log whose first record starts with
+    // this op is ignored unless a later record contains it as well.
+    kCheckpoint = 0xf3
   };
 
-  FileSet(const MountOptions& options, const Slice& name, bool sync_on_close)
+  FileSet(const OfsOptions& ofs_options, const MountOptions& options,
+          const Slice& name)
       : paranoid_checks(options.paranoid_checks),
         read_only(options.read_only),
         create_if_missing(options.create_if_missing),
         error_if_exists(options.error_if_exists),
-        sync_on_close(sync_on_close),
+        sync_on_close(ofs_options.sync_log_on_close),
         sync(options.sync),
+        max_log_size(ofs_options.max_log_size),
+        checkpoint_pool(ofs_options.checkpoint_pool),
+        info_log(ofs_options.info_log),
         name(name.ToString()),
+        mount_micros(0),
+        replayed_records(0),
+        replayed_ops(0),
+        osd(NULL),
         xfile(NULL),
-        xlog(NULL) {}
+        xlog(NULL),
+        refs_(0),
+        cv_(&mu_),
+        update_cv_(&mu_),
+        log_size_(0),
+        next_checkpoint_size_(0),
+        num_checkpoints_(0),
+        checkpointing_(false),
+        recording_tail_(false) {}
 
   ~FileSet() {
+    assert(refs_ == 0);
+    assert(writers_.empty());
+    assert(updating_.Empty());
+    assert(!checkpointing_);
     struct Visitor : public FileSet::Visitor {
       virtual void visit(const Slice& k, char* const v) {
         if (v) {
@@ -59,7 +87,7 @@ class FileSet {
       }
     };
     Visitor v;
-    files.VisitAll(&v);
+    files_.VisitAll(&v);
     delete xlog;
     if (xfile != NULL) {
       if (sync_on_close) {
@@ -69,92 +97,56 @@ class FileSet {
     }
   }
 
+  // Membership updates. Each update is logged before it is applied to the
+  // in-memory file map. Updates issued concurrently by different threads
+  // are group committed: they are written as a single log record followed
+  // by at most one sync. Concurrent updates to the same file are applied
+  // in an unspecified order.
   Status TryCreateObject(const std::string& underlying_obj) {
-    if (xlog == NULL) {
-      return Status::ReadOnly(Slice());
-    } else {
-      assert(!read_only);
-      Status s = xlog->AddRecord(LogRecord(kTryCreateObj, underlying_obj));
-      if (s.ok() && sync) {
-        s = xfile->Sync();
-      }
-      return s;
-    }
+    return Commit(kTryCreateObj, underlying_obj);
   }
 
   Status Link(const Slice& lname, const std::string& underlying_obj) {
-    if (xlog == NULL) {
-      return Status::ReadOnly(Slice());
-    } else {
-      assert(!read_only);
-      Status s = xlog->AddRecord(LogRecord(kLink, lname, underlying_obj));
-      if (s.ok() && sync) {
-        s = xfile->Sync();
-      }
-      if (s.ok()) {
-        char* c = strdup(underlying_obj.c_str());
-        c = files.Insert(lname, c);
-        if (c) {
-          free(c);
-        }
-      }
-      return s;
-    }
+    return Commit(kLink, lname, underlying_obj);
   }
 
   Status UnlinkAndDelete(  ///
       const Slice& lname, const std::string& underlying_obj) {
-    if (xlog == NULL) {
-      return Status::ReadOnly(Slice());
-    } else {
-      assert(!read_only);
-      Status s =
-          xlog->AddRecord(LogRecord(kUnlinkAndDel, lname, underlying_obj));
-      if (s.ok() && sync) {
-        s = xfile->Sync();
-      }
-      if (s.ok()) {
-        char* const c = files.Erase(lname);
-        if (c) {
-          free(c);
-        }
-      }
-      return s;
-    }
+    return Commit(kUnlinkAndDel, lname, underlying_obj);
   }
 
-  Status Unlink(const Slice& lname) {
-    if (xlog == NULL) {
-      return Status::ReadOnly(Slice());
-    } else {
-      assert(!read_only);
-      Status s = xlog->AddRecord(LogRecord(kUnlink, lname));
-      if (s.ok() && sync) {
-        s = xfile->Sync();
-      }
-      if (s.ok()) {
-        char* const c = files.Erase(lname);
-        if (c) {
-          free(c);
-        }
-      }
-      return s;
-    }
-  }
+  Status Unlink(const Slice& lname) { return Commit(kUnlink, lname); }
 
   Status DeletedObject(const std::string& underlying_obj) {
-    if (xlog == NULL) {
-      return Status::ReadOnly(Slice());
-    } else {
-      assert(!read_only);
-      Status s = xlog->AddRecord(LogRecord(kObjDeleted, underlying_obj));
-      if (s.ok() && sync) {
-        s = xfile->Sync();
-      }
-      return s;
-    }
+    return Commit(kObjDeleted, underlying_obj);
   }
 
+  // Force all committed updates to storage.
+  Status Sync() { return Commit(kNoOp, Slice(), Slice(), true); }
+
+  // Store the name of the object backing a file in *underlying_obj.
+  // Return false if the file does not exist.
+  bool GetObjectName(const Slice& lname, std::string* underlying_obj);
+  bool HasFile(const Slice& lname);
+  bool IsEmpty();
+  void ListFiles(std::vector<std::string>* names);
+  void GetStats(FileSetStats* stats);
+
+  // Updates of the same file are serialized so that checking the file, the
+  // object I/O, and the commit of the update are atomic with respect to
+  // other updates of that file. A file is marked busy for the duration of an
+  // update. No lock is held while the update runs, and updates of different
+  // files never wait for each other.
+  void BeginUpdate(const Slice& lname);
+  void EndUpdate(const Slice& lname);
+
+  // A file set is deleted only after the last reference to it is dropped.
+  // The mount table holds no reference so that an unmount can wait for all
+  // in-flight operations to finish.
+  void Ref();
+  void Unref();
+  void WaitForUnrefs();
+
   // File set options
   // Constant after construction
   bool paranoid_checks;
@@ -163,19 +155,65 @@ class FileSet {
   bool error_if_exists;
   bool sync_on_close;
   bool sync;
+  uint64_t max_log_size;
+  ThreadPool* checkpoint_pool;
+  Logger* info_log;
 
   typedef HashMap<char>::Visitor Visitor;
-  std::string name;     // Internal name of the file set
-  HashMap<char> files;  // Children files
+  std::string name;  // Internal name of the file set
+  // Children files and objects to be garbage collected. May only be
+  // accessed without locking before the file set is mounted.
+  HashMap<char>* RawFiles() { return &files_; }
+  HashSet* RawGarbage() { return &garbage_; }
+
+  // Recovery statistics
+  // Constant after the file set is mounted
+  uint64_t mount_micros;
+  uint64_t replayed_records;
+  uint64_t replayed_ops;
 
   // Atomically write a log record
   static std::string LogRecord(  ///
       RecordType type, const Slice& name1, const Slice& name2 = Slice());
-  WritableFile* xfile;  // The file backing the write-ahead log
+  // Set when the file set is mounted. Replaced by checkpoints afterwards, in
+  // which case they are protected by mu_.
+  Osd* osd;
+  std::string log_name;  // Name of the object backing the write-ahead log
+  WritableFile* xfile;   // The file backing the write-ahead log
   typedef log::Writer Log;
   Log* xlog;  // Write-ahead logger
+  // Account for a snapshot written as the first record of a new log.
+  void SetSnapshotSize(uint64_t size) {
+    log_size_ = size;
+    next_checkpoint_size_ = size + max_log_size;
+  }
 
  private:
+  struct Writer;
+  Status Commit(RecordType type, const Slice& name1,
+                const Slice& name2 = Slice(), bool force_sync = false);
+  static void BGCheckpoint(void* arg);
+  void Checkpoint();
+
+  port::Mutex mu_;
+  HashMap<char> files_;  // Protected by mu_
+  HashSet garbage_;      // Protected by mu_
+  std::deque<Writer*> writers_;  // Queue of pending updates
+  int refs_;
+  port::CondVar cv_;  // Signaled when refs_ drops to 0
+  HashSet updating_;  // Files being updated, protected by mu_
+  port::CondVar update_cv_;  // Signaled when a file update ends
+  uint64_t log_size_;  // Bytes written to the current log
+  // Log size at which the next checkpoint starts. Pushed back by failed
+  // checkpoints so that a persistent error is not retried on every commit.
+  uint64_t next_checkpoint_size_;
+  uint64_t num_checkpoints_;
+  bool checkpointing_;
+  // Records committed to the current log since a checkpoint captured its
+  // snapshot. They are copied to the new log before switching to it.
+  bool recording_tail_;
+  std::vector<std::string> tail_;
+
   // No copying allowed
   void operator=(const FileSet& other);
   FileSet(const FileSet&);
@@ -193,7 +231,9 @@ class Ofs::Impl {
   ~Impl() {
     // All file sets should have be unmounted
     // at this point
-    assert(mtable_.Empty());
+    for (int i = 0; i < kNumShards; i++) {
+      assert(shards_[i].mtable.Empty());
+    }
   }
 
   bool HasFileSet(const Slice& mntptr);
@@ -201,6 +241,7 @@ class Ofs::Impl {
   Status UnlinkFileSet(const Slice& mntptr, bool deletion);
   Status ListFileSet(const Slice& mntptr, std::vector<std::string>* names);
   Status SynFileSet(const Slice& mntptr);
+  Status GetFileSetStats(const Slice& mntptr, FileSetStats* stats);
 
   bool HasFile(const OfsPath& fp);
   Status GetFile(const OfsPath& fp, std::string* data);
@@ -215,8 +256,20 @@ class Ofs::Impl {
   Status Rename(const OfsPath& sp, const OfsPath& dp);
 
  private:
-  port::Mutex mutex_;
-  HashMap<FileSet> mtable_;
+  // The mount table is striped across a fixed number of shards so operations
+  // on different file sets rarely contend. Shard locks are only held for
+  // table lookups and updates. No object I/O is done under a shard lock.
+  enum { kNumShards = 16 };
+  struct Shard {
+    port::Mutex mu;
+    HashMap<FileSet> mtable;  // Protected by mu
+  };
+  Shard* ShardFor(const Slice& mntptr);
+  // Return the file set mounted at the given path with a new reference, or
+  // NULL if there is no such set.
+  FileSet* Lookup(const Slice& mntptr);
+  port::Mutex mount_mu_;  // Serializes mounts and unmounts
+  Shard shards_[kNumShards];
   // No copying allowed
   void operator=(const Impl&);
   Impl(const Impl&);
@@ -9,15 +9,158 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 #include "pdlfs-common/ofs.h"
+#include "ofs_impl.h"
 
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/osd.h"
+#include "pdlfs-common/port.h"
 #include "pdlfs-common/testharness.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <set>
+#include <vector>
 
 namespace pdlfs {
 
+namespace {
+struct CreateThreadState {
+  Ofs* ofs;
+  std::string dirname;
+  int id;
+  int num_files;
+  port::Mutex* mu;
+  port::CondVar* cv;
+  int* num_running;
+  Status status;
+};
+
+void CreateFiles(void* arg) {
+  CreateThreadState* const state = reinterpret_cast<CreateThreadState*>(arg);
+  Status s;
+  char tmp[100];
+  for (int i = 0; i < state->num_files && s.ok(); i++) {
+    snprintf(tmp, sizeof(tmp), "%s/t%d-%08d", state->dirname.c_str(),
+             state->id, i);
+    s = state->ofs->WriteStringToFile(tmp, "xyz");
+  }
+  MutexLock l(state->mu);
+  state->status = s;
+  if (--*state->num_running == 0) {
+    state->cv->SignalAll();
+  }
+}
+
+// Start "num_threads" threads that each create "num_files" files and wait
+// for them to finish. Thread i creates its files in the file set mounted at
+// dirnames[i % dirnames.size()].
+Status RunCreateThreads(Ofs* ofs, const std::vector<std::string>& dirnames,
+                        int num_threads, int num_files) {
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  int num_running = num_threads;
+  std::vector<CreateThreadState> states(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    states[i].ofs = ofs;
+    states[i].dirname = dirnames[i % dirnames.size()];
+    states[i].id = i;
+    states[i].num_files = num_files;
+    states[i].mu = &mu;
+    states[i].cv = &cv;
+    states[i].num_running = &num_running;
+    Env::Default()->StartThread(CreateFiles, &states[i]);
+  }
+  mu.Lock();
+  while (num_running != 0) {
+    cv.Wait();
+  }
+  mu.Unlock();
+  Status s;
+  for (int i = 0; i < num_threads && s.ok(); i++) {
+    s = states[i].status;
+  }
+  return s;
+}
+
+// Threads racing on the same file name. A thread with a non-empty "src"
+// renames it to "dst". Other threads either put or delete "dst" "n" times.
+struct SameNameThreadState {
+  Ofs* ofs;
+  std::string src;
+  std::string dst;
+  bool deleter;
+  int n;
+  port::Mutex* mu;
+  port::CondVar* cv;
+  int* num_running;
+  int* num_renamed;
+  Status status;
+};
+
+void OperateOnSameName(void* arg) {
+  SameNameThreadState* const state =
+      reinterpret_cast<SameNameThreadState*>(arg);
+  const char* const dst = state->dst.c_str();
+  bool renamed = false;
+  Status s;
+  if (!state->src.empty()) {
+    s = state->ofs->Rename(state->src.c_str(), dst);
+    if (s.ok()) {
+      renamed = true;
+    } else if (s.IsAlreadyExists()) {
+      s = Status::OK();
+    }
+  } else {
+    for (int i = 0; i < state->n && s.ok(); i++) {
+      if (!state->deleter) {
+        s = state->ofs->WriteStringToFile(dst, "xyz");
+      } else {
+        s = state->ofs->DeleteFile(dst);
+        if (s.IsNotFound()) {
+          s = Status::OK();
+        }
+      }
+    }
+  }
+  MutexLock l(state->mu);
+  state->status = s;
+  if (renamed) {
+    ++*state->num_renamed;
+  }
+  if (--*state->num_running == 0) {
+    state->cv->SignalAll();
+  }
+}
+
+// Start a thread for each of "states" and wait for them to finish. Return
+// the number of successful renames in *num_renamed.
+Status RunSameNameThreads(std::vector<SameNameThreadState>* states,
+                          int* num_renamed) {
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  int num_running = static_cast<int>(states->size());
+  *num_renamed = 0;
+  for (size_t i = 0; i < states->size(); i++) {
+    (*states)[i].mu = &mu;
+    (*states)[i].cv = &cv;
+    (*states)[i].num_running = &num_running;
+    (*states)[i].num_renamed = num_renamed;
+    Env::Default()->StartThread(OperateOnSameName, &(*states)[i]);
+  }
+  mu.Lock();
+  while (num_running != 0) {
+    cv.Wait();
+  }
+  mu.Unlock();
+  Status s;
+  for (size_t i = 0; i < states->size() && s.ok(); i++) {
+    s = (*states)[i].status;
+  }
+  return s;
+}
+}  // namespace
+
 class OFS {
  public:
   OFS() {
@@ -94,6 +237,42 @@ class OFS {
     return ofs_->FileExists(f.c_str());
   }
 
+  FileSetStats Stats() {
+    FileSetStats stats;
+    ASSERT_OK(ofs_->GetFileSetStats(fsetpath_.c_str(), &stats));
+    return stats;
+  }
+
+  // Recreate the ofs to apply new options.
+  void Reset() {
+    delete ofs_;
+    ofs_ = new Ofs(options_, osd_);
+  }
+
+  // Create "n" files and then delete every other one.
+  void Churn(int n) {
+    char tmp[30];
+    for (int i = 0; i < n; i++) {
+      snprintf(tmp, sizeof(tmp), "f%08d", i);
+      ASSERT_OK(Create(tmp));
+    }
+    for (int i = 0; i < n; i += 2) {
+      snprintf(tmp, sizeof(tmp), "f%08d", i);
+      ASSERT_OK(Delete(tmp));
+    }
+  }
+
+  void CheckChurned(int n) {
+    std::set<std::string> files = List();
+    ASSERT_EQ(files.size(), n / 2);
+    char tmp[30];
+    for (int i = 1; i < n; i += 2) {
+      snprintf(tmp, sizeof(tmp), "f%08d", i);
+      ASSERT_EQ(files.count(tmp), 1);
+      ASSERT_OK(Access(tmp));
+    }
+  }
+
   std::string fsetpath_;
   std::string root_;
   MountOptions mount_opts_;
@@ -225,8 +404,292 @@ TEST(OFS, Rename) {
   ASSERT_OK(Unmount());
 }
 
+TEST(OFS, ConcurrentCreates) {
+  mount_opts_.sync = true;
+  ASSERT_OK(Mount());
+  const std::string fsetpath2 = fsetpath_ + "2";
+  ASSERT_OK(ofs_->MountFileSet(mount_opts_, fsetpath2.c_str()));
+  std::vector<std::string> dirnames;
+  dirnames.push_back(fsetpath_);
+  dirnames.push_back(fsetpath2);
+  const int num_threads = 8;
+  const int num_files = 100;
+  ASSERT_OK(RunCreateThreads(ofs_, dirnames, num_threads, num_files));
+  ASSERT_OK(ofs_->UnmountFileSet(unmount_opts_, fsetpath2.c_str()));
+  ASSERT_OK(Unmount());
+  ASSERT_OK(Mount());
+  std::set<std::string> files = List();
+  ASSERT_EQ(files.size(), num_threads / 2 * num_files);
+  char tmp[100];
+  for (int i = 0; i < num_threads; i += 2) {
+    for (int j = 0; j < num_files; j++) {
+      snprintf(tmp, sizeof(tmp), "t%d-%08d", i, j);
+      ASSERT_EQ(files.count(tmp), 1);
+      ASSERT_OK(Access(tmp));
+    }
+  }
+  ASSERT_OK(Unmount());
+}
+
+// Renames to the same destination must not all succeed, or all but one of
+// the renamed files are lost.
+TEST(OFS, ConcurrentRenamesToSameName) {
+  mount_opts_.sync = true;
+  ASSERT_OK(Mount());
+  const int num_threads = 8;
+  const std::string dst = fsetpath_ + "/dst";
+  char tmp[100];
+  for (int r = 0; r < 10; r++) {
+    std::vector<SameNameThreadState> states(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+      snprintf(tmp, sizeof(tmp), "src%d-%d", r, i);
+      ASSERT_OK(Create(tmp));
+      states[i].ofs = ofs_;
+      states[i].src = fsetpath_ + "/" + tmp;
+      states[i].dst = dst;
+    }
+    int num_renamed;
+    ASSERT_OK(RunSameNameThreads(&states, &num_renamed));
+    ASSERT_EQ(num_renamed, 1);
+    ASSERT_EQ(List().size(), num_threads);
+    ASSERT_OK(ofs_->DeleteFile(dst.c_str()));
+    for (int i = 0; i < num_threads; i++) {
+      snprintf(tmp, sizeof(tmp), "src%d-%d", r, i);
+      if (Exists(tmp)) {
+        ASSERT_OK(Delete(tmp));
+      }
+    }
+  }
+  ASSERT_OK(Unmount());
+}
+
+// A delete must not remove the object of a file concurrently put under the
+// same name, leaving the file without its object.
+TEST(OFS, ConcurrentPutsAndDeletesOnSameName) {
+  mount_opts_.sync = true;
+  ASSERT_OK(Mount());
+  const std::string dst = fsetpath_ + "/dst";
+  for (int r = 0; r < 20; r++) {
+    ASSERT_OK(ofs_->WriteStringToFile(dst.c_str(), "xyz"));
+    // Overwrite the file while deleting it
+    std::vector<SameNameThreadState> states(2);
+    for (int i = 0; i < 2; i++) {
+      states[i].ofs = ofs_;
+      states[i].dst = dst;
+      states[i].deleter = (i == 1);
+      states[i].n = 1;
+    }
+    int num_renamed;
+    ASSERT_OK(RunSameNameThreads(&states, &num_renamed));
+    if (ofs_->FileExists(dst.c_str())) {
+      std::string data;
+      ASSERT_OK(ofs_->ReadFileToString(dst.c_str(), &data));
+      ASSERT_EQ(data, "xyz");
+      ASSERT_OK(ofs_->DeleteFile(dst.c_str()));
+    }
+  }
+  ASSERT_OK(Unmount());
+}
+
+// Without a checkpoint pool the log is only compacted at mount time.
+TEST(OFS, NoCheckpointPool) {
+  const int n = 1000;
+  options_.max_log_size = 4096;
+  Reset();
+  ASSERT_OK(Mount());
+  Churn(n);
+  ASSERT_EQ(Stats().num_checkpoints, 0);
+  ASSERT_OK(Unmount());
+  ASSERT_OK(Mount());
+  ASSERT_GE(Stats().replayed_records, n + n / 2);
+  CheckChurned(n);
+  ASSERT_OK(Unmount());
+}
+
+TEST(OFS, Checkpoint) {
+  const int n = 1000;
+  ThreadPool* const pool = ThreadPool::NewFixed(1);
+  options_.max_log_size = 4096;
+  options_.checkpoint_pool = pool;
+  Reset();
+  mount_opts_.sync = true;
+  ASSERT_OK(Mount());
+  Churn(n);
+  ASSERT_OK(Unmount());  // Waits for checkpoints
+  ASSERT_OK(Mount());
+  // Only the last snapshot and a short tail are replayed
+  ASSERT_LT(Stats().replayed_records, 200);
+  CheckChurned(n);
+  std::vector<std::string> dirnames(1, fsetpath_);
+  ASSERT_OK(RunCreateThreads(ofs_, dirnames, 4, 200));
+  ASSERT_OK(Unmount());
+  ASSERT_OK(Mount());
+  ASSERT_EQ(List().size(), n / 2 + 4 * 200);
+  ASSERT_OK(Unmount());
+  options_.max_log_size = 0;
+  Reset();
+  ASSERT_OK(Mount());
+  ASSERT_EQ(List().size(), n / 2 + 4 * 200);
+  ASSERT_OK(Unmount());
+  options_.checkpoint_pool = NULL;
+  Reset();
+  delete pool;
+}
+
+// A checkpoint that did not finish leaves a newer log without a closing
+// marker. Such logs are ignored.
+TEST(OFS, UnfinishedCheckpoint) {
+  ASSERT_OK(Mount());  // Logs to fset_1
+  ASSERT_OK(Create("a"));
+  ASSERT_OK(Create("b"));
+  ASSERT_OK(Unmount());
+  WritableFile* file;
+  ASSERT_OK(osd_->NewWritableObj("fset_2", &file));
+  log::Writer* const log = new log::Writer(file);
+  std::string record;
+  PutFixed64(&record, CurrentMicros());
+  PutFixed32(&record, 2);
+  PutOp(&record, FileSet::kCheckpoint, Slice());
+  PutOp(&record, FileSet::kLink, "c", "fset_c");
+  ASSERT_OK(log->AddRecord(record));
+  delete log;
+  delete file;
+  ASSERT_OK(Mount());
+  ASSERT_OK(Access("a"));
+  ASSERT_OK(Access("b"));
+  ASSERT_TRUE(!Exists("c"));
+  ASSERT_OK(Unmount());
+  ASSERT_OK(Mount());
+  ASSERT_EQ(List().size(), 2);
+  ASSERT_OK(Unmount());
+}
+
+// Objects created but never linked are left behind by a crash between the
+// creation of a file and the commit of its mapping. They are collected when
+// the set is mounted.
+TEST(OFS, MountGarbage) {
+  const char* const objnames[] = {"fset_x", "fset_y", "fset_z"};
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_OK(osd_->Put(objnames[i], "xyz"));
+  }
+  ASSERT_OK(osd_->Put("fset_a", "xyz"));
+  WritableFile* file;
+  ASSERT_OK(osd_->NewWritableObj("fset_1", &file));
+  log::Writer* const log = new log::Writer(file);
+  std::string record;
+  PutFixed64(&record, CurrentMicros());
+  PutFixed32(&record, 5);
+  PutOp(&record, FileSet::kTryCreateObj, "fset_a");
+  PutOp(&record, FileSet::kLink, "a", "fset_a");
+  for (size_t i = 0; i < 3; i++) {
+    PutOp(&record, FileSet::kTryCreateObj, objnames[i]);
+  }
+  ASSERT_OK(log->AddRecord(record));
+  delete log;
+  delete file;
+  ASSERT_OK(Mount());
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(!osd_->Exists(objnames[i]));
+  }
+  ASSERT_OK(Access("a"));
+  ASSERT_OK(Unmount());
+  ASSERT_OK(Mount());
+  ASSERT_EQ(List().size(), 1);
+  ASSERT_OK(Access("a"));
+  ASSERT_OK(Unmount());
+}
+
+// Create files from multiple threads either in a single shared file set or
+// in one file set per thread.
+static void BM_Creates(int num_files, int num_threads, bool shared,
+                       bool sync) {
+  const std::string root = test::PrepareTmpDir("ofs_test_benchmark");
+  Osd* const osd = Osd::FromEnv(root.c_str());
+  Ofs* const ofs = new Ofs(OfsOptions(), osd);
+  MountOptions mount_options;
+  mount_options.sync = sync;
+  std::vector<std::string> dirnames;
+  char tmp[100];
+  for (int i = 0; i < (shared ? 1 : num_threads); i++) {
+    snprintf(tmp, sizeof(tmp), "/mnt/fset%d", i);
+    dirnames.push_back(tmp);
+    ASSERT_OK(ofs->MountFileSet(mount_options, tmp));
+  }
+  const uint64_t start = CurrentMicros();
+  ASSERT_OK(RunCreateThreads(ofs, dirnames, num_threads, num_files));
+  const uint64_t micros = CurrentMicros() - start;
+  const uint64_t total = static_cast<uint64_t>(num_files) * num_threads;
+  fprintf(stderr,
+          "%-6s %-7s %2d threads: %8llu creates in %10llu us "
+          "(%.0f creates/s)\n",
+          shared ? "shared" : "split", sync ? "sync" : "nosync", num_threads,
+          static_cast<unsigned long long>(total),
+          static_cast<unsigned long long>(micros),
+          micros != 0 ? total * 1e6 / micros : 0.0);
+  for (size_t i = 0; i < dirnames.size(); i++) {
+    ASSERT_OK(ofs->UnmountFileSet(UnmountOptions(), dirnames[i].c_str()));
+  }
+  delete ofs;
+  delete osd;
+}
+
+// Churn through "num_files" files in a file set and report the cost of
+// mounting the set afterwards.
+static void BM_Mount(int num_files, uint64_t max_log_size) {
+  const std::string root = test::PrepareTmpDir("ofs_test_benchmark");
+  Osd* const osd = Osd::FromEnv(root.c_str());
+  ThreadPool* const pool = ThreadPool::NewFixed(1);
+  OfsOptions options;
+  options.max_log_size = max_log_size;
+  options.checkpoint_pool = pool;
+  Ofs* const ofs = new Ofs(options, osd);
+  const char* const dirname = "/mnt/fset";
+  ASSERT_OK(ofs->MountFileSet(MountOptions(), dirname));
+  char tmp[100];
+  for (int i = 0; i < num_files; i++) {
+    snprintf(tmp, sizeof(tmp), "%s/f%08d", dirname, i);
+    ASSERT_OK(ofs->WriteStringToFile(tmp, "xyz"));
+    if (i % 2 == 0) {
+      ASSERT_OK(ofs->DeleteFile(tmp));
+    }
+  }
+  FileSetStats stats;
+  ASSERT_OK(ofs->GetFileSetStats(dirname, &stats));
+  const uint64_t num_checkpoints = stats.num_checkpoints;
+  ASSERT_OK(ofs->UnmountFileSet(UnmountOptions(), dirname));
+  ASSERT_OK(ofs->MountFileSet(MountOptions(), dirname));
+  ASSERT_OK(ofs->GetFileSetStats(dirname, &stats));
+  fprintf(stderr,
+          "max_log_size=%-9llu %8d files, %4llu checkpoints: replayed "
+          "%8llu records (%8llu ops) in %8llu us\n",
+          static_cast<unsigned long long>(max_log_size), num_files,
+          static_cast<unsigned long long>(num_checkpoints),
+          static_cast<unsigned long long>(stats.replayed_records),
+          static_cast<unsigned long long>(stats.replayed_ops),
+          static_cast<unsigned long long>(stats.mount_micros));
+  ASSERT_OK(ofs->UnmountFileSet(UnmountOptions(), dirname));
+  delete ofs;
+  delete pool;
+  delete osd;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const int num_files = argc > 2 ? atoi(argv[2]) : 2000;
+    for (int sync = 0; sync < 2; sync++) {
+      for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+        ::pdlfs::BM_Creates(num_files, num_threads, true, sync != 0);
+        ::pdlfs::BM_Creates(num_files, num_threads, false, sync != 0);
+      }
+    }
+    const uint64_t max_log_sizes[] = {0, 1 << 20, 4 << 20};
+    for (size_t i = 0; i < 3; i++) {
+      ::pdlfs::BM_Mount(num_files * 50, max_log_sizes[i]);
+    }
+    return 0;
+  }
+
   return ::pdlfs::test::RunAllTests(&argc, &argv);
 }
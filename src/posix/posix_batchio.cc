@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "posix_batchio.h"
+
+#include "posix_env.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <vector>
+#if defined(PDLFS_OS_LINUX)
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#define PDLFS_HAVE_IO_URING
+#endif
+#if defined(__NR_io_setup) && defined(__NR_io_submit) &&       \
+    defined(__NR_io_getevents) && defined(__NR_io_cancel) && \
+    defined(__NR_io_destroy)
+#include <linux/aio_abi.h>
+#define PDLFS_HAVE_LINUX_AIO
+#endif
+#endif
+
+namespace pdlfs {
+
+namespace {
+// Max number of reads in flight per thread. Larger batches are issued
+// in multiple rounds.
+const unsigned kMaxBatch = 64;
+
+// Finish a request given the number of bytes read. Short reads are
+// completed with pread() so that results match those of Read().
+void Complete(const std::string& fname, int fd, ReadRequest* req, long res) {
+  if (res < 0) {
+    req->status = PosixError(fname, static_cast<int>(-res));
+    req->result = Slice();
+    return;
+  }
+  size_t done = static_cast<size_t>(res);
+  while (done != 0 && done < req->n) {
+    ssize_t r = pread(fd, req->scratch + done, req->n - done,
+                      static_cast<off_t>(req->offset + done));
+    if (r < 0) {
+      req->status = PosixError(fname, errno);
+      req->result = Slice();
+      return;
+    } else if (r == 0) {
+      break;  // EOF
+    }
+    done += r;
+  }
+  req->status = Status::OK();
+  req->result = Slice(req->scratch, done);
+}
+
+void PreadAll(const std::string& fname, int fd, ReadRequest* reqs, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    ssize_t r = pread(fd, reqs[i].scratch, reqs[i].n,
+                      static_cast<off_t>(reqs[i].offset));
+    Complete(fname, fd, &reqs[i], r < 0 ? -errno : r);
+  }
+}
+
+#if defined(PDLFS_HAVE_IO_URING)
+// A minimal io_uring driver using raw system calls so that we do not
+// depend on liburing. Each instance is used by a single thread.
+class IoUring {
+ public:
+  static IoUring* Open(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0) {
+      return NULL;
+    }
+    IoUring* r = new IoUring(fd);
+    if (!r->Map(p)) {
+      delete r;
+      return NULL;
+    }
+    return r;
+  }
+
+  ~IoUring() {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_len_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_len_);
+    if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_len_);
+    close(fd_);
+  }
+
+  unsigned capacity() const { return sq_entries_; }
+
+  // Read reqs[0,n-1] from "fd" and wait for all reads to complete. Reads
+  // that could not be submitted are served by pread(). Never returns while
+  // a read is still in flight. Return false if the ring failed, in which
+  // case it should no longer be used. REQUIRES: n <= capacity().
+  bool ReadAll(const std::string& fname, int fd, ReadRequest* reqs,
+               unsigned n) {
+    iovs_.resize(n);
+    done_.assign(n, 0);
+    unsigned tail = *sq_tail_;
+    for (unsigned i = 0; i < n; i++) {
+      iovs_[i].iov_base = reqs[i].scratch;
+      iovs_[i].iov_len = reqs[i].n;
+      const unsigned idx = tail & *sq_mask_;
+      struct io_uring_sqe* sqe = &sqes_[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = fd;
+      sqe->off = reqs[i].offset;
+      sqe->addr = reinterpret_cast<uintptr_t>(&iovs_[i]);
+      sqe->len = 1;
+      sqe->user_data = i;
+      sq_array_[idx] = idx;
+      tail++;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    bool ok = true;
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    while (completed < submitted || (ok && submitted < n)) {
+      const unsigned to_submit = ok ? n - submitted : 0;
+      long r = syscall(__NR_io_uring_enter, fd_, to_submit, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+      if (r >= 0) {
+        submitted += static_cast<unsigned>(r);
+      } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        if (to_submit != 0) {
+          // Stop submitting. Without SQPOLL the kernel only consumes
+          // entries during io_uring_enter(), so those it has not consumed
+          // can be withdrawn from the queue.
+          ok = false;
+          const unsigned sq_head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+          __atomic_store_n(sq_tail_, sq_head, __ATOMIC_RELEASE);
+        } else {
+          // The kernel may still be writing into the buffers of the reads
+          // in flight. Keep polling the completion queue until all of them
+          // are done.
+          sched_yield();
+        }
+      }
+      unsigned head = *cq_head_;
+      const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (; head != cq_tail; head++) {
+        const struct io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        Complete(fname, fd, &reqs[cqe->user_data], cqe->res);
+        done_[cqe->user_data] = 1;
+        completed++;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    if (!ok) {
+      // Nothing is in flight at this point
+      for (unsigned i = 0; i < n; i++) {
+        if (!done_[i]) PreadAll(fname, fd, &reqs[i], 1);
+      }
+    }
+    return ok;
+  }
+
+ private:
+  explicit IoUring(int fd)
+      : fd_(fd),
+        sq_entries_(0),
+        sq_ptr_(MAP_FAILED),
+        sq_len_(0),
+        cq_ptr_(MAP_FAILED),
+        cq_len_(0),
+        sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        sqes_len_(0) {}
+
+  bool Map(const struct io_uring_params& p) {
+    sq_entries_ = p.sq_entries;
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && cq_len_ > sq_len_) {
+      sq_len_ = cq_len_;
+    }
+    sq_ptr_ = mmap(NULL, sq_len_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) return false;
+    if (single_mmap) {
+      cq_ptr_ = sq_ptr_;
+    } else {
+      cq_ptr_ = mmap(NULL, cq_len_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+      if (cq_ptr_ == MAP_FAILED) return false;
+    }
+    sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(
+        mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) return false;
+
+    char* const sq = static_cast<char*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    char* const cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  const int fd_;
+  unsigned sq_entries_;
+  void* sq_ptr_;
+  size_t sq_len_;
+  void* cq_ptr_;
+  size_t cq_len_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_len_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  struct io_uring_cqe* cqes_;
+  std::vector<struct iovec> iovs_;
+  std::vector<char> done_;
+
+  // No copying allowed
+  IoUring(const IoUring&);
+  void operator=(const IoUring&);
+};
+#endif
+
+#if defined(PDLFS_HAVE_LINUX_AIO)
+// Batched reads through Linux native aio. Reads against buffered files may
+// be performed synchronously by the kernel during submission, but a batch
+// still costs only a couple of system calls.
+class LinuxAio {
+ public:
+  static LinuxAio* Open(unsigned entries) {
+    aio_context_t ctx = 0;
+    if (syscall(__NR_io_setup, entries, &ctx) < 0) {
+      return NULL;
+    }
+    return new LinuxAio(ctx);
+  }
+
+  ~LinuxAio() {
+    if (ctx_ != 0) syscall(__NR_io_destroy, ctx_);
+  }
+
+  // Read reqs[0,n-1] from "fd" and wait for all reads to complete. Reads
+  // that could not be submitted are served by pread(). Return false if we
+  // failed to wait for the reads submitted, in which case those that did
+  // not complete are failed and the context must no longer be used.
+  bool ReadAll(const std::string& fname, int fd, ReadRequest* reqs,
+               unsigned n) {
+    done_.assign(n, 0);
+    cbs_.resize(n);
+    ptrs_.resize(n);
+    events_.resize(n);
+    for (unsigned i = 0; i < n; i++) {
+      struct iocb* cb = &cbs_[i];
+      memset(cb, 0, sizeof(*cb));
+      cb->aio_data = i;
+      cb->aio_lio_opcode = IOCB_CMD_PREAD;
+      cb->aio_fildes = fd;
+      cb->aio_buf = reinterpret_cast<uintptr_t>(reqs[i].scratch);
+      cb->aio_nbytes = reqs[i].n;
+      cb->aio_offset = static_cast<int64_t>(reqs[i].offset);
+      ptrs_[i] = cb;
+    }
+    unsigned submitted = 0;
+    while (submitted < n) {
+      long r = syscall(__NR_io_submit, ctx_, n - submitted, &ptrs_[submitted]);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) break;
+      submitted += static_cast<unsigned>(r);
+    }
+    unsigned completed = 0;
+    int err = 0;
+    while (completed < submitted) {
+      long r = syscall(__NR_io_getevents, ctx_, 1, submitted - completed,
+                       &events_[0], NULL);
+      if (r < 0) {
+        if (errno == EINTR) continue;
+        err = errno;  // Should not happen
+        break;
+      }
+      for (long i = 0; i < r; i++) {
+        Complete(fname, fd, &reqs[events_[i].data], events_[i].res);
+        done_[events_[i].data] = 1;
+      }
+      completed += static_cast<unsigned>(r);
+    }
+    if (completed != submitted) {
+      // The kernel may still be writing into the buffers of the reads in
+      // flight. Cancel them and destroy the context, which blocks until
+      // all of them are finished, before failing them.
+      for (unsigned i = 0; i < submitted; i++) {
+        if (!done_[i]) {
+          struct io_event ev;
+          syscall(__NR_io_cancel, ctx_, &cbs_[i], &ev);
+        }
+      }
+      syscall(__NR_io_destroy, ctx_);
+      ctx_ = 0;
+      for (unsigned i = 0; i < submitted; i++) {
+        if (!done_[i]) {
+          reqs[i].status = PosixError(fname, err);
+          reqs[i].result = Slice();
+        }
+      }
+    }
+    if (submitted != n) {
+      // Serve the rest synchronously
+      PreadAll(fname, fd, reqs + submitted, n - submitted);
+    }
+    return completed == submitted;
+  }
+
+ private:
+  explicit LinuxAio(aio_context_t ctx) : ctx_(ctx) {}
+
+  aio_context_t ctx_;
+  std::vector<struct iocb> cbs_;
+  std::vector<struct iocb*> ptrs_;
+  std::vector<struct io_event> events_;
+  std::vector<char> done_;
+
+  // No copying allowed
+  LinuxAio(const LinuxAio&);
+  void operator=(const LinuxAio&);
+};
+#endif
+
+// Per-thread batch io state. Deleted when its thread exits.
+struct BatchIoContext {
+  BatchIoContext() {
+#if defined(PDLFS_HAVE_IO_URING)
+    uring = NULL;
+#endif
+#if defined(PDLFS_HAVE_LINUX_AIO)
+    aio = NULL;
+#endif
+  }
+
+  ~BatchIoContext() {
+#if defined(PDLFS_HAVE_IO_URING)
+    delete uring;
+#endif
+#if defined(PDLFS_HAVE_LINUX_AIO)
+    delete aio;
+#endif
+  }
+
+#if defined(PDLFS_HAVE_IO_URING)
+  IoUring* uring;
+#endif
+#if defined(PDLFS_HAVE_LINUX_AIO)
+  LinuxAio* aio;
+#endif
+};
+
+port::OnceType once = PDLFS_ONCE_INIT;
+pthread_key_t context_key;
+PosixBatchIoType batch_io_type = kPosixBatchIoPread;
+
+void DeleteContext(void* arg) {
+  delete reinterpret_cast<BatchIoContext*>(arg);
+}
+
+// Probe the mechanisms supported by the os, in order of preference.
+void InitBatchIo() {
+  pthread_key_create(&context_key, &DeleteContext);
+#if defined(PDLFS_HAVE_IO_URING)
+  IoUring* uring = IoUring::Open(kMaxBatch);
+  if (uring != NULL) {
+    delete uring;
+    batch_io_type = kPosixBatchIoUring;
+    return;
+  }
+#endif
+#if defined(PDLFS_HAVE_LINUX_AIO)
+  LinuxAio* aio = LinuxAio::Open(kMaxBatch);
+  if (aio != NULL) {
+    delete aio;
+    batch_io_type = kPosixBatchIoAio;
+    return;
+  }
+#endif
+}
+
+BatchIoContext* GetContext() {
+  BatchIoContext* ctx =
+      reinterpret_cast<BatchIoContext*>(pthread_getspecific(context_key));
+  if (ctx == NULL) {
+    ctx = new BatchIoContext;
+    pthread_setspecific(context_key, ctx);
+  }
+  return ctx;
+}
+
+}  // namespace
+
+PosixBatchIoType PosixBatchIo() {
+  port::InitOnce(&once, &InitBatchIo);
+  return batch_io_type;
+}
+
+void PosixMultiRead(const std::string& fname, int fd, ReadRequest* reqs,
+                    size_t n) {
+  const PosixBatchIoType type = PosixBatchIo();
+  if (n < 2 || type == kPosixBatchIoPread) {
+    PreadAll(fname, fd, reqs, n);
+    return;
+  }
+  BatchIoContext* const ctx = GetContext();
+  while (n != 0) {
+    const unsigned batch = static_cast<unsigned>(n < kMaxBatch ? n : kMaxBatch);
+    bool ok = false;
+#if defined(PDLFS_HAVE_IO_URING)
+    if (type == kPosixBatchIoUring) {
+      if (ctx->uring == NULL) {
+        ctx->uring = IoUring::Open(kMaxBatch);
+      }
+      if (ctx->uring != NULL && batch <= ctx->uring->capacity()) {
+        if (!ctx->uring->ReadAll(fname, fd, reqs, batch)) {
+          // Nothing is left in flight; start over with a new ring
+          delete ctx->uring;
+          ctx->uring = NULL;
+        }
+        ok = true;  // All requests have been served
+      }
+    }
+#endif
+#if defined(PDLFS_HAVE_LINUX_AIO)
+    if (type == kPosixBatchIoAio) {
+      if (ctx->aio == NULL) {
+        ctx->aio = LinuxAio::Open(kMaxBatch);
+      }
+      if (ctx->aio != NULL) {
+        if (!ctx->aio->ReadAll(fname, fd, reqs, batch)) {
+          delete ctx->aio;
+          ctx->aio = NULL;
+        }
+        ok = true;  // All requests have been served
+      }
+    }
+#endif
+    if (!ok) {
+      PreadAll(fname, fd, reqs, batch);
+    }
+    reqs += batch;
+    n -= batch;
+  }
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/pdlfs_platform.h"
+
+#include <string>
+
+namespace pdlfs {
+
+// The mechanism used by PosixMultiRead().
+enum PosixBatchIoType {
+  kPosixBatchIoPread = 0,  // One pread() per request
+  kPosixBatchIoUring = 1,  // Linux io_uring
+  kPosixBatchIoAio = 2     // Linux native aio
+};
+
+// Issue "n" reads against an open file descriptor at once and wait for all
+// of them to complete. Each calling thread uses its own io_uring instance
+// if the os supports it, falling back to Linux native aio, and finally to
+// one pread() per request. Set reqs[i].result and reqs[i].status as if
+// by PosixRandomAccessFile::Read(). "fname" is only used in error messages.
+extern void PosixMultiRead(const std::string& fname, int fd, ReadRequest* reqs,
+                           size_t n);
+
+// Return the mechanism used by PosixMultiRead() in this process.
+extern PosixBatchIoType PosixBatchIo();
+
+}  // namespace pdlfs
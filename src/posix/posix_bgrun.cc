@@ -15,8 +15,11 @@
 namespace pdlfs {
 
 std::string PosixThreadPool::ToDebugString() {
-  char tmp[100];
-  snprintf(tmp, sizeof(tmp), "Tpool: max_threads=%d", max_threads_);
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "Tpool: max_threads=%d, queued=[high=%d, low=%d], steals=%llu",
+           max_threads_, queued_[kHigh].load(), queued_[kLow].load(),
+           num_steals_.load());
   return tmp;
 }
 
@@ -28,8 +31,36 @@ pthread_t Pthread(void* (*func)(void*), void* arg, void* attr) {
   port::PthreadCall("pthread_detach", pthread_detach(th));
   return th;
 }
+
+// Identifies the pool and the work queue owned by the current thread, if the
+// current thread is a pool thread.
+thread_local PosixThreadPool* tls_pool = NULL;
+thread_local int tls_worker_id = -1;
 }  // namespace
 
+PosixThreadPool::PosixThreadPool(int max_threads, bool eager_init, void* attr)
+    : bg_cv_(&mu_),
+      num_pool_threads_(0),
+      max_threads_(max_threads),
+      next_worker_id_(0),
+      started_(false),
+      shutting_down_(false),
+      paused_(false),
+      num_queues_(max_threads > 0 ? max_threads : 1),
+      queues_(new WorkQueue[num_queues_]),
+      num_idle_(0),
+      next_queue_(0),
+      num_steals_(0) {
+  for (int p = 0; p < kNumPriorities; p++) {
+    queued_[p] = 0;
+  }
+  if (eager_init) {
+    // Start pool threads immediately
+    MutexLock ml(&mu_);
+    InitPool(attr);
+  }
+}
+
 PosixThreadPool::~PosixThreadPool() {
   mu_.Lock();
   shutting_down_ = true;
@@ -38,6 +69,7 @@ PosixThreadPool::~PosixThreadPool() {
     bg_cv_.Wait();
   }
   mu_.Unlock();
+  delete[] queues_;
 }
 
 void PosixThreadPool::InitPool(void* attr) {
@@ -46,49 +78,115 @@ void PosixThreadPool::InitPool(void* attr) {
     Pthread(BGWrapper, this, attr);
     num_pool_threads_++;
   }
+  started_ = true;
 }
 
 void PosixThreadPool::Schedule(void (*function)(void*), void* arg) {
-  MutexLock ml(&mu_);
+  ScheduleWithPriority(function, arg, kHigh);
+}
+
+void PosixThreadPool::ScheduleWithPriority(void (*function)(void*), void* arg,
+                                           Priority pri) {
   if (shutting_down_) return;
-  InitPool(NULL);  // Start background threads if necessary
+  if (!started_) {
+    MutexLock ml(&mu_);
+    InitPool(NULL);  // Start background threads if necessary
+  }
+  if (pri < 0 || pri >= kNumPriorities) {
+    pri = kLow;
+  }
 
-  // If the queue is currently empty, the background threads
-  // may be waiting.
-  if (queue_.empty()) bg_cv_.SignalAll();
+  int qid;
+  if (tls_pool == this) {
+    qid = tls_worker_id;  // Keep work local to the submitting thread
+  } else {
+    qid = next_queue_++ % num_queues_;
+  }
+  // Count the item before making it visible so that queued_ never falls
+  // behind the actual number of items.
+  queued_[pri]++;
+  WorkQueue* const wq = &queues_[qid];
+  wq->mu.Lock();
+  wq->q[pri].push_back(BGItem());
+  wq->q[pri].back().function = function;
+  wq->q[pri].back().arg = arg;
+  wq->mu.Unlock();
+
+  // Idle threads register themselves under mu_ before checking queued_ for
+  // the last time, so a thread that is about to sleep either sees the new
+  // item or is seen by us here.
+  if (num_idle_ > 0) {
+    MutexLock ml(&mu_);
+    bg_cv_.Signal();
+  }
+}
 
-  // Add to priority queue
-  queue_.push_back(BGItem());
-  queue_.back().function = function;
-  queue_.back().arg = arg;
+int PosixThreadPool::NumQueued() const {
+  int result = 0;
+  for (int p = 0; p < kNumPriorities; p++) {
+    result += queued_[p];
+  }
+  return result;
 }
 
-void PosixThreadPool::BGThread() {
-  void (*function)(void*) = NULL;
-  void* arg;
+bool PosixThreadPool::PopFrom(int qid, int pri, BGItem* item) {
+  WorkQueue* const wq = &queues_[qid];
+  MutexLock ml(&wq->mu);
+  if (wq->q[pri].empty()) {
+    return false;
+  }
+  *item = wq->q[pri].front();
+  wq->q[pri].pop_front();
+  queued_[pri]--;
+  return true;
+}
 
-  while (true) {
-    {
-      MutexLock l(&mu_);
-      // Wait until there is an item that is ready to run
-      while (!shutting_down_ && (paused_ || queue_.empty())) {
-        bg_cv_.Wait();
-      }
-      if (shutting_down_) {
-        assert(num_pool_threads_ > 0);
-        num_pool_threads_--;
-        bg_cv_.SignalAll();
-        return;
+bool PosixThreadPool::TryPop(int myid, BGItem* item) {
+  for (int p = 0; p < kNumPriorities; p++) {
+    if (queued_[p] <= 0) {
+      continue;
+    }
+    if (PopFrom(myid, p, item)) {
+      return true;
+    }
+    for (int i = 1; i < num_queues_; i++) {
+      if (PopFrom((myid + i) % num_queues_, p, item)) {
+        num_steals_++;
+        return true;
       }
+    }
+  }
+  return false;
+}
 
-      assert(!queue_.empty());
-      function = queue_.front().function;
-      arg = queue_.front().arg;
-      queue_.pop_front();
+void PosixThreadPool::BGThread() {
+  mu_.Lock();
+  const int myid = next_worker_id_++ % num_queues_;
+  mu_.Unlock();
+  tls_pool = this;
+  tls_worker_id = myid;
+  BGItem item;
+
+  while (true) {
+    if (!paused_ && !shutting_down_ && TryPop(myid, &item)) {
+      assert(item.function != NULL);
+      item.function(item.arg);
+      continue;
     }
 
-    assert(function != NULL);
-    function(arg);
+    MutexLock l(&mu_);
+    // Wait until there is an item that is ready to run
+    num_idle_++;
+    while (!shutting_down_ && (paused_ || NumQueued() == 0)) {
+      bg_cv_.Wait();
+    }
+    num_idle_--;
+    if (shutting_down_) {
+      assert(num_pool_threads_ > 0);
+      num_pool_threads_--;
+      bg_cv_.SignalAll();
+      return;
+    }
   }
 }
 
@@ -20,29 +20,29 @@
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
 #include <deque>
 
 namespace pdlfs {
 
-// A simple thread pool implementation with a fixed max pool size.
+// A thread pool implementation with a fixed max pool size.
 // Once created, threads keep running until pool destruction.
+//
+// Each pool thread owns a work queue per priority class. Work items submitted
+// from outside the pool are spread across these queues in a round-robin
+// manner, while items submitted by a pool thread go to that thread's own
+// queues. A thread first takes items from its own queues and then steals
+// from those of other threads when its own are empty. High priority items
+// are always taken before low priority items, regardless of which thread's
+// queue holds them. The pool-wide mutex is only used for putting idle
+// threads to sleep and waking them up.
 class PosixThreadPool : public ThreadPool {
  public:
-  PosixThreadPool(int max_threads, bool eager_init = false, void* attr = NULL)
-      : bg_cv_(&mu_),
-        num_pool_threads_(0),
-        max_threads_(max_threads),
-        shutting_down_(false),
-        paused_(false) {
-    if (eager_init) {
-      // Start pool threads immediately
-      MutexLock ml(&mu_);
-      InitPool(attr);
-    }
-  }
-
+  PosixThreadPool(int max_threads, bool eager_init = false, void* attr = NULL);
   virtual ~PosixThreadPool();
   virtual void Schedule(void (*function)(void*), void* arg);
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri);
   virtual std::string ToDebugString();
   virtual void Resume();
   virtual void Pause();
@@ -59,21 +59,41 @@ class PosixThreadPool : public ThreadPool {
     return NULL;
   }
 
-  port::Mutex mu_;
-  port::CondVar bg_cv_;
-  int num_pool_threads_;
-  int max_threads_;
-
-  bool shutting_down_;
-  bool paused_;
-
   // Entry per Schedule() call
   struct BGItem {
     void* arg;
     void (*function)(void*);
   };
   typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+
+  // Per-thread work queues
+  struct WorkQueue {
+    port::Mutex mu;
+    BGQueue q[kNumPriorities];
+  };
+
+  bool TryPop(int myid, BGItem* item);
+  bool PopFrom(int qid, int pri, BGItem* item);
+  int NumQueued() const;
+
+  port::Mutex mu_;
+  port::CondVar bg_cv_;
+  int num_pool_threads_;
+  int max_threads_;
+  int next_worker_id_;  // Protected by mu_
+
+  std::atomic<bool> started_;
+  std::atomic<bool> shutting_down_;
+  std::atomic<bool> paused_;
+
+  const int num_queues_;
+  WorkQueue* const queues_;
+  // Number of items pending in all queues. May temporarily exceed the actual
+  // number of items, but never falls behind it.
+  std::atomic<int> queued_[kNumPriorities];
+  std::atomic<int> num_idle_;  // Number of threads waiting on bg_cv_
+  std::atomic<unsigned> next_queue_;
+  std::atomic<unsigned long long> num_steals_;
 
   struct StartThreadState {
     void (*user_function)(void*);
@@ -16,6 +16,7 @@
  */
 #include "posix_env.h"
 
+#include "posix_batchio.h"
 #include "posix_bgrun.h"
 #include "posix_fastcopy.h"
 #include "posix_filecopy.h"
@@ -26,6 +27,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #if __cplusplus >= 201103L
 #define OVERRIDE override
@@ -37,6 +39,10 @@ namespace pdlfs {
 
 PosixRandomAccessFile::~PosixRandomAccessFile() { close(fd_); }
 
+void PosixRandomAccessFile::MultiRead(ReadRequest* reqs, size_t n) const {
+  PosixMultiRead(filename_, fd_, reqs, n);
+}
+
 PosixBufferedSequentialFile::~PosixBufferedSequentialFile() { fclose(file_); }
 
 PosixSequentialFile::~PosixSequentialFile() { close(fd_); }
@@ -273,36 +279,35 @@ class PosixLibcBufferedIoEnvWrapper : public EnvWrapper {
 class PosixMmapIoEnvWrapper : public EnvWrapper {
  public:
   explicit PosixMmapIoEnvWrapper(Env* base) : EnvWrapper(base) {}
+  PosixMmapIoEnvWrapper(Env* base, uint64_t max_mmap_bytes)
+      : EnvWrapper(base), mmap_limit_(1000, max_mmap_bytes) {}
   virtual ~PosixMmapIoEnvWrapper() {}
 
   virtual Status NewRandomAccessFile(  ///
       const char* fname, RandomAccessFile** r) OVERRIDE {
     *r = NULL;
-    Status s;
+    uint64_t size;
+    Status s = target()->GetFileSize(fname, &size);
+    if (!s.ok()) {
+      return s;
+    }
     int fd = open(fname, O_RDONLY);
     if (fd < 0) {
       s = PosixError(fname, errno);
-    } else if (!mmap_limit_.Acquire()) {
+    } else if (size == 0) {
+      *r = new PosixEmptyFile();
+      close(fd);
+    } else if (!mmap_limit_.Acquire(size)) {
       *r = new PosixRandomAccessFile(fname, fd);
     } else {
-      uint64_t size;
-      s = target()->GetFileSize(fname, &size);
-      if (s.ok()) {
-        if (size != 0) {
-          void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-          if (base != MAP_FAILED) {
-            *r = new PosixMmapReadableFile(fname, base, size, &mmap_limit_);
-          } else {
-            s = PosixError(fname, errno);
-          }
-        } else {
-          *r = new PosixEmptyFile();
-        }
+      void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (base != MAP_FAILED) {
+        *r = new PosixMmapReadableFile(fname, base, size, &mmap_limit_);
+      } else {
+        s = PosixError(fname, errno);
+        mmap_limit_.Release(size);
       }
       close(fd);
-      if (!s.ok()) {
-        mmap_limit_.Release();
-      }
     }
     return s;
   }
@@ -319,6 +324,10 @@ Env* Env::NewMmapIoEnvWrapper(Env* const base) {
   return new PosixMmapIoEnvWrapper(base);
 }
 
+Env* Env::NewMmapIoEnvWrapper(Env* const base, uint64_t max_mmap_bytes) {
+  return new PosixMmapIoEnvWrapper(base, max_mmap_bytes);
+}
+
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 
 static Env* posix_env_wrapped;
@@ -350,6 +359,17 @@ uint64_t CurrentMicros() {
   return result;
 }
 
+// Return the CPU time of the calling thread in microseconds.
+uint64_t CurrentThreadCpuMicros() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+  }
+#endif
+  return CurrentMicros();
+}
+
 // Sleep for a certain amount of microseconds.
 // We may sleep a bit longer than the specified amount.
 void SleepForMicroseconds(int micros) { usleep(static_cast<unsigned>(micros)); }
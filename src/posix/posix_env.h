@@ -174,6 +174,9 @@ class PosixRandomAccessFile : public RandomAccessFile {
     }
     return s;
   }
+
+  // Issue all reads at once using io_uring or Linux aio when available.
+  virtual void MultiRead(ReadRequest* reqs, size_t n) const;
 };
 
 class PosixBufferedWritableFile : public WritableFile {
@@ -19,9 +19,32 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 
 namespace pdlfs {
 
+namespace {
+// Print the prefix of a log message. Return the number of characters that
+// would have been written if there were enough space.
+int FormatPrefix(char* p, char* limit, int severity, uint64_t micros,
+                 uint64_t thread_id) {
+  const time_t seconds = static_cast<time_t>(micros / 1000000);
+  struct tm t;
+  localtime_r(&seconds, &t);
+  char m = 'I';
+  if (severity >= 2) {
+    m = 'E';
+  } else if (severity == 1) {
+    m = 'W';
+  }
+  return snprintf(p, limit - p, "%c%04d/%02d/%02d-%02d:%02d:%02d.%06d %llx ", m,
+                  t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour,
+                  t.tm_min, t.tm_sec, static_cast<int>(micros % 1000000),
+                  static_cast<long long unsigned int>(thread_id));
+}
+}  // namespace
+
 void PosixLogger::Logv(const char* file, int line, int severity, int verbose,
                        const char* format, va_list ap) {
   const uint64_t thread_id = (*gettid_)();
@@ -44,19 +67,9 @@ void PosixLogger::Logv(const char* file, int line, int severity, int verbose,
 
     struct timeval now_tv;
     gettimeofday(&now_tv, NULL);
-    const time_t seconds = now_tv.tv_sec;
-    struct tm t;
-    localtime_r(&seconds, &t);
-    char m = 'I';
-    if (severity >= 2) {
-      m = 'E';
-    } else if (severity == 1) {
-      m = 'W';
-    }
-    p += snprintf(p, limit - p, "%c%04d/%02d/%02d-%02d:%02d:%02d.%06d %llx ", m,
-                  t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour,
-                  t.tm_min, t.tm_sec, static_cast<int>(now_tv.tv_usec),
-                  static_cast<long long unsigned int>(thread_id));
+    const uint64_t micros =
+        static_cast<uint64_t>(now_tv.tv_sec) * 1000000 + now_tv.tv_usec;
+    p += FormatPrefix(p, limit, severity, micros, thread_id);
 
     // Print the message
     if (p < limit) {
@@ -96,4 +109,351 @@ void PosixLogger::Logv(const char* file, int line, int severity, int verbose,
   }
 }
 
+// Each message is stored as a header followed by the formatted message.
+struct MessageHeader {
+  uint64_t micros;
+  uint64_t thread_id;
+  uint32_t size;  // Size of the message following the header
+  int32_t severity;
+};
+
+struct PosixAsyncLogger::Ring {
+  Ring(size_t capacity, uint64_t owner)
+      : owner(owner),
+        buf(new char[capacity]),
+        capacity(capacity),
+        head(0),
+        tail(0),
+        orphaned(false),
+        refs(2) {}
+
+  ~Ring() { delete[] buf; }
+
+  // Rings are referenced by both the owning thread and the logger. Whoever
+  // drops the last reference frees the ring.
+  void Unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  // Copy "n" bytes into the ring at the given position, wrapping around the
+  // end of the buffer if needed.
+  void Put(uint64_t pos, const void* src, size_t n) {
+    const size_t off = pos % capacity;
+    const size_t n1 = std::min(n, capacity - off);
+    memcpy(buf + off, src, n1);
+    memcpy(buf, static_cast<const char*>(src) + n1, n - n1);
+  }
+
+  void Get(uint64_t pos, void* dst, size_t n) const {
+    const size_t off = pos % capacity;
+    const size_t n1 = std::min(n, capacity - off);
+    memcpy(dst, buf + off, n1);
+    memcpy(static_cast<char*>(dst) + n1, buf, n - n1);
+  }
+
+  const uint64_t owner;  // Id of the logger that created the ring
+  char* const buf;
+  const size_t capacity;
+  // Only written by the background thread
+  std::atomic<uint64_t> head;
+  // Only written by the thread owning the ring
+  std::atomic<uint64_t> tail;
+  // Set when the owning thread exits
+  std::atomic<bool> orphaned;
+  std::atomic<int> refs;
+};
+
+// Thread-specific keys of deleted loggers are kept for reuse by later loggers.
+// Deleting a key would leave the rings of threads that are still running
+// with no one to free them.
+static port::OnceType once = PDLFS_ONCE_INIT;
+static port::Mutex* keys_mu;
+static std::vector<pthread_key_t>* free_keys;
+static std::atomic<uint64_t> next_logger_id(1);
+
+static void InitKeys() {
+  keys_mu = new port::Mutex;
+  free_keys = new std::vector<pthread_key_t>;
+}
+
+PosixAsyncLogger::PosixAsyncLogger(const AsyncLoggerOptions& options, FILE* f,
+                                   uint64_t (*gettid)())
+    : options_(options),
+      id_(next_logger_id.fetch_add(1)),
+      ring_size_(std::max<size_t>(options.buffer_size, 1024)),
+      file_(f),
+      gettid_(gettid),
+      dropped_(0),
+      bg_cv_(&mu_),
+      space_cv_(&mu_),
+      wakeup_(false),
+      num_drains_(0),
+      draining_(false),
+      shutting_down_(false),
+      bg_done_(false) {
+  port::InitOnce(&once, InitKeys);
+  keys_mu->Lock();
+  if (!free_keys->empty()) {
+    key_ = free_keys->back();
+    free_keys->pop_back();
+  } else {
+    port::PthreadCall("pthread_key_create",
+                      pthread_key_create(&key_, &DeleteRing));
+  }
+  keys_mu->Unlock();
+  Env::Default()->StartThread(&PosixAsyncLogger::BGWork, this);
+}
+
+PosixAsyncLogger::~PosixAsyncLogger() {
+  mu_.Lock();
+  shutting_down_ = true;
+  bg_cv_.Signal();
+  while (!bg_done_) {
+    space_cv_.Wait();
+  }
+  // Threads drop their own references when they exit, possibly while we are
+  // here, so only the references held by the logger are dropped
+  std::vector<Ring*> rings;
+  rings.swap(rings_);
+  mu_.Unlock();
+  for (size_t i = 0; i < rings.size(); i++) {
+    rings[i]->Unref();
+  }
+  keys_mu->Lock();
+  free_keys->push_back(key_);
+  keys_mu->Unlock();
+  fclose(file_);
+}
+
+void PosixAsyncLogger::DeleteRing(void* arg) {
+  // The background thread drops its reference once the ring is drained
+  Ring* const r = reinterpret_cast<Ring*>(arg);
+  r->orphaned.store(true, std::memory_order_release);
+  r->Unref();
+}
+
+PosixAsyncLogger::Ring* PosixAsyncLogger::GetRing() {
+  Ring* r = reinterpret_cast<Ring*>(pthread_getspecific(key_));
+  if (r != NULL && r->owner != id_) {
+    // Left behind by a deleted logger that used the same key
+    r->Unref();
+    r = NULL;
+  }
+  if (r == NULL) {
+    r = new Ring(ring_size_, id_);
+    pthread_setspecific(key_, r);
+    MutexLock l(&mu_);
+    rings_.push_back(r);
+  }
+  return r;
+}
+
+void PosixAsyncLogger::Logv(const char* file, int line, int severity,
+                            int verbose, const char* format, va_list ap) {
+  // We try twice: the first time with a fixed-size stack allocated buffer,
+  // and the second time with a much larger dynamically allocated buffer.
+  char buffer[500];
+  for (int iter = 0; iter < 2; iter++) {
+    char* base;
+    int bufsize;
+    if (iter == 0) {
+      bufsize = sizeof(buffer);
+      base = buffer;
+    } else {
+      bufsize = 30000;
+      base = new char[bufsize];
+    }
+    char* p = base;
+    char* limit = base + bufsize;
+
+    // Print the message
+    va_list backup_ap;
+    va_copy(backup_ap, ap);
+    p += vsnprintf(p, limit - p, format, backup_ap);
+    va_end(backup_ap);
+
+    // Print source code location
+    if (p < limit) {
+      const char* c = strrchr(file, '/');
+      p += snprintf(p, limit - p, " (%s:%d)", c ? c + 1 : file, line);
+    }
+
+    // Truncate to available space if necessary
+    if (p >= limit) {
+      if (iter == 0) {
+        continue;  // Try again with larger buffer
+      } else {
+        p = limit - 1;
+      }
+    }
+
+    Append(GetRing(), base, p - base, severity);
+    if (base != buffer) {
+      delete[] base;
+    }
+    break;
+  }
+}
+
+void PosixAsyncLogger::Append(Ring* r, const char* msg, size_t n,
+                              int severity) {
+  MessageHeader h;
+  h.micros = CurrentMicros();
+  h.thread_id = (*gettid_)();
+  h.severity = severity;
+  n = std::min(n, r->capacity - sizeof(h));
+  h.size = static_cast<uint32_t>(n);
+  const size_t len = sizeof(h) + n;
+  const uint64_t tail = r->tail.load(std::memory_order_relaxed);
+  if (tail + len - r->head.load(std::memory_order_acquire) > r->capacity) {
+    if (!options_.block_when_full) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    MutexLock l(&mu_);
+    while (tail + len - r->head.load(std::memory_order_acquire) >
+           r->capacity) {
+      if (bg_done_) {  // No more room will be made
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      wakeup_.store(true);
+      bg_cv_.Signal();
+      space_cv_.Wait();
+    }
+  }
+  r->Put(tail, &h, sizeof(h));
+  r->Put(tail + sizeof(h), msg, n);
+  r->tail.store(tail + len, std::memory_order_release);
+  // Have the background thread drain the ring early once it is half full
+  const uint64_t used = tail + len - r->head.load(std::memory_order_relaxed);
+  if (used >= r->capacity / 2 && !wakeup_.load(std::memory_order_relaxed)) {
+    MutexLock l(&mu_);
+    wakeup_.store(true);
+    bg_cv_.Signal();
+  }
+}
+
+void PosixAsyncLogger::Flush() {
+  MutexLock l(&mu_);
+  // A drain that is in progress may have missed messages logged by us
+  const uint64_t target = num_drains_ + (draining_ ? 2 : 1);
+  wakeup_.store(true);
+  bg_cv_.Signal();
+  while (num_drains_ < target && !bg_done_) {
+    space_cv_.Wait();
+  }
+}
+
+void PosixAsyncLogger::BGWork(void* arg) {
+  reinterpret_cast<PosixAsyncLogger*>(arg)->BGLoop();
+}
+
+void PosixAsyncLogger::BGLoop() {
+  std::string batch;
+  uint64_t reported_dropped = 0;
+  MutexLock l(&mu_);
+  while (true) {
+    // Messages logged before shutting_down_ is set are in the last drain
+    const bool exiting = shutting_down_;
+    draining_ = true;
+    mu_.Unlock();
+    wakeup_.store(false);
+    DrainRings(&batch);
+    // Report messages dropped since the last report at the end of the batch
+    const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+      char msg[200];
+      const int n = FormatPrefix(msg, msg + sizeof(msg), 1, CurrentMicros(),
+                                 (*gettid_)());
+      batch.append(msg, std::min<size_t>(n, sizeof(msg) - 1));
+      snprintf(msg, sizeof(msg), "%llu messages dropped\n",
+               static_cast<unsigned long long>(dropped - reported_dropped));
+      batch.append(msg);
+      reported_dropped = dropped;
+    }
+    if (!batch.empty()) {
+      fwrite(batch.data(), 1, batch.size(), file_);
+      fflush(file_);
+    }
+    mu_.Lock();
+    // Free the rings of threads that have exited
+    size_t j = 0;
+    for (size_t i = 0; i < rings_.size(); i++) {
+      Ring* const r = rings_[i];
+      if (r->orphaned.load(std::memory_order_acquire) &&
+          r->head.load(std::memory_order_relaxed) ==
+              r->tail.load(std::memory_order_acquire)) {
+        r->Unref();
+      } else {
+        rings_[j++] = r;
+      }
+    }
+    rings_.resize(j);
+    draining_ = false;
+    num_drains_++;
+    space_cv_.SignalAll();
+    if (exiting) {
+      break;
+    } else if (!shutting_down_ && !wakeup_.load()) {
+      bg_cv_.TimedWait(options_.flush_interval_micros);
+    }
+  }
+  bg_done_ = true;
+  space_cv_.SignalAll();
+}
+
+// Move all buffered messages into *batch in time order. Return the number of
+// messages moved.
+size_t PosixAsyncLogger::DrainRings(std::string* batch) {
+  std::vector<Ring*> rings;
+  mu_.Lock();
+  rings = rings_;
+  mu_.Unlock();
+  struct Entry {
+    uint64_t micros;
+    size_t offset;  // Offset of the printed message in scratch
+    size_t size;
+    bool operator<(const Entry& other) const { return micros < other.micros; }
+  };
+  std::vector<Entry> entries;
+  std::string scratch;
+  char prefix[100];
+  for (size_t i = 0; i < rings.size(); i++) {
+    Ring* const r = rings[i];
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    const uint64_t tail = r->tail.load(std::memory_order_acquire);
+    while (head < tail) {
+      MessageHeader h;
+      r->Get(head, &h, sizeof(h));
+      Entry e;
+      e.micros = h.micros;
+      e.offset = scratch.size();
+      const int n = FormatPrefix(prefix, prefix + sizeof(prefix), h.severity,
+                                 h.micros, h.thread_id);
+      scratch.append(prefix, std::min<size_t>(n, sizeof(prefix) - 1));
+      const size_t off = scratch.size();
+      scratch.resize(off + h.size);
+      r->Get(head + sizeof(h), &scratch[off], h.size);
+      // Add newline if necessary
+      if (h.size == 0 || scratch[scratch.size() - 1] != '\n') {
+        scratch.push_back('\n');
+      }
+      e.size = scratch.size() - e.offset;
+      entries.push_back(e);
+      head += sizeof(h) + h.size;
+    }
+    r->head.store(head, std::memory_order_release);
+  }
+  std::stable_sort(entries.begin(), entries.end());
+  batch->clear();
+  batch->reserve(scratch.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    batch->append(scratch, entries[i].offset, entries[i].size);
+  }
+  return entries.size();
+}
+
 }  // namespace pdlfs
@@ -18,8 +18,12 @@
 
 #include "posix_env.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
 
 namespace pdlfs {
 
@@ -44,4 +48,58 @@ class PosixLogger : public Logger {
   }
 };
 
+// Logger that moves time formatting and file io off the calling thread.
+// Each logging thread formats its messages into a private lock-free ring
+// buffer that has a single producer (the thread) and a single consumer (a
+// background thread). The background thread periodically drains all
+// buffers, orders messages by time, and writes them out in a single batch.
+// Messages dropped because a buffer was full are counted and reported by a
+// "N messages dropped" line at the end of the next batch.
+class PosixAsyncLogger : public Logger {
+ public:
+  PosixAsyncLogger(const AsyncLoggerOptions& options, FILE* f,
+                   uint64_t (*gettid)());
+  virtual ~PosixAsyncLogger();
+
+  virtual void Logv(const char* file, int line, int severity, int verbose,
+                    const char* format, va_list ap);
+
+  // Wait until all messages logged before the call have been written out.
+  void Flush();
+
+  // Return the number of messages dropped because a buffer was full.
+  uint64_t NumDropped() const { return dropped_.load(); }
+
+ private:
+  struct Ring;
+  static void BGWork(void* arg);
+  static void DeleteRing(void* arg);
+  Ring* GetRing();
+  void Append(Ring* r, const char* msg, size_t n, int severity);
+  void BGLoop();
+  size_t DrainRings(std::string* batch);
+
+  const AsyncLoggerOptions options_;
+  const uint64_t id_;  // Unique across all loggers
+  const size_t ring_size_;
+  FILE* const file_;
+  uint64_t (*gettid_)();
+  pthread_key_t key_;  // Ring of each thread, reused after deletion
+  std::atomic<uint64_t> dropped_;
+
+  port::Mutex mu_;
+  port::CondVar bg_cv_;     // Wakes up the background thread
+  port::CondVar space_cv_;  // Signaled after every drain
+  std::vector<Ring*> rings_;
+  std::atomic<bool> wakeup_;  // Drain without waiting for the next interval
+  uint64_t num_drains_;
+  bool draining_;
+  bool shutting_down_;
+  bool bg_done_;
+
+  // No copying allowed
+  void operator=(const PosixAsyncLogger&);
+  PosixAsyncLogger(const PosixAsyncLogger&);
+};
+
 }  // namespace pdlfs
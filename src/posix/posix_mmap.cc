@@ -13,9 +13,15 @@
 namespace pdlfs {
 
 // Up to 1000 mmaps for 64-bit binaries; none for smaller pointer sizes.
-MmapLimiter::MmapLimiter() {
+MmapLimiter::MmapLimiter() : max_bytes_(~static_cast<uint64_t>(0)), bytes_(0) {
   MutexLock l(&mu_);
   SetAllowed(sizeof(void*) >= 8 ? 1000 : 0);
 }
 
+MmapLimiter::MmapLimiter(intptr_t max_maps, uint64_t max_bytes)
+    : max_bytes_(max_bytes), bytes_(0) {
+  MutexLock l(&mu_);
+  SetAllowed(sizeof(void*) >= 8 ? max_maps : 0);
+}
+
 }  // namespace pdlfs
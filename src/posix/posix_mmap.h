@@ -20,6 +20,8 @@
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 
+#include <assert.h>
+#include <stdint.h>
 #include <sys/mman.h>
 
 namespace pdlfs {
@@ -30,10 +32,13 @@ namespace pdlfs {
 class MmapLimiter {
  public:
   MmapLimiter();
+  // Allow up to "max_maps" mmaps that together map at most "max_bytes" bytes.
+  MmapLimiter(intptr_t max_maps, uint64_t max_bytes);
 
-  // If another mmap slot is available, acquire it and return true.
-  // Else return false.
-  bool Acquire() {
+  // If another mmap slot is available and the total number of bytes mapped
+  // would stay within limit after mapping another "size" bytes, acquire the
+  // slot along with the bytes and return true. Else return false.
+  bool Acquire(uint64_t size) {
     if (GetAllowed() <= 0) {
       return false;
     }
@@ -41,19 +46,30 @@ class MmapLimiter {
     intptr_t x = GetAllowed();
     if (x <= 0) {
       return false;
+    } else if (size > max_bytes_ - bytes_) {
+      return false;
     } else {
       SetAllowed(x - 1);
+      bytes_ += size;
       return true;
     }
   }
 
-  // Release a slot acquired by a previous call to
+  // Release a slot and the bytes acquired by a previous call to
   // Acquire() that returned true.
-  void Release() {
+  void Release(uint64_t size) {
     MutexLock l(&mu_);
+    assert(bytes_ >= size);
+    bytes_ -= size;
     SetAllowed(GetAllowed() + 1);
   }
 
+  // Return the total number of bytes currently acquired.
+  uint64_t BytesMapped() {
+    MutexLock l(&mu_);
+    return bytes_;
+  }
+
  private:
   MmapLimiter(const MmapLimiter& limiter);
   void operator=(const MmapLimiter&);
@@ -69,6 +85,8 @@ class MmapLimiter {
 
   port::AtomicPointer allowed_;
   port::Mutex mu_;
+  const uint64_t max_bytes_;
+  uint64_t bytes_;  // Protected by mu_
 };
 
 // A random access file implementation for files that are pre-mapped to memory.
@@ -103,7 +121,7 @@ class PosixMmapReadableFile : public RandomAccessFile {
 
   virtual ~PosixMmapReadableFile() {
     munmap(mmapped_region_, length_);
-    limiter_->Release();
+    limiter_->Release(length_);
   }
 };
 
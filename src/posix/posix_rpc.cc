@@ -166,11 +166,23 @@ inline PosixSocketServer* CreateServer(const RPCOptions& options, int tcp) {
 }  // namespace
 
 PosixRPC::PosixRPC(const RPCOptions& options)
-    : srv_(NULL), options_(options), tcp_(0) {
+    : srv_(NULL), pool_(NULL), options_(options), tcp_(0) {
   tcp_ = Slice(options_.uri).starts_with("tcp://");
   if (options_.mode == rpc::kServerClient) {
     srv_ = CreateServer(options_, tcp_);
   }
+  if (tcp_ && options_.tcp_persistent_conns) {
+    pool_ = new PosixTCPConnPool(options_.addr_cache_size,
+                                 options_.rpc_timeout);
+    pool_->Ref();
+  }
+}
+
+PosixRPC::~PosixRPC() {
+  // Close client connections first so that their TIME_WAIT states are
+  // not left on the server's port
+  if (pool_) pool_->Unref();
+  delete srv_;
 }
 
 Status PosixRPC::Start() {
@@ -216,6 +228,8 @@ rpc::If* PosixRPC::OpenStubFor(const std::string& uri) {
         new PosixUDPCli(options_.rpc_timeout, options_.udp_max_expected_msgsz);
     cli->Open(uri);
     return cli;
+  } else if (pool_) {
+    return new PosixTCPPooledCli(pool_, uri);
   } else {
     PosixTCPCli* const cli = new PosixTCPCli(options_.rpc_timeout);
     cli->SetTarget(uri);
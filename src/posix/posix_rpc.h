@@ -38,7 +38,7 @@ class PosixSocketServer {
   // Return base uri of the server. Unlike a full uri, a base uri is not coupled
   // with a protocol (tcp, udp).
   std::string GetBaseUri();
-  std::string GetUsageInfo();
+  virtual std::string GetUsageInfo();
   Status status();
 
  protected:
@@ -71,11 +71,13 @@ class PosixSocketServer {
   int fd_;
 };
 
+class PosixTCPConnPool;
+
 // Posix RPC impl wrapper.
 class PosixRPC : public RPC {
  public:
   explicit PosixRPC(const RPCOptions& options);
-  virtual ~PosixRPC() { delete srv_; }
+  virtual ~PosixRPC();
 
   virtual rpc::If* OpenStubFor(const std::string& uri);
   virtual Status Start();  // Open server the start background progressing
@@ -91,6 +93,9 @@ class PosixRPC : public RPC {
   void operator=(const PosixRPC& other);
   PosixRPC(const PosixRPC&);
   PosixSocketServer* srv_;  // NULL for client only mode
+  // Connections shared by all TCP stubs when options_.tcp_persistent_conns
+  // is set. NULL otherwise.
+  PosixTCPConnPool* pool_;
   RPCOptions options_;
   int tcp_;  // O for UDP, non-0 for TCP
 };
@@ -10,17 +10,173 @@
  */
 #include "posix_rpc_tcp.h"
 
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/mutexlock.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(PDLFS_OS_LINUX)
+#include <sys/epoll.h>
+#endif
 
 namespace pdlfs {
+namespace {
+// Set or unset the O_NONBLOCK flag on a given file.
+inline void SET_O_NONBLOCK(int fd, bool non_blocking) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  fcntl(fd, F_SETFL, flags);
+}
+
+// Avoid SIGPIPE when writing to a connection already closed by the peer.
+#if defined(MSG_NOSIGNAL)
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+const size_t kFrameHeaderSize = 8;           // length:fixed32, id:fixed32
+const uint32_t kMaxFrameSize = 64u << 20;  // Larger frames are rejected
+// Set in the length field of a reply frame whose payload is the fixed32 error
+// code of a failed call instead of the reply itself.
+const uint32_t kErrorFrame = 1u << 31;
+
+// Parse the next frame from *input. Return 1 and advance *input if a full
+// frame is found. Return 0 if more input is needed, or -1 if the frame is
+// corrupted.
+int ParseFrame(Slice* input, uint32_t* id, Slice* payload, bool* error) {
+  if (input->size() < kFrameHeaderSize) {
+    return 0;
+  }
+  uint32_t len = DecodeFixed32(input->data());
+  *error = (len & kErrorFrame) != 0;
+  len &= ~kErrorFrame;
+  if (len > kMaxFrameSize) {
+    return -1;
+  } else if (input->size() < kFrameHeaderSize + len) {
+    return 0;
+  }
+  *id = DecodeFixed32(input->data() + 4);
+  *payload = Slice(input->data() + kFrameHeaderSize, len);
+  input->remove_prefix(kFrameHeaderSize + len);
+  return 1;
+}
+
+// Receive up to "n" bytes from a socket directly into the end of *dst.
+// Return the result of recv(). The capacity of *dst is reused across calls so
+// no buffer is allocated per read.
+ssize_t RecvAppend(int fd, std::string* dst, size_t n) {
+  const size_t off = dst->size();
+  dst->resize(off + n);
+  const ssize_t rv = recv(fd, &(*dst)[off], n, MSG_DONTWAIT);
+  dst->resize(off + (rv > 0 ? rv : 0));
+  return rv;
+}
+
+// Write a frame to a non-blocking socket, waiting for the socket to become
+// writable when necessary. Give up after "timeout" microseconds.
+Status WriteFrame(int fd, uint32_t id, const Slice& payload, uint64_t timeout,
+                  bool error = false) {
+  char header[kFrameHeaderSize];
+  uint32_t len = static_cast<uint32_t>(payload.size());
+  if (error) {
+    len |= kErrorFrame;
+  }
+  EncodeFixed32(header, len);
+  EncodeFixed32(header + 4, id);
+  Slice parts[2];
+  parts[0] = Slice(header, sizeof(header));
+  parts[1] = payload;
+  struct pollfd po;
+  memset(&po, 0, sizeof(struct pollfd));
+  po.events = POLLOUT;
+  po.fd = fd;
+  const uint64_t start = CurrentMicros();
+  int i = 0;
+  while (i < 2) {
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    for (int j = i; j < 2; j++) {
+      iov[j - i].iov_base = const_cast<char*>(parts[j].data());
+      iov[j - i].iov_len = parts[j].size();
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2 - i;
+    ssize_t rv = sendmsg(fd, &msg, kSendFlags);
+    if (rv >= 0) {
+      size_t nbytes = rv;
+      while (i < 2 && nbytes >= parts[i].size()) {
+        nbytes -= parts[i].size();
+        i++;
+      }
+      if (i < 2) {
+        parts[i].remove_prefix(nbytes);
+      }
+      continue;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EWOULDBLOCK && errno != EAGAIN) {
+      return Status::IOError("TCP send", strerror(errno));
+    } else if (CurrentMicros() - start >= timeout) {
+      return Status::Disconnected("timeout");
+    }
+    rv = poll(&po, 1, 200);
+    if (rv == -1 && errno != EINTR) {
+      return Status::IOError("TCP poll", strerror(errno));
+    }
+  }
+  return Status::OK();
+}
+}  // namespace
+
+// A persistent connection accepted by the server. At most one epoll thread
+// reads from a connection at a time (EPOLLONESHOT) but replies may be sent
+// concurrently by extra workers.
+struct PosixTCPServer::Conn {
+  port::Mutex send_mu;  // Serializes replies
+  std::string rbuf;     // Partially received frames
+  int refs;             // Protected by the server's mutex_
+  int fd;
+};
+
+struct PosixTCPServer::FramedCall {
+  PosixTCPServer* srv;
+  Conn* conn;
+  uint32_t id;
+  std::string msg;
+};
+
 PosixTCPServer::PosixTCPServer(const RPCOptions& opts, uint64_t t, size_t s)
-    : PosixSocketServer(opts), rpc_timeout_(t), buf_sz_(s) {}
+    : PosixSocketServer(opts),
+      rpc_timeout_(t),
+      buf_sz_(s),
+      persistent_(opts.tcp_persistent_conns),
+      epfd_(-1),
+      bg_count_(0) {}
+
+PosixTCPServer::~PosixTCPServer() {
+  BGStop();  // Stop accepting new calls
+  MutexLock ml(&mutex_);
+  while (bg_count_ != 0) {  // Wait until all bg work items have been processed
+    bg_cv_.Wait();
+  }
+  for (size_t i = 0; i < conns_.size(); i++) {
+    Unref(conns_[i]);
+  }
+  conns_.clear();
+  if (epfd_ != -1) {
+    close(epfd_);
+  }
+  // More resources will be released by parent
+}
 
 Status PosixTCPServer::OpenAndBind(const std::string& uri) {
   MutexLock ml(&mutex_);
@@ -58,19 +214,39 @@ Status PosixTCPServer::OpenAndBind(const std::string& uri) {
                 &tmp);
   }
 
-  return status;
-}
+  if (status.ok() && persistent_) {
+#if defined(PDLFS_OS_LINUX)
+    epfd_ = epoll_create1(0);
+    if (epfd_ == -1) {
+      status = Status::IOError("Cannot create epoll instance", strerror(errno));
+    } else {
+      SET_O_NONBLOCK(fd_, true);
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = NULL;  // NULL indicates the listening socket
+      if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd_, &ev) == -1) {
+        status = Status::IOError("epoll_ctl", strerror(errno));
+        close(epfd_);
+        epfd_ = -1;
+      }
+    }
+#else
+    status = Status::NotSupported("Persistent TCP connections require epoll");
+#endif
+    if (!status.ok()) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
 
-namespace {
-// Set or unset the O_NONBLOCK flag on a given file.
-inline void SET_O_NONBLOCK(int fd, bool non_blocking) {
-  int flags = fcntl(fd, F_GETFL, 0);
-  flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
-  fcntl(fd, F_SETFL, flags);
+  return status;
 }
-}  // namespace
 
 Status PosixTCPServer::BGLoop(int myid) {
+  if (persistent_) {
+    return BGLoopFramed(myid);
+  }
   SET_O_NONBLOCK(fd_, true);
   struct pollfd po;
   po.events = POLLIN;
@@ -112,11 +288,9 @@ void PosixTCPServer::HandleIncomingCall(CallState* const call) {
   memset(&po, 0, sizeof(struct pollfd));
   po.events = POLLIN;
   po.fd = call->fd;
-  char* const buf = new char[buf_sz_];
   while (true) {
-    ssize_t rv = recv(call->fd, buf, buf_sz_, MSG_DONTWAIT);
+    ssize_t rv = RecvAppend(call->fd, &in.extra_buf, buf_sz_);
     if (rv > 0) {
-      in.extra_buf.append(buf, rv);
       continue;
     } else if (rv == 0) {  // End of message
       in.contents = in.extra_buf;
@@ -139,7 +313,6 @@ void PosixTCPServer::HandleIncomingCall(CallState* const call) {
     }
   }
 
-  delete[] buf;
   if (err) {
     //
     return;
@@ -162,6 +335,201 @@ void PosixTCPServer::HandleIncomingCall(CallState* const call) {
   shutdown(call->fd, SHUT_WR);
 }
 
+Status PosixTCPServer::BGLoopFramed(int myid) {
+#if defined(PDLFS_OS_LINUX)
+  const int kMaxEvents = 32;
+  struct epoll_event events[kMaxEvents];
+
+  int err = 0;
+  while (!err && !shutting_down_.Acquire_Load()) {
+    // We wait for 0.2 second and therefore shutdown requests are only checked
+    // roughly every that amount of time.
+    int rv = epoll_wait(epfd_, events, kMaxEvents, 200);
+    if (rv == -1) {
+      if (errno != EINTR) err = errno;
+      continue;
+    }
+    for (int i = 0; i < rv; i++) {
+      Conn* const conn = static_cast<Conn*>(events[i].data.ptr);
+      if (conn == NULL) {
+        AcceptConns();
+      } else {
+        ReadConn(conn);
+      }
+    }
+  }
+
+  Status status;
+  if (err) {
+    status = Status::IOError("epoll_wait", strerror(err));
+  }
+  return status;
+#else
+  return Status::NotSupported("Persistent TCP connections require epoll");
+#endif
+}
+
+#if defined(PDLFS_OS_LINUX)
+void PosixTCPServer::AcceptConns() {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  while (true) {
+    int fd = accept(fd_, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR) continue;
+      if (errno != EWOULDBLOCK && errno != EAGAIN) {
+        Log(options_.info_log, 0, "Error accepting TCP connection: %s",
+            strerror(errno));
+      }
+      break;
+    }
+    SET_O_NONBLOCK(fd, true);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Conn* const conn = new Conn;
+    conn->refs = 1;  // For the server itself; dropped at CloseConn()
+    conn->fd = fd;
+    mutex_.Lock();
+    conns_.push_back(conn);
+    mutex_.Unlock();
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      Log(options_.info_log, 0, "Cannot monitor TCP connection: %s",
+          strerror(errno));
+      CloseConn(conn);
+    }
+  }
+  // Rearm the listening socket
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd_, EPOLL_CTL_MOD, fd_, &ev);
+}
+
+void PosixTCPServer::ReadConn(Conn* const conn) {
+  bool eof = false;
+  int err = 0;
+  while (true) {
+    ssize_t rv = RecvAppend(conn->fd, &conn->rbuf, buf_sz_);
+    if (rv > 0) {
+      continue;
+    } else if (rv == 0) {
+      eof = true;
+      break;
+    } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+      break;
+    } else if (errno != EINTR) {
+      err = errno;
+      break;
+    }
+  }
+
+  // Dispatch all complete frames
+  Slice input(conn->rbuf);
+  uint32_t id;
+  Slice payload;
+  bool error;
+  int r;
+  while ((r = ParseFrame(&input, &id, &payload, &error)) == 1) {
+    if (error) {  // Only sent by servers
+      r = -1;
+      break;
+    }
+    FramedCall* const call = new FramedCall;
+    call->srv = this;
+    call->conn = conn;
+    call->id = id;
+    call->msg.assign(payload.data(), payload.size());
+    if (options_.extra_workers) {
+      mutex_.Lock();
+      ++conn->refs;
+      ++bg_count_;
+      options_.extra_workers->Schedule(ProcessFramedCallWrapper, call);
+      mutex_.Unlock();
+    } else {
+      ProcessFramedCall(call);
+      delete call;
+    }
+  }
+  conn->rbuf.erase(0, conn->rbuf.size() - input.size());
+  if (r == -1) {
+    Log(options_.info_log, 0, "Bad frame from TCP client; closing connection");
+  } else if (err) {
+    Log(options_.info_log, 1, "Error reading from TCP client: %s",
+        strerror(err));
+  }
+
+  if (eof || err || r == -1) {
+    CloseConn(conn);
+  } else {  // Rearm the connection
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+void PosixTCPServer::CloseConn(Conn* const conn) {
+  epoll_ctl(epfd_, EPOLL_CTL_DEL, conn->fd, NULL);
+  MutexLock ml(&mutex_);
+  std::vector<Conn*>::iterator it =
+      std::find(conns_.begin(), conns_.end(), conn);
+  if (it != conns_.end()) {
+    conns_.erase(it);
+  }
+  Unref(conn);
+}
+#endif
+
+// REQUIRES: mutex_ has been locked.
+void PosixTCPServer::Unref(Conn* const conn) {
+  mutex_.AssertHeld();
+  assert(conn->refs > 0);
+  --conn->refs;
+  if (!conn->refs) {
+    close(conn->fd);
+    delete conn;
+  }
+}
+
+void PosixTCPServer::ProcessFramedCallWrapper(void* arg) {
+  FramedCall* const call = reinterpret_cast<FramedCall*>(arg);
+  PosixTCPServer* const srv = call->srv;
+  srv->ProcessFramedCall(call);
+  MutexLock ml(&srv->mutex_);
+  srv->Unref(call->conn);
+  delete call;
+  assert(srv->bg_count_ > 0);
+  --srv->bg_count_;
+  if (!srv->bg_count_) {
+    srv->bg_cv_.SignalAll();
+  }
+}
+
+void PosixTCPServer::ProcessFramedCall(FramedCall* const call) {
+  rpc::If::Message in, out;
+  in.contents = call->msg;
+  Status s = options_.fs->Call(in, out);
+  // Failed calls get an error frame so that the caller does not have to wait
+  // for its timeout
+  const bool failed = !s.ok();
+  char code[4];
+  Slice reply = out.contents;
+  if (failed) {
+    Log(options_.info_log, 0, "Fail to handle incoming call: %s",
+        s.ToString().c_str());
+    EncodeFixed32(code, static_cast<uint32_t>(s.err_code()));
+    reply = Slice(code, sizeof(code));
+  }
+  MutexLock ml(&call->conn->send_mu);
+  s = WriteFrame(call->conn->fd, call->id, reply, rpc_timeout_, failed);
+  if (!s.ok()) {
+    Log(options_.info_log, 0, "Error sending data to client: %s",
+        s.ToString().c_str());
+  }
+}
+
 std::string PosixTCPServer::GetUri() {
   return std::string("tcp://") + GetBaseUri();
 }
@@ -215,11 +583,9 @@ Status PosixTCPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
   memset(&po, 0, sizeof(struct pollfd));
   po.events = POLLIN;
   po.fd = fd;
-  char* const buf = new char[buf_sz_];
   while (true) {
-    ssize_t rv = recv(fd, buf, buf_sz_, MSG_DONTWAIT);
+    ssize_t rv = RecvAppend(fd, &out.extra_buf, buf_sz_);
     if (rv > 0) {
-      out.extra_buf.append(buf, rv);
       continue;
     } else if (rv == 0) {  // End of message
       out.contents = out.extra_buf;
@@ -242,9 +608,303 @@ Status PosixTCPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
     }
   }
 
-  delete[] buf;
   close(fd);
   return status;
 }
 
+struct PosixTCPConn::Waiter {
+  explicit Waiter(port::Mutex* mu) : cv(mu), out(NULL), id(0), done(false) {}
+  port::CondVar cv;
+  std::string* out;
+  uint32_t id;
+  bool done;
+  Status status;
+};
+
+PosixTCPConn::PosixTCPConn(uint64_t timeout, size_t buf_sz)
+    : rpc_timeout_(timeout),
+      buf_sz_(buf_sz),
+      next_id_(0),
+      reading_(false),
+      fd_(-1) {}
+
+PosixTCPConn::~PosixTCPConn() {
+  assert(waiters_.empty());
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+Status PosixTCPConn::Connect(const std::string& uri) {
+  PosixSocketAddr addr;
+  Status status = addr.ResolvUri(uri);
+  if (!status.ok()) {
+    return status;
+  }
+  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd_ == -1) {
+    return Status::IOError("Cannot create TCP socket", strerror(errno));
+  }
+  // Connect in non-blocking mode so that an unresponsive server cannot block
+  // us beyond our timeout
+  SET_O_NONBLOCK(fd_, true);
+  int rv = connect(fd_, reinterpret_cast<struct sockaddr*>(addr.rep()),
+                   sizeof(struct sockaddr_in));
+  if (rv == -1 && errno == EINPROGRESS) {
+    struct pollfd po;
+    memset(&po, 0, sizeof(struct pollfd));
+    po.events = POLLOUT;
+    po.fd = fd_;
+    const uint64_t start = CurrentMicros();
+    while (true) {
+      rv = poll(&po, 1, 200);
+      if (rv == 1) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+          errno = err;
+          rv = -1;
+        } else {
+          rv = 0;
+        }
+        break;
+      } else if (rv == -1 && errno != EINTR) {
+        break;
+      } else if (CurrentMicros() - start >= rpc_timeout_) {
+        status = Status::Disconnected("TCP connect", "timeout");
+        break;
+      }
+    }
+  }
+  if (status.ok() && rv == -1) {
+    status = Status::IOError("TCP connect", strerror(errno));
+  }
+  if (!status.ok()) {
+    close(fd_);
+    fd_ = -1;
+    return status;
+  }
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return status;
+}
+
+bool PosixTCPConn::IsBroken() {
+  MutexLock ml(&mu_);
+  return !error_.ok();
+}
+
+Status PosixTCPConn::SendFrame(uint32_t id, const Slice& payload) {
+  MutexLock ml(&send_mu_);
+  return WriteFrame(fd_, id, payload, rpc_timeout_);
+}
+
+Status PosixTCPConn::Call(const Slice& in, std::string* out) {
+  Waiter w(&mu_);
+  w.out = out;
+  MutexLock ml(&mu_);
+  if (!error_.ok()) {
+    return error_;
+  }
+  w.id = next_id_++;
+  waiters_.push_back(&w);
+  mu_.Unlock();
+  Status status = SendFrame(w.id, in);
+  mu_.Lock();
+  if (!status.ok()) {
+    // A partially written frame leaves the stream unusable
+    FailAll(status);
+  }
+
+  // Callers take turns reading replies from the connection. The one holding
+  // the reader role routes each reply to its caller.
+  const uint64_t start = CurrentMicros();
+  while (!w.done) {
+    if (!reading_) {
+      reading_ = true;
+      mu_.Unlock();
+      status = ReadFrames();
+      mu_.Lock();
+      if (status.ok()) {
+        status = DeliverReplies();
+      }
+      reading_ = false;
+      if (!status.ok()) {
+        FailAll(status);
+      }
+    } else {
+      w.cv.TimedWait(200 * 1000);
+    }
+    if (!w.done && CurrentMicros() - start >= rpc_timeout_) {
+      waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &w));
+      w.status = Status::Disconnected("timeout");
+      w.done = true;
+    }
+  }
+
+  // Hand the reader role over so that remaining calls continue to progress
+  if (!reading_ && !waiters_.empty()) {
+    waiters_.front()->cv.Signal();
+  }
+  return w.status;
+}
+
+Status PosixTCPConn::ReadFrames() {
+  Status status;
+  struct pollfd po;
+  memset(&po, 0, sizeof(struct pollfd));
+  po.events = POLLIN;
+  po.fd = fd_;
+  bool got_data = false;
+  while (true) {
+    ssize_t rv = RecvAppend(fd_, &rbuf_, buf_sz_);
+    if (rv > 0) {
+      got_data = true;
+      continue;
+    } else if (rv == 0) {
+      status = Status::Disconnected("Connection closed by peer");
+      break;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EWOULDBLOCK && errno != EAGAIN) {
+      status = Status::IOError("TCP recv", strerror(errno));
+      break;
+    } else if (got_data) {
+      break;
+    }
+    // We wait for 0.2 second so that the caller can check its timeout
+    rv = poll(&po, 1, 200);
+    if (rv == -1 && errno != EINTR) {
+      status = Status::IOError("TCP poll", strerror(errno));
+      break;
+    } else if (rv == 0) {
+      break;
+    }
+  }
+  return status;
+}
+
+Status PosixTCPConn::DeliverReplies() {
+  mu_.AssertHeld();
+  Slice input(rbuf_);
+  uint32_t id;
+  Slice payload;
+  bool error;
+  int r;
+  while ((r = ParseFrame(&input, &id, &payload, &error)) == 1) {
+    // Replies for calls that have timed out are silently dropped
+    for (size_t i = 0; i < waiters_.size(); i++) {
+      Waiter* const w = waiters_[i];
+      if (w->id == id) {
+        if (!error) {
+          w->out->assign(payload.data(), payload.size());
+        } else {
+          int code = payload.size() == 4 ? DecodeFixed32(payload.data()) : 0;
+          if (code <= 0 || code > Status::kMaxCode) {
+            code = Status::kIOError;
+          }
+          w->status = Status::FromCode(code);
+        }
+        w->done = true;
+        waiters_.erase(waiters_.begin() + i);
+        w->cv.Signal();
+        break;
+      }
+    }
+  }
+  rbuf_.erase(0, rbuf_.size() - input.size());
+  if (r == -1) {
+    return Status::Corruption("Bad frame from TCP server");
+  }
+  return Status::OK();
+}
+
+void PosixTCPConn::FailAll(const Status& s) {
+  mu_.AssertHeld();
+  error_ = s;
+  for (size_t i = 0; i < waiters_.size(); i++) {
+    Waiter* const w = waiters_[i];
+    w->status = s;
+    w->done = true;
+    w->cv.Signal();
+  }
+  waiters_.clear();
+}
+
+PosixTCPConnPool::PosixTCPConnPool(size_t capacity, uint64_t timeout,
+                                   size_t buf_sz)
+    : rpc_timeout_(timeout), buf_sz_(buf_sz), conns_(capacity), refs_(0) {}
+
+PosixTCPConnPool::~PosixTCPConnPool() {
+  MutexLock ml(&mu_);
+  conns_.Prune();  // Close all idle connections
+  assert(conns_.Empty());
+}
+
+void PosixTCPConnPool::Ref() {
+  MutexLock ml(&mu_);
+  ++refs_;
+}
+
+void PosixTCPConnPool::Unref() {
+  mu_.Lock();
+  assert(refs_ > 0);
+  --refs_;
+  const bool last_ref = !refs_;
+  mu_.Unlock();
+  if (last_ref) {
+    delete this;
+  }
+}
+
+Status PosixTCPConnPool::Call(const std::string& uri, const Slice& in,
+                              std::string* out) {
+  const uint32_t hash = Hash(uri.data(), uri.size(), 0);
+  mu_.Lock();
+  ConnEntry* e = conns_.Lookup(uri, hash);
+  mu_.Unlock();
+  if (e == NULL) {
+    PosixTCPConn* const conn = new PosixTCPConn(rpc_timeout_, buf_sz_);
+    Status status = conn->Connect(uri);
+    if (!status.ok()) {
+      delete conn;
+      return status;
+    }
+    MutexLock ml(&mu_);
+    e = conns_.Insert(uri, hash, conn, 1, LRUValueDeleter<PosixTCPConn>);
+  }
+  Status status = e->value->Call(in, out);
+  MutexLock ml(&mu_);
+  if (e->value->IsBroken()) {
+    // Next call will reconnect. Erase by key, and only if the entry has not
+    // been replaced, so that *e is left untouched until its final Release().
+    ConnEntry* const cur = conns_.Lookup(uri, hash);
+    if (cur != NULL) {
+      if (cur == e) {
+        conns_.Erase(uri, hash);
+      }
+      conns_.Release(cur);
+    }
+  }
+  conns_.Release(e);
+  return status;
+}
+
+PosixTCPPooledCli::PosixTCPPooledCli(PosixTCPConnPool* pool,
+                                     const std::string& uri)
+    : pool_(pool), uri_(uri) {
+  pool_->Ref();
+}
+
+PosixTCPPooledCli::~PosixTCPPooledCli() { pool_->Unref(); }
+
+Status PosixTCPPooledCli::Call(Message& in, Message& out) RPCNOEXCEPT {
+  Status status = pool_->Call(uri_, in.contents, &out.extra_buf);
+  if (status.ok()) {
+    out.contents = out.extra_buf;
+  }
+  return status;
+}
+
 }  // namespace pdlfs
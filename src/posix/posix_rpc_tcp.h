@@ -12,18 +12,28 @@
 
 #include "posix_rpc.h"
 
+#include "pdlfs-common/lru.h"
+
 #include <stddef.h>
 #include <sys/socket.h>
 
 namespace pdlfs {
-// RPC srv impl using TCP.
+// RPC srv impl using TCP. By default, each incoming connection carries exactly
+// one request and one reply (one-shot mode). When RPCOptions::
+// tcp_persistent_conns is set, connections are instead kept open and carry a
+// stream of length-prefixed frames (see below) that may be interleaved among
+// multiple outstanding requests. Connections are then monitored through epoll
+// and decoded requests are handed to RPCOptions::extra_workers when available.
+//
+// Each frame is:
+//    length: fixed32  (size of the payload)
+//    id: fixed32      (request id, echoed back in the reply frame)
+//    payload: char[length]
 class PosixTCPServer : public PosixSocketServer {
  public:
   PosixTCPServer(const RPCOptions& options, uint64_t timeout,
                  size_t buf_sz = 4000);
-  virtual ~PosixTCPServer() {
-    BGStop();
-  }  // More resources to be released by parent
+  virtual ~PosixTCPServer();
 
   // On OK, BGStart() from parent should then be called to commence background
   // server progressing.
@@ -41,6 +51,22 @@ class PosixTCPServer : public PosixSocketServer {
   virtual Status BGLoop(int myid);
   const uint64_t rpc_timeout_;  // In microseconds
   const size_t buf_sz_;         // Buffer size for reading peer data
+
+  // Persistent connection mode
+  struct Conn;
+  struct FramedCall;
+  Status BGLoopFramed(int myid);
+  void AcceptConns();
+  void ReadConn(Conn* conn);
+  void CloseConn(Conn* conn);
+  void Unref(Conn* conn);
+  void ProcessFramedCall(FramedCall* call);
+  static void ProcessFramedCallWrapper(void* arg);
+  const bool persistent_;
+  int epfd_;  // epoll instance for the listening socket and all connections
+  // State below protected by mutex_
+  std::vector<Conn*> conns_;  // Open connections
+  int bg_count_;              // Total number of bg work items pending
 };
 
 // TCP client.
@@ -68,4 +94,85 @@ class PosixTCPCli : public rpc::If {
   Status status_;
 };
 
+// A persistent, framed TCP connection to a single server. Multiple threads may
+// issue calls through the same connection concurrently. Each call is assigned a
+// request id. Replies are read by whichever caller currently holds the reader
+// role, which then routes each reply to its caller by id.
+class PosixTCPConn {
+ public:
+  PosixTCPConn(uint64_t timeout, size_t buf_sz);
+  ~PosixTCPConn();
+
+  Status Connect(const std::string& uri);
+  Status Call(const Slice& in, std::string* out);
+
+  // Return true iff the connection has encountered an error and should no
+  // longer be used.
+  bool IsBroken();
+
+ private:
+  struct Waiter;
+  Status SendFrame(uint32_t id, const Slice& payload);
+  Status ReadFrames();  // REQUIRES: caller holds the reader role
+  // REQUIRES: mu_ has been locked and caller holds the reader role.
+  Status DeliverReplies();
+  void FailAll(const Status& s);
+  // No copying allowed
+  void operator=(const PosixTCPConn&);
+  PosixTCPConn(const PosixTCPConn& other);
+  const uint64_t rpc_timeout_;  // In microseconds
+  const size_t buf_sz_;
+  port::Mutex send_mu_;  // Serializes frame writes
+  port::Mutex mu_;
+  // State below protected by mu_
+  std::vector<Waiter*> waiters_;  // Calls waiting for replies
+  uint32_t next_id_;
+  bool reading_;  // True iff some caller currently holds the reader role
+  Status error_;  // Sticky connection error
+  std::string rbuf_;  // Partial input. Only accessed by the reader
+  int fd_;
+};
+
+// A cache of persistent connections keyed by server uri. At most
+// "capacity" idle connections are kept. Reference counted so that stubs
+// created from the pool may outlive the RPC instance that created it.
+class PosixTCPConnPool {
+ public:
+  PosixTCPConnPool(size_t capacity, uint64_t timeout, size_t buf_sz = 4000);
+
+  void Ref();
+  void Unref();
+
+  Status Call(const std::string& uri, const Slice& in, std::string* out);
+
+ private:
+  typedef LRUEntry<PosixTCPConn> ConnEntry;
+  ~PosixTCPConnPool();
+  // No copying allowed
+  void operator=(const PosixTCPConnPool&);
+  PosixTCPConnPool(const PosixTCPConnPool& other);
+  const uint64_t rpc_timeout_;
+  const size_t buf_sz_;
+  port::Mutex mu_;
+  // State below protected by mu_
+  LRUCache<ConnEntry> conns_;
+  int refs_;
+};
+
+// TCP client reusing pooled persistent connections.
+class PosixTCPPooledCli : public rpc::If {
+ public:
+  PosixTCPPooledCli(PosixTCPConnPool* pool, const std::string& uri);
+  virtual ~PosixTCPPooledCli();
+
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
+
+ private:
+  // No copying allowed
+  void operator=(const PosixTCPPooledCli&);
+  PosixTCPPooledCli(const PosixTCPPooledCli& other);
+  PosixTCPConnPool* const pool_;
+  const std::string uri_;
+};
+
 }  // namespace pdlfs
@@ -13,10 +13,12 @@
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/mutexlock.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <netdb.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace pdlfs {
@@ -24,6 +26,7 @@ namespace pdlfs {
 PosixUDPServer::PosixUDPServer(const RPCOptions& options)
     : PosixSocketServer(options),
       max_msgsz_(options.udp_max_unexpected_msgsz),
+      batch_size_(std::max(options.udp_batch_size, 1)),
       bg_count_(0) {}
 
 PosixUDPServer::~PosixUDPServer() {
@@ -32,9 +35,49 @@ PosixUDPServer::~PosixUDPServer() {
   while (bg_count_ != 0) {  // Wait until all bg work items have been processed
     bg_cv_.Wait();
   }
+  for (size_t i = 0; i < extra_fds_.size(); i++) {
+    close(extra_fds_[i]);
+  }
+  for (size_t i = 0; i < batch_stats_.size(); i++) {
+    delete batch_stats_[i];
+  }
   // More resources will be released by parent
 }
 
+void PosixUDPServer::ConfigureSocket(int fd) {
+  if (options_.udp_srv_rcvbuf != -1) {
+    int rv = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options_.udp_srv_rcvbuf,
+                        sizeof(options_.udp_srv_rcvbuf));
+    if (rv != 0) {
+      Log(options_.info_log, 0, "Cannot set SO_RCVBUF=%d: %s",
+          options_.udp_srv_rcvbuf, strerror(errno));
+    }
+  }
+
+  if (options_.udp_srv_sndbuf != -1) {
+    int rv = setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options_.udp_srv_sndbuf,
+                        sizeof(options_.udp_srv_sndbuf));
+    if (rv != 0) {
+      Log(options_.info_log, 0, "Cannot set SO_SNDBUF=%d: %s",
+          options_.udp_srv_sndbuf, strerror(errno));
+    }
+  }
+}
+
+namespace {
+Status SetReusePort(int fd) {
+#if defined(SO_REUSEPORT)
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+    return Status::IOError("Cannot set SO_REUSEPORT", strerror(errno));
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_REUSEPORT");
+#endif
+}
+}  // namespace
+
 Status PosixUDPServer::OpenAndBind(const std::string& uri) {
   MutexLock ml(&mutex_);
   if (fd_ != -1) {
@@ -51,34 +94,24 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
   if (fd_ == -1) {
     status = Status::IOError("Cannot create UDP socket", strerror(errno));
   } else {
-    int rv = bind(fd_, reinterpret_cast<struct sockaddr*>(addr_->rep()),
-                  sizeof(struct sockaddr_in));
-    if (rv == -1) {
-      status = Status::IOError("UDP bind", strerror(errno));
-      close(fd_);
-      fd_ = -1;
+    if (options_.udp_reuseport) {
+      status = SetReusePort(fd_);
     }
-  }
-
-  if (options_.udp_srv_rcvbuf != -1) {
-    int rv = setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &options_.udp_srv_rcvbuf,
-                        sizeof(options_.udp_srv_rcvbuf));
-    if (rv != 0) {
-      Log(options_.info_log, 0, "Cannot set SO_RCVBUF=%d: %s",
-          options_.udp_srv_rcvbuf, strerror(errno));
+    if (status.ok()) {
+      int rv = bind(fd_, reinterpret_cast<struct sockaddr*>(addr_->rep()),
+                    sizeof(struct sockaddr_in));
+      if (rv == -1) {
+        status = Status::IOError("UDP bind", strerror(errno));
+      }
     }
-  }
-
-  if (options_.udp_srv_sndbuf != -1) {
-    int rv = setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &options_.udp_srv_sndbuf,
-                        sizeof(options_.udp_srv_sndbuf));
-    if (rv != 0) {
-      Log(options_.info_log, 0, "Cannot set SO_SNDBUF=%d: %s",
-          options_.udp_srv_sndbuf, strerror(errno));
+    if (!status.ok()) {
+      close(fd_);
+      fd_ = -1;
     }
   }
 
   if (status.ok()) {
+    ConfigureSocket(fd_);
     // Fetch the port that we have just bound to in case we have decided to have
     // the OS choose the port
     socklen_t tmp = sizeof(struct sockaddr_in);
@@ -89,25 +122,67 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
   return status;
 }
 
-inline PosixUDPServer::CallState* PosixUDPServer::CreateCallState() {
+// Open an additional socket bound to the same address as the main server
+// socket. Sockets are closed when the server is deleted so that pending
+// replies from extra workers can still go through them after the bg loop
+// exits.
+Status PosixUDPServer::OpenReusePortSocket(int* result) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    return Status::IOError("Cannot create UDP socket", strerror(errno));
+  }
+  Status status = SetReusePort(fd);
+  if (status.ok()) {
+    MutexLock ml(&mutex_);
+    int rv = bind(fd, reinterpret_cast<struct sockaddr*>(actual_addr_->rep()),
+                  sizeof(struct sockaddr_in));
+    if (rv == -1) {
+      status = Status::IOError("UDP bind", strerror(errno));
+    } else {
+      extra_fds_.push_back(fd);
+    }
+  }
+  if (status.ok()) {
+    ConfigureSocket(fd);
+    *result = fd;
+  } else {
+    close(fd);
+  }
+  return status;
+}
+
+inline PosixUDPServer::CallState* PosixUDPServer::CreateCallState(int fd) {
   CallState* const call = static_cast<CallState*>(
       malloc(sizeof(struct CallState) - 1 + max_msgsz_));
   call->parent_srv = this;
+  call->fd = fd;
   return call;
 }
 
 Status PosixUDPServer::BGLoop(int myid) {
-  CallState* call = CreateCallState();
+  int fd = fd_;
+  if (options_.udp_reuseport && myid != 0) {
+    Status s = OpenReusePortSocket(&fd);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+#if defined(PDLFS_OS_LINUX)
+  if (batch_size_ > 1) {
+    return BGLoopBatched(myid, fd);
+  }
+#endif
+  CallState* call = CreateCallState(fd);
   struct pollfd po;
   po.events = POLLIN;
-  po.fd = fd_;
+  po.fd = fd;
 
   int err = 0;
   while (!err && !shutting_down_.Acquire_Load()) {
     call->addrlen = sizeof(call->addrstor);
     // Try performing a quick non-blocking receive from peers before sinking
     // into poll.
-    ssize_t rv = recvfrom(fd_, call->msg, max_msgsz_, MSG_DONTWAIT,
+    ssize_t rv = recvfrom(fd, call->msg, max_msgsz_, MSG_DONTWAIT,
                           call->addrbuf(), &call->addrlen);
     if (rv > 0) {
       call->msgsz = rv;
@@ -134,8 +209,121 @@ Status PosixUDPServer::BGLoop(int myid) {
   return status;
 }
 
+Status PosixUDPServer::BGLoopBatched(int myid, int fd) {
+#if defined(PDLFS_OS_LINUX)
+  const int n = batch_size_;
+  std::vector<CallState*> calls(n);
+  std::vector<struct mmsghdr> msgs(n);
+  std::vector<struct iovec> iovs(n);
+  for (int i = 0; i < n; i++) {
+    calls[i] = CreateCallState(fd);
+  }
+  // Replies generated inline are coalesced and sent through sendmmsg()
+  std::vector<rpc::If::Message> replies(n);
+  std::vector<struct mmsghdr> reply_msgs(n);
+  std::vector<struct iovec> reply_iovs(n);
+  mutex_.Lock();
+  if (batch_stats_.size() <= static_cast<size_t>(myid)) {
+    batch_stats_.resize(myid + 1, NULL);
+  }
+  if (batch_stats_[myid] == NULL) {
+    batch_stats_[myid] = new BatchStats;
+  }
+  BatchStats* const stats = batch_stats_[myid];
+  mutex_.Unlock();
+  struct pollfd po;
+  po.events = POLLIN;
+  po.fd = fd;
+
+  int err = 0;
+  while (!err && !shutting_down_.Acquire_Load()) {
+    for (int i = 0; i < n; i++) {
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      iovs[i].iov_base = calls[i]->msg;
+      iovs[i].iov_len = max_msgsz_;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = calls[i]->addrbuf();
+      msgs[i].msg_hdr.msg_namelen = sizeof(calls[i]->addrstor);
+    }
+    // Try performing a quick non-blocking receive from peers before sinking
+    // into poll.
+    int rv = recvmmsg(fd, &msgs[0], n, MSG_DONTWAIT, NULL);
+    if (rv > 0) {
+      stats->batches.fetch_add(1, std::memory_order_relaxed);
+      stats->msgs.fetch_add(rv, std::memory_order_relaxed);
+      int k = 0;  // Number of replies to send
+      for (int i = 0; i < rv; i++) {
+        CallState* const call = calls[i];
+        call->msgsz = msgs[i].msg_len;
+        call->addrlen = msgs[i].msg_hdr.msg_namelen;
+        if (call->msgsz == 0) {  // Empty message
+          continue;
+        } else if (options_.extra_workers) {
+          HandleIncomingCall(&calls[i]);
+          continue;
+        }
+        rpc::If::Message in;
+        rpc::If::Message& out = replies[k];
+        out.contents = Slice();
+        out.extra_buf.clear();
+        in.contents = Slice(call->msg, call->msgsz);
+        Status s = options_.fs->Call(in, out);
+        if (!s.ok()) {
+          Log(options_.info_log, 0, "Fail to handle incoming call: %s",
+              s.ToString().c_str());
+          continue;
+        }
+        memset(&reply_msgs[k], 0, sizeof(struct mmsghdr));
+        reply_iovs[k].iov_base = const_cast<char*>(out.contents.data());
+        reply_iovs[k].iov_len = out.contents.size();
+        reply_msgs[k].msg_hdr.msg_iov = &reply_iovs[k];
+        reply_msgs[k].msg_hdr.msg_iovlen = 1;
+        reply_msgs[k].msg_hdr.msg_name = call->addrbuf();
+        reply_msgs[k].msg_hdr.msg_namelen = call->addrlen;
+        k++;
+      }
+      int j = 0;
+      while (j < k) {
+        int r = sendmmsg(fd, &reply_msgs[j], k - j, 0);
+        if (r > 0) {
+          j += r;
+        } else if (r == -1 && errno == EINTR) {
+          continue;
+        } else {  // Skip the reply that fails
+          Log(options_.info_log, 0, "Error sending data to client: %s",
+              strerror(errno));
+          j++;
+        }
+      }
+      continue;
+    } else if (errno == EWOULDBLOCK) {
+      rv = poll(&po, 1, 200);
+    }
+
+    // Either poll() or recvmmsg() may have returned error
+    if (rv == -1 && errno != EINTR) {
+      err = errno;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    free(calls[i]);
+  }
+
+  Status status;
+  if (err) {
+    status = Status::IOError("UDP recvmmsg/poll", strerror(err));
+  }
+  return status;
+#else
+  return Status::NotSupported("recvmmsg");
+#endif
+}
+
 void PosixUDPServer::HandleIncomingCall(CallState** call) {
   if (options_.extra_workers) {
+    const int fd = (*call)->fd;  // *call may be freed once scheduled
     mutex_.Lock();
     ++bg_count_;
     // XXX: senders/callers are implicitly rate-limited by not sending them
@@ -145,7 +333,7 @@ void PosixUDPServer::HandleIncomingCall(CallState** call) {
     // PosixUDPCli, which in turn returns a special Status to the caller.
     options_.extra_workers->Schedule(ProcessCallWrapper, *call);
     mutex_.Unlock();
-    *call = CreateCallState();
+    *call = CreateCallState(fd);
   } else {
     ProcessCall(*call);
   }
@@ -173,7 +361,7 @@ void PosixUDPServer::ProcessCall(CallState* const call) {
         s.ToString().c_str());
     return;
   }
-  ssize_t nbytes = sendto(fd_, out.contents.data(), out.contents.size(), 0,
+  ssize_t nbytes = sendto(call->fd, out.contents.data(), out.contents.size(), 0,
                           call->addrbuf(), call->addrlen);
   if (nbytes != out.contents.size()) {
 #if VERBOSE >= 1
@@ -191,6 +379,35 @@ void PosixUDPServer::ProcessCall(CallState* const call) {
   }
 }
 
+std::string PosixUDPServer::GetUsageInfo() {
+  std::string result = PosixSocketServer::GetUsageInfo();
+  if (batch_size_ <= 1) {
+    return result;
+  }
+  MutexLock ml(&mutex_);
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp), "%6s %12s %12s %12s\n", "Thread", "Batches",
+           "Msgs", "Fill(%)");
+  result += tmp;
+  result += "---------------------------------------------\n";
+  for (size_t i = 0; i < batch_stats_.size(); i++) {
+    if (batch_stats_[i] == NULL) {
+      continue;
+    }
+    const uint64_t batches = batch_stats_[i]->batches.load();
+    const uint64_t msgs = batch_stats_[i]->msgs.load();
+    double fill = 0;
+    if (batches != 0) {
+      fill = 100.0 * msgs / batches / batch_size_;
+    }
+    snprintf(tmp, sizeof(tmp), "%-6d %12llu %12llu %12.1f\n", int(i),
+             static_cast<unsigned long long>(batches),
+             static_cast<unsigned long long>(msgs), fill);
+    result += tmp;
+  }
+  return result;
+}
+
 std::string PosixUDPServer::GetUri() {
   return std::string("udp://") + GetBaseUri();
 }
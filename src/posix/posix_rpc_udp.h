@@ -14,9 +14,15 @@
 
 #include <stddef.h>
 #include <sys/socket.h>
+#include <atomic>
+#include <vector>
 
 namespace pdlfs {
-// RPC srv impl using UDP.
+// RPC srv impl using UDP. When RPCOptions::udp_batch_size is larger than 1,
+// each server thread receives up to that many datagrams per recvmmsg() call
+// and, when replies are generated inline, sends them back using a single
+// sendmmsg() call. When RPCOptions::udp_reuseport is set, each server thread
+// owns a separate socket bound to the same address through SO_REUSEPORT.
 class PosixUDPServer : public PosixSocketServer {
  public:
   explicit PosixUDPServer(const RPCOptions& options);
@@ -26,11 +32,15 @@ class PosixUDPServer : public PosixSocketServer {
   // server progressing.
   virtual Status OpenAndBind(const std::string& uri);
   virtual std::string GetUri();
+  // In addition to per-thread CPU usage, report per-thread batch fill when
+  // batched receiving is enabled.
+  virtual std::string GetUsageInfo();
 
  private:
   // State for each incoming procedure call.
   struct CallState {
     PosixUDPServer* parent_srv;  // Back pointer to the server
+    int fd;                      // Socket through which to send the reply
     // Location of the caller
     struct sockaddr_storage addrstor;
     struct sockaddr* addrbuf() {
@@ -40,13 +50,26 @@ class PosixUDPServer : public PosixSocketServer {
     size_t msgsz;  // Payload size
     char msg[1];
   };
-  CallState* CreateCallState();
+  CallState* CreateCallState(int fd);
   void HandleIncomingCall(CallState** call);  // May send call to bg worker pool
   void ProcessCall(CallState* call);
   static void ProcessCallWrapper(void* arg);
+  void ConfigureSocket(int fd);
+  Status OpenReusePortSocket(int* result);
   virtual Status BGLoop(int myid);
+  Status BGLoopBatched(int myid, int fd);
   const size_t max_msgsz_;  // Buffer size for incoming rpc messages
+  const int batch_size_;
+  // Updated by each bg thread after every batch and read concurrently by
+  // GetUsageInfo().
+  struct BatchStats {
+    BatchStats() : batches(0), msgs(0) {}
+    std::atomic<uint64_t> batches;  // Total number of non-empty batches
+    std::atomic<uint64_t> msgs;  // Total number of datagrams in these batches
+  };
   // State below protected by mutex_
+  std::vector<BatchStats*> batch_stats_;  // Indexed by bg thread id
+  std::vector<int> extra_fds_;  // Per-thread sockets opened with SO_REUSEPORT
   int bg_count_;  // Total number of bg work items pending
 };
 
@@ -42,7 +42,10 @@ RPCOptions::RPCOptions()
       udp_max_unexpected_msgsz(1432),
       udp_max_expected_msgsz(1432),
       udp_srv_rcvbuf(-1),
-      udp_srv_sndbuf(-1) {}
+      udp_srv_sndbuf(-1),
+      udp_batch_size(1),
+      udp_reuseport(false),
+      tcp_persistent_conns(false) {}
 
 int RPC::GetPort() { return -1; }
 
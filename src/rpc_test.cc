@@ -10,6 +10,7 @@
  */
 #include "pdlfs-common/rpc.h"
 
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/testharness.h"
 
@@ -23,6 +24,9 @@ class RPCTest : public rpc::If {
   RPCTest() {}
 
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
+    if (in.contents == Slice("fail")) {
+      return Status::NotFound(Slice());
+    }
     out.extra_buf.assign(in.contents.data(), in.contents.size());
     out.contents = out.extra_buf;
     return Status::OK();
@@ -93,6 +97,176 @@ TEST(RPCTest, SendAndRecv) {
   delete extra_worker;
 }
 
+namespace {
+// State shared by concurrent callers. When stub is NULL, each caller opens
+// its own stub to uri.
+struct CallerState {
+  CallerState(RPC* rpc, const char* uri, rpc::If* stub)
+      : rpc(rpc),
+        uri(uri),
+        stub(stub),
+        cv(&mu),
+        num_running(0),
+        num_failures(0),
+        next_thread_id(0) {}
+  RPC* const rpc;
+  const char* const uri;
+  rpc::If* const stub;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+  int num_failures;
+  int next_thread_id;
+};
+
+void ConcurrentCaller(void* arg) {
+  CallerState* const state = reinterpret_cast<CallerState*>(arg);
+  state->mu.Lock();
+  const int id = state->next_thread_id++;
+  state->mu.Unlock();
+  rpc::If* const stub =
+      state->stub != NULL ? state->stub : state->rpc->OpenStubFor(state->uri);
+  int failures = 0;
+  char tmp[50];
+  for (int i = 0; i < 200; i++) {
+    snprintf(tmp, sizeof(tmp), "thread-%d-call-%d", id, i);
+    rpc::If::Message in, out;
+    in.contents = Slice(tmp);
+    Status s = stub->Call(in, out);
+    if (!s.ok() || out.contents != in.contents) {
+      failures++;
+    }
+  }
+  if (stub != state->stub) {
+    delete stub;
+  }
+  MutexLock ml(&state->mu);
+  state->num_failures += failures;
+  state->num_running--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+TEST(RPCTest, PersistentTCPConns) {
+  ThreadPool* extra_worker = ThreadPool::NewFixed(2, true);
+  const char* uri = "tcp://127.0.0.1:22222";
+  for (int j = 0; j < 2; j++) {
+    RPCOptions options;
+    options.uri = uri;
+    options.fs = this;
+    options.num_rpc_threads = 2;
+    options.extra_workers = j != 0 ? extra_worker : NULL;
+    options.tcp_persistent_conns = true;
+    RPC* rpc = RPC::Open(options);
+    ASSERT_OK(rpc->Start());
+    rpc::If* client = rpc->OpenStubFor(uri);
+    ASSERT_TRUE(client != NULL);
+    // Multiple threads share a single stub and therefore a single connection
+    CallerState state(rpc, uri, client);
+    const int num_threads = 4;
+    state.num_running = num_threads;
+    for (int i = 0; i < num_threads; i++) {
+      Env::Default()->StartThread(ConcurrentCaller, &state);
+    }
+    state.mu.Lock();
+    while (state.num_running != 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+    ASSERT_EQ(state.num_failures, 0);
+    ASSERT_OK(rpc->Stop());
+    delete client;
+    delete rpc;
+  }
+  delete extra_worker;
+}
+
+TEST(RPCTest, PersistentTCPCallErrors) {
+  const char* uri = "tcp://127.0.0.1:22222";
+  RPCOptions options;
+  options.uri = uri;
+  options.fs = this;
+  options.rpc_timeout = 30 * 1000 * 1000;
+  options.tcp_persistent_conns = true;
+  RPC* rpc = RPC::Open(options);
+  ASSERT_OK(rpc->Start());
+  rpc::If* client = rpc->OpenStubFor(uri);
+  ASSERT_TRUE(client != NULL);
+  // A failed call is reported right away instead of timing out
+  rpc::If::Message in, out;
+  in.contents = Slice("fail");
+  const uint64_t start = CurrentMicros();
+  Status s = client->Call(in, out);
+  ASSERT_TRUE(s.IsNotFound());
+  ASSERT_TRUE(CurrentMicros() - start < options.rpc_timeout);
+  // The connection remains usable
+  rpc::If::Message in2, out2;
+  in2.contents = Slice("xxyyzz");
+  ASSERT_OK(client->Call(in2, out2));
+  ASSERT_TRUE(out2.contents == in2.contents);
+  ASSERT_OK(rpc->Stop());
+  delete client;
+  delete rpc;
+}
+
+namespace {
+// Sum the message counts in the batch stats section of a UDP server's usage
+// info.
+unsigned long long SumBatchedMsgs(const std::string& usage) {
+  size_t pos = usage.find("Batches");
+  pos = usage.find('\n', usage.find('\n', pos) + 1);
+  unsigned long long sum = 0;
+  while (pos != std::string::npos && pos + 1 < usage.size()) {
+    int id;
+    unsigned long long batches, msgs;
+    if (sscanf(usage.c_str() + pos + 1, "%d %llu %llu", &id, &batches,
+               &msgs) == 3) {
+      sum += msgs;
+    }
+    pos = usage.find('\n', pos + 1);
+  }
+  return sum;
+}
+}  // namespace
+
+TEST(RPCTest, BatchedUDP) {
+  ThreadPool* extra_worker = ThreadPool::NewFixed(2, true);
+  const char* uri = "udp://127.0.0.1:22222";
+  for (int j = 0; j < 4; j++) {
+    RPCOptions options;
+    options.uri = uri;
+    options.fs = this;
+    options.num_rpc_threads = 2;
+    options.extra_workers = (j & 1) != 0 ? extra_worker : NULL;
+    options.udp_reuseport = (j & 2) != 0;
+    options.udp_batch_size = 8;
+    fprintf(stderr, "Uri: %s (extra workers: %d, reuseport: %d)\n", uri,
+            int(options.extra_workers != NULL), int(options.udp_reuseport));
+    RPC* rpc = RPC::Open(options);
+    ASSERT_OK(rpc->Start());
+    // Each caller has its own stub
+    CallerState state(rpc, uri, NULL);
+    const int num_threads = 4;
+    state.num_running = num_threads;
+    for (int i = 0; i < num_threads; i++) {
+      Env::Default()->StartThread(ConcurrentCaller, &state);
+    }
+    state.mu.Lock();
+    while (state.num_running != 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+    ASSERT_EQ(state.num_failures, 0);
+    // Batch stats are visible while the server is still running
+    const std::string usage = rpc->GetUsageInfo();
+    ASSERT_TRUE(SumBatchedMsgs(usage) >= num_threads * 200);
+    ASSERT_OK(rpc->Stop());
+    fprintf(stderr, "%s\n", usage.c_str());
+    delete rpc;
+  }
+  delete extra_worker;
+}
+
 namespace {
 int GetOptionFromEnv(const char* key, int def) {
   const char* env = getenv(key);
@@ -138,6 +312,9 @@ class RPCBenchServer : public RPCBench, public rpc::If {
   }
 
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
+    if (in.contents == Slice("fail")) {
+      return Status::NotFound(Slice());
+    }
     out.extra_buf.assign(in.contents.data(), in.contents.size());
     out.contents = out.extra_buf;
     if (out.extra_buf[0] == 'b') {  // Client says goodbye
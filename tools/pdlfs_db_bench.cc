@@ -5,23 +5,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <algorithm>
+#include <vector>
 
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/histogram.h"
-#include "pdlfs-common/leveldb/db/db.h"
-#include "pdlfs-common/leveldb/db/write_batch.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/filter_policy.h"
+#include "pdlfs-common/leveldb/write_batch.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/random.h"
+#include "pdlfs-common/strutil.h"
 #include "pdlfs-common/testutil.h"
 
 // Comma-separated list of operations to run in the specified order
 //   Actual benchmarks:
 //      fillseq       -- write N values in sequential key order in async mode
 //      fillrandom    -- write N values in random key order in async mode
+//      fillconcurrent -- same as fillrandom, but with concurrent memtable
+//                        writes enabled (use with --threads=T to see scaling)
 //      overwrite     -- overwrite N values in random key order in async mode
 //      fillsync      -- write N/100 values in random key order in sync mode
 //      fill100K      -- write N/1000 100K values in random order in async mode
@@ -30,11 +36,24 @@
 //      readseq       -- read N times sequentially
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
+//      multireadrandom -- read N times in random order, looking up
+//                         --multiget_batch keys per MultiGet() call
+//      readrandomscaling -- readrandom with 1, 2, 4, ... up to --threads
+//                           threads, each thread doing N reads
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
+//                       (use with --threads=T and --cache_type to compare
+//                        cache implementations under concurrent readers)
 //      seekrandom    -- N random seeks
 //      open          -- cost of opening a DB
 //      crc32c        -- repeated crc32c of 4K of data
+//      snappycomp    -- repeated snappy compression of a block of data
+//      snappyuncomp  -- repeated snappy uncompression of a block of data
+//      lz4comp       -- same as snappycomp, but using lz4
+//      lz4uncomp     -- same as snappyuncomp, but using lz4
+//      zstdcomp      -- same as snappycomp, but using zstd and, if
+//                       --compression_dict_size is set, a trained dictionary
+//      zstduncomp    -- same as snappyuncomp, but using zstd
 //      acquireload   -- load N*1000 times
 //   Meta operations:
 //      compact     -- Compact the entire DB
@@ -58,6 +77,10 @@ static const char* FLAGS_benchmarks =
     "crc32c,"
     "snappycomp,"
     "snappyuncomp,"
+    "lz4comp,"
+    "lz4uncomp,"
+    "zstdcomp,"
+    "zstduncomp,"
     "acquireload,";
 
 // Number of key/values to place in database
@@ -69,6 +92,9 @@ static int FLAGS_reads = -1;
 // Number of concurrent threads to run.
 static int FLAGS_threads = 1;
 
+// Number of keys looked up by each MultiGet() call in multireadrandom.
+static int FLAGS_multiget_batch = 32;
+
 // Size of each value
 static int FLAGS_value_size = 100;
 
@@ -91,10 +117,35 @@ static int FLAGS_max_file_size = 0;
 // (initialized to default value by "main")
 static int FLAGS_block_size = 0;
 
+// Codec for compressing table blocks. One of "none", "snappy", "lz4", and
+// "zstd".
+static const char* FLAGS_compression = "snappy";
+
+// If non-empty, a comma-separated list of codecs for the tables of each
+// level, overriding --compression (e.g. "lz4,lz4,zstd").
+static const char* FLAGS_compression_per_level = "";
+
+// If non-zero, train a zstd dictionary of this many bytes for each table
+// compressed with zstd.
+static int FLAGS_compression_dict_size = 0;
+
+// If non-zero, partition table indexes into blocks of this many bytes.
+static int FLAGS_index_partition_size = 0;
+
+// If true, add an ECT index to tables for point lookups.
+static bool FLAGS_ect_index = false;
+
 // Number of bytes to use as a cache of uncompressed data.
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Cache implementation for both the block cache and the table cache.
+// Either "lru" or "clock".
+static const char* FLAGS_cache_type = "lru";
+
+// Number of shards is 2^cache_shard_bits. Only used by the clock cache.
+static int FLAGS_cache_shard_bits = 4;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -102,6 +153,14 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// Bloom filter implementation. Either "classic", "blocked" (cache-line
+// blocked with simd probing), or "blocked_portable" (same as "blocked" but
+// without simd).
+static const char* FLAGS_bloom_type = "classic";
+
+// If true, build one filter per table instead of one per 2KB of data.
+static bool FLAGS_full_filter = false;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -110,12 +169,92 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// If true, let concurrent writers insert into the memtable in parallel.
+static bool FLAGS_concurrent_memtable_write = false;
+
+// If greater than 1, run compactions on a dedicated thread pool and split
+// each compaction into up to this many concurrently processed key ranges.
+static int FLAGS_subcompactions = 1;
+
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
 namespace pdlfs {
 
 namespace {
+
+bool ParseCompressionType(const Slice& name, CompressionType* type) {
+  if (name == "none") {
+    *type = kNoCompression;
+  } else if (name == "snappy") {
+    *type = kSnappyCompression;
+  } else if (name == "lz4") {
+    *type = kLZ4Compression;
+  } else if (name == "zstd") {
+    *type = kZstdCompression;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Parse a comma-separated list of codec names.
+bool ParseCompressionTypes(const char* names,
+                           std::vector<CompressionType>* types) {
+  types->clear();
+  std::vector<std::string> parts;
+  SplitString(&parts, names, ',');
+  for (size_t i = 0; i < parts.size(); i++) {
+    CompressionType type;
+    if (!ParseCompressionType(parts[i], &type)) {
+      return false;
+    }
+    types->push_back(type);
+  }
+  return true;
+}
+
+const char* CompressionName(CompressionType type) {
+  switch (type) {
+    case kNoCompression:
+      return "none";
+    case kSnappyCompression:
+      return "snappy";
+    case kLZ4Compression:
+      return "lz4";
+    case kZstdCompression:
+      return "zstd";
+  }
+  return "unknown";
+}
+
+bool CompressWith(CompressionType type, const Slice& input,
+                  const port::ZstdCompressionDict* dict, std::string* output) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Compress(input.data(), input.size(), output);
+    case kLZ4Compression:
+      return port::LZ4_Compress(input.data(), input.size(), output);
+    case kZstdCompression:
+      return port::Zstd_Compress(input.data(), input.size(), dict, output);
+    default:
+      return false;
+  }
+}
+
+bool UncompressWith(CompressionType type, const std::string& input,
+                    const port::ZstdUncompressionDict* dict, char* output) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Uncompress(input.data(), input.size(), output);
+    case kLZ4Compression:
+      return port::LZ4_Uncompress(input.data(), input.size(), output);
+    case kZstdCompression:
+      return port::Zstd_Uncompress(input.data(), input.size(), dict, output);
+    default:
+      return false;
+  }
+}
 pdlfs::Env* g_env = NULL;
 
 // Helper for quickly generating random data.
@@ -194,7 +333,7 @@ class Stats {
     done_ = 0;
     bytes_ = 0;
     seconds_ = 0;
-    start_ = g_env->NowMicros();
+    start_ = CurrentMicros();
     finish_ = start_;
     message_.clear();
   }
@@ -212,7 +351,7 @@ class Stats {
   }
 
   void Stop() {
-    finish_ = g_env->NowMicros();
+    finish_ = CurrentMicros();
     seconds_ = (finish_ - start_) * 1e-6;
   }
 
@@ -220,7 +359,7 @@ class Stats {
 
   void FinishedSingleOp() {
     if (FLAGS_histogram) {
-      double now = g_env->NowMicros();
+      double now = CurrentMicros();
       double micros = now - last_op_finish_;
       hist_.Add(micros);
       if (micros > 20000) {
@@ -310,15 +449,36 @@ struct ThreadState {
 
 }  // namespace
 
+static const FilterPolicy* NewFilterPolicy(int bits_per_key) {
+  if (strcmp(FLAGS_bloom_type, "blocked") == 0) {
+    return NewBlockedBloomFilterPolicy(bits_per_key);
+  } else if (strcmp(FLAGS_bloom_type, "blocked_portable") == 0) {
+    return NewBlockedBloomFilterPolicy(bits_per_key, false);
+  } else {
+    return NewBloomFilterPolicy(bits_per_key);
+  }
+}
+
+static Cache* NewCache(size_t capacity) {
+  if (strcmp(FLAGS_cache_type, "clock") == 0) {
+    return NewClockCache(capacity, FLAGS_cache_shard_bits);
+  } else {
+    return NewLRUCache(capacity);
+  }
+}
+
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* table_cache_;
   const FilterPolicy* filter_policy_;
+  ThreadPool* compaction_pool_;
   DB* db_;
   int num_;
   int value_size_;
   int entries_per_batch_;
   WriteOptions write_options_;
+  bool concurrent_memtable_write_;
   int reads_;
   int heap_counter_;
 
@@ -330,6 +490,12 @@ class Benchmark {
             FLAGS_value_size,
             static_cast<int>(FLAGS_value_size * FLAGS_compression_ratio + 0.5));
     fprintf(stdout, "Entries:    %d\n", num_);
+    fprintf(stdout, "Cache:      %s\n", FLAGS_cache_type);
+    if (FLAGS_bloom_bits >= 0) {
+      fprintf(stdout, "Filter:     %s (%d bits per key, %s)\n",
+              FLAGS_bloom_type, FLAGS_bloom_bits,
+              FLAGS_full_filter ? "full" : "per 2KB");
+    }
     fprintf(stdout, "RawSize:    %.1f MB (estimated)\n",
             ((static_cast<int64_t>(kKeySize + FLAGS_value_size) * num_) /
              1048576.0));
@@ -351,13 +517,20 @@ class Benchmark {
             "WARNING: Assertions are enabled; benchmarks unnecessarily slow\n");
 #endif
 
-    // See if snappy is working by attempting to compress a compressible string
-    const char text[] = "yyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyy";
-    std::string compressed;
-    if (!port::Snappy_Compress(text, sizeof(text), &compressed)) {
-      fprintf(stdout, "WARNING: Snappy compression is not enabled\n");
-    } else if (compressed.size() >= sizeof(text)) {
-      fprintf(stdout, "WARNING: Snappy compression is not effective\n");
+    // See if each codec is working by attempting to compress a compressible
+    // string
+    const Slice text("yyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyy");
+    const CompressionType types[] = {kSnappyCompression, kLZ4Compression,
+                                     kZstdCompression};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+      std::string compressed;
+      if (!CompressWith(types[i], text, NULL, &compressed)) {
+        fprintf(stdout, "WARNING: %s compression is not enabled\n",
+                CompressionName(types[i]));
+      } else if (compressed.size() >= text.size()) {
+        fprintf(stdout, "WARNING: %s compression is not effective\n",
+                CompressionName(types[i]));
+      }
     }
   }
 
@@ -398,21 +571,26 @@ class Benchmark {
 
  public:
   Benchmark()
-      : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+      : cache_(NewCache(FLAGS_cache_size >= 0 ? FLAGS_cache_size : 8 << 20)),
+        table_cache_(NewCache(1000)),
         filter_policy_(FLAGS_bloom_bits >= 0
-                           ? NewBloomFilterPolicy(FLAGS_bloom_bits)
+                           ? NewFilterPolicy(FLAGS_bloom_bits)
                            : NULL),
+        compaction_pool_(FLAGS_subcompactions > 1
+                             ? ThreadPool::NewFixed(FLAGS_subcompactions)
+                             : NULL),
         db_(NULL),
         num_(FLAGS_num),
         value_size_(FLAGS_value_size),
         entries_per_batch_(1),
+        concurrent_memtable_write_(FLAGS_concurrent_memtable_write),
         reads_(FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads),
         heap_counter_(0) {
     std::vector<std::string> files;
     g_env->GetChildren(FLAGS_db, &files);
     for (size_t i = 0; i < files.size(); i++) {
       if (Slice(files[i]).starts_with("heap-")) {
-        g_env->DeleteFile(std::string(FLAGS_db) + "/" + files[i]);
+        g_env->DeleteFile((std::string(FLAGS_db) + "/" + files[i]).c_str());
       }
     }
     if (!FLAGS_use_existing_db) {
@@ -422,7 +600,9 @@ class Benchmark {
 
   ~Benchmark() {
     delete db_;
+    delete compaction_pool_;
     delete cache_;
+    delete table_cache_;
     delete filter_policy_;
   }
 
@@ -448,6 +628,7 @@ class Benchmark {
       value_size_ = FLAGS_value_size;
       entries_per_batch_ = 1;
       write_options_ = WriteOptions();
+      concurrent_memtable_write_ = FLAGS_concurrent_memtable_write;
 
       void (Benchmark::*method)(ThreadState*) = NULL;
       bool fresh_db = false;
@@ -467,6 +648,10 @@ class Benchmark {
       } else if (name == Slice("fillrandom")) {
         fresh_db = true;
         method = &Benchmark::WriteRandom;
+      } else if (name == Slice("fillconcurrent")) {
+        fresh_db = true;
+        concurrent_memtable_write_ = true;
+        method = &Benchmark::WriteRandom;
       } else if (name == Slice("overwrite")) {
         fresh_db = false;
         method = &Benchmark::WriteRandom;
@@ -486,6 +671,15 @@ class Benchmark {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("readrandomscaling")) {
+        for (int n = 1;; n = std::min(2 * n, FLAGS_threads)) {
+          char label[50];
+          snprintf(label, sizeof(label), "readrandom/%d", n);
+          RunBenchmark(n, label, &Benchmark::ReadRandom);
+          if (n >= FLAGS_threads) break;
+        }
+      } else if (name == Slice("multireadrandom")) {
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
@@ -512,6 +706,14 @@ class Benchmark {
         method = &Benchmark::SnappyCompress;
       } else if (name == Slice("snappyuncomp")) {
         method = &Benchmark::SnappyUncompress;
+      } else if (name == Slice("lz4comp")) {
+        method = &Benchmark::LZ4Compress;
+      } else if (name == Slice("lz4uncomp")) {
+        method = &Benchmark::LZ4Uncompress;
+      } else if (name == Slice("zstdcomp")) {
+        method = &Benchmark::ZstdCompress;
+      } else if (name == Slice("zstduncomp")) {
+        method = &Benchmark::ZstdUncompress;
       } else if (name == Slice("heapprofile")) {
         HeapProfile();
       } else if (name == Slice("stats")) {
@@ -656,21 +858,71 @@ class Benchmark {
   }
 
   void SnappyCompress(ThreadState* thread) {
+    Compress(thread, kSnappyCompression);
+  }
+
+  void SnappyUncompress(ThreadState* thread) {
+    Uncompress(thread, kSnappyCompression);
+  }
+
+  void LZ4Compress(ThreadState* thread) { Compress(thread, kLZ4Compression); }
+
+  void LZ4Uncompress(ThreadState* thread) {
+    Uncompress(thread, kLZ4Compression);
+  }
+
+  void ZstdCompress(ThreadState* thread) { Compress(thread, kZstdCompression); }
+
+  void ZstdUncompress(ThreadState* thread) {
+    Uncompress(thread, kZstdCompression);
+  }
+
+  // Return a dictionary trained on generated blocks if the zstd benchmarks
+  // are asked to use one, or an empty string otherwise.
+  static std::string CompressionDict(CompressionType type) {
+    std::string dict;
+    if (type == kZstdCompression && FLAGS_compression_dict_size > 0) {
+      RandomGenerator gen;
+      std::string samples;
+      std::vector<size_t> sample_sizes;
+      for (int i = 0; i < 100; i++) {
+        Slice sample = gen.Generate(DBOptions().block_size);
+        samples.append(sample.data(), sample.size());
+        sample_sizes.push_back(sample.size());
+      }
+      port::Zstd_TrainDictionary(samples.data(), &sample_sizes[0],
+                                 sample_sizes.size(),
+                                 FLAGS_compression_dict_size, &dict);
+    }
+    return dict;
+  }
+
+  void Compress(ThreadState* thread, CompressionType type) {
     RandomGenerator gen;
     Slice input = gen.Generate(DBOptions().block_size);
+    const std::string dict = CompressionDict(type);
+    port::ZstdCompressionDict* cdict = NULL;
+    if (!dict.empty()) {
+      cdict = port::Zstd_NewCompressionDict(dict.data(), dict.size());
+    }
     int64_t bytes = 0;
     int64_t produced = 0;
-    bool ok = true;
+    bool ok = dict.empty() || cdict != NULL;
     std::string compressed;
     while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+      ok = CompressWith(type, input, cdict, &compressed);
       produced += compressed.size();
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
+    if (cdict != NULL) {
+      port::Zstd_DeleteCompressionDict(cdict);
+    }
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      char buf[100];
+      snprintf(buf, sizeof(buf), "(%s failure)", CompressionName(type));
+      thread->stats.AddMessage(buf);
     } else {
       char buf[100];
       snprintf(buf, sizeof(buf), "(output: %.1f%%)",
@@ -680,23 +932,38 @@ class Benchmark {
     }
   }
 
-  void SnappyUncompress(ThreadState* thread) {
+  void Uncompress(ThreadState* thread, CompressionType type) {
     RandomGenerator gen;
     Slice input = gen.Generate(DBOptions().block_size);
+    const std::string dict = CompressionDict(type);
+    port::ZstdCompressionDict* cdict = NULL;
+    port::ZstdUncompressionDict* ddict = NULL;
+    if (!dict.empty()) {
+      cdict = port::Zstd_NewCompressionDict(dict.data(), dict.size());
+      ddict = port::Zstd_NewUncompressionDict(dict.data(), dict.size());
+    }
     std::string compressed;
-    bool ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+    bool ok = (dict.empty() || (cdict != NULL && ddict != NULL)) &&
+              CompressWith(type, input, cdict, &compressed);
     int64_t bytes = 0;
     char* uncompressed = new char[input.size()];
-    while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok = port::Snappy_Uncompress(compressed.data(), compressed.size(),
-                                   uncompressed);
+    while (ok && bytes < 1024 * 1048576) {  // Uncompress 1G
+      ok = UncompressWith(type, compressed, ddict, uncompressed);
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
     delete[] uncompressed;
+    if (cdict != NULL) {
+      port::Zstd_DeleteCompressionDict(cdict);
+    }
+    if (ddict != NULL) {
+      port::Zstd_DeleteUncompressionDict(ddict);
+    }
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      char buf[100];
+      snprintf(buf, sizeof(buf), "(%s failure)", CompressionName(type));
+      thread->stats.AddMessage(buf);
     } else {
       thread->stats.AddBytes(bytes);
     }
@@ -708,15 +975,26 @@ class Benchmark {
     options.env = g_env;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.table_cache = table_cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
 #if 0 /* XXXCDC: not imported into our options yet */
     options.max_file_size = FLAGS_max_file_size;
 #endif
     options.block_size = FLAGS_block_size;
+    options.index_partition_size = FLAGS_index_partition_size;
+    options.ect_index = FLAGS_ect_index;
+    options.full_filter = FLAGS_full_filter;
+    ParseCompressionType(FLAGS_compression, &options.compression);
+    ParseCompressionTypes(FLAGS_compression_per_level,
+                          &options.compression_per_level);
+    options.compression_dict_size = FLAGS_compression_dict_size;
 #if 0 /* XXXCDC: not imported into our options yet */
     options.max_open_files = FLAGS_open_files;
 #endif
     options.filter_policy = filter_policy_;
+    options.allow_concurrent_memtable_write = concurrent_memtable_write_;
+    options.compaction_pool = compaction_pool_;
+    options.max_subcompactions = FLAGS_subcompactions;
 #if 0 /* XXXCDC: not imported into our options yet */
     options.reuse_logs = FLAGS_reuse_logs;
 #endif
@@ -813,6 +1091,35 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void MultiReadRandom(ThreadState* thread) {
+    ReadOptions options;
+    std::vector<std::string> keys(FLAGS_multiget_batch);
+    std::vector<Slice> slices(FLAGS_multiget_batch);
+    std::vector<std::string> values(FLAGS_multiget_batch);
+    std::vector<Status> statuses(FLAGS_multiget_batch);
+    int found = 0;
+    for (int i = 0; i < reads_; i += FLAGS_multiget_batch) {
+      const int n = std::min(FLAGS_multiget_batch, reads_ - i);
+      for (int j = 0; j < n; j++) {
+        char key[100];
+        const int k = thread->rand.Next() % FLAGS_num;
+        snprintf(key, sizeof(key), "%016d", k);
+        keys[j] = key;
+        slices[j] = keys[j];
+      }
+      db_->MultiGet(options, n, &slices[0], &values[0], &statuses[0]);
+      for (int j = 0; j < n; j++) {
+        if (statuses[j].ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -973,12 +1280,22 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
+    } else if (sscanf(argv[i], "--concurrent_memtable_write=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_concurrent_memtable_write = n;
+    } else if (sscanf(argv[i], "--subcompactions=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_subcompactions = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
       FLAGS_reads = n;
     } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
       FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--multiget_batch=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_multiget_batch = n;
     } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1) {
       FLAGS_value_size = n;
     } else if (sscanf(argv[i], "--write_buffer_size=%d%c", &n, &junk) == 1) {
@@ -987,10 +1304,56 @@ int main(int argc, char** argv) {
       FLAGS_max_file_size = n;
     } else if (sscanf(argv[i], "--block_size=%d%c", &n, &junk) == 1) {
       FLAGS_block_size = n;
+    } else if (sscanf(argv[i], "--index_partition_size=%d%c", &n, &junk) ==
+                   1 &&
+               n >= 0) {
+      FLAGS_index_partition_size = n;
+    } else if (sscanf(argv[i], "--ect_index=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_ect_index = n;
+    } else if (strncmp(argv[i], "--compression=", 14) == 0) {
+      FLAGS_compression = argv[i] + 14;
+      pdlfs::CompressionType type;
+      if (!pdlfs::ParseCompressionType(FLAGS_compression, &type)) {
+        fprintf(stderr, "Invalid compression '%s'\n", FLAGS_compression);
+        exit(1);
+      }
+    } else if (strncmp(argv[i], "--compression_per_level=", 24) == 0) {
+      FLAGS_compression_per_level = argv[i] + 24;
+      std::vector<pdlfs::CompressionType> types;
+      if (!pdlfs::ParseCompressionTypes(FLAGS_compression_per_level, &types)) {
+        fprintf(stderr, "Invalid compression per level '%s'\n",
+                FLAGS_compression_per_level);
+        exit(1);
+      }
+    } else if (sscanf(argv[i], "--compression_dict_size=%d%c", &n, &junk) ==
+                   1 &&
+               n >= 0) {
+      FLAGS_compression_dict_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (strncmp(argv[i], "--bloom_type=", 13) == 0) {
+      FLAGS_bloom_type = argv[i] + 13;
+      if (strcmp(FLAGS_bloom_type, "classic") != 0 &&
+          strcmp(FLAGS_bloom_type, "blocked") != 0 &&
+          strcmp(FLAGS_bloom_type, "blocked_portable") != 0) {
+        fprintf(stderr, "Invalid bloom type '%s'\n", FLAGS_bloom_type);
+        exit(1);
+      }
+    } else if (sscanf(argv[i], "--full_filter=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_full_filter = n;
+    } else if (strncmp(argv[i], "--cache_type=", 13) == 0) {
+      FLAGS_cache_type = argv[i] + 13;
+      if (strcmp(FLAGS_cache_type, "lru") != 0 &&
+          strcmp(FLAGS_cache_type, "clock") != 0) {
+        fprintf(stderr, "Invalid cache type '%s'\n", FLAGS_cache_type);
+        exit(1);
+      }
+    } else if (sscanf(argv[i], "--cache_shard_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_shard_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {